@@ -127,6 +127,15 @@ architecture Behavioral of audio_player is
 	-- SDRAM wishbone bus arbiter
 	type SDRAM_BUS_STATES is (IDLE, DAC, ETHERNET, RPI);
 	signal sdram_bus_state : SDRAM_BUS_STATES := IDLE;
+	signal dac_sdram_granted, eth_sdram_granted, rpi_sdram_granted : std_logic;
+	
+	-- Arbiter bandwidth counters, see sdram_stats.vhd
+	signal sdram_stats_snapshot, sdram_stats_clear, sdram_stats_stall : std_logic;
+	signal sdram_stats_cycles, sdram_stats_cycles_o : std_logic_vector(31 downto 0);
+	signal dac_stats_grants, dac_stats_stall_cycles, dac_stats_words : std_logic_vector(31 downto 0);
+	signal eth_stats_grants, eth_stats_stall_cycles, eth_stats_words : std_logic_vector(31 downto 0);
+	signal rpi_stats_grants, rpi_stats_stall_cycles, rpi_stats_words : std_logic_vector(31 downto 0);
+	signal dac_stats_max_wait, eth_stats_max_wait, rpi_stats_max_wait : std_logic_vector(15 downto 0);
 	
 	
 	-- Signals that are shared between ethernet and DAC, because
@@ -135,6 +144,10 @@ architecture Behavioral of audio_player is
 	signal sdram_buffer_below_minimum : std_logic;
 	signal sdram_size_avail : std_logic_vector(23 downto 0);
 	
+	-- Counters from the DAC controller, reported in status packets
+	signal dac_sram_empty_count : std_logic_vector(15 downto 0);
+	signal dac_sdram_underrun_count : std_logic_vector(15 downto 0);
+	
 	
 	-- Signals from ethernet to control other state machines
 	signal cmd_mute : std_logic;
@@ -185,10 +198,12 @@ architecture Behavioral of audio_player is
 	signal user_sig, idle_sig : std_logic;
 	signal idle_count : std_logic_vector(31 downto 0);
 	
+	signal zzdummy_stats : slv16_array(28 to 50);
 	signal zzdummy0, zzdummy1, zzdummy2, zzdummy3, zzdummy4, zzdummy5, zzdummy6, zzdummy7, zzdummy8, zzdummy9, zzdummy10, zzdummy11, zzdummy12, zzdummy13, zzdummy14, zzdummy15, zzdummy16, zzdummy17, zzdummy18, zzdummy19, zzdummy20, zzdummy21, zzdummy22 : std_logic_vector(15 downto 0);
 	
 	-- registers signals
 	signal reg_sdram_data_o, reg_sdram_data_i, reg_sdram_addr_h, reg_sdram_addr_l, reg_sdram_ctl_o, reg_sdram_ctl_i : std_logic_vector(15 downto 0);
+	signal reg_stats_ctl_o, reg_stats_ctl_i : std_logic_vector(15 downto 0);
 	signal dbg_eth_state, dbg_dac_state, dbg_sdram_bus_state : std_logic_vector(15 downto 0);
 	signal dbg_sram_read_addr, dbg_sram_write_addr : std_logic_vector(15 downto 0);
 	signal dbg_eth_next_sequence, dbg_ip_ident, dbg_ip_frag_offset, dbg_spi_readdata : std_logic_vector(15 downto 0);
@@ -522,12 +537,107 @@ begin
 	end if;
 end process;
 
+
+dac_sdram_granted <= '1' when sdram_bus_state = DAC else '0';
+eth_sdram_granted <= '1' when sdram_bus_state = ETHERNET else '0';
+rpi_sdram_granted <= '1' when sdram_bus_state = RPI else '0';
+sdram_stats_stall <= sdram_stall and sdram_strobe;
+
+-- Bandwidth counters for the arbiter.  Setting bit 0 of the stats control
+-- register takes a snapshot of all counters into the stats registers, and
+-- if bit 1 is also set the counters restart from 0.  Bit 0 must be cleared
+-- again before the next snapshot, the same as the SDRAM control register.
+process(sys_clk,sys_reset)
+begin
+	if sys_reset = '1' then
+		reg_stats_ctl_i <= X"0000";
+		sdram_stats_snapshot <= '0';
+		sdram_stats_clear <= '0';
+		sdram_stats_cycles <= (others => '0');
+		sdram_stats_cycles_o <= (others => '0');
+	elsif rising_edge(sys_clk) then
+		
+		sdram_stats_snapshot <= '0';
+		sdram_stats_clear <= '0';
+		
+		if reg_stats_ctl_o(0) = '1' and reg_stats_ctl_i(0) = '0' then
+			sdram_stats_snapshot <= '1';
+			sdram_stats_clear <= reg_stats_ctl_o(1);
+			reg_stats_ctl_i(0) <= '1';
+		elsif reg_stats_ctl_o(0) = '0' and reg_stats_ctl_i(0) = '1' then
+			reg_stats_ctl_i(0) <= '0';
+		end if;
+		
+		-- Cycles since the last clear, so that the counters can be turned
+		-- into a fraction of the bus time
+		if sdram_stats_snapshot = '1' then
+			sdram_stats_cycles_o <= sdram_stats_cycles;
+			if sdram_stats_clear = '1' then
+				sdram_stats_cycles <= X"00000001";
+			else
+				sdram_stats_cycles <= sdram_stats_cycles + 1;
+			end if;
+		else
+			sdram_stats_cycles <= sdram_stats_cycles + 1;
+		end if;
+		
+	end if;
+end process;
+
+dac_stats : entity work.sdram_stats
+	port map (
+		sys_clk => sys_clk,
+		sys_reset => sys_reset,
+		snapshot_i => sdram_stats_snapshot,
+		clear_i => sdram_stats_clear,
+		cycle_i => dac_sdram_cycle,
+		granted_i => dac_sdram_granted,
+		stall_i => sdram_stats_stall,
+		ack_i => dac_sdram_ack,
+		grants_o => dac_stats_grants,
+		stall_cycles_o => dac_stats_stall_cycles,
+		words_o => dac_stats_words,
+		max_wait_o => dac_stats_max_wait
+	);
+
+eth_stats : entity work.sdram_stats
+	port map (
+		sys_clk => sys_clk,
+		sys_reset => sys_reset,
+		snapshot_i => sdram_stats_snapshot,
+		clear_i => sdram_stats_clear,
+		cycle_i => eth_sdram_cycle,
+		granted_i => eth_sdram_granted,
+		stall_i => sdram_stats_stall,
+		ack_i => eth_sdram_ack,
+		grants_o => eth_stats_grants,
+		stall_cycles_o => eth_stats_stall_cycles,
+		words_o => eth_stats_words,
+		max_wait_o => eth_stats_max_wait
+	);
+
+rpi_stats : entity work.sdram_stats
+	port map (
+		sys_clk => sys_clk,
+		sys_reset => sys_reset,
+		snapshot_i => sdram_stats_snapshot,
+		clear_i => sdram_stats_clear,
+		cycle_i => rpi_sdram_cycle,
+		granted_i => rpi_sdram_granted,
+		stall_i => sdram_stats_stall,
+		ack_i => rpi_sdram_ack,
+		grants_o => rpi_stats_grants,
+		stall_cycles_o => rpi_stats_stall_cycles,
+		words_o => rpi_stats_words,
+		max_wait_o => rpi_stats_max_wait
+	);
+
 									      
 										  
 -- Debug registers that the Raspberry PI can read/write, that
 -- are connected to various signals (mostly read-only)
 register0 : wishbone_register
-	generic map(nb_regs => 27)
+	generic map(nb_regs => 51)
 	 port map
 	 (
 		  -- Syscon signals
@@ -570,6 +680,30 @@ register0 : wishbone_register
 		  reg_out(24) => zzdummy20,
 		  reg_out(25) => zzdummy21,
 		  reg_out(26) => zzdummy22,
+		  reg_out(27) => reg_stats_ctl_o, -- stats control: bit 0 = snapshot, bit 1 = clear
+		  reg_out(28) => zzdummy_stats(28),
+		  reg_out(29) => zzdummy_stats(29),
+		  reg_out(30) => zzdummy_stats(30),
+		  reg_out(31) => zzdummy_stats(31),
+		  reg_out(32) => zzdummy_stats(32),
+		  reg_out(33) => zzdummy_stats(33),
+		  reg_out(34) => zzdummy_stats(34),
+		  reg_out(35) => zzdummy_stats(35),
+		  reg_out(36) => zzdummy_stats(36),
+		  reg_out(37) => zzdummy_stats(37),
+		  reg_out(38) => zzdummy_stats(38),
+		  reg_out(39) => zzdummy_stats(39),
+		  reg_out(40) => zzdummy_stats(40),
+		  reg_out(41) => zzdummy_stats(41),
+		  reg_out(42) => zzdummy_stats(42),
+		  reg_out(43) => zzdummy_stats(43),
+		  reg_out(44) => zzdummy_stats(44),
+		  reg_out(45) => zzdummy_stats(45),
+		  reg_out(46) => zzdummy_stats(46),
+		  reg_out(47) => zzdummy_stats(47),
+		  reg_out(48) => zzdummy_stats(48),
+		  reg_out(49) => zzdummy_stats(49),
+		  reg_out(50) => zzdummy_stats(50),
 		 
 		  reg_in(0) => X"DEAD", -- Magic word to verify that the FPGA is loaded
 		  reg_in(1) => reg_sdram_data_i,
@@ -597,7 +731,31 @@ register0 : wishbone_register
 		  reg_in(23) => dbg_ip_ident,
 		  reg_in(24) => dbg_ip_frag_offset,
 		  reg_in(25) => X"0000", -- Unused
-		  reg_in(26) => X"0000"  -- Unused
+		  reg_in(26) => X"0000", -- Unused
+		  reg_in(27) => reg_stats_ctl_i,
+		  reg_in(28) => sdram_stats_cycles_o(31 downto 16),
+		  reg_in(29) => sdram_stats_cycles_o(15 downto 0),
+		  reg_in(30) => dac_stats_grants(31 downto 16),
+		  reg_in(31) => dac_stats_grants(15 downto 0),
+		  reg_in(32) => dac_stats_stall_cycles(31 downto 16),
+		  reg_in(33) => dac_stats_stall_cycles(15 downto 0),
+		  reg_in(34) => dac_stats_words(31 downto 16),
+		  reg_in(35) => dac_stats_words(15 downto 0),
+		  reg_in(36) => dac_stats_max_wait,
+		  reg_in(37) => eth_stats_grants(31 downto 16),
+		  reg_in(38) => eth_stats_grants(15 downto 0),
+		  reg_in(39) => eth_stats_stall_cycles(31 downto 16),
+		  reg_in(40) => eth_stats_stall_cycles(15 downto 0),
+		  reg_in(41) => eth_stats_words(31 downto 16),
+		  reg_in(42) => eth_stats_words(15 downto 0),
+		  reg_in(43) => eth_stats_max_wait,
+		  reg_in(44) => rpi_stats_grants(31 downto 16),
+		  reg_in(45) => rpi_stats_grants(15 downto 0),
+		  reg_in(46) => rpi_stats_stall_cycles(31 downto 16),
+		  reg_in(47) => rpi_stats_stall_cycles(15 downto 0),
+		  reg_in(48) => rpi_stats_words(31 downto 16),
+		  reg_in(49) => rpi_stats_words(15 downto 0),
+		  reg_in(50) => rpi_stats_max_wait
 	 );
 
 
@@ -684,6 +842,9 @@ ethernet_controller : entity work.ethernet
 		audioclk_warning => audioclk_warning_o,
 		audioclk_warning_rst => audioclk_warning_rst,
 		
+		sram_empty_count => dac_sram_empty_count,
+		sdram_underrun_count => dac_sdram_underrun_count,
+		
 		dbg_state => dbg_eth_state,
 		dbg_next_sequence => dbg_eth_next_sequence,
 		dbg_ip_ident => dbg_ip_ident,
@@ -745,6 +906,9 @@ dac_controller : entity work.dac_controller
 		volume_right_uppermid_i => volume_right_uppermid,
 		volume_right_tweeter_i => volume_right_tweeter,
 		
+		sram_empty_count_o => dac_sram_empty_count,
+		sdram_underrun_count_o => dac_sdram_underrun_count,
+		
 		dbg_state => dbg_dac_state,
 		dbg_sram_read_addr => dbg_sram_read_addr,
 		dbg_sram_write_addr => dbg_sram_write_addr
@@ -64,6 +64,11 @@ entity dac_controller is
 			  volume_right_uppermid_i : in STD_LOGIC_VECTOR(8 downto 0);
 			  volume_right_tweeter_i : in STD_LOGIC_VECTOR(8 downto 0);
 
+			  -- Number of times the SRAM ran dry and had to be reloaded
+			  sram_empty_count_o : out STD_LOGIC_VECTOR(15 downto 0);
+			  -- Number of times the SRAM needed more data but SDRAM was empty
+			  sdram_underrun_count_o : out STD_LOGIC_VECTOR(15 downto 0);
+
 			  dbg_state : out STD_LOGIC_VECTOR(15 downto 0);
 			  dbg_sram_read_addr : out STD_LOGIC_VECTOR(15 downto 0);
 			  dbg_sram_write_addr : out STD_LOGIC_VECTOR(15 downto 0)
@@ -209,6 +214,11 @@ architecture Behavioral of dac_controller is
 	
 	signal dbg_count : std_logic_vector(7 downto 0);
 	
+	signal sram_empty_count : std_logic_vector(15 downto 0);
+	signal sdram_underrun_count : std_logic_vector(15 downto 0);
+	-- Set once an underrun has been counted, until SDRAM has data again
+	signal sdram_starved : std_logic;
+	
 	type BUFFER_STATES is (
 		INIT, INIT_WAIT_ACK,
 		INIT_SRAM_WRITE, INIT_SRAM_WRITE_DONE,
@@ -260,6 +270,9 @@ begin
 	dbg_sram_read_addr <= X"0000";
 	dbg_sram_write_addr <= (15 downto SRAM_ADDR_SIZE => '0') & sram_write_addr;
 	
+	sram_empty_count_o <= sram_empty_count;
+	sdram_underrun_count_o <= sdram_underrun_count;
+	
 	-- Slower versions of clocks to help with signal synchronizer circuits
 	process (sys_clk)
 	begin
@@ -845,6 +858,9 @@ begin
 			--sram_read_reset_i <= '1';
 			sram_buff_need_more_rst <= '0';
 			dbg_count <= (others => '0');
+			sram_empty_count <= (others => '0');
+			sdram_underrun_count <= (others => '0');
+			sdram_starved <= '0';
 			sample_count_in_frame <= 0;
 		elsif rising_edge(sys_clk) then
 			
@@ -993,11 +1009,16 @@ begin
 						sram_read_reset_i <= '1';
 						buffer_state <= INIT;
 						dbg_count <= dbg_count + 1;
+						sram_empty_count <= sram_empty_count + 1;
 					-- More data available in SDRAM and SRAM pointer wrapped around to next half
 					elsif sdram_buffer_empty = '0' and sram_buff_need_more_o = '1' then
 						sram_buff_need_more_rst <= '1';
 						sdram_timeout_counter <= (others => '0');
 						buffer_state <= SDRAM_START_READ;
+					elsif sram_buff_need_more_o = '1' and sdram_starved = '0' then
+						-- Need more but SDRAM is empty, only count this once
+						sdram_underrun_count <= sdram_underrun_count + 1;
+						sdram_starved <= '1';
 					end if;
 					
 				when SDRAM_START_READ =>
@@ -1032,6 +1053,8 @@ begin
 					-- Done read
 					sdram_strobe <= '0';
 					
+					sdram_starved <= '0';
+					
 					-- Next address for later
 					sdram_read_ptr <= sdram_read_ptr + 1;
 					
@@ -1094,6 +1117,11 @@ begin
 					else
 						-- Release SDRAM so it can be filled again
 						sdram_cycle <= '0';
+						
+						if sdram_starved = '0' then
+							sdram_underrun_count <= sdram_underrun_count + 1;
+							sdram_starved <= '1';
+						end if;
 					end if;
 					
 					-- If SDRAM doesn't fill in time then abort
@@ -1103,6 +1131,7 @@ begin
 						sdram_strobe <= '0';
 						buffer_state <= INIT;
 						dbg_count <= dbg_count + 1;
+						sram_empty_count <= sram_empty_count + 1;
 					end if;
 					
 					
@@ -57,6 +57,10 @@ entity ethernet is
 				audioclk_warning : in STD_LOGIC;
 				audioclk_warning_rst : out STD_LOGIC;
 				
+				-- Counters from the DAC controller, reported in status packets
+				sram_empty_count : in STD_LOGIC_VECTOR(15 downto 0);
+				sdram_underrun_count : in STD_LOGIC_VECTOR(15 downto 0);
+				
 				
 				dbg_state : out STD_LOGIC_VECTOR(15 downto 0);
 				dbg_next_sequence : out STD_LOGIC_VECTOR(15 downto 0);
@@ -112,6 +116,9 @@ architecture Behavioral of ethernet is
 	constant REG_ERXTAILL : std_logic_vector(7 downto 0) := X"06";
 	constant REG_ERXTAILH : std_logic_vector(7 downto 0) := X"07";
 	
+	constant REG_ERXHEADL : std_logic_vector(7 downto 0) := X"08";
+	constant REG_ERXHEADH : std_logic_vector(7 downto 0) := X"09";
+	
 	constant REG_EUDASTL : std_logic_vector(7 downto 0) := X"16";
 	constant REG_EUDASTH : std_logic_vector(7 downto 0) := X"17";
 	
@@ -170,6 +177,11 @@ architecture Behavioral of ethernet is
 	
 	-- Transmit buffer is 0 to this number, receive is this to 5FFF
 	constant RX_BUFFER_ADDR : std_logic_vector(15 downto 0) := X"0800"; -- 2K tx, 22K rx
+	-- Size of the receive buffer, for wrapping ERXHEAD - rx_current_packet
+	constant RX_BUFFER_SIZE : std_logic_vector(15 downto 0) := X"6000" - RX_BUFFER_ADDR;
+	
+	-- Version of the extended status payload (after the original 12 bytes)
+	constant STATUS_VERSION : std_logic_vector(31 downto 0) := X"00000001";
 	
 	type ETHERNET_STATES is (
 		
@@ -184,7 +196,7 @@ architecture Behavioral of ethernet is
 		LINK_RD_LINK_STAT, LINK_WR_DUPLEX, LINK_WR_MABBIPG,
 		LINK_RXEN, LINK_RXDISABLE, LINK_CLEAR_INTERRUPT,
 		
-		RX_SET_READ_PTR, RX_READ_NEXT_PTR, RX_READ_RSV_1,
+		RX_READ_ERXHEAD, RX_SET_READ_PTR, RX_READ_NEXT_PTR, RX_READ_RSV_1,
 		RX_READ_DST_ADDR_1, RX_READ_DST_ADDR_2_SRC_ADDR_1, RX_READ_SRC_ADDR_2,
 		RX_READ_ETHERTYPE, RX_READ_DATA_1,
 		
@@ -204,6 +216,7 @@ architecture Behavioral of ethernet is
 		RX_AUDIO_HDR_2, RX_AUDIO_DATA_SAVE, RX_AUDIO_DATA_WAIT_SDRAM,
 		RX_AUDIO_DATA_SDRAM_COMPLETE, RX_UDP_RESUME_FRAGMENT,
 		RX_UDP_RESUME_FRAGMENT_FROM_REG,
+		RX_RICE_START, RX_RICE_FETCH, RX_RICE_LOAD, RX_RICE_WRITE_SDRAM,
 		
 		RX_VOLUME_1, RX_VOLUME_2, RX_VOLUME_3, RX_VOLUME_4,
 		
@@ -214,6 +227,8 @@ architecture Behavioral of ethernet is
 		TX_STATUS_IPHDR_3, TX_STATUS_IPHDR_4, TX_STATUS_IPHDR_5,
 		TX_STATUS_UDPHDR_1, TX_STATUS_UDPHDR_2, TX_STATUS_UDPHDR_3,
 		TX_STATUS_SEQUENCE, TX_STATUS_WINDOW, TX_STATUS_STATUS,
+		TX_STATUS_VERSION, TX_STATUS_SDRAM_FILL, TX_STATUS_DAC_COUNTS,
+		TX_STATUS_RX_COUNTS, TX_STATUS_RX_HIGH_WATER,
 		TX_STATUS_SET_TXST, TX_STATUS_SET_TXLEN, TX_STATUS_DO_TXRTS,
 		
 		IDLE, STARTSPI, WAITACK, WAITCOUNT, ERROR,
@@ -421,6 +436,39 @@ architecture Behavioral of ethernet is
 	-- Holds audio sample data for samples that cross packet boundary
 	signal inter_packet_data_reg : std_logic_vector(15 downto 0);
 	signal inter_packet_data_len : std_logic_vector(1 downto 0);
+	-- A sample completed from inter_packet_data_reg and the next fragment
+	signal inter_packet_sample : std_logic_vector(23 downto 0);
+	
+	-- Packed mode (command bit 3): two 20-bit samples in 5 bytes.  The first
+	-- sample of a pair is read as 3 bytes and the low 4 bits are saved as the
+	-- top of the second sample, which is then read as 2 bytes.
+	signal audio_packed : std_logic;
+	-- '1' when the next sample is the second of a packed pair
+	signal packed_phase : std_logic;
+	signal packed_nibble : std_logic_vector(3 downto 0);
+	-- Bytes in the sample being read (3, or 2 for the second of a packed pair)
+	signal sample_len : std_logic_vector(15 downto 0);
+	-- '1' when the sample after the current one is the 2 byte half of a pair
+	signal next_sample_short : std_logic;
+	-- The 24-bit sample in spi_readdata, lower 4 bits are zero in packed mode
+	signal sample_data : std_logic_vector(23 downto 0);
+	
+	-- Compressed mode (command bit 4): the audio data is a Rice coded block
+	-- that is expanded by rice_decoder before being written to SDRAM
+	signal audio_compressed : std_logic;
+	signal rice_start : std_logic;
+	signal rice_word : std_logic_vector(31 downto 0);
+	signal rice_word_bits : std_logic_vector(5 downto 0);
+	signal rice_word_valid : std_logic;
+	signal rice_word_ready : std_logic;
+	signal rice_need_word : std_logic;
+	signal rice_sample : std_logic_vector(19 downto 0);
+	signal rice_sample_valid : std_logic;
+	signal rice_sample_ack : std_logic;
+	signal rice_done : std_logic;
+	signal rice_error : std_logic;
+	-- Number of bytes in the SPI read that is in progress
+	signal rice_fetch_len : std_logic_vector(2 downto 0);
 	
 	-- A counter that runs at 10Hz
 	signal ten_hz_int_i : std_logic;
@@ -431,6 +479,20 @@ architecture Behavioral of ethernet is
 	-- Next sample received is the beginning of a frame
 	signal start_of_frame : std_logic;
 	
+	-- Counters reported in the extended status packet.  These are free
+	-- running and wrap around, so the host should only look at differences
+	-- between two status packets.
+	
+	-- Audio datagrams discarded because the sequence number did not match
+	signal rx_discard_count : std_logic_vector(15 downto 0);
+	-- UDP fragments discarded because the offset or ident did not match
+	signal rx_frag_gap_count : std_logic_vector(15 downto 0);
+	
+	-- ENC424J600 receive buffer usage when the last packet was read, and
+	-- the highest value seen since the last status packet
+	signal rx_buffer_used : std_logic_vector(15 downto 0);
+	signal rx_buffer_high_water : std_logic_vector(15 downto 0);
+	
 	
 begin
 
@@ -461,6 +523,16 @@ begin
 	
 	dbg_next_sequence <= audio_next_sequence(15 downto 0);
 	
+	sample_len <= X"0002" when audio_packed = '1' and packed_phase = '1' else X"0003";
+	next_sample_short <= '1' when audio_packed = '1' and packed_phase = '0' else '0';
+	
+	sample_data <= packed_nibble & spi_readdata(15 downto 0) & "0000" when audio_packed = '1' and packed_phase = '1' else
+		spi_readdata(23 downto 4) & "0000" when audio_packed = '1' else
+		spi_readdata(23 downto 0);
+	
+	inter_packet_sample <= inter_packet_data_reg(15 downto 8) & spi_readdata(15 downto 0) when inter_packet_data_len = "01" else
+		inter_packet_data_reg(15 downto 0) & spi_readdata(7 downto 0);
+	
 	dbg_ip_ident <= ip_ident;
 	dbg_ip_frag_offset <= ip_frag_offset & "000";
 	
@@ -520,7 +592,21 @@ begin
 		len_remaining <= (others => '0');
 		inter_packet_data_reg <= (others => '0');
 		inter_packet_data_len <= (others => '0');
+		audio_packed <= '0';
+		packed_phase <= '0';
+		packed_nibble <= (others => '0');
+		audio_compressed <= '0';
+		rice_start <= '0';
+		rice_word <= (others => '0');
+		rice_word_bits <= (others => '0');
+		rice_word_valid <= '0';
+		rice_sample_ack <= '0';
+		rice_fetch_len <= (others => '0');
 		start_of_frame <= '1';
+		rx_discard_count <= (others => '0');
+		rx_frag_gap_count <= (others => '0');
+		rx_buffer_used <= (others => '0');
+		rx_buffer_high_water <= (others => '0');
 		cmd_user_sig <= '1';
 		audioclk_warning_rst <= '0';
 		-- Volume defaults to -12db
@@ -536,6 +622,9 @@ begin
 	
 		ten_hz_int_rst <= '0';
 		audioclk_warning_rst <= '0';
+		rice_start <= '0';
+		rice_word_valid <= '0';
+		rice_sample_ack <= '0';
 		
 		case state is
 		
@@ -884,7 +973,7 @@ begin
 				if spi_readdata(3) = '1' then
 					state <= LINK_RD_LINK_STAT;
 				elsif spi_readdata(14) = '1' then
-					state <= RX_SET_READ_PTR;
+					state <= RX_READ_ERXHEAD;
 				else
 					state <= ERROR;
 				end if;
@@ -1021,13 +1110,30 @@ begin
 -- Packet received interrupt
 -------------------------------------------------------------------
 			
--- Not used.  At one point there seemed to be extra interrupts and
--- this would prevent reading data when there was none.
-			
+			when RX_READ_ERXHEAD =>
+				-- Read ERXHEAD so that we know how full the receive buffer is
+				
+				dbg_state <= X"00CE";
+				
+				spi_writedata <= CMD_READ_REG_UNBANKED & REG_ERXHEADL & X"00" & X"00";
+				spi_datacount <= "100";
+				spi_auto_disable <= '1';
+				
+				next_state <= RX_SET_READ_PTR;
+				state <= STARTSPI;
+				
 			when RX_SET_READ_PTR =>
 				
 				dbg_state <= X"00CF";
 				
+				-- Buffer usage is from the packet we are about to read up to ERXHEAD,
+				-- register is little endian
+				if (spi_readdata(7 downto 0) & spi_readdata(15 downto 8)) >= rx_current_packet then
+					rx_buffer_used <= (spi_readdata(7 downto 0) & spi_readdata(15 downto 8)) - rx_current_packet;
+				else
+					rx_buffer_used <= (spi_readdata(7 downto 0) & spi_readdata(15 downto 8)) - rx_current_packet + RX_BUFFER_SIZE;
+				end if;
+				
 				-- Set RX pointer to next packet address
 				
 				spi_writedata <= CMD_WRITE_ERXRDPT & rx_current_packet(7 downto 0) & rx_current_packet(15 downto 8) & X"00";
@@ -1042,6 +1148,10 @@ begin
 				
 				dbg_state <= X"00C2";
 				
+				if rx_buffer_used > rx_buffer_high_water then
+					rx_buffer_high_water <= rx_buffer_used;
+				end if;
+				
 				spi_writedata <= CMD_READ_ERXDATA & X"00" & X"00" & X"00";
 				spi_datacount <= "101";
 				spi_auto_disable <= '0';
@@ -1678,6 +1788,9 @@ begin
 						
 					else
 						
+						-- A fragment is missing or out of order
+						rx_frag_gap_count <= rx_frag_gap_count + 1;
+						
 						spi_cycle <= '0'; -- Since auto_disable was 0 in prev state
 						state <= RX_SET_ERXTAIL;
 						
@@ -1775,6 +1888,8 @@ begin
 				
 				-- data(31) => '1' means no audio samples
 				-- data(8) => '1' means reset dac controller (sdram buffer is ignored)
+				-- data(4) => '1' means samples are compressed (Rice coded block)
+				-- data(3) => '1' means samples are packed two per 5 bytes
 				-- data(1) => '1' means a new data stream, so reset seq
 				-- data(0) => '1' means mute on, '0' means mute off
 				
@@ -1835,16 +1950,32 @@ begin
 					-- First fragment so always assume there was no audio data in between
 					inter_packet_data_len <= (others => '0');
 					
-					-- Read 3 bytes of audio data
+					-- Datagram always starts with the first sample of a packed pair
+					audio_packed <= audio_cmd(3);
+					packed_phase <= '0';
 					
-					eth_needs_restart <= '0';
+					audio_compressed <= audio_cmd(4);
 					
-					spi_writedata <= X"00" & X"00" & X"00" & X"00";
-					spi_datacount <= "011";
-					spi_auto_disable <= '0';
+					eth_needs_restart <= '0';
 					
-					next_state <= RX_AUDIO_DATA_SAVE;
-					state <= STARTSPI;
+					if audio_cmd(4) = '1' then
+						
+						-- The whole datagram is one compressed block
+						rice_start <= '1';
+						state <= RX_RICE_START;
+						
+					else
+						
+						-- Read 3 bytes of audio data
+						
+						spi_writedata <= X"00" & X"00" & X"00" & X"00";
+						spi_datacount <= "011";
+						spi_auto_disable <= '0';
+						
+						next_state <= RX_AUDIO_DATA_SAVE;
+						state <= STARTSPI;
+						
+					end if;
 					
 				elsif audio_cmd(8) = '1' then
 					
@@ -1854,6 +1985,11 @@ begin
 					
 				else
 					
+					-- Audio data with the wrong sequence number
+					if audio_cmd(31) = '0' then
+						rx_discard_count <= rx_discard_count + 1;
+					end if;
+					
 					ip_next_frag_offset <= (others => '0'); -- Force next fragment to be 0
 					spi_cycle <= '0'; -- Since auto_disable was 0 in prev state
 					state <= RX_SET_ERXTAIL;
@@ -1865,33 +2001,37 @@ begin
 				
 				dbg_state <= X"0306";
 				
-				-- 3 bytes of audio data
-				len_remaining <= len_remaining - 3;
+				-- 3 bytes of audio data (2 for the second sample of a packed pair)
+				len_remaining <= len_remaining - sample_len;
 				
-				if len_remaining = X"0001" or len_remaining = X"0002" then
+				if len_remaining < sample_len then
 					
-					-- len is less than a full 3-byte audio sample
+					-- len is less than a full audio sample
 					-- Special case to save in a register and quit now
 					
 					-- audio_tmp_sequence is not updated as it will be done later
 
-					-- NOTE: Since we tried to read 3 bytes, the last 1 or 2 bytes will
-					-- be garbage
+					-- NOTE: Since we tried to read 3 (or 2) bytes, the last 1 or 2
+					-- bytes will be garbage
 					
-					inter_packet_data_reg <= spi_readdata(23 downto 8);
+					if sample_len = X"0002" then
+						inter_packet_data_reg <= spi_readdata(15 downto 0);
+					else
+						inter_packet_data_reg <= spi_readdata(23 downto 8);
+					end if;
 					
 					inter_packet_data_len <= len_remaining(1 downto 0);
 					
 					state <= RX_SET_ERXTAIL;
 					
 					
-				elsif len_remaining = X"0003" then
+				elsif len_remaining = sample_len then
 					
-					-- There was 3 bytes left before we subtracted above,
+					-- There was one sample left before we subtracted above,
 					-- so now we are done.  Don't read from ethernet, just
 					-- wait for the SDRAM write above to finish
 					
-					audio_tmp_sequence <= audio_tmp_sequence + 3;
+					audio_tmp_sequence <= audio_tmp_sequence + sample_len;
 					
 					sdram_write_complete <= '0';
 				
@@ -1899,7 +2039,12 @@ begin
 					sdram_strobe_s <= '1';
 					
 					-- Also pass sequence start of frame to dac controller to sync the beginning of a frame
-					sdram_writedata_reg <= start_of_frame & "0000000" & spi_readdata(23 downto 0);
+					sdram_writedata_reg <= start_of_frame & "0000000" & sample_data;
+					
+					if audio_packed = '1' then
+						packed_nibble <= spi_readdata(3 downto 0);
+						packed_phase <= not packed_phase;
+					end if;
 					
 					state <= RX_AUDIO_DATA_WAIT_SDRAM;
 					
@@ -1908,7 +2053,7 @@ begin
 					
 				else
 					
-					audio_tmp_sequence <= audio_tmp_sequence + 3;
+					audio_tmp_sequence <= audio_tmp_sequence + sample_len;
 				
 					sdram_write_complete <= '0';
 
@@ -1916,7 +2061,12 @@ begin
 					sdram_strobe_s <= '1';
 					
 					-- Also pass sequence start of frame to dac controller to sync the beginning of a frame
-					sdram_writedata_reg <= start_of_frame & "0000000" & spi_readdata(23 downto 0);
+					sdram_writedata_reg <= start_of_frame & "0000000" & sample_data;
+					
+					if audio_packed = '1' then
+						packed_nibble <= spi_readdata(3 downto 0);
+						packed_phase <= not packed_phase;
+					end if;
 					
 					-- Start another read from ethernet
 					
@@ -1925,10 +2075,18 @@ begin
 					
 					if eth_needs_restart = '1' then
 						spi_writedata <= CMD_READ_ERXDATA & X"00" & X"00" & X"00";
-						spi_datacount <= "100";
+						if next_sample_short = '1' then
+							spi_datacount <= "011";
+						else
+							spi_datacount <= "100";
+						end if;
 					else
 						spi_writedata <= X"00" & X"00" & X"00" & X"00";
-						spi_datacount <= "011";
+						if next_sample_short = '1' then
+							spi_datacount <= "010";
+						else
+							spi_datacount <= "011";
+						end if;
 					end if;
 					
 					spi_auto_disable <= '0';
@@ -2027,17 +2185,33 @@ begin
 				-- No UDP header on subsequent fragments
 				len_remaining <= ip_pkt_len - (ip_hdr_len & "00");
 				
+				eth_needs_restart <= '0';
+				
+				if audio_compressed = '1' then
+					
+					-- The decoder kept its place in the block, just
+					-- carry on feeding it from this fragment
+					state <= RX_RICE_FETCH;
+					
 				-- No audio data left from the last fragment
-				if inter_packet_data_len = "00" then
+				elsif inter_packet_data_len = "00" then
 
-					-- Read 3 bytes of audio data
-					spi_datacount <= "011";
+					-- Read 3 bytes of audio data (2 for second of a packed pair)
+					if sample_len = X"0002" then
+						spi_datacount <= "010";
+					else
+						spi_datacount <= "011";
+					end if;
 					next_state <= RX_AUDIO_DATA_SAVE;
 
 				elsif inter_packet_data_len = "01" then
 
 					-- Only read what we need to finish this off
-					spi_datacount <= "010";
+					if sample_len = X"0002" then
+						spi_datacount <= "001";
+					else
+						spi_datacount <= "010";
+					end if;
 					next_state <= RX_UDP_RESUME_FRAGMENT_FROM_REG;
 
 				elsif inter_packet_data_len = "10" then
@@ -2048,12 +2222,14 @@ begin
 
 				end if;
 				
-				eth_needs_restart <= '0';
-				
-				spi_writedata <= X"00" & X"00" & X"00" & X"00";
-				spi_auto_disable <= '0';
-				
-				state <= STARTSPI;
+				if audio_compressed = '0' then
+					
+					spi_writedata <= X"00" & X"00" & X"00" & X"00";
+					spi_auto_disable <= '0';
+					
+					state <= STARTSPI;
+					
+				end if;
 				
 					
 				
@@ -2065,7 +2241,7 @@ begin
 
 				dbg_state <= X"030B";
 
-				audio_tmp_sequence <= audio_tmp_sequence + 3;
+				audio_tmp_sequence <= audio_tmp_sequence + sample_len;
 
 				-- NOTE: Unlike RX_AUDIO_DATA_SAVE, we assume that the next fragment will never
 				-- contain less than 3 bytes of audio data.
@@ -2076,23 +2252,41 @@ begin
 				sdram_cycle_s <= '1';
 				sdram_strobe_s <= '1';
 
-				if inter_packet_data_len = "01" then
+				if audio_packed = '1' and packed_phase = '1' then
+				
+					-- Second of a packed pair, only "01" is possible
+					len_remaining <= len_remaining - 1;
+					sdram_writedata_reg <= start_of_frame & "0000000" & packed_nibble & inter_packet_data_reg(15 downto 8) & spi_readdata(7 downto 0) & "0000";
+					
+					packed_phase <= '0';
+				
+				elsif audio_packed = '1' then
+				
+					-- First of a packed pair, keep the low 4 bits for the second sample
+					if inter_packet_data_len = "01" then
+						len_remaining <= len_remaining - 2;
+					else
+						len_remaining <= len_remaining - 1;
+					end if;
+					sdram_writedata_reg <= start_of_frame & "0000000" & inter_packet_sample(23 downto 4) & "0000";
+					
+					packed_nibble <= inter_packet_sample(3 downto 0);
+					packed_phase <= '1';
+					
+				elsif inter_packet_data_len = "01" then
 
 					len_remaining <= len_remaining - 2; -- == len - (3 - inter_packet_data_len)
-					sdram_writedata_reg <= start_of_frame & "0000000" & inter_packet_data_reg(15 downto 8) & spi_readdata(15 downto 0);
-
-					-- No longer the first sample in a frame
-					start_of_frame <= '0';
+					sdram_writedata_reg <= start_of_frame & "0000000" & inter_packet_sample;
 					
 				else -- "10"
 
 					len_remaining <= len_remaining - 1; -- == len - (3 - inter_packet_data_len)
-					sdram_writedata_reg <= start_of_frame & "0000000" & inter_packet_data_reg(15 downto 0) & spi_readdata(7 downto 0);
-
-					-- No longer the first sample in a frame
-					start_of_frame <= '0';
+					sdram_writedata_reg <= start_of_frame & "0000000" & inter_packet_sample;
 					
 				end if;
+				
+				-- No longer the first sample in a frame
+				start_of_frame <= '0';
 
 				-- Start another read from ethernet
 
@@ -2101,10 +2295,18 @@ begin
 
 				if eth_needs_restart = '1' then
 					spi_writedata <= CMD_READ_ERXDATA & X"00" & X"00" & X"00";
-					spi_datacount <= "100";
+					if next_sample_short = '1' then
+						spi_datacount <= "011";
+					else
+						spi_datacount <= "100";
+					end if;
 				else
 					spi_writedata <= X"00" & X"00" & X"00" & X"00";
-					spi_datacount <= "011";
+					if next_sample_short = '1' then
+						spi_datacount <= "010";
+					else
+						spi_datacount <= "011";
+					end if;
 				end if;
 
 				spi_auto_disable <= '0';
@@ -2113,6 +2315,129 @@ begin
 				state <= STARTSPI;
 				
 				
+			when RX_RICE_START =>
+				-- Give rice_decoder a clock to reset before looking at it
+				
+				dbg_state <= X"0310";
+				
+				state <= RX_RICE_FETCH;
+				
+			when RX_RICE_FETCH =>
+				-- Move decoded samples to SDRAM and keep the decoder fed
+				
+				-- The SPI cycle is held open between reads here.  If the
+				-- decoder or SDRAM is slow spimaster just stretches spi_clk.
+				
+				dbg_state <= X"0311";
+				
+				if rice_sample_valid = '1' then
+					
+					sdram_cycle_s <= '1';
+					sdram_strobe_s <= '1';
+					
+					-- Also pass sequence start of frame to dac controller to sync the beginning of a frame
+					sdram_writedata_reg <= start_of_frame & "0000000" & rice_sample & "0000";
+					
+					-- No longer the first sample in a frame
+					start_of_frame <= '0';
+					
+					rice_sample_ack <= '1';
+					
+					state <= RX_RICE_WRITE_SDRAM;
+					
+				elsif rice_error = '1' then
+					
+					-- Bad block header, drop the rest of the datagram
+					ip_next_frag_offset <= (others => '0'); -- Force next fragment to be 0
+					spi_cycle <= '0'; -- Since auto_disable was 0 in prev state
+					state <= RX_SET_ERXTAIL;
+					
+				elsif rice_done = '1' then
+					
+					-- Any padding left in the fragment is skipped.  The block may
+					-- finish before the last fragment if only padding is left, in
+					-- which case the last fragment will come back here.
+					
+					-- Last fragment is done, so all data is available for audio
+					if ip_more_fragments = '0' then
+						-- Sequence counts bytes on the wire, so skip the whole block
+						audio_next_sequence <= audio_tmp_sequence + udp_len - 8;
+						sdram_complete_ptr <= sdram_write_ptr;
+					end if;
+					
+					spi_cycle <= '0'; -- Since auto_disable was 0 in prev state
+					state <= RX_SET_ERXTAIL;
+					
+				elsif rice_word_ready = '1' and rice_word_valid = '0' and len_remaining /= X"0000" then
+					
+					-- Read up to 4 more bytes of the block
+					
+					if len_remaining < 4 then
+						rice_fetch_len <= len_remaining(2 downto 0);
+						spi_datacount <= len_remaining(2 downto 0);
+						len_remaining <= (others => '0');
+					else
+						rice_fetch_len <= "100";
+						spi_datacount <= "100";
+						len_remaining <= len_remaining - 4;
+					end if;
+					
+					spi_writedata <= X"00" & X"00" & X"00" & X"00";
+					spi_auto_disable <= '0';
+					
+					next_state <= RX_RICE_LOAD;
+					state <= STARTSPI;
+					
+				elsif rice_need_word = '1' and rice_word_valid = '0' and len_remaining = X"0000" then
+					
+					-- Out of data in this fragment, the next one will continue
+					-- the block (or the datagram was short and gets dropped)
+					spi_cycle <= '0'; -- Since auto_disable was 0 in prev state
+					state <= RX_SET_ERXTAIL;
+					
+				end if;
+				
+			when RX_RICE_LOAD =>
+				-- Pass the bytes just read to the decoder, left aligned
+				
+				dbg_state <= X"0312";
+				
+				if rice_fetch_len = "100" then
+					rice_word <= spi_readdata;
+				elsif rice_fetch_len = "011" then
+					rice_word <= spi_readdata(23 downto 0) & X"00";
+				elsif rice_fetch_len = "010" then
+					rice_word <= spi_readdata(15 downto 0) & X"0000";
+				else
+					rice_word <= spi_readdata(7 downto 0) & X"000000";
+				end if;
+				
+				rice_word_bits <= rice_fetch_len & "000";
+				rice_word_valid <= '1';
+				
+				state <= RX_RICE_FETCH;
+				
+			when RX_RICE_WRITE_SDRAM =>
+				-- Wait for the SDRAM write of one decoded sample
+				
+				dbg_state <= X"0313";
+				
+				if sdram_ack = '1' then
+					
+					sdram_cycle_s <= '0';
+					sdram_strobe_s <= '0';
+					
+					sdram_write_ptr <= sdram_write_ptr + 1;
+					
+					if sdram_write_ptr = (SDRAM_BUFFER_SIZE-1) then
+						sdram_write_ptr <= X"000000";
+					end if;
+					
+					state <= RX_RICE_FETCH;
+					
+				end if;
+				
+				
 				
 			when RX_VOLUME_1 =>
 				-- First two 9-bit channel volume controls
@@ -2672,10 +2997,10 @@ begin
 			when TX_STATUS_IPHDR_1 =>
 				-- Write 4 bytes of IP header: (Ver, IHL), (DSCP, ECN), Total Len (x2)
 				
-				ip_checksum <= X"00004500" + X"00000028";
+				ip_checksum <= X"00004500" + X"0000003C";
 				
-				-- Length = 20 (IP hdr) + 8 (UDP hdr) + 12 (data) = 0x0028
-				spi_writedata <= X"45" & X"00" & X"0028";
+				-- Length = 20 (IP hdr) + 8 (UDP hdr) + 32 (data) = 0x003C
+				spi_writedata <= X"45" & X"00" & X"003C";
 				spi_datacount <= "100";
 				spi_auto_disable <= '0';
 				
@@ -2739,9 +3064,9 @@ begin
 			when TX_STATUS_UDPHDR_2 =>
 				-- Write 4 bytes of UDP header: Dest port, Length, Checksum
 				
-				-- UDP hdr = 8, UDP data = 12, total 20 bytes
+				-- UDP hdr = 8, UDP data = 32, total 40 bytes
 				-- Checksum 0 means ignore
-				spi_writedata <= X"0014" & X"0000";
+				spi_writedata <= X"0028" & X"0000";
 				spi_datacount <= "100";
 				spi_auto_disable <= '0';
 				
@@ -2775,8 +3100,65 @@ begin
 				
 				spi_writedata <= X"0000000" & "000" & audioclk_warning;
 				spi_datacount <= "100";
+				spi_auto_disable <= '0';
+				
+				next_state <= TX_STATUS_VERSION;
+				state <= STARTSPI;
+				
+			-- Everything below is the extended status payload.  Older hosts
+			-- only read the first 12 bytes, so new fields must be added at the
+			-- end and STATUS_VERSION incremented.
+				
+			when TX_STATUS_VERSION =>
+				-- Write 4 bytes of status payload version
+				
+				spi_writedata <= STATUS_VERSION;
+				spi_datacount <= "100";
+				spi_auto_disable <= '0';
+				
+				next_state <= TX_STATUS_SDRAM_FILL;
+				state <= STARTSPI;
+				
+			when TX_STATUS_SDRAM_FILL =>
+				-- Write 4 bytes of SDRAM buffer usage (same units as window size)
+				
+				spi_writedata <= "000000" & (SDRAM_BUFFER_SIZE - sdram_size_avail) & "00";
+				spi_datacount <= "100";
+				spi_auto_disable <= '0';
+				
+				next_state <= TX_STATUS_DAC_COUNTS;
+				state <= STARTSPI;
+				
+			when TX_STATUS_DAC_COUNTS =>
+				-- Write 2 bytes of SRAM empty count, 2 bytes of SDRAM underrun count
+				
+				spi_writedata <= sram_empty_count & sdram_underrun_count;
+				spi_datacount <= "100";
+				spi_auto_disable <= '0';
+				
+				next_state <= TX_STATUS_RX_COUNTS;
+				state <= STARTSPI;
+				
+			when TX_STATUS_RX_COUNTS =>
+				-- Write 2 bytes of discarded datagram count, 2 bytes of fragment gap count
+				
+				spi_writedata <= rx_discard_count & rx_frag_gap_count;
+				spi_datacount <= "100";
+				spi_auto_disable <= '0';
+				
+				next_state <= TX_STATUS_RX_HIGH_WATER;
+				state <= STARTSPI;
+				
+			when TX_STATUS_RX_HIGH_WATER =>
+				-- Write 2 bytes of receive buffer high-water mark, 2 reserved bytes
+				
+				spi_writedata <= rx_buffer_high_water & X"0000";
+				spi_datacount <= "100";
 				spi_auto_disable <= '1';
 				
+				-- Start tracking again for the next status packet
+				rx_buffer_high_water <= rx_buffer_used;
+				
 				next_state <= TX_STATUS_SET_TXST;
 				state <= STARTSPI;
 				
@@ -2793,8 +3175,8 @@ begin
 			when TX_STATUS_SET_TXLEN =>
 				-- Set TXLEN to length of packet
 				
-				-- IP/UDP header is 28 bytes, 12 bytes data, plus 2 ethertype, plus 6 dest MAC addr
-				spi_writedata <= CMD_WRITE_REG_UNBANKED & REG_ETXLENL & X"34" & X"00";
+				-- IP/UDP header is 28 bytes, 32 bytes data, plus 2 ethertype, plus 6 dest MAC addr
+				spi_writedata <= CMD_WRITE_REG_UNBANKED & REG_ETXLENL & X"44" & X"00";
 				spi_datacount <= "100";
 				spi_auto_disable <= '1';
 				
@@ -3711,6 +4093,23 @@ end process;
 		rst_i => ten_hz_int_rst
 	);
 
+	audio_decoder : entity work.rice_decoder
+		port map(
+			sys_clk => sys_clk,
+			sys_reset => sys_reset,
+			start_i => rice_start,
+			word_i => rice_word,
+			word_bits_i => rice_word_bits,
+			word_valid_i => rice_word_valid,
+			word_ready_o => rice_word_ready,
+			need_word_o => rice_need_word,
+			sample_o => rice_sample,
+			sample_valid_o => rice_sample_valid,
+			sample_ack_i => rice_sample_ack,
+			done_o => rice_done,
+			error_o => rice_error
+		);
+
 	ethspi_interface : entity work.spimaster
 		port map(
 			sys_clk => sys_clk,
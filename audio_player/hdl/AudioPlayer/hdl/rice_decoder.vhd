@@ -0,0 +1,351 @@
+----------------------------------------------------------------------------------
+--
+-- Streaming decoder for compressed audio blocks (command bit 4)
+--
+-- A block is one UDP datagram worth of audio: a 16-bit frame count, one
+-- byte per channel with the predictor order (bits 7-5) and Rice parameter
+-- (bits 4-0), then one Rice code per sample in frame order.  See the
+-- network protocol document for the exact format.
+--
+-- The ethernet state machine feeds in up to 32 bits at a time (left
+-- aligned) and takes decoded 20-bit samples out of a small FIFO.  Bits are
+-- decoded one per clock, which is several times faster than they arrive
+-- over SPI, so the decoder normally waits for data.  The state for a block
+-- is kept between words, so a block may span several IP fragments.
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.STD_LOGIC_UNSIGNED.ALL;
+
+entity rice_decoder is
+    Port ( sys_clk : in  STD_LOGIC;
+           sys_reset : in  STD_LOGIC;
+
+           -- Pulse to forget everything and start a new block
+           start_i : in  STD_LOGIC;
+
+           -- Input data, MSB first.  word_bits_i is 8, 16, 24 or 32
+           word_i : in  STD_LOGIC_VECTOR (31 downto 0);
+           word_bits_i : in  STD_LOGIC_VECTOR (5 downto 0);
+           word_valid_i : in  STD_LOGIC;
+           word_ready_o : out  STD_LOGIC;
+           -- All input has been used and more is needed to continue
+           need_word_o : out  STD_LOGIC;
+
+           -- Decoded samples, sample_ack_i pulses to remove one
+           sample_o : out  STD_LOGIC_VECTOR (19 downto 0);
+           sample_valid_o : out  STD_LOGIC;
+           sample_ack_i : in  STD_LOGIC;
+
+           -- All frames in the block have been decoded
+           done_o : out  STD_LOGIC;
+           -- Block header had an invalid predictor order or Rice parameter
+           error_o : out  STD_LOGIC);
+end rice_decoder;
+
+architecture Behavioral of rice_decoder is
+
+	-- 31 zeros means the residual follows as 20 raw bits
+	constant ESCAPE_QUOTIENT : std_logic_vector(4 downto 0) := "11110";
+	constant MAX_RICE_PARAM : std_logic_vector(4 downto 0) := "10011";
+
+	type DECODER_STATES is (IDLE, HDR_FRAMES, HDR_CHAN, UNARY, REMAINDER,
+		ESCAPE, PREDICT, SAMPLE, DONE, BAD);
+
+	signal state : DECODER_STATES;
+
+	type SAMPLE_ARRAY is array(0 to 7) of std_logic_vector(19 downto 0);
+	type ORDER_ARRAY is array(0 to 7) of std_logic_vector(1 downto 0);
+	type PARAM_ARRAY is array(0 to 7) of std_logic_vector(4 downto 0);
+
+	-- Word being decoded and the one after it
+	signal cur_word : std_logic_vector(31 downto 0);
+	signal cur_bits : std_logic_vector(5 downto 0);
+	signal next_word : std_logic_vector(31 downto 0);
+	signal next_bits : std_logic_vector(5 downto 0);
+	signal next_valid : std_logic;
+
+	-- Header fields and remainders are shifted in here
+	signal value : std_logic_vector(19 downto 0);
+	signal shifted : std_logic_vector(19 downto 0);
+	-- Bits left to read in a fixed size field
+	signal field_count : std_logic_vector(4 downto 0);
+	-- Number of zeros seen in the unary part of a Rice code
+	signal quotient : std_logic_vector(4 downto 0);
+
+	signal channel : std_logic_vector(2 downto 0);
+	signal frames_left : std_logic_vector(15 downto 0);
+	-- Frames decoded so far in this block, stops counting at 2
+	signal warmup : std_logic_vector(1 downto 0);
+
+	-- Per channel parameters from the block header
+	signal chan_order : ORDER_ARRAY;
+	signal chan_param : PARAM_ARRAY;
+
+	-- Last two samples of each channel for the predictor
+	signal prev1 : SAMPLE_ARRAY;
+	signal prev2 : SAMPLE_ARRAY;
+	signal prediction : std_logic_vector(19 downto 0);
+
+	-- Decoded samples waiting to be written to SDRAM
+	signal fifo : SAMPLE_ARRAY;
+	signal fifo_wr : std_logic_vector(2 downto 0);
+	signal fifo_rd : std_logic_vector(2 downto 0);
+	signal fifo_count : std_logic_vector(3 downto 0);
+	signal fifo_push : std_logic;
+	signal fifo_pop : std_logic;
+
+begin
+
+	shifted <= value(18 downto 0) & cur_word(31);
+
+	word_ready_o <= not next_valid;
+
+	need_word_o <= '1' when cur_bits = "000000" and next_valid = '0' and
+		(state = HDR_FRAMES or state = HDR_CHAN or state = UNARY or
+		 state = REMAINDER or state = ESCAPE) else '0';
+
+	sample_o <= fifo(conv_integer(fifo_rd));
+	sample_valid_o <= '1' when fifo_count /= "0000" else '0';
+
+	done_o <= '1' when state = DONE else '0';
+	error_o <= '1' when state = BAD else '0';
+
+	fifo_push <= '1' when state = SAMPLE and fifo_count /= "1000" else '0';
+	fifo_pop <= '1' when sample_ack_i = '1' and fifo_count /= "0000" else '0';
+
+	process(sys_clk,sys_reset)
+	begin
+
+		if sys_reset = '1' then
+
+			state <= IDLE;
+
+			cur_word <= (others => '0');
+			cur_bits <= (others => '0');
+			next_word <= (others => '0');
+			next_bits <= (others => '0');
+			next_valid <= '0';
+
+			value <= (others => '0');
+			field_count <= (others => '0');
+			quotient <= (others => '0');
+			channel <= (others => '0');
+			frames_left <= (others => '0');
+			warmup <= (others => '0');
+			prediction <= (others => '0');
+
+			fifo_wr <= (others => '0');
+			fifo_rd <= (others => '0');
+			fifo_count <= (others => '0');
+
+		elsif rising_edge(sys_clk) then
+
+			-- Move the next word in once the current one is used up
+			if cur_bits = "000000" and next_valid = '1' then
+				cur_word <= next_word;
+				cur_bits <= next_bits;
+				next_valid <= '0';
+			end if;
+
+			if word_valid_i = '1' then
+				next_word <= word_i;
+				next_bits <= word_bits_i;
+				next_valid <= '1';
+			end if;
+
+
+			case state is
+			when IDLE =>
+
+				null;
+
+			when HDR_FRAMES =>
+				-- 16-bit frame count
+
+				if cur_bits /= "000000" then
+
+					value <= shifted;
+					field_count <= field_count - 1;
+
+					if field_count = "00001" then
+						frames_left <= shifted(15 downto 0);
+						field_count <= "01000";
+						state <= HDR_CHAN;
+					end if;
+
+				end if;
+
+			when HDR_CHAN =>
+				-- Order and Rice parameter for each channel
+
+				if cur_bits /= "000000" then
+
+					value <= shifted;
+					field_count <= field_count - 1;
+
+					if field_count = "00001" then
+
+						chan_order(conv_integer(channel)) <= shifted(6 downto 5);
+						chan_param(conv_integer(channel)) <= shifted(4 downto 0);
+
+						field_count <= "01000";
+						channel <= channel + 1;
+
+						if shifted(7 downto 5) > "010" or shifted(4 downto 0) > MAX_RICE_PARAM then
+							state <= BAD;
+						elsif channel = "111" and frames_left = X"0000" then
+							state <= DONE;
+						elsif channel = "111" then
+							quotient <= (others => '0');
+							state <= UNARY;
+						end if;
+
+					end if;
+
+				end if;
+
+			when UNARY =>
+				-- Count zeros up to the terminating one
+
+				if cur_bits /= "000000" then
+
+					if cur_word(31) = '1' then
+
+						-- Remainder bits are shifted in below the quotient
+						value <= X"000" & "000" & quotient;
+
+						field_count <= chan_param(conv_integer(channel));
+
+						if chan_param(conv_integer(channel)) = "00000" then
+							state <= PREDICT;
+						else
+							state <= REMAINDER;
+						end if;
+
+					elsif quotient = ESCAPE_QUOTIENT then
+
+						value <= (others => '0');
+						field_count <= "10100";
+						state <= ESCAPE;
+
+					else
+
+						quotient <= quotient + 1;
+
+					end if;
+
+				end if;
+
+			when REMAINDER | ESCAPE =>
+
+				if cur_bits /= "000000" then
+
+					value <= shifted;
+					field_count <= field_count - 1;
+
+					if field_count = "00001" then
+						state <= PREDICT;
+					end if;
+
+				end if;
+
+			when PREDICT =>
+				-- Undo the zigzag mapping and work out the fixed prediction
+
+				value <= ("0" & value(19 downto 1)) xor (value'range => value(0));
+
+				if warmup = "00" or chan_order(conv_integer(channel)) = "00" then
+					prediction <= (others => '0');
+				elsif warmup = "01" or chan_order(conv_integer(channel)) = "01" then
+					prediction <= prev1(conv_integer(channel));
+				else
+					prediction <= (prev1(conv_integer(channel))(18 downto 0) & "0") - prev2(conv_integer(channel));
+				end if;
+
+				state <= SAMPLE;
+
+			when SAMPLE =>
+				-- Wait for space in the FIFO
+
+				if fifo_push = '1' then
+
+					prev1(conv_integer(channel)) <= prediction + value;
+					prev2(conv_integer(channel)) <= prev1(conv_integer(channel));
+
+					channel <= channel + 1;
+					quotient <= (others => '0');
+
+					if channel = "111" then
+
+						frames_left <= frames_left - 1;
+
+						if warmup /= "10" then
+							warmup <= warmup + 1;
+						end if;
+
+					end if;
+
+					if channel = "111" and frames_left = X"0001" then
+						state <= DONE;
+					else
+						state <= UNARY;
+					end if;
+
+				end if;
+
+			when DONE | BAD =>
+
+				null;
+
+			end case;
+
+
+			-- Shift out one bit in the states that read from the input
+			if cur_bits /= "000000" and (state = HDR_FRAMES or state = HDR_CHAN or
+				state = UNARY or state = REMAINDER or state = ESCAPE) then
+				cur_word <= cur_word(30 downto 0) & "0";
+				cur_bits <= cur_bits - 1;
+			end if;
+
+
+			if fifo_push = '1' then
+				fifo(conv_integer(fifo_wr)) <= prediction + value;
+				fifo_wr <= fifo_wr + 1;
+			end if;
+
+			if fifo_pop = '1' then
+				fifo_rd <= fifo_rd + 1;
+			end if;
+
+			if fifo_push = '1' and fifo_pop = '0' then
+				fifo_count <= fifo_count + 1;
+			elsif fifo_push = '0' and fifo_pop = '1' then
+				fifo_count <= fifo_count - 1;
+			end if;
+
+
+			if start_i = '1' then
+
+				state <= HDR_FRAMES;
+
+				cur_bits <= (others => '0');
+				next_valid <= '0';
+
+				value <= (others => '0');
+				field_count <= "10000";
+				channel <= (others => '0');
+				warmup <= (others => '0');
+
+				fifo_wr <= (others => '0');
+				fifo_rd <= (others => '0');
+				fifo_count <= (others => '0');
+
+			end if;
+
+		end if;
+
+	end process;
+
+end Behavioral;
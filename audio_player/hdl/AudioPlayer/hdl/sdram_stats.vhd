@@ -0,0 +1,108 @@
+----------------------------------------------------------------------------------
+--
+-- Bandwidth counters for one master of the SDRAM bus arbiter
+--
+-- Counts the grants the master gets from the arbiter, the cycles it spends
+-- stalled (waiting for the arbiter, or for the SDRAM controller once it
+-- has the bus), and the words acked to it.  Also keeps the longest wait
+-- for a grant, in sys_clk cycles, saturating at 0xFFFF.
+--
+-- The counters are free-running and wrap around.  snapshot_i copies them
+-- to the outputs, so that the Raspberry Pi can read a consistent set over
+-- several register reads.  If clear_i is also set the counters and the
+-- maximum wait restart from 0 on the same clock.
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.STD_LOGIC_UNSIGNED.ALL;
+
+entity sdram_stats is
+    Port ( sys_clk : in  STD_LOGIC;
+           sys_reset : in  STD_LOGIC;
+
+           snapshot_i : in  STD_LOGIC;
+           clear_i : in  STD_LOGIC;
+
+           -- Wishbone cycle from the master, and whether the arbiter
+           -- has given it the bus
+           cycle_i : in  STD_LOGIC;
+           granted_i : in  STD_LOGIC;
+           -- SDRAM controller stall while this master has the bus, and the
+           -- ack as passed on to the master
+           stall_i : in  STD_LOGIC;
+           ack_i : in  STD_LOGIC;
+
+           grants_o : out  STD_LOGIC_VECTOR (31 downto 0);
+           stall_cycles_o : out  STD_LOGIC_VECTOR (31 downto 0);
+           words_o : out  STD_LOGIC_VECTOR (31 downto 0);
+           max_wait_o : out  STD_LOGIC_VECTOR (15 downto 0));
+end sdram_stats;
+
+architecture Behavioral of sdram_stats is
+
+	signal granted_q : std_logic;
+
+	signal grants, stall_cycles, words : std_logic_vector(31 downto 0);
+	signal wait_count, max_wait : std_logic_vector(15 downto 0);
+
+begin
+
+	process (sys_clk, sys_reset)
+	begin
+		if sys_reset = '1' then
+			granted_q <= '0';
+			grants <= (others => '0');
+			stall_cycles <= (others => '0');
+			words <= (others => '0');
+			wait_count <= (others => '0');
+			max_wait <= (others => '0');
+			grants_o <= (others => '0');
+			stall_cycles_o <= (others => '0');
+			words_o <= (others => '0');
+			max_wait_o <= (others => '0');
+		elsif rising_edge(sys_clk) then
+
+			granted_q <= granted_i;
+
+			if granted_i = '1' and granted_q = '0' then
+				grants <= grants + 1;
+			end if;
+
+			if cycle_i = '1' and (granted_i = '0' or stall_i = '1') then
+				stall_cycles <= stall_cycles + 1;
+			end if;
+
+			if ack_i = '1' then
+				words <= words + 1;
+			end if;
+
+			-- Length of the current wait for a grant
+			if cycle_i = '0' or granted_i = '1' then
+				wait_count <= (others => '0');
+			elsif wait_count /= X"FFFF" then
+				wait_count <= wait_count + 1;
+			end if;
+
+			if wait_count > max_wait then
+				max_wait <= wait_count;
+			end if;
+
+			if snapshot_i = '1' then
+				grants_o <= grants;
+				stall_cycles_o <= stall_cycles;
+				words_o <= words;
+				max_wait_o <= max_wait;
+
+				if clear_i = '1' then
+					grants <= (others => '0');
+					stall_cycles <= (others => '0');
+					words <= (others => '0');
+					max_wait <= (others => '0');
+				end if;
+			end if;
+
+		end if;
+	end process;
+
+end Behavioral;
@@ -0,0 +1,68 @@
+----------------------------------------------------------------------------------
+--
+-- Simulation models of the two clock wizard cores.  The real ones are a
+-- DCM_SP (50 MHz * 17/10 = 85 MHz) and a PLL_BASE (~16.9 MHz audio clock),
+-- here the output clocks are simply generated at the same frequencies.
+-- They are not phase locked to the input, which doesn't matter because
+-- the design treats them as unrelated clock domains anyway.
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+
+entity sysclk_from_onboard is
+port
+ (
+	OSC_FPGA : in std_logic;
+	sysclk_out : out std_logic;
+	RESET : in std_logic;
+	LOCKED : out std_logic
+ );
+end sysclk_from_onboard;
+
+architecture sim of sysclk_from_onboard is
+
+	constant HALF_PERIOD : time := 5882 ps; -- 85 MHz
+
+	signal clk : std_logic := '0';
+
+begin
+
+	clk <= not clk after HALF_PERIOD;
+
+	sysclk_out <= clk;
+
+	LOCKED <= '0', '1' after 1 us;
+
+end sim;
+
+
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+
+entity audio_clkgen is
+port
+ (
+	clk_in : in std_logic;
+	cllk_16m : out std_logic;
+	sys_reset : in std_logic;
+	pll_locked : out std_logic
+ );
+end audio_clkgen;
+
+architecture sim of audio_clkgen is
+
+	constant HALF_PERIOD : time := 29526 ps; -- 16.9344 MHz
+
+	signal clk : std_logic := '0';
+
+begin
+
+	clk <= not clk after HALF_PERIOD;
+
+	cllk_16m <= clk;
+
+	pll_locked <= '0', '1' after 1 us;
+
+end sim;
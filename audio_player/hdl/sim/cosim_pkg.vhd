@@ -0,0 +1,81 @@
+----------------------------------------------------------------------------------
+--
+-- Foreign (VHPIDIRECT) procedures that connect the simulation to the C side:
+--
+-- sdram_cosim_cycle: one clock of the Verilated sdram.v plus the SDRAM chip
+-- model (sdram_model.cpp).
+--
+-- tb_cycle: one clock of the testbench (tb_main.c), which plays the
+-- Raspberry Pi on the SPI-wishbone bridge, the ENC424J600 on PMOD1 and
+-- keeps the SDRAM arbiter statistics.
+--
+-- Scalars with mode "in" are passed by value, "out" as pointers.
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+package cosim_pkg is
+
+	function to_int(b : std_logic) return integer;
+	function to_int(v : std_logic_vector) return integer;
+	function to_sl(i : integer) return std_logic;
+
+	procedure sdram_cosim_cycle(
+		rst, stb, we, sel, cyc, addr, data : in integer;
+		data_o, stall, ack : out integer);
+	attribute foreign of sdram_cosim_cycle : procedure is "VHPIDIRECT sdram_cosim_cycle";
+
+	procedure tb_cycle(
+		rpi_miso, eth_sck, eth_mosi, eth_cs : in integer;
+		dac_cyc, eth_cyc, rpi_cyc, dac_ack, eth_ack, rpi_ack, stall, bus_state : in integer;
+		rpi_sck, rpi_mosi, rpi_ss, eth_miso, eth_int, reset_n, dac_start, done : out integer);
+	attribute foreign of tb_cycle : procedure is "VHPIDIRECT tb_cycle";
+
+end cosim_pkg;
+
+package body cosim_pkg is
+
+	function to_int(b : std_logic) return integer is
+	begin
+		if b = '1' or b = 'H' then
+			return 1;
+		end if;
+		return 0;
+	end function;
+
+	-- Anything that isn't 0/1 (uninitialized signals) counts as 0.  32-bit
+	-- buses go through as signed so they fit, C casts them back.
+	function to_int(v : std_logic_vector) return integer is
+	begin
+		if v'length < 32 then
+			return to_integer(to_01(unsigned(v)));
+		end if;
+		return to_integer(signed(to_01(unsigned(v))));
+	end function;
+
+	function to_sl(i : integer) return std_logic is
+	begin
+		if i /= 0 then
+			return '1';
+		end if;
+		return '0';
+	end function;
+
+	procedure sdram_cosim_cycle(
+		rst, stb, we, sel, cyc, addr, data : in integer;
+		data_o, stall, ack : out integer) is
+	begin
+		assert false report "VHPIDIRECT sdram_cosim_cycle" severity failure;
+	end procedure;
+
+	procedure tb_cycle(
+		rpi_miso, eth_sck, eth_mosi, eth_cs : in integer;
+		dac_cyc, eth_cyc, rpi_cyc, dac_ack, eth_ack, rpi_ack, stall, bus_state : in integer;
+		rpi_sck, rpi_mosi, rpi_ss, eth_miso, eth_int, reset_n, dac_start, done : out integer) is
+	begin
+		assert false report "VHPIDIRECT tb_cycle" severity failure;
+	end procedure;
+
+end cosim_pkg;
@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "enc424j600.h"
+
+// SPI opcodes, same names as ethernet.vhd
+#define CMD_READ_REG_UNBANKED	0x20
+#define CMD_WRITE_REG_UNBANKED	0x22
+#define CMD_BIT_SET_UNBANKED	0x24
+#define CMD_BIT_CLR_UNBANKED	0x26
+#define CMD_READ_EGPDATA	0x28
+#define CMD_WRITE_EGPDATA	0x2A
+#define CMD_READ_ERXDATA	0x2C
+#define CMD_WRITE_ERXRDPT	0x64
+#define CMD_WRITE_EGPWRPT	0x6C
+
+#define CMD_SETETHRST		0xCA
+#define CMD_SETPKTDEC		0xCC
+#define CMD_SETTXRTS		0xD4
+#define CMD_ENABLERX		0xE8
+#define CMD_DISABLERX		0xEA
+#define CMD_SETEIE		0xEC
+#define CMD_CLREIE		0xEE
+
+// Register addresses (low byte)
+#define REG_ETXST		0x00
+#define REG_ETXLEN		0x02
+#define REG_ERXST		0x04
+#define REG_ERXTAIL		0x06
+#define REG_ERXHEAD		0x08
+#define REG_ESTAT		0x1A
+#define REG_EIR			0x1C
+#define REG_ECON1		0x1E
+#define REG_MAADR3		0x60
+#define REG_MAADR2		0x62
+#define REG_MAADR1		0x64
+#define REG_EIE			0x72
+
+#define ESTAT_PHYLNK		0x0100
+#define ESTAT_PHYDPX		0x0400
+#define ESTAT_CLKRDY		0x1000
+#define ESTAT_FCIDLE		0x4000
+#define ESTAT_INT		0x8000
+
+#define EIR_TXIF		0x0008
+#define EIR_PKTIF		0x0040
+#define EIR_LINKIF		0x0800
+
+#define EIE_INTIE		0x8000
+
+#define ECON1_RXEN		0x0001
+
+// RSV bit 23, received OK
+#define RSV_RECEIVED_OK		0x80
+
+
+static unsigned int sfr16(struct enc424j600 *e, int addr) {
+	return e->sfr[addr] | (e->sfr[addr + 1] << 8);
+}
+
+static void set_sfr16(struct enc424j600 *e, int addr, unsigned int value) {
+	e->sfr[addr] = value & 0xFF;
+	e->sfr[addr + 1] = (value >> 8) & 0xFF;
+}
+
+static unsigned int rx_start(struct enc424j600 *e) {
+	return sfr16(e, REG_ERXST) & 0x7FFE;
+}
+
+// Next address in the receive ring, which wraps from the end of SRAM
+static unsigned int rx_next(struct enc424j600 *e, unsigned int addr) {
+
+	addr++;
+
+	if (addr >= ENC_SRAM_SIZE)
+		addr = rx_start(e);
+
+	return addr;
+}
+
+// State after power on or SETETHRST
+static void enc_reset(struct enc424j600 *e) {
+
+	unsigned char mac[6];
+
+	// MAADR survives, it is loaded from the chip's EUI-48
+	memcpy(mac, &e->sfr[REG_MAADR3], 6);
+
+	memset(e->sfr, 0, sizeof(e->sfr));
+
+	memcpy(&e->sfr[REG_MAADR3], mac, 6);
+
+	set_sfr16(e, REG_ERXST, 0x5340);
+	set_sfr16(e, REG_ERXTAIL, 0x5FFE);
+
+	// The state machine waits for a link change before enabling RX
+	set_sfr16(e, REG_EIR, EIR_LINKIF);
+
+	e->rxHead = 0x5340;
+	e->rxReadPtr = 0x5340;
+	e->gpWritePtr = 0;
+	e->pktCount = 0;
+	e->rxEnabled = 0;
+
+}
+
+void enc_init(struct enc424j600 *e, const unsigned char *mac) {
+
+	memset(e, 0, sizeof(*e));
+
+	// MAADR1 holds the first two bytes of the address
+	e->sfr[REG_MAADR1] = mac[0];
+	e->sfr[REG_MAADR1 + 1] = mac[1];
+	e->sfr[REG_MAADR2] = mac[2];
+	e->sfr[REG_MAADR2 + 1] = mac[3];
+	e->sfr[REG_MAADR3] = mac[4];
+	e->sfr[REG_MAADR3 + 1] = mac[5];
+
+	enc_reset(e);
+
+	e->link = 1;
+	e->lastSck = 0;
+	e->lastCs = 1;
+
+}
+
+static unsigned int estat(struct enc424j600 *e) {
+
+	unsigned int value = ESTAT_CLKRDY | ESTAT_FCIDLE | (e->pktCount & 0xFF);
+
+	if (e->link)
+		value |= ESTAT_PHYLNK | ESTAT_PHYDPX;
+
+	return value;
+}
+
+static unsigned int eir(struct enc424j600 *e) {
+
+	// PKTIF follows the packet counter and can't be cleared directly
+	unsigned int value = sfr16(e, REG_EIR) & ~EIR_PKTIF;
+
+	if (e->pktCount > 0)
+		value |= EIR_PKTIF;
+
+	return value;
+}
+
+static int int_pending(struct enc424j600 *e) {
+
+	unsigned int eie = sfr16(e, REG_EIE);
+
+	return (eie & EIE_INTIE) && (eir(e) & eie & 0x7FFF);
+}
+
+static unsigned char reg_read(struct enc424j600 *e, int addr) {
+
+	unsigned int value;
+
+	addr &= 0x7F;
+
+	switch (addr & 0x7E) {
+
+		case REG_ESTAT:
+			value = estat(e);
+			if (int_pending(e))
+				value |= ESTAT_INT;
+			break;
+
+		case REG_EIR:
+			value = eir(e);
+			break;
+
+		case REG_ERXHEAD:
+			value = e->rxHead;
+			break;
+
+		default:
+			return e->sfr[addr];
+
+	}
+
+	return (addr & 1) ? (value >> 8) & 0xFF : value & 0xFF;
+}
+
+// Unbanked write, set or clear of one SFR byte
+static void reg_write(struct enc424j600 *e, int addr, unsigned char value, int op) {
+
+	addr &= 0x7F;
+
+	// Read-only
+	if ((addr & 0x7E) == REG_ESTAT || (addr & 0x7E) == REG_ERXHEAD)
+		return;
+
+	if (op == CMD_BIT_SET_UNBANKED)
+		value = e->sfr[addr] | value;
+	else if (op == CMD_BIT_CLR_UNBANKED)
+		value = e->sfr[addr] & ~value;
+
+	e->sfr[addr] = value;
+
+	// The head follows ERXST while RX is off
+	if ((addr & 0x7E) == REG_ERXST && !e->rxEnabled) {
+		e->rxHead = rx_start(e);
+		e->rxReadPtr = e->rxHead;
+	}
+
+	if ((addr & 0x7E) == REG_ECON1)
+		e->rxEnabled = sfr16(e, REG_ECON1) & ECON1_RXEN;
+
+}
+
+static void transmit(struct enc424j600 *e) {
+
+	unsigned int start, len, i;
+
+	start = sfr16(e, REG_ETXST);
+	len = sfr16(e, REG_ETXLEN);
+
+	if (len > ENC_MAX_FRAME)
+		len = ENC_MAX_FRAME;
+
+	for (i = 0; i < len; i++)
+		e->txFrame[i] = e->sram[(start + i) % ENC_SRAM_SIZE];
+
+	e->txLength = len;
+	e->stats.frames_sent++;
+
+	set_sfr16(e, REG_EIR, sfr16(e, REG_EIR) | EIR_TXIF);
+
+}
+
+static void single_byte_command(struct enc424j600 *e, unsigned char opcode) {
+
+	switch (opcode) {
+
+		case CMD_SETETHRST:
+			enc_reset(e);
+			break;
+
+		case CMD_SETPKTDEC:
+			if (e->pktCount > 0)
+				e->pktCount--;
+			break;
+
+		case CMD_SETTXRTS:
+			transmit(e);
+			break;
+
+		case CMD_ENABLERX:
+			set_sfr16(e, REG_ECON1, sfr16(e, REG_ECON1) | ECON1_RXEN);
+			e->rxEnabled = 1;
+			break;
+
+		case CMD_DISABLERX:
+			set_sfr16(e, REG_ECON1, sfr16(e, REG_ECON1) & ~ECON1_RXEN);
+			e->rxEnabled = 0;
+			break;
+
+		case CMD_SETEIE:
+			set_sfr16(e, REG_EIE, sfr16(e, REG_EIE) | EIE_INTIE);
+			break;
+
+		case CMD_CLREIE:
+			set_sfr16(e, REG_EIE, sfr16(e, REG_EIE) & ~EIE_INTIE);
+			break;
+
+	}
+
+}
+
+// A whole byte arrived on MOSI, returns the byte to shift out next
+static unsigned char spi_byte(struct enc424j600 *e, unsigned char in) {
+
+	unsigned char out = 0;
+	int index = e->byteIndex++;
+
+	e->stats.spi_bytes++;
+
+	if (index == 0) {
+
+		e->opcode = in;
+
+		if (in >= 0xC0)
+			single_byte_command(e, in);
+		else if (in == CMD_READ_ERXDATA) {
+			out = e->sram[e->rxReadPtr];
+			e->rxReadPtr = rx_next(e, e->rxReadPtr);
+		}
+
+		return out;
+	}
+
+	switch (e->opcode) {
+
+		case CMD_READ_REG_UNBANKED:
+			if (index == 1)
+				e->regAddr = in;
+			out = reg_read(e, e->regAddr);
+			e->regAddr = (e->regAddr + 1) & 0x7F;
+			break;
+
+		case CMD_WRITE_REG_UNBANKED:
+		case CMD_BIT_SET_UNBANKED:
+		case CMD_BIT_CLR_UNBANKED:
+			if (index == 1) {
+				e->regAddr = in;
+			} else {
+				reg_write(e, e->regAddr, in, e->opcode);
+				e->regAddr = (e->regAddr + 1) & 0x7F;
+			}
+			break;
+
+		case CMD_READ_ERXDATA:
+			out = e->sram[e->rxReadPtr];
+			e->rxReadPtr = rx_next(e, e->rxReadPtr);
+			break;
+
+		case CMD_WRITE_EGPDATA:
+			e->sram[e->gpWritePtr] = in;
+			// The general purpose area ends where the RX ring starts
+			e->gpWritePtr++;
+			if (e->gpWritePtr >= rx_start(e))
+				e->gpWritePtr = 0;
+			break;
+
+		case CMD_WRITE_ERXRDPT:
+			if (index == 1)
+				e->rxReadPtr = (e->rxReadPtr & 0xFF00) | in;
+			else if (index == 2)
+				e->rxReadPtr = ((e->rxReadPtr & 0x00FF) | (in << 8)) % ENC_SRAM_SIZE;
+			break;
+
+		case CMD_WRITE_EGPWRPT:
+			if (index == 1)
+				e->gpWritePtr = (e->gpWritePtr & 0xFF00) | in;
+			else if (index == 2)
+				e->gpWritePtr = ((e->gpWritePtr & 0x00FF) | (in << 8)) % ENC_SRAM_SIZE;
+			break;
+
+	}
+
+	return out;
+}
+
+void enc_clock(struct enc424j600 *e, int sck, int mosi, int cs, int *miso, int *int_n) {
+
+	if (cs) {
+
+		e->byteIndex = 0;
+		e->bitCount = 0;
+		e->outPending = 0;
+		e->outShift = 0;
+
+	} else if (e->lastCs) {
+
+		// CS fell, a new command starts
+		e->byteIndex = 0;
+		e->bitCount = 0;
+		e->outPending = 0;
+		e->outShift = 0;
+
+	} else if (sck && !e->lastSck) {
+
+		// Mode 0, sample on the rising edge
+		e->inShift = (e->inShift << 1) | (mosi & 1);
+		e->bitCount++;
+
+		if (e->bitCount == 8) {
+			e->outNext = spi_byte(e, e->inShift);
+			e->outPending = 1;
+			e->bitCount = 0;
+		}
+
+	} else if (!sck && e->lastSck) {
+
+		// and change MISO on the falling edge
+		if (e->outPending) {
+			e->outShift = e->outNext;
+			e->outPending = 0;
+		} else {
+			e->outShift <<= 1;
+		}
+
+	}
+
+	e->lastSck = sck;
+	e->lastCs = cs;
+
+	*miso = (e->outShift >> 7) & 1;
+	*int_n = int_pending(e) ? 0 : 1;
+
+}
+
+unsigned int enc_rx_free(struct enc424j600 *e) {
+
+	unsigned int tail = sfr16(e, REG_ERXTAIL);
+	unsigned int size = ENC_SRAM_SIZE - rx_start(e);
+
+	if (tail >= e->rxHead)
+		return tail - e->rxHead;
+
+	return size - (e->rxHead - tail);
+}
+
+// Ring space a frame takes: next pointer, RSV, the frame and its CRC,
+// padded to an even address
+static unsigned int rx_needed(unsigned int len) {
+	return (8 + len + 4 + 1) & ~1;
+}
+
+int enc_can_receive(struct enc424j600 *e, unsigned int len) {
+	return e->rxEnabled && e->link && e->pktCount < 0xFF && rx_needed(len) < enc_rx_free(e);
+}
+
+int enc_receive(struct enc424j600 *e, const unsigned char *frame, unsigned int len) {
+
+	unsigned int needed, next, addr, i, used;
+	unsigned char header[8];
+
+	if (!enc_can_receive(e, len)) {
+		e->stats.frames_dropped++;
+		return 1;
+	}
+
+	needed = rx_needed(len);
+
+	next = e->rxHead + needed;
+
+	if (next >= ENC_SRAM_SIZE)
+		next = next - ENC_SRAM_SIZE + rx_start(e);
+
+	header[0] = next & 0xFF;
+	header[1] = (next >> 8) & 0xFF;
+	header[2] = (len + 4) & 0xFF;
+	header[3] = ((len + 4) >> 8) & 0xFF;
+	header[4] = RSV_RECEIVED_OK;
+	header[5] = 0;
+	header[6] = 0;
+	header[7] = 0;
+
+	addr = e->rxHead;
+
+	for (i = 0; i < 8; i++) {
+		e->sram[addr] = header[i];
+		addr = rx_next(e, addr);
+	}
+
+	for (i = 0; i < len + 4; i++) {
+		e->sram[addr] = i < len ? frame[i] : 0;
+		addr = rx_next(e, addr);
+	}
+
+	e->rxHead = next;
+	e->pktCount++;
+
+	e->stats.frames_received++;
+	e->stats.bytes_received += len;
+
+	used = (ENC_SRAM_SIZE - rx_start(e)) - enc_rx_free(e);
+
+	if (used > e->stats.rx_high_water)
+		e->stats.rx_high_water = used;
+
+	return 0;
+}
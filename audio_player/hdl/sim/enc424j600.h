@@ -0,0 +1,75 @@
+#ifndef ENC424J600_H
+#define ENC424J600_H
+
+#include <stdint.h>
+
+/*
+ * Model of the ENC424J600 on the PmodNIC100, as far as ethernet.vhd uses
+ * it: the SPI opcodes and SFRs it sends, the 24 KB packet SRAM with the
+ * receive ring, the packet counter and the interrupt pin.  The pins are
+ * sampled once per sys_clk, which is fast enough for the 85 MHz / 6 SPI
+ * clock that spimaster.vhd generates.
+ */
+
+#define ENC_SRAM_SIZE		0x6000
+#define ENC_MAX_FRAME		1518
+
+struct enc_stats {
+	uint64_t frames_received;
+	uint64_t bytes_received;
+	// No room between ERXHEAD and ERXTAIL, or RX was not enabled
+	uint64_t frames_dropped;
+	uint64_t frames_sent;
+	uint64_t spi_bytes;
+	// Most of the RX ring in use at once
+	unsigned int rx_high_water;
+};
+
+struct enc424j600 {
+
+	unsigned char sram[ENC_SRAM_SIZE];
+
+	// Special function registers 0x00-0x7F, little endian pairs
+	unsigned char sfr[0x80];
+
+	unsigned int rxHead;
+	unsigned int rxReadPtr;
+	unsigned int gpWritePtr;
+	unsigned int pktCount;
+	int rxEnabled;
+	int link;
+
+	// SPI state
+	int lastSck, lastCs;
+	unsigned char inShift, outShift, outNext;
+	int bitCount, outPending;
+	int byteIndex;
+	unsigned char opcode;
+	unsigned char regAddr;
+	int miso;
+
+	// Last frame sent with SETTXRTS
+	unsigned char txFrame[ENC_MAX_FRAME];
+	unsigned int txLength;
+
+	struct enc_stats stats;
+
+};
+
+extern void enc_init(struct enc424j600 *e, const unsigned char *mac);
+
+// One sys_clk with the pins driven by the FPGA, returns MISO and INT (low
+// when an enabled interrupt is pending)
+extern void enc_clock(struct enc424j600 *e, int sck, int mosi, int cs, int *miso, int *int_n);
+
+// Puts a frame (no CRC) into the receive ring as the MAC would.  Returns
+// non-zero if it was dropped.
+extern int enc_receive(struct enc424j600 *e, const unsigned char *frame, unsigned int len);
+
+// True if enc_receive would take a frame of len bytes now
+extern int enc_can_receive(struct enc424j600 *e, unsigned int len);
+
+// Free bytes in the receive ring
+extern unsigned int enc_rx_free(struct enc424j600 *e);
+
+#endif
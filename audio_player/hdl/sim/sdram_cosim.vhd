@@ -0,0 +1,73 @@
+----------------------------------------------------------------------------------
+--
+-- Takes the place of the sdram component (verilog_compat.vhd) in simulation.
+-- Every rising edge of clk_i the wishbone inputs are handed to the Verilated
+-- sdram.v, which also clocks the SDRAM chip model, and the registered
+-- outputs come back.  The chip pins stay on the C side so the SDRAM_* ports
+-- of audio_player are left idle.
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+library work;
+use work.cosim_pkg.all;
+
+entity sdram is
+port (
+	clk_i : in std_logic;
+	rst_i : in std_logic;
+	stb_i : in std_logic;
+	we_i : in std_logic;
+	sel_i : in std_logic_vector(3 downto 0);
+	cyc_i : in std_logic;
+	addr_i : in std_logic_vector(31 downto 0);
+	data_i : in std_logic_vector(31 downto 0);
+	data_o : out std_logic_vector(31 downto 0);
+	stall_o : out std_logic;
+	ack_o : out std_logic;
+
+	sdram_clk_o : out std_logic;
+	sdram_cke_o : out std_logic;
+	sdram_cs_o : out std_logic;
+	sdram_ras_o : out std_logic;
+	sdram_cas_o : out std_logic;
+	sdram_we_o : out std_logic;
+	sdram_dqm_o : out std_logic_vector(1 downto 0);
+	sdram_addr_o : out std_logic_vector(12 downto 0);
+	sdram_ba_o : out std_logic_vector(1 downto 0);
+	sdram_data_io : inout std_logic_vector(15 downto 0)
+);
+end sdram;
+
+architecture cosim of sdram is
+begin
+
+	sdram_clk_o <= not clk_i;
+	sdram_cke_o <= '1';
+	sdram_cs_o <= '1';
+	sdram_ras_o <= '1';
+	sdram_cas_o <= '1';
+	sdram_we_o <= '1';
+	sdram_dqm_o <= "11";
+	sdram_addr_o <= (others => '0');
+	sdram_ba_o <= "00";
+	sdram_data_io <= (others => 'Z');
+
+	process(clk_i)
+		variable data, stall, ack : integer;
+	begin
+		if rising_edge(clk_i) then
+
+			sdram_cosim_cycle(to_int(rst_i), to_int(stb_i), to_int(we_i), to_int(sel_i),
+				to_int(cyc_i), to_int(addr_i), to_int(data_i), data, stall, ack);
+
+			data_o <= std_logic_vector(to_signed(data, 32));
+			stall_o <= to_sl(stall);
+			ack_o <= to_sl(ack);
+
+		end if;
+	end process;
+
+end cosim;
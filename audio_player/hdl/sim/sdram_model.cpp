@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "verilated.h"
+#include "Vsdram_sim.h"
+
+#include "sdram_model.h"
+
+/*
+ * Runs the real sdram.v controller (through Verilator) against a model of
+ * the SDRAM chip on the Logi-Pi.  The chip is clocked on the falling edge
+ * of clk_i, which is the rising edge of sdram_clk_o (~clk_i).  It checks
+ * that commands go to open rows and keeps the data, so reads return what
+ * was written and the DAC gets back what ethernet stored.
+ *
+ * Timing is only at the clock level: read data appears CAS latency chip
+ * clocks after the READ and is held for one clock, write data is taken on
+ * the same edge as the WRITE.  Refresh and tRCD/tRP are not checked, only
+ * counted.
+ */
+
+#define ROW_BITS	13
+#define COL_BITS	9
+#define BANKS		4
+
+#define CMD_LOAD_MODE	0x0
+#define CMD_REFRESH	0x1
+#define CMD_PRECHARGE	0x2
+#define CMD_ACTIVE	0x3
+#define CMD_WRITE	0x4
+#define CMD_READ	0x5
+#define CMD_NOP		0x7
+
+// Read data waiting to be put on DQ, indexed by chip clock
+#define PIPE_LEN	8
+
+static VerilatedContext *context;
+static Vsdram_sim *top;
+
+static uint16_t *memory;
+
+static int openRow[BANKS];
+static int casLatency = 2;
+static int burstLength = 2;
+
+// Write burst in progress
+static int writeLeft, writeBank, writeRow, writeCol;
+
+static uint16_t pipeData[PIPE_LEN];
+static int pipeValid[PIPE_LEN];
+static uint64_t chipClock;
+
+static struct sdram_model_stats stats;
+
+
+static uint32_t word_index(int bank, int row, int col) {
+	return (((uint32_t)bank << ROW_BITS | row) << COL_BITS) | col;
+}
+
+static void model_init() {
+
+	int i;
+
+	context = new VerilatedContext;
+	top = new Vsdram_sim{context};
+
+	memory = (uint16_t *)calloc((size_t)BANKS << (ROW_BITS + COL_BITS), sizeof(uint16_t));
+
+	if (!memory) {
+		fprintf(stderr, "Could not allocate SDRAM model\n");
+		exit(1);
+	}
+
+	for (i = 0; i < BANKS; i++)
+		openRow[i] = -1;
+
+	top->clk_i = 0;
+	top->rst_i = 1;
+	top->eval();
+
+}
+
+// One rising edge of sdram_clk, with the pins as the controller left them
+static void chip_clock() {
+
+	int cmd, bank, addr, col, i, slot;
+	uint16_t dq, mask;
+
+	cmd = (top->sdram_cs_o << 3) | (top->sdram_ras_o << 2) | (top->sdram_cas_o << 1) | top->sdram_we_o;
+	bank = top->sdram_ba_o;
+	addr = top->sdram_addr_o;
+	dq = top->sdram_dq_o;
+
+	// DQM masks write data with no latency, high bit for the upper byte
+	mask = (top->sdram_dqm_o & 1 ? 0x00FF : 0) | (top->sdram_dqm_o & 2 ? 0xFF00 : 0);
+
+	// Rest of a write burst, any other command ends it early
+	if (writeLeft > 0 && cmd != CMD_NOP && (cmd & 0x8) == 0)
+		writeLeft = 0;
+
+	if (writeLeft > 0) {
+		uint16_t *p = &memory[word_index(writeBank, writeRow, writeCol)];
+		*p = (*p & mask) | (dq & ~mask);
+		writeCol = (writeCol & ~(burstLength - 1)) | ((writeCol + 1) & (burstLength - 1));
+		writeLeft--;
+	}
+
+	if (top->sdram_cke_o && (cmd & 0x8) == 0) {
+
+		switch (cmd) {
+
+			case CMD_LOAD_MODE:
+				casLatency = (addr >> 4) & 7;
+				burstLength = 1 << (addr & 7);
+				if (casLatency < 1 || casLatency > 3 || burstLength > 8) {
+					stats.protocol_errors++;
+					casLatency = 2;
+					burstLength = 2;
+				}
+				break;
+
+			case CMD_REFRESH:
+				stats.refreshes++;
+				for (i = 0; i < BANKS; i++)
+					if (openRow[i] >= 0)
+						stats.protocol_errors++;
+				break;
+
+			case CMD_PRECHARGE:
+				stats.precharges++;
+				if (addr & (1 << 10)) {
+					for (i = 0; i < BANKS; i++)
+						openRow[i] = -1;
+				} else {
+					openRow[bank] = -1;
+				}
+				break;
+
+			case CMD_ACTIVE:
+				stats.activates++;
+				if (openRow[bank] >= 0)
+					stats.protocol_errors++;
+				openRow[bank] = addr;
+				break;
+
+			case CMD_WRITE:
+				stats.writes++;
+				if (openRow[bank] < 0) {
+					stats.protocol_errors++;
+					break;
+				}
+				writeBank = bank;
+				writeRow = openRow[bank];
+				writeCol = addr & ((1 << COL_BITS) - 1);
+				writeLeft = burstLength;
+
+				// First word is on DQ with the command
+				{
+					uint16_t *p = &memory[word_index(writeBank, writeRow, writeCol)];
+					*p = (*p & mask) | (dq & ~mask);
+				}
+				writeCol = (writeCol & ~(burstLength - 1)) | ((writeCol + 1) & (burstLength - 1));
+				writeLeft--;
+				break;
+
+			case CMD_READ:
+				stats.reads++;
+				if (openRow[bank] < 0) {
+					stats.protocol_errors++;
+					break;
+				}
+				col = addr & ((1 << COL_BITS) - 1);
+				for (i = 0; i < burstLength; i++) {
+					slot = (chipClock + casLatency + i) % PIPE_LEN;
+					pipeData[slot] = memory[word_index(bank, openRow[bank], col)];
+					pipeValid[slot] = 1;
+					col = (col & ~(burstLength - 1)) | ((col + 1) & (burstLength - 1));
+				}
+				break;
+
+		}
+
+	}
+
+	// Drive DQ until the next edge
+	slot = chipClock % PIPE_LEN;
+
+	top->chip_oe_i = pipeValid[slot];
+	top->chip_dq_i = pipeData[slot];
+
+	pipeValid[slot] = 0;
+
+	chipClock++;
+
+}
+
+extern "C" void sdram_cosim_cycle(int rst, int stb, int we, int sel, int cyc, int addr, int data,
+	int *data_o, int *stall, int *ack) {
+
+	if (!top)
+		model_init();
+
+	top->rst_i = rst;
+	top->stb_i = stb;
+	top->we_i = we;
+	top->sel_i = sel;
+	top->cyc_i = cyc;
+	top->addr_i = (uint32_t)addr;
+	top->data_i = (uint32_t)data;
+
+	top->clk_i = 1;
+	top->eval();
+
+	*data_o = (int)top->data_o;
+	*stall = top->stall_o;
+	*ack = top->ack_o;
+
+	// The chip sees the new command half a cycle later
+	chip_clock();
+
+	top->clk_i = 0;
+	top->eval();
+
+	stats.cycles++;
+
+}
+
+extern "C" void sdram_model_get_stats(struct sdram_model_stats *s) {
+
+	memcpy(s, &stats, sizeof(stats));
+
+}
+
+extern "C" void sdram_model_free(void) {
+
+	if (top) {
+		top->final();
+		delete top;
+		delete context;
+		top = NULL;
+	}
+
+	free(memory);
+	memory = NULL;
+
+}
@@ -0,0 +1,39 @@
+#ifndef SDRAM_MODEL_H
+#define SDRAM_MODEL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * sdram.v (Verilated) with a model of the 32 MB SDRAM chip on its pins.
+ * The simulation calls sdram_cosim_cycle() from sdram_cosim.vhd once per
+ * rising edge of sys_clk, the testbench only needs the counters.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sdram_model_stats {
+	uint64_t cycles;
+	uint64_t activates;
+	uint64_t precharges;
+	uint64_t refreshes;
+	uint64_t reads;
+	uint64_t writes;
+	// Commands the chip would not accept (no open row, bus contention...)
+	uint64_t protocol_errors;
+};
+
+extern void sdram_cosim_cycle(int rst, int stb, int we, int sel, int cyc, int addr, int data,
+	int *data_o, int *stall, int *ack);
+
+extern void sdram_model_get_stats(struct sdram_model_stats *stats);
+
+extern void sdram_model_free(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+//-----------------------------------------------------------------
+// Verilator top level around sdram.v.  The generic (non-Xilinx) I/O
+// path is used, and the DQ bus is resolved here between the controller
+// and the chip model so that the C++ side only sees plain wires.
+//-----------------------------------------------------------------
+module sdram_sim
+(
+    input           clk_i,
+    input           rst_i,
+
+    input           stb_i,
+    input           we_i,
+    input [3:0]     sel_i,
+    input           cyc_i,
+    input [31:0]    addr_i,
+    input [31:0]    data_i,
+    output [31:0]   data_o,
+    output          stall_o,
+    output          ack_o,
+
+    output          sdram_cke_o,
+    output          sdram_cs_o,
+    output          sdram_ras_o,
+    output          sdram_cas_o,
+    output          sdram_we_o,
+    output [1:0]    sdram_dqm_o,
+    output [12:0]   sdram_addr_o,
+    output [1:0]    sdram_ba_o,
+
+    // DQ as seen by the chip, and what the chip drives back
+    output [15:0]   sdram_dq_o,
+    input [15:0]    chip_dq_i,
+    input           chip_oe_i
+);
+
+wire [15:0] dq;
+wire        sdram_clk_w;
+
+assign dq         = chip_oe_i ? chip_dq_i : 16'bz;
+assign sdram_dq_o = dq;
+
+sdram
+#(
+    .SDRAM_MHZ(85),
+    .SDRAM_TARGET("SIM")
+)
+u_sdram
+(
+    .clk_i(clk_i),
+    .rst_i(rst_i),
+    .stb_i(stb_i),
+    .we_i(we_i),
+    .sel_i(sel_i),
+    .cyc_i(cyc_i),
+    .addr_i(addr_i),
+    .data_i(data_i),
+    .data_o(data_o),
+    .stall_o(stall_o),
+    .ack_o(ack_o),
+
+    .sdram_clk_o(sdram_clk_w),
+    .sdram_cke_o(sdram_cke_o),
+    .sdram_cs_o(sdram_cs_o),
+    .sdram_ras_o(sdram_ras_o),
+    .sdram_cas_o(sdram_cas_o),
+    .sdram_we_o(sdram_we_o),
+    .sdram_dqm_o(sdram_dqm_o),
+    .sdram_addr_o(sdram_addr_o),
+    .sdram_ba_o(sdram_ba_o),
+    .sdram_data_io(dq)
+);
+
+endmodule
+
+//-----------------------------------------------------------------
+// Empty Xilinx primitives, only so that Verilator can resolve the
+// SDRAM_TARGET == "XILINX" branch of sdram.v, which is not used here
+//-----------------------------------------------------------------
+/* verilator lint_off UNUSED */
+module ODDR2
+#(
+    parameter DDR_ALIGNMENT = "NONE",
+    parameter INIT          = 1'b0,
+    parameter SRTYPE        = "SYNC"
+)
+(
+    output Q,
+    input  C0,
+    input  C1,
+    input  CE,
+    input  D0,
+    input  D1,
+    input  R,
+    input  S
+);
+assign Q = 1'b0;
+endmodule
+
+module IOBUF
+#(
+    parameter DRIVE      = 12,
+    parameter IOSTANDARD = "DEFAULT",
+    parameter SLEW       = "SLOW"
+)
+(
+    output O,
+    inout  IO,
+    input  I,
+    input  T
+);
+assign O  = IO;
+assign IO = T ? 1'bz : I;
+endmodule
+/* verilator lint_on UNUSED */
@@ -0,0 +1,132 @@
+----------------------------------------------------------------------------------
+--
+-- Testbench for the whole audio_player design.  Only the board clock is
+-- generated here, everything else is done once per sys_clk by tb_cycle()
+-- in tb_main.c: reset, the Raspberry Pi SPI master, the ENC424J600 on PMOD1
+-- and the SDRAM arbiter statistics.
+--
+-- Needs VHDL-2008 for the external names into the design (the arbiter
+-- signals and sys_clk) and for force, which is used on the PMOD1 inputs
+-- because the inout port has no driver of its own for those pins.  With
+-- COSIM_DAC_START it also holds sdram_buffer_below_minimum low, so the DAC
+-- starts reading SDRAM as soon as ethernet has written a datagram to it.
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+
+library work;
+use work.cosim_pkg.all;
+
+entity tb_audio_player is
+end tb_audio_player;
+
+architecture sim of tb_audio_player is
+
+	signal osc_fpga : std_logic := '0';
+
+	signal pb : std_logic_vector(1 downto 0) := "10";
+	signal sw : std_logic_vector(1 downto 0) := "00";
+	signal led : std_logic_vector(1 downto 0);
+
+	signal pmod1, pmod2, pmod3, pmod4 : std_logic_vector(7 downto 0);
+
+	signal sdram_cke, sdram_clk, sdram_ncas, sdram_nras, sdram_nwe : std_logic;
+	signal sdram_ba, sdram_dqm : std_logic_vector(1 downto 0);
+	signal sdram_addr : std_logic_vector(12 downto 0);
+	signal sdram_dq : std_logic_vector(15 downto 0);
+
+	signal rp_gpio_gen2 : std_logic;
+
+	signal rpi_sck : std_logic := '0';
+	signal rpi_mosi : std_logic := '0';
+	signal rpi_ss : std_logic := '1';
+	signal rpi_miso : std_logic;
+
+begin
+
+	-- 50 MHz onboard oscillator
+	osc_fpga <= not osc_fpga after 10 ns;
+
+	dut : entity work.audio_player
+	port map (
+		OSC_FPGA => osc_fpga,
+		PB => pb,
+		SW => sw,
+		LED => led,
+		PMOD4 => pmod4,
+		PMOD3 => pmod3,
+		PMOD2 => pmod2,
+		PMOD1 => pmod1,
+		SDRAM_CKE => sdram_cke,
+		SDRAM_CLK => sdram_clk,
+		SDRAM_nCAS => sdram_ncas,
+		SDRAM_nRAS => sdram_nras,
+		SDRAM_nWE => sdram_nwe,
+		SDRAM_BA => sdram_ba,
+		SDRAM_DQM => sdram_dqm,
+		SDRAM_ADDR => sdram_addr,
+		SDRAM_DQ => sdram_dq,
+		RP_GPIO_GEN2 => rp_gpio_gen2,
+		SYS_SPI_SCK => rpi_sck,
+		RP_SPI_CE0N => rpi_ss,
+		SYS_SPI_MOSI => rpi_mosi,
+		SYS_SPI_MISO => rpi_miso
+	);
+
+	-- After dut so that the external names are elaborated already
+	testbench : block
+
+		alias sys_clk is <<signal .tb_audio_player.dut.sys_clk : std_logic>>;
+
+		alias dac_cyc is <<signal .tb_audio_player.dut.dac_sdram_cycle : std_logic>>;
+		alias eth_cyc is <<signal .tb_audio_player.dut.eth_sdram_cycle : std_logic>>;
+		alias rpi_cyc is <<signal .tb_audio_player.dut.rpi_sdram_cycle : std_logic>>;
+		alias dac_ack is <<signal .tb_audio_player.dut.dac_sdram_ack : std_logic>>;
+		alias eth_ack is <<signal .tb_audio_player.dut.eth_sdram_ack : std_logic>>;
+		alias rpi_ack is <<signal .tb_audio_player.dut.rpi_sdram_ack : std_logic>>;
+		alias sdram_stall is <<signal .tb_audio_player.dut.sdram_stall : std_logic>>;
+		alias bus_state is <<signal .tb_audio_player.dut.dbg_sdram_bus_state : std_logic_vector(15 downto 0)>>;
+
+		alias dut_pmod1 is <<signal .tb_audio_player.dut.PMOD1 : std_logic_vector(7 downto 0)>>;
+
+		alias below_minimum is <<signal .tb_audio_player.dut.sdram_buffer_below_minimum : std_logic>>;
+
+	begin
+
+		process(sys_clk)
+			variable sck, mosi, ss, miso, eth_int, reset_n, dac_start, done : integer;
+		begin
+			if rising_edge(sys_clk) then
+
+				-- PMOD1: 0 cs, 1 mosi, 2 miso, 3 sck, 4 int (ethernet.vhd)
+				tb_cycle(to_int(rpi_miso), to_int(pmod1(3)), to_int(pmod1(1)), to_int(pmod1(0)),
+					to_int(dac_cyc), to_int(eth_cyc), to_int(rpi_cyc),
+					to_int(dac_ack), to_int(eth_ack), to_int(rpi_ack),
+					to_int(sdram_stall), to_int(bus_state(7 downto 0)),
+					sck, mosi, ss, miso, eth_int, reset_n, dac_start, done);
+
+				rpi_sck <= to_sl(sck);
+				rpi_mosi <= to_sl(mosi);
+				rpi_ss <= to_sl(ss);
+
+				dut_pmod1(2) <= force in to_sl(miso);
+				dut_pmod1(4) <= force in to_sl(eth_int);
+
+				if dac_start /= 0 then
+					below_minimum <= force in '0';
+				end if;
+
+				-- PB(0) low is reset
+				pb(0) <= to_sl(reset_n);
+
+				if done /= 0 then
+					std.env.finish;
+				end if;
+
+			end if;
+		end process;
+
+	end block;
+
+end sim;
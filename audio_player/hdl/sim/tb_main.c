@@ -0,0 +1,692 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "enc424j600.h"
+#include "sdram_model.h"
+
+/*
+ * C side of tb_audio_player.vhd.  tb_cycle() is called on every rising
+ * edge of sys_clk (85 MHz) and:
+ *
+ * - holds PB(0) low for reset at the start,
+ * - plays the Raspberry Pi: bit-bangs SPI mode 0 into spi_wishbone_wrapper,
+ *   reads the 0xDEAD ID, then writes and reads back words of SDRAM through
+ *   the indirect access registers 1-4 (as audio-write.c does),
+ * - runs the ENC424J600 model on PMOD1 and feeds it audio datagrams for
+ *   UDP port 9000 as fast as its receive ring takes them,
+ * - counts, per SDRAM master, the cycles it wanted the bus, the cycles it
+ *   had it, the words it moved and how long it waited.
+ *
+ * Settings come from the environment:
+ *
+ * COSIM_CYCLES		sys_clk cycles to run (default 4000000, ~47 ms)
+ * COSIM_PI_DIV		sys_clks per half SPI clock from the Pi (default 4)
+ * COSIM_PI_WORDS	SDRAM words in each Pi write/read pass (default 32)
+ * COSIM_PI_LOOP	keep repeating Pi passes until the end (default 1)
+ * COSIM_AUDIO_BYTES	audio bytes per datagram, multiple of 24 (default 20088)
+ * COSIM_DATAGRAMS	datagrams to send, 0 for no limit (default 0)
+ * COSIM_DAC_START	start the DAC as soon as there is audio instead of
+ *			after ~3.4 MB, which takes ~2.5 s (default 1)
+ * COSIM_JSON		also write the results to this file
+ */
+
+#define RESET_CYCLES		100
+// The SDRAM controller spends ~9000 cycles in its power up delay
+#define PI_START_CYCLE		12000
+#define AUDIO_START_DELAY	1000
+
+// Indirect SDRAM access registers, see audio_player.vhd
+#define REG_ID			0
+#define REG_SDRAM_DATA		1
+#define REG_SDRAM_ADDR_H	2
+#define REG_SDRAM_ADDR_L	3
+#define REG_SDRAM_CTL		4
+#define SDRAM_CTL_GO		0x0001
+#define SDRAM_CTL_WRITE		0x0002
+// Above the 4 MB audio ring, in 16-bit words
+#define PI_SDRAM_BASE		0x300000
+
+#define MTU			1500
+#define AUDIO_PORT		9000
+#define HOST_PORT		5000
+#define MAX_FRAGMENTS		64
+
+// Values of dbg_sdram_bus_state(7 downto 0)
+#define BUS_IDLE		1
+#define BUS_DAC			2
+#define BUS_ETH			3
+#define BUS_RPI			4
+
+#define MASTER_DAC		0
+#define MASTER_ETH		1
+#define MASTER_RPI		2
+#define MASTERS			3
+
+static const char *masterName[MASTERS] = { "dac", "eth", "rpi" };
+
+struct master_stats {
+	uint64_t request_cycles;
+	uint64_t grant_cycles;
+	uint64_t wait_cycles;
+	uint64_t stall_cycles;
+	uint64_t grants;
+	uint64_t words;
+	uint64_t max_wait;
+	// Current wait, from cyc going high until the arbiter picks it
+	uint64_t waiting;
+};
+
+enum pi_op_type { PI_READ, PI_WRITE, PI_WAIT };
+
+struct pi_op {
+	enum pi_op_type type;
+	int reg;
+	unsigned int value;
+	// For reads, compare with value
+	int check;
+};
+
+enum pi_state { PI_NEXT_OP, PI_DELAY, PI_SS_SETUP, PI_CLOCK_LOW, PI_CLOCK_HIGH, PI_SS_HOLD };
+
+#define PI_MAX_OPS		4096
+
+static struct {
+	struct pi_op ops[PI_MAX_OPS];
+	int count, current;
+	int pass;
+
+	enum pi_state state;
+	int timer;
+	unsigned char tx[5], rx[5];
+	int bit;
+
+	int sck, mosi, ss;
+
+	uint64_t reads, writes, mismatches;
+	int idSeen;
+} pi;
+
+static struct {
+	unsigned char frames[MAX_FRAGMENTS][MTU + 14];
+	unsigned int lengths[MAX_FRAGMENTS];
+	int count, current;
+
+	uint32_t sequence;
+	uint16_t ident;
+	uint64_t datagrams, bytes;
+	int started;
+	uint64_t startCycle;
+} audio;
+
+static struct enc424j600 enc;
+
+static struct master_stats masters[MASTERS];
+static uint64_t busIdleCycles;
+static int lastBusState;
+
+static uint64_t cycle;
+static uint64_t maxCycles;
+static int piDiv, piWords, piLoop, audioBytes;
+static uint64_t maxDatagrams;
+static int dacStart;
+static int initialized;
+
+static const unsigned char hostMac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const unsigned char encMac[6] = { 0x00, 0x04, 0xA3, 0x12, 0x34, 0x56 };
+
+
+static long env_long(const char *name, long def) {
+
+	char *value = getenv(name);
+
+	if (!value || !*value)
+		return def;
+
+	return strtol(value, NULL, 0);
+}
+
+static void pi_add(enum pi_op_type type, int reg, unsigned int value, int check) {
+
+	if (pi.count >= PI_MAX_OPS)
+		return;
+
+	pi.ops[pi.count].type = type;
+	pi.ops[pi.count].reg = reg;
+	pi.ops[pi.count].value = value;
+	pi.ops[pi.count].check = check;
+	pi.count++;
+}
+
+static unsigned int pi_pattern(int pass, int i) {
+	return ((pass * 0x9E37) ^ (i * 0x3B1)) & 0xFFFF;
+}
+
+// One pass of writing piWords words of SDRAM and reading them back
+static void pi_build_pass(int pass) {
+
+	unsigned int addr;
+	int i;
+
+	pi.count = 0;
+	pi.current = 0;
+
+	if (pass == 0)
+		pi_add(PI_READ, REG_ID, 0xDEAD, 1);
+
+	for (i = 0; i < piWords; i++) {
+		addr = PI_SDRAM_BASE + i;
+		pi_add(PI_WRITE, REG_SDRAM_ADDR_H, addr >> 16, 0);
+		pi_add(PI_WRITE, REG_SDRAM_ADDR_L, addr & 0xFFFF, 0);
+		pi_add(PI_WRITE, REG_SDRAM_DATA, pi_pattern(pass, i), 0);
+		pi_add(PI_WRITE, REG_SDRAM_CTL, SDRAM_CTL_GO | SDRAM_CTL_WRITE, 0);
+		pi_add(PI_WRITE, REG_SDRAM_CTL, 0, 0);
+	}
+
+	for (i = 0; i < piWords; i++) {
+		addr = PI_SDRAM_BASE + i;
+		pi_add(PI_WRITE, REG_SDRAM_ADDR_H, addr >> 16, 0);
+		pi_add(PI_WRITE, REG_SDRAM_ADDR_L, addr & 0xFFFF, 0);
+		pi_add(PI_WRITE, REG_SDRAM_CTL, SDRAM_CTL_GO, 0);
+		pi_add(PI_WRITE, REG_SDRAM_CTL, 0, 0);
+		pi_add(PI_READ, REG_SDRAM_DATA, pi_pattern(pass, i), 1);
+	}
+
+	pi_add(PI_WAIT, 0, 1000, 0);
+
+}
+
+// Same header as logipi_write/logipi_read in wishbone_wrapper.c, then one
+// data word, low byte first
+static void pi_load(struct pi_op *op) {
+
+	unsigned int add = op->reg;
+	int read = op->type == PI_READ;
+
+	pi.tx[0] = (add >> 14) & 0xFF;
+	pi.tx[1] = (add >> 6) & 0xFF;
+	pi.tx[2] = ((add << 2) & 0xFC) | (1 << 1) | (read ? 0x01 : 0);
+	pi.tx[3] = read ? 0 : op->value & 0xFF;
+	pi.tx[4] = read ? 0 : (op->value >> 8) & 0xFF;
+
+	memset(pi.rx, 0, sizeof(pi.rx));
+	pi.bit = 0;
+}
+
+static void pi_finish(struct pi_op *op) {
+
+	unsigned int value;
+
+	if (op->type == PI_WRITE) {
+		pi.writes++;
+		return;
+	}
+
+	pi.reads++;
+	value = pi.rx[3] | (pi.rx[4] << 8);
+
+	if (op->reg == REG_ID && value == 0xDEAD)
+		pi.idSeen = 1;
+
+	if (op->check && value != op->value) {
+		if (pi.mismatches < 10)
+			fprintf(stderr, "cycle %llu: Pi read register %d = 0x%04x, expected 0x%04x\n",
+				(unsigned long long)cycle, op->reg, value, op->value);
+		pi.mismatches++;
+	}
+
+}
+
+static void pi_clock(int miso) {
+
+	struct pi_op *op;
+
+	if (cycle < PI_START_CYCLE)
+		return;
+
+	switch (pi.state) {
+
+		case PI_NEXT_OP:
+			if (pi.current >= pi.count) {
+				if (!piLoop && pi.pass > 0)
+					return;
+				pi_build_pass(pi.pass++);
+			}
+
+			op = &pi.ops[pi.current];
+
+			if (op->type == PI_WAIT) {
+				pi.timer = op->value;
+				pi.current++;
+				pi.state = PI_DELAY;
+				break;
+			}
+
+			pi_load(op);
+			pi.ss = 0;
+			pi.timer = piDiv;
+			pi.state = PI_SS_SETUP;
+			break;
+
+		case PI_DELAY:
+			if (--pi.timer <= 0)
+				pi.state = PI_NEXT_OP;
+			break;
+
+		case PI_SS_SETUP:
+			if (--pi.timer > 0)
+				break;
+			pi.mosi = (pi.tx[0] >> 7) & 1;
+			pi.timer = piDiv;
+			pi.state = PI_CLOCK_LOW;
+			break;
+
+		case PI_CLOCK_LOW:
+			if (--pi.timer > 0)
+				break;
+			// Rising edge, MISO has been stable since the falling edge
+			pi.sck = 1;
+			if (miso)
+				pi.rx[pi.bit / 8] |= 0x80 >> (pi.bit % 8);
+			pi.timer = piDiv;
+			pi.state = PI_CLOCK_HIGH;
+			break;
+
+		case PI_CLOCK_HIGH:
+			if (--pi.timer > 0)
+				break;
+			pi.sck = 0;
+			pi.bit++;
+			pi.timer = piDiv;
+			if (pi.bit == 8 * (int)sizeof(pi.tx)) {
+				pi.state = PI_SS_HOLD;
+			} else {
+				pi.mosi = (pi.tx[pi.bit / 8] >> (7 - pi.bit % 8)) & 1;
+				pi.state = PI_CLOCK_LOW;
+			}
+			break;
+
+		case PI_SS_HOLD:
+			if (--pi.timer > 0)
+				break;
+			pi.ss = 1;
+			pi_finish(&pi.ops[pi.current]);
+			pi.current++;
+			// Gap between transfers, like the ioctl overhead on the Pi
+			pi.timer = 4 * piDiv;
+			pi.state = PI_DELAY;
+			break;
+
+	}
+
+}
+
+static uint16_t ip_checksum(const unsigned char *header, int len) {
+
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < len; i += 2)
+		sum += (header[i] << 8) | header[i+1];
+
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return ~sum & 0xFFFF;
+}
+
+// Splits the next datagram into ethernet frames, see networking.md
+static void audio_build_datagram() {
+
+	unsigned char *payload, *frame;
+	unsigned int payloadLen, offset, chunk, i;
+	uint32_t command;
+	int n;
+
+	payloadLen = 8 + 8 + audioBytes;
+	payload = malloc(payloadLen);
+
+	if (!payload) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	// Reset the DAC and set the sequence number on the first one
+	command = audio.datagrams == 0 ? 0x00000102 : 0;
+
+	// UDP header, no checksum
+	payload[0] = HOST_PORT >> 8;
+	payload[1] = HOST_PORT & 0xFF;
+	payload[2] = AUDIO_PORT >> 8;
+	payload[3] = AUDIO_PORT & 0xFF;
+	payload[4] = (payloadLen >> 8) & 0xFF;
+	payload[5] = payloadLen & 0xFF;
+	payload[6] = 0;
+	payload[7] = 0;
+
+	for (i = 0; i < 4; i++) {
+		payload[8 + i] = (command >> (24 - i * 8)) & 0xFF;
+		payload[12 + i] = (audio.sequence >> (24 - i * 8)) & 0xFF;
+	}
+
+	// A slow ramp per channel, 3 bytes per sample
+	for (i = 0; i < (unsigned int)audioBytes; i += 3) {
+		uint32_t sample = ((audio.bytes + i) / 24 * 0x10 + (i / 3 % 8) * 0x10000) & 0xFFFFF0;
+		payload[16 + i] = (sample >> 16) & 0xFF;
+		payload[16 + i + 1] = (sample >> 8) & 0xFF;
+		payload[16 + i + 2] = sample & 0xFF;
+	}
+
+	audio.count = 0;
+	audio.current = 0;
+
+	for (offset = 0, n = 0; offset < payloadLen && n < MAX_FRAGMENTS; offset += chunk, n++) {
+
+		// Fragments other than the last carry a multiple of 8 bytes
+		chunk = payloadLen - offset;
+		if (chunk > MTU - 20)
+			chunk = (MTU - 20) & ~7;
+
+		frame = audio.frames[n];
+
+		memset(frame, 0xFF, 6);
+		memcpy(frame + 6, hostMac, 6);
+		frame[12] = 0x08;
+		frame[13] = 0x00;
+
+		frame[14] = 0x45;
+		frame[15] = 0;
+		frame[16] = ((20 + chunk) >> 8) & 0xFF;
+		frame[17] = (20 + chunk) & 0xFF;
+		frame[18] = audio.ident >> 8;
+		frame[19] = audio.ident & 0xFF;
+		frame[20] = ((offset / 8) >> 8) & 0x1F;
+		if (offset + chunk < payloadLen)
+			frame[20] |= 0x20;
+		frame[21] = (offset / 8) & 0xFF;
+		frame[22] = 64;
+		frame[23] = 17;
+		frame[24] = 0;
+		frame[25] = 0;
+		// 192.168.1.10 to 255.255.255.255
+		frame[26] = 192;
+		frame[27] = 168;
+		frame[28] = 1;
+		frame[29] = 10;
+		memset(frame + 30, 0xFF, 4);
+
+		i = ip_checksum(frame + 14, 20);
+		frame[24] = i >> 8;
+		frame[25] = i & 0xFF;
+
+		memcpy(frame + 34, payload + offset, chunk);
+
+		audio.lengths[n] = 34 + chunk;
+		audio.count++;
+	}
+
+	free(payload);
+
+	audio.ident++;
+	audio.sequence += audioBytes;
+	audio.bytes += audioBytes;
+	audio.datagrams++;
+
+}
+
+static void audio_clock() {
+
+	if (!enc.rxEnabled)
+		return;
+
+	if (!audio.started) {
+		audio.started = 1;
+		audio.startCycle = cycle + AUDIO_START_DELAY;
+	}
+
+	if (cycle < audio.startCycle)
+		return;
+
+	if (audio.current >= audio.count) {
+		if (maxDatagrams && audio.datagrams >= maxDatagrams)
+			return;
+		audio_build_datagram();
+	}
+
+	// Back to back as long as the ring has room, the host paces itself
+	// with the window in status packets anyway
+	if (enc_can_receive(&enc, audio.lengths[audio.current])) {
+		enc_receive(&enc, audio.frames[audio.current], audio.lengths[audio.current]);
+		audio.current++;
+	}
+
+}
+
+static void arbiter_clock(const int *cyc, const int *ack, int stall, int busState) {
+
+	int m, granted;
+
+	if (busState == BUS_IDLE)
+		busIdleCycles++;
+
+	for (m = 0; m < MASTERS; m++) {
+
+		granted = busState == BUS_DAC + m;
+
+		if (granted) {
+			masters[m].grant_cycles++;
+			if (lastBusState != busState)
+				masters[m].grants++;
+			if (stall)
+				masters[m].stall_cycles++;
+		}
+
+		if (cyc[m]) {
+			masters[m].request_cycles++;
+			if (!granted) {
+				masters[m].wait_cycles++;
+				masters[m].waiting++;
+				if (masters[m].waiting > masters[m].max_wait)
+					masters[m].max_wait = masters[m].waiting;
+			}
+		}
+
+		if (!cyc[m] || granted)
+			masters[m].waiting = 0;
+
+		if (ack[m])
+			masters[m].words++;
+
+	}
+
+	lastBusState = busState;
+
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+	return whole ? 100.0 * part / whole : 0.0;
+}
+
+// Words are 32 bits, sys_clk is 85 MHz
+static double mbytes_per_sec(uint64_t words, uint64_t cycles) {
+	return cycles ? words * 4.0 * 85.0 / cycles : 0.0;
+}
+
+static void report() {
+
+	struct sdram_model_stats sdram;
+	FILE *json;
+	char *jsonName;
+	int m;
+
+	sdram_model_get_stats(&sdram);
+
+	printf("\n%llu cycles (%.3f ms at 85 MHz)\n\n", (unsigned long long)cycle, cycle / 85000.0);
+
+	printf("SDRAM arbiter        dac          eth          rpi\n");
+	printf("requesting  ");
+	for (m = 0; m < MASTERS; m++)
+		printf("  %10.3f%%", percent(masters[m].request_cycles, cycle));
+	printf("\ngranted     ");
+	for (m = 0; m < MASTERS; m++)
+		printf("  %10.3f%%", percent(masters[m].grant_cycles, cycle));
+	printf("\ngrants      ");
+	for (m = 0; m < MASTERS; m++)
+		printf("  %11llu", (unsigned long long)masters[m].grants);
+	printf("\nwords       ");
+	for (m = 0; m < MASTERS; m++)
+		printf("  %11llu", (unsigned long long)masters[m].words);
+	printf("\nMB/s        ");
+	for (m = 0; m < MASTERS; m++)
+		printf("  %11.3f", mbytes_per_sec(masters[m].words, cycle));
+	printf("\nwait cycles ");
+	for (m = 0; m < MASTERS; m++)
+		printf("  %11llu", (unsigned long long)masters[m].wait_cycles);
+	printf("\nmax wait    ");
+	for (m = 0; m < MASTERS; m++)
+		printf("  %11llu", (unsigned long long)masters[m].max_wait);
+	printf("\nstalled     ");
+	for (m = 0; m < MASTERS; m++)
+		printf("  %11llu", (unsigned long long)masters[m].stall_cycles);
+	printf("\n\nBus idle %.3f%%\n", percent(busIdleCycles, cycle));
+
+	printf("SDRAM chip: %llu activates, %llu reads, %llu writes, %llu refreshes, %llu protocol errors\n",
+		(unsigned long long)sdram.activates, (unsigned long long)sdram.reads,
+		(unsigned long long)sdram.writes, (unsigned long long)sdram.refreshes,
+		(unsigned long long)sdram.protocol_errors);
+
+	printf("ENC424J600: %llu frames in (%llu bytes), %llu dropped, %llu sent, RX high-water %u bytes\n",
+		(unsigned long long)enc.stats.frames_received, (unsigned long long)enc.stats.bytes_received,
+		(unsigned long long)enc.stats.frames_dropped, (unsigned long long)enc.stats.frames_sent,
+		enc.stats.rx_high_water);
+
+	printf("Audio: %llu datagrams, %llu bytes queued\n",
+		(unsigned long long)audio.datagrams, (unsigned long long)audio.bytes);
+
+	printf("Raspberry Pi: ID %s, %llu reads, %llu writes, %llu mismatches\n",
+		pi.idSeen ? "0xDEAD" : "not seen", (unsigned long long)pi.reads,
+		(unsigned long long)pi.writes, (unsigned long long)pi.mismatches);
+
+	if (masters[MASTER_DAC].words == 0 && !dacStart)
+		printf("(The DAC only starts reading once ~3.4 MB of audio is buffered, run longer or set COSIM_DAC_START=1.)\n");
+
+	jsonName = getenv("COSIM_JSON");
+
+	if (!jsonName || !*jsonName)
+		return;
+
+	json = fopen(jsonName, "w");
+
+	if (!json) {
+		fprintf(stderr, "Error opening %s\n", jsonName);
+		return;
+	}
+
+	fprintf(json, "{\n  \"cycles\": %llu,\n  \"bus_idle_cycles\": %llu,\n  \"masters\": {\n",
+		(unsigned long long)cycle, (unsigned long long)busIdleCycles);
+
+	for (m = 0; m < MASTERS; m++) {
+		fprintf(json, "    \"%s\": {\"request_cycles\": %llu, \"grant_cycles\": %llu, \"grants\": %llu, "
+			"\"words\": %llu, \"mb_per_s\": %.3f, \"wait_cycles\": %llu, \"max_wait\": %llu, \"stall_cycles\": %llu}%s\n",
+			masterName[m], (unsigned long long)masters[m].request_cycles,
+			(unsigned long long)masters[m].grant_cycles, (unsigned long long)masters[m].grants,
+			(unsigned long long)masters[m].words, mbytes_per_sec(masters[m].words, cycle),
+			(unsigned long long)masters[m].wait_cycles, (unsigned long long)masters[m].max_wait,
+			(unsigned long long)masters[m].stall_cycles, m < MASTERS - 1 ? "," : "");
+	}
+
+	fprintf(json, "  },\n  \"sdram_protocol_errors\": %llu,\n  \"enc_frames_received\": %llu,\n"
+		"  \"enc_frames_dropped\": %llu,\n  \"audio_bytes\": %llu,\n  \"pi_mismatches\": %llu\n}\n",
+		(unsigned long long)sdram.protocol_errors, (unsigned long long)enc.stats.frames_received,
+		(unsigned long long)enc.stats.frames_dropped, (unsigned long long)audio.bytes,
+		(unsigned long long)pi.mismatches);
+
+	fclose(json);
+
+}
+
+static void tb_init() {
+
+	maxCycles = env_long("COSIM_CYCLES", 4000000);
+	piDiv = env_long("COSIM_PI_DIV", 4);
+	piWords = env_long("COSIM_PI_WORDS", 32);
+	piLoop = env_long("COSIM_PI_LOOP", 1);
+	audioBytes = env_long("COSIM_AUDIO_BYTES", 20088);
+	maxDatagrams = env_long("COSIM_DATAGRAMS", 0);
+	dacStart = env_long("COSIM_DAC_START", 1);
+
+	if (piDiv < 1)
+		piDiv = 1;
+
+	// 5 ops per word per direction
+	if (piWords < 1 || piWords * 10 + 2 > PI_MAX_OPS)
+		piWords = 32;
+
+	audioBytes -= audioBytes % 24;
+	if (audioBytes < 24 || 16 + audioBytes > MAX_FRAGMENTS * ((MTU - 20) & ~7))
+		audioBytes = 20088;
+
+	enc_init(&enc, encMac);
+
+	pi.sck = 0;
+	pi.mosi = 0;
+	pi.ss = 1;
+	pi.state = PI_NEXT_OP;
+
+	initialized = 1;
+
+}
+
+void tb_cycle(int rpi_miso, int eth_sck, int eth_mosi, int eth_cs,
+	int dac_cyc, int eth_cyc, int rpi_cyc, int dac_ack, int eth_ack, int rpi_ack, int stall, int bus_state,
+	int *rpi_sck, int *rpi_mosi, int *rpi_ss, int *eth_miso, int *eth_int, int *reset_n, int *dac_start, int *done) {
+
+	int cyc[MASTERS], ack[MASTERS];
+
+	if (!initialized)
+		tb_init();
+
+	// Already reported, just waiting for the simulation to stop
+	if (cycle >= maxCycles) {
+		*done = 1;
+		return;
+	}
+
+	cyc[MASTER_DAC] = dac_cyc;
+	cyc[MASTER_ETH] = eth_cyc;
+	cyc[MASTER_RPI] = rpi_cyc;
+	ack[MASTER_DAC] = dac_ack;
+	ack[MASTER_ETH] = eth_ack;
+	ack[MASTER_RPI] = rpi_ack;
+
+	*reset_n = cycle >= RESET_CYCLES;
+
+	if (cycle >= RESET_CYCLES) {
+		enc_clock(&enc, eth_sck, eth_mosi, eth_cs, eth_miso, eth_int);
+		pi_clock(rpi_miso);
+		audio_clock();
+		arbiter_clock(cyc, ack, stall, bus_state);
+	} else {
+		*eth_miso = 0;
+		*eth_int = 1;
+	}
+
+	*rpi_sck = pi.sck;
+	*rpi_mosi = pi.mosi;
+	*rpi_ss = pi.ss;
+	// Once the first datagram's samples are in SDRAM, one word each, so the
+	// DAC has something to follow; its first read doesn't check for empty
+	*dac_start = dacStart && masters[MASTER_ETH].words >= (uint64_t)audioBytes / 3;
+
+	cycle++;
+
+	*done = 0;
+
+	if (cycle >= maxCycles) {
+		report();
+		sdram_model_free();
+		*done = 1;
+	}
+
+}
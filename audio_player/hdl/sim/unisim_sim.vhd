@@ -0,0 +1,77 @@
+----------------------------------------------------------------------------------
+--
+-- Behavioural stand-ins for the few UNISIM primitives that audio_player.vhd
+-- and the clock wizard files use, so that GHDL can elaborate the design
+-- without the Xilinx simulation libraries.  Compile into library "unisim".
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+
+package vcomponents is
+
+component BUFG is
+	port (
+		O : out std_logic;
+		I : in std_logic
+	);
+end component;
+
+component BUFGMUX is
+	generic (
+		CLK_SEL_TYPE : string := "SYNC"
+	);
+	port (
+		O : out std_logic;
+		I0 : in std_logic;
+		I1 : in std_logic;
+		S : in std_logic
+	);
+end component;
+
+end vcomponents;
+
+
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+
+entity BUFG is
+	port (
+		O : out std_logic;
+		I : in std_logic
+	);
+end BUFG;
+
+architecture sim of BUFG is
+begin
+
+	O <= I;
+
+end sim;
+
+
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+
+-- Switches without the glitch-free handover, the select input only changes
+-- at reset in this design
+entity BUFGMUX is
+	generic (
+		CLK_SEL_TYPE : string := "SYNC"
+	);
+	port (
+		O : out std_logic;
+		I0 : in std_logic;
+		I1 : in std_logic;
+		S : in std_logic
+	);
+end BUFGMUX;
+
+architecture sim of BUFGMUX is
+begin
+
+	O <= I1 when S = '1' else I0;
+
+end sim;
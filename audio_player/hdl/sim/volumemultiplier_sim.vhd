@@ -0,0 +1,46 @@
+----------------------------------------------------------------------------------
+--
+-- Behavioural replacement for the volumemultiplier core (mult_gen,
+-- XilinxCoreLib).  Same ports and behaviour: signed a times unsigned b,
+-- 5 clocks of latency, output is bits 31..8 of the product, and the
+-- pipeline only moves when ce is high.
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+entity volumemultiplier is
+	port (
+		clk : in std_logic;
+		a : in std_logic_vector(23 downto 0);
+		b : in std_logic_vector(7 downto 0);
+		ce : in std_logic;
+		p : out std_logic_vector(23 downto 0)
+	);
+end volumemultiplier;
+
+architecture sim of volumemultiplier is
+
+	constant LATENCY : integer := 5;
+
+	type pipeline_t is array(1 to LATENCY) of signed(32 downto 0);
+	signal pipeline : pipeline_t := (others => (others => '0'));
+
+begin
+
+	process(clk)
+	begin
+		if rising_edge(clk) then
+			if ce = '1' then
+				pipeline(1) <= signed(a) * signed('0' & b);
+				for i in 2 to LATENCY loop
+					pipeline(i) <= pipeline(i-1);
+				end loop;
+			end if;
+		end if;
+	end process;
+
+	p <= std_logic_vector(pipeline(LATENCY)(31 downto 8));
+
+end sim;
@@ -57,12 +57,45 @@ namespace AudioPlayer
         public const UInt32 CMD_MUTE = 0x00000001;
         public const UInt32 CMD_SET_SEQUENCE = 0x00000002;
         public const UInt32 CMD_PAUSE = 0x00000004;
+        public const UInt32 CMD_PACKED = 0x00000008;
+        public const UInt32 CMD_COMPRESSED = 0x00000010;
         public const UInt32 CMD_RESET_I2S = 0x00000100;
         public const UInt32 CMD_USER_SIG_OFF = 0x00010000;
         public const UInt32 CMD_USER_SIG_ON = 0x00020000;
 
         public const UInt32 STATUS_CLOCK_WARNING = 0x00000001;
 
+        /// <summary>
+        /// Size of the original status packet (sequence, window, status bits)
+        /// </summary>
+        public const int STATUS_BASIC_LENGTH = 12;
+
+        /// <summary>
+        /// Size of the version 1 extended status packet
+        /// </summary>
+        public const int STATUS_V1_LENGTH = 32;
+
+        /// <summary>
+        /// Size of the ENC424J600 receive buffer on the amplifier
+        /// </summary>
+        public const int DEVICE_RX_BUFFER_SIZE = 0x5800;
+
+        /// <summary>
+        /// Compressed blocks start with a 16-bit frame count and one
+        /// parameter byte per channel
+        /// </summary>
+        public const int COMPRESSED_HEADER_LENGTH = 10;
+
+        /// <summary>
+        /// Largest Rice parameter the amplifier's decoder accepts
+        /// </summary>
+        private const int RICE_MAX_PARAM = 19;
+
+        /// <summary>
+        /// A unary part this long is an escape, the value follows as 20 raw bits
+        /// </summary>
+        private const int RICE_ESCAPE = 31;
+
 
         /// <summary>
         /// Socket to send data to amplifier
@@ -120,10 +153,47 @@ namespace AudioPlayer
         /// </summary>
         private volatile UInt32 statusBitmask;
 
+        /// <summary>
+        /// Version of the extended status payload (0 if the device only sends
+        /// the basic 12 byte status)
+        /// </summary>
+        private volatile UInt32 statusVersion;
+
+        /// <summary>
+        /// Amount of the SDRAM buffer in use, same units as the window size
+        /// </summary>
+        private volatile UInt32 sdramFill;
+
+        /// <summary>
+        /// Counters from the device.  These wrap around at 16 bits, so only
+        /// the difference between two status updates is meaningful.
+        /// </summary>
+        private volatile UInt16 sramEmptyCount;
+        private volatile UInt16 sdramUnderrunCount;
+        private volatile UInt16 discardedDatagramCount;
+        private volatile UInt16 fragmentGapCount;
+
+        /// <summary>
+        /// Highest ENC424J600 receive buffer usage (bytes) since the last status update
+        /// </summary>
+        private volatile UInt16 rxBufferHighWater;
+
         private bool didConnectSender;
         private bool isMute;
         private bool isPaused;
 
+        /// <summary>
+        /// Send two 20-bit samples in 5 bytes instead of 6.  Set this before
+        /// starting a new audio stream.
+        /// </summary>
+        private bool usePackedSamples;
+
+        /// <summary>
+        /// Send each datagram as a Rice coded block when that is smaller
+        /// than the normal (or packed) format.
+        /// </summary>
+        private bool useCompression;
+
         public delegate void AmplifierConnectedHandler(object sender);
         /// <summary>
         /// Fired when the amplifier is found on the network.
@@ -214,6 +284,61 @@ namespace AudioPlayer
             return statusBitmask;
         }
 
+        public bool getUsePackedSamples()
+        {
+            return usePackedSamples;
+        }
+
+        public void setUsePackedSamples(bool value)
+        {
+            usePackedSamples = value;
+        }
+
+        public bool getUseCompression()
+        {
+            return useCompression;
+        }
+
+        public void setUseCompression(bool value)
+        {
+            useCompression = value;
+        }
+
+        public UInt32 getStatusVersion()
+        {
+            return statusVersion;
+        }
+
+        public UInt32 getSdramFill()
+        {
+            return sdramFill;
+        }
+
+        public UInt16 getSramEmptyCount()
+        {
+            return sramEmptyCount;
+        }
+
+        public UInt16 getSdramUnderrunCount()
+        {
+            return sdramUnderrunCount;
+        }
+
+        public UInt16 getDiscardedDatagramCount()
+        {
+            return discardedDatagramCount;
+        }
+
+        public UInt16 getFragmentGapCount()
+        {
+            return fragmentGapCount;
+        }
+
+        public UInt16 getRxBufferHighWater()
+        {
+            return rxBufferHighWater;
+        }
+
         /// <summary>
         /// Returns the number of milliseconds that we need to sleep
         /// between packets, based on the given packet length and
@@ -234,7 +359,11 @@ namespace AudioPlayer
             // For a total of 1000 ms we need to sleep this long
             int msPerSleep = (int)Math.Floor(1000.0 / pktsPerSec);
 
-            if (recvWindowSize > packetSize*10)
+            // If the ENC424J600's receive buffer is close to overflowing then the SPI
+            // link is already saturated and sending faster would only lose fragments
+            bool deviceRxCongested = statusVersion >= 1 && rxBufferHighWater > (DEVICE_RX_BUFFER_SIZE * 3) / 4;
+
+            if (recvWindowSize > packetSize*10 && !deviceRxCongested)
                 msPerSleep = msPerSleep / 3; // Buffer is low, need to fill faster
             else if (recvWindowSize < packetSize*4)
                 msPerSleep = msPerSleep * 2; // Buffer is nearly full, need to fill slower
@@ -254,7 +383,13 @@ namespace AudioPlayer
             if (dataLen % 6 != 0)
                 throw new Exception("Data must contain 2 channels of 24 bit samples, a multiple of 6 bytes per packet.");
 
-            if (dataLen > 21000)
+            if (useCompression && dataLen % 24 != 0)
+                throw new Exception("Compressed data must contain whole frames of 8 channels, a multiple of 24 bytes per packet.");
+
+            // Number of bytes that will actually go over the network
+            int wireLen = usePackedSamples ? (dataLen / 6) * 5 : dataLen;
+
+            if (wireLen > 21000)
                 throw new Exception("Amplifier can only accept up to 21,000 bytes per packet.");
 
             if (!didConnectSender)
@@ -308,7 +443,22 @@ namespace AudioPlayer
             // Command will below will unpause automatically
             isPaused = false;
 
-            byte[] pktBytes = new byte[dataLen + 8];
+            // Only use a compressed block if it actually saves something
+            byte[] compressedData = null;
+
+            if (useCompression)
+            {
+                compressedData = new byte[wireLen];
+
+                int compressedLen = compressSamples(data, dataLen, compressedData, 0, wireLen - 1);
+
+                if (compressedLen > 0)
+                    wireLen = compressedLen;
+                else
+                    compressedData = null;
+            }
+
+            byte[] pktBytes = new byte[wireLen + 8];
 
             // Command
             pktBytes[0] = 0;
@@ -316,6 +466,11 @@ namespace AudioPlayer
             pktBytes[2] = 0;
             pktBytes[3] = 0;
 
+            if (compressedData != null)
+                pktBytes[3] |= (byte)CMD_COMPRESSED;
+            else if (usePackedSamples)
+                pktBytes[3] |= (byte)CMD_PACKED;
+
             // Always reset mute when starting a new stream
             if (newAudioStream)
                 isMute = false;
@@ -349,7 +504,12 @@ namespace AudioPlayer
             pktBytes[6] = seqData[1];
             pktBytes[7] = seqData[0];
 
-            Array.Copy(data, 0, pktBytes, 8, dataLen);
+            if (compressedData != null)
+                Array.Copy(compressedData, 0, pktBytes, 8, wireLen);
+            else if (usePackedSamples)
+                packSamples(data, dataLen, pktBytes, 8);
+            else
+                Array.Copy(data, 0, pktBytes, 8, dataLen);
 
             PacketData pkt = new PacketData();
             pkt.seq = sendSequence;
@@ -362,12 +522,259 @@ namespace AudioPlayer
 
             int retVal = udpSend.Send(pktBytes, pktBytes.Length);
 
+            // Sequence counts bytes on the wire, not bytes of 24-bit samples
             if (retVal == pktBytes.Length)
-                sendSequence += (uint)dataLen;
+                sendSequence += (uint)wireLen;
 
             return retVal;
         }
 
+        /// <summary>
+        /// Packs 24-bit big endian samples (lower 4 bits ignored) into the
+        /// 20-bit wire format: each pair of samples becomes 5 bytes, with
+        /// the low 4 bits of the third byte holding the top of the second
+        /// sample.
+        /// </summary>
+        /// <param name="src">24-bit samples, dataLen must be a multiple of 6</param>
+        /// <param name="dataLen">Number of bytes in src to pack</param>
+        /// <param name="dst">Packed output, needs (dataLen / 6) * 5 bytes after dstOffset</param>
+        /// <param name="dstOffset">Where to start writing in dst</param>
+        public static void packSamples(byte[] src, int dataLen, byte[] dst, int dstOffset)
+        {
+            int o = dstOffset;
+
+            // Two samples per iteration, building the 40 output bits in one
+            // 64-bit word so that there is no per-byte shifting of partial samples
+            for (int i = 0; i < dataLen; i += 6)
+            {
+                ulong a = ((ulong)src[i] << 12) | ((ulong)src[i + 1] << 4) | ((ulong)src[i + 2] >> 4);
+                ulong b = ((ulong)src[i + 3] << 12) | ((ulong)src[i + 4] << 4) | ((ulong)src[i + 5] >> 4);
+                ulong pair = (a << 20) | b;
+
+                dst[o] = (byte)(pair >> 32);
+                dst[o + 1] = (byte)(pair >> 24);
+                dst[o + 2] = (byte)(pair >> 16);
+                dst[o + 3] = (byte)(pair >> 8);
+                dst[o + 4] = (byte)pair;
+
+                o += 5;
+            }
+        }
+
+        /// <summary>
+        /// Compresses 24-bit big endian samples (lower 4 bits ignored) into
+        /// one block for the amplifier's Rice decoder.  Each channel picks the
+        /// fixed predictor (order 0, 1 or 2) and Rice parameter that give the
+        /// fewest bits for this block.
+        /// </summary>
+        /// <param name="src">24-bit samples, dataLen must be a multiple of 24 (8 channels)</param>
+        /// <param name="dataLen">Number of bytes in src to compress</param>
+        /// <param name="dst">Compressed output</param>
+        /// <param name="dstOffset">Where to start writing in dst</param>
+        /// <param name="maxLen">Give up if the block would be longer than this</param>
+        /// <returns>Number of bytes written, or -1 if the block did not fit in maxLen</returns>
+        public static int compressSamples(byte[] src, int dataLen, byte[] dst, int dstOffset, int maxLen)
+        {
+            int frames = dataLen / 24;
+
+            if (maxLen < COMPRESSED_HEADER_LENGTH || frames > 0xFFFF)
+                return -1;
+
+            int[][] residuals = new int[8][];
+            int[] param = new int[8];
+
+            dst[dstOffset] = (byte)(frames >> 8);
+            dst[dstOffset + 1] = (byte)frames;
+
+            int[] samples = new int[frames];
+            int[] residual = new int[frames];
+
+            for (int ch = 0; ch < 8; ch++)
+            {
+                for (int f = 0; f < frames; f++)
+                {
+                    int i = f * 24 + ch * 3;
+                    samples[f] = (src[i] << 12) | (src[i + 1] << 4) | (src[i + 2] >> 4);
+                }
+
+                long bestBits = long.MaxValue;
+                int bestOrder = 0;
+
+                for (int order = 0; order <= 2; order++)
+                {
+                    // The first frames of a block have no history, so they
+                    // use a lower order the same way the decoder does
+                    for (int f = 0; f < frames; f++)
+                    {
+                        int n = Math.Min(order, f);
+                        int pred = 0;
+
+                        if (n == 1)
+                            pred = samples[f - 1];
+                        else if (n == 2)
+                            pred = 2 * samples[f - 1] - samples[f - 2];
+
+                        // Differences wrap around at 20 bits, then zigzag so
+                        // that small negative values are small codes too
+                        int r = ((samples[f] - pred) << 12) >> 12;
+                        residual[f] = ((r << 1) ^ (r >> 19)) & 0xFFFFF;
+                    }
+
+                    int k;
+                    long bits = chooseRiceParam(residual, frames, out k);
+
+                    if (bits < bestBits)
+                    {
+                        bestBits = bits;
+                        bestOrder = order;
+                        param[ch] = k;
+                        residuals[ch] = (int[])residual.Clone();
+                    }
+                }
+
+                dst[dstOffset + 2 + ch] = (byte)((bestOrder << 5) | param[ch]);
+            }
+
+            RiceWriter writer = new RiceWriter(dst, dstOffset + COMPRESSED_HEADER_LENGTH, maxLen - COMPRESSED_HEADER_LENGTH);
+
+            for (int f = 0; f < frames; f++)
+            {
+                for (int ch = 0; ch < 8; ch++)
+                {
+                    int u = residuals[ch][f];
+                    int k = param[ch];
+                    int q = u >> k;
+
+                    if (q < RICE_ESCAPE)
+                    {
+                        // q zeros and a one, then the low k bits
+                        writer.write(1, q + 1);
+                        writer.write(u & ((1 << k) - 1), k);
+                    }
+                    else
+                    {
+                        writer.write(0, RICE_ESCAPE);
+                        writer.write(u, 20);
+                    }
+                }
+
+                if (writer.isFull())
+                    return -1;
+            }
+
+            int len = writer.flush();
+
+            if (len < 0)
+                return -1;
+
+            return COMPRESSED_HEADER_LENGTH + len;
+        }
+
+        /// <summary>
+        /// Picks the Rice parameter with the fewest total bits for the given
+        /// zigzag residuals.  Only the parameters around the one suggested by
+        /// the mean are tried.
+        /// </summary>
+        /// <returns>Total bits for the residuals</returns>
+        private static long chooseRiceParam(int[] residual, int count, out int bestParam)
+        {
+            long sum = 0;
+
+            for (int i = 0; i < count; i++)
+                sum += residual[i];
+
+            int estimate = 0;
+            while (estimate < RICE_MAX_PARAM && ((long)count << (estimate + 1)) < sum)
+                estimate++;
+
+            long bestBits = long.MaxValue;
+            bestParam = 0;
+
+            for (int k = Math.Max(0, estimate - 1); k <= Math.Min(RICE_MAX_PARAM, estimate + 1); k++)
+            {
+                long bits = 0;
+
+                for (int i = 0; i < count; i++)
+                {
+                    int q = residual[i] >> k;
+
+                    if (q < RICE_ESCAPE)
+                        bits += q + 1 + k;
+                    else
+                        bits += RICE_ESCAPE + 20;
+                }
+
+                if (bits < bestBits)
+                {
+                    bestBits = bits;
+                    bestParam = k;
+                }
+            }
+
+            return bestBits;
+        }
+
+        /// <summary>
+        /// Writes bits MSB first into a byte array
+        /// </summary>
+        private class RiceWriter
+        {
+            private byte[] buffer;
+            private int start;
+            private int offset;
+            private int end;
+
+            private ulong bits;
+            private int bitCount;
+
+            public RiceWriter(byte[] buffer, int offset, int maxLen)
+            {
+                this.buffer = buffer;
+                this.start = offset;
+                this.offset = offset;
+                this.end = offset + maxLen;
+            }
+
+            /// <summary>
+            /// Appends the low count bits of value (count is at most 32)
+            /// </summary>
+            public void write(int value, int count)
+            {
+                bits = (bits << count) | ((ulong)(uint)value & ((1UL << count) - 1));
+                bitCount += count;
+
+                while (bitCount >= 8)
+                {
+                    bitCount -= 8;
+
+                    if (offset < end)
+                        buffer[offset] = (byte)(bits >> bitCount);
+
+                    offset++;
+                }
+            }
+
+            public bool isFull()
+            {
+                return offset > end;
+            }
+
+            /// <summary>
+            /// Pads the last byte with zeros
+            /// </summary>
+            /// <returns>Number of bytes written, or -1 if it did not fit</returns>
+            public int flush()
+            {
+                if (bitCount > 0)
+                    write(0, 8 - bitCount);
+
+                if (offset > end)
+                    return -1;
+
+                return offset - start;
+            }
+        }
+
         public void sendMuteOn()
         {
             uint bitmask = CMD_MUTE;
@@ -572,6 +979,22 @@ namespace AudioPlayer
 
             statusBitmask = BitConverter.ToUInt32(statusData, 0);
 
+            // Older devices only send the first 12 bytes
+            if (data.Length >= STATUS_V1_LENGTH)
+            {
+                statusVersion = readUInt32BigEndian(data, 12);
+                sdramFill = readUInt32BigEndian(data, 16);
+                sramEmptyCount = readUInt16BigEndian(data, 20);
+                sdramUnderrunCount = readUInt16BigEndian(data, 22);
+                discardedDatagramCount = readUInt16BigEndian(data, 24);
+                fragmentGapCount = readUInt16BigEndian(data, 26);
+                rxBufferHighWater = readUInt16BigEndian(data, 28);
+            }
+            else
+            {
+                statusVersion = 0;
+            }
+
             if (!didConnectSender)
             {
                 IPEndPoint epSend = new IPEndPoint(ampIPAddress, 9000);
@@ -635,6 +1058,17 @@ namespace AudioPlayer
 
         }
 
+        private static UInt32 readUInt32BigEndian(byte[] data, int offset)
+        {
+            return ((UInt32)data[offset] << 24) | ((UInt32)data[offset + 1] << 16) |
+                ((UInt32)data[offset + 2] << 8) | (UInt32)data[offset + 3];
+        }
+
+        private static UInt16 readUInt16BigEndian(byte[] data, int offset)
+        {
+            return (UInt16)((data[offset] << 8) | data[offset + 1]);
+        }
+
         private void onStatusTimeout(Object state)
         {
             TimeSpan elapsedTime = (DateTime.Now - lastSeenTime);
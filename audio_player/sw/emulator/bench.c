@@ -0,0 +1,682 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "emu_device.h"
+#include "sender.h"
+
+
+/*
+ * Streaming benchmark.  The sender model (sender.c) streams audio over
+ * loopback UDP to the device model (emu_device.c) under a set of network
+ * impairment profiles.  Time is simulated, so an hour of streaming takes
+ * seconds, and every run with the same seed gives the same result.
+ *
+ * One JSON object is printed per profile and sample format.  Given a
+ * previous output file with -c, runs that got worse are reported and the
+ * exit status is 2.
+ */
+
+
+#define NS_PER_SEC		1000000000ULL
+#define NS_PER_MS		1000000ULL
+
+// Buffer occupancy is sampled this often
+#define SAMPLE_NS		(100 * NS_PER_MS)
+
+// Occupancy is only counted once playback has been running this long
+#define STEADY_STATE_NS		(5 * NS_PER_SEC)
+
+// Amount of generated audio, played in a loop
+#define SOURCE_PACKETS		64
+
+#define SAMPLE_RATE		44100
+
+#define MAX_PROFILES		32
+
+
+struct profile {
+	char name[32];
+	const char *description;
+	struct emu_config cfg;
+};
+
+struct result {
+	double startup_latency_s;
+	double occupancy_mean_s;
+	double occupancy_min_s;
+	double occupancy_p5_s;
+	double retransmit_percent;
+	double wire_bytes_per_s;
+	double cpu_s_per_stream_hour;
+	struct emu_stats dev;
+	struct sender_stats snd;
+};
+
+static const char *format_names[] = { "raw", "packed", "compressed" };
+
+static struct profile profiles[MAX_PROFILES];
+static int num_profiles;
+
+static unsigned char *source;
+static unsigned char packet[EMU_MAX_DATAGRAM];
+
+
+static void usage(const char *name) {
+
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "  -d seconds   Simulated stream length for each run (default 600)\n");
+	fprintf(stderr, "  -p name      Only run this profile (default all)\n");
+	fprintf(stderr, "  -f format    Only use raw, packed or compressed samples (default all)\n");
+	fprintf(stderr, "  -x spec      Add a profile, e.g. name=wifi,loss=0.5,burst=1/20/40,jitter=10\n");
+	fprintf(stderr, "               Keys: loss, reorder, burst (enter/exit/loss), jitter (ms),\n");
+	fprintf(stderr, "               spi (bytes/sec), rxbuf (bytes), mtu\n");
+	fprintf(stderr, "  -S seed      Random seed (default 1)\n");
+	fprintf(stderr, "  -o file      Write results to this file instead of stdout\n");
+	fprintf(stderr, "  -c file      Compare against results from an earlier run\n");
+	fprintf(stderr, "  -t percent   Allowed change before a result counts as worse (default 10)\n");
+	fprintf(stderr, "  -l           List the profiles\n");
+
+}
+
+static void default_config(struct emu_config *cfg) {
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->rx_buffer_size = EMU_RX_BUFFER_SIZE;
+	cfg->spi_rate = 1500000;
+	cfg->link_rate = 100000000;
+	cfg->mtu = 1500;
+	cfg->sample_rate = SAMPLE_RATE;
+
+}
+
+static struct profile *add_profile(const char *name, const char *description) {
+
+	struct profile *p;
+
+	if (num_profiles == MAX_PROFILES) {
+		fprintf(stderr, "Too many profiles\n");
+		exit(1);
+	}
+
+	p = &profiles[num_profiles++];
+
+	snprintf(p->name, sizeof(p->name), "%s", name);
+	p->description = description;
+	default_config(&p->cfg);
+
+	return p;
+}
+
+static void builtin_profiles(void) {
+
+	struct profile *p;
+
+	add_profile("clean", "No impairments");
+
+	p = add_profile("loss-1", "1% of IP fragments dropped at random");
+	p->cfg.loss_percent = 1;
+
+	p = add_profile("loss-5", "5% of IP fragments dropped at random");
+	p->cfg.loss_percent = 5;
+
+	p = add_profile("burst", "Bursts averaging 10 fragments with half of them lost");
+	p->cfg.burst_enter_percent = 0.5;
+	p->cfg.burst_exit_percent = 10;
+	p->cfg.burst_loss_percent = 50;
+
+	p = add_profile("jitter", "Each datagram delayed by up to 30 ms");
+	p->cfg.jitter_us = 30000;
+
+	p = add_profile("reorder", "5% of IP fragments swapped with the next one");
+	p->cfg.reorder_percent = 5;
+
+	p = add_profile("slow-spi", "Receive buffer emptied at 1 MB/s");
+	p->cfg.spi_rate = 1000000;
+
+	p = add_profile("mixed", "0.5% loss, short bursts, 2% reordering and 10 ms of jitter");
+	p->cfg.loss_percent = 0.5;
+	p->cfg.burst_enter_percent = 0.2;
+	p->cfg.burst_exit_percent = 25;
+	p->cfg.burst_loss_percent = 50;
+	p->cfg.reorder_percent = 2;
+	p->cfg.jitter_us = 10000;
+
+}
+
+// Parses the -x option
+static void custom_profile(char *spec) {
+
+	struct profile *p;
+	char *item, *value;
+
+	p = add_profile("custom", "From the command line");
+
+	for (item = strtok(spec, ","); item != NULL; item = strtok(NULL, ",")) {
+
+		value = strchr(item, '=');
+		if (value == NULL) {
+			fprintf(stderr, "Expected key=value in profile: %s\n", item);
+			exit(1);
+		}
+		*value++ = '\0';
+
+		if (strcmp(item, "name") == 0) {
+			snprintf(p->name, sizeof(p->name), "%s", value);
+		} else if (strcmp(item, "loss") == 0) {
+			p->cfg.loss_percent = atof(value);
+		} else if (strcmp(item, "reorder") == 0) {
+			p->cfg.reorder_percent = atof(value);
+		} else if (strcmp(item, "burst") == 0) {
+			if (sscanf(value, "%lf/%lf/%lf", &p->cfg.burst_enter_percent,
+					&p->cfg.burst_exit_percent, &p->cfg.burst_loss_percent) != 3) {
+				fprintf(stderr, "Burst loss must be given as enter/exit/loss\n");
+				exit(1);
+			}
+		} else if (strcmp(item, "jitter") == 0) {
+			p->cfg.jitter_us = (unsigned int)(atof(value) * 1000.0);
+		} else if (strcmp(item, "spi") == 0) {
+			p->cfg.spi_rate = strtoul(value, NULL, 0);
+		} else if (strcmp(item, "rxbuf") == 0) {
+			p->cfg.rx_buffer_size = strtoul(value, NULL, 0);
+		} else if (strcmp(item, "mtu") == 0) {
+			p->cfg.mtu = strtoul(value, NULL, 0);
+		} else {
+			fprintf(stderr, "Unknown profile key: %s\n", item);
+			exit(1);
+		}
+	}
+
+	if (p->cfg.mtu < 68 || p->cfg.spi_rate == 0) {
+		fprintf(stderr, "Invalid MTU or SPI rate in profile\n");
+		exit(1);
+	}
+
+}
+
+// Something that compresses like music: a few tones per channel with a
+// slowly changing level and a little noise, 20 bits in 24-bit samples
+static void generate_source(void) {
+
+	static const double base_freq[EMU_NUM_CHANNELS] = {
+		55, 82.4, 220, 329.6, 880, 1318.5, 3520, 5274
+	};
+	unsigned int frames = SOURCE_PACKETS * SENDER_PACKET_SIZE / 24;
+	unsigned int f, ch, i;
+	uint32_t noise = 12345;
+	double t, v;
+	int32_t s;
+
+	source = malloc(SOURCE_PACKETS * SENDER_PACKET_SIZE);
+	if (source == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	for (f = 0; f < frames; f++) {
+
+		t = (double)f / SAMPLE_RATE;
+
+		for (ch = 0; ch < EMU_NUM_CHANNELS; ch++) {
+
+			v = sin(2 * M_PI * base_freq[ch] * t) * 0.5
+				+ sin(2 * M_PI * base_freq[ch] * 1.5 * t) * 0.25
+				+ sin(2 * M_PI * base_freq[ch] * 2.01 * t) * 0.125;
+
+			v *= 0.6 + 0.4 * sin(2 * M_PI * 0.3 * t + ch);
+
+			noise ^= noise << 13;
+			noise ^= noise >> 17;
+			noise ^= noise << 5;
+
+			s = (int32_t)(v * 0x30000) + (int32_t)(noise % 65) - 32;
+
+			i = f * 24 + ch * 3;
+			source[i] = (s >> 12) & 0xFF;
+			source[i + 1] = (s >> 4) & 0xFF;
+			source[i + 2] = (s << 4) & 0xF0;
+		}
+	}
+
+}
+
+static uint64_t cpu_ns(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Waits until a datagram is ready, loopback is quick but not synchronous
+static int wait_readable(int fd) {
+
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	return poll(&pfd, 1, 1000) > 0;
+}
+
+// Hands everything the sender has sent so far to the device model
+static void deliver(int sockfd, struct emu_device *dev, struct sender *snd,
+		uint64_t *delivered, uint64_t now_ns) {
+
+	int len;
+
+	while (*delivered < snd->stats.datagrams_sent) {
+
+		if (!wait_readable(sockfd)) {
+			fprintf(stderr, "Datagram lost on loopback\n");
+			exit(1);
+		}
+
+		len = recv(sockfd, packet, sizeof(packet), 0);
+		if (len < 0) {
+			fprintf(stderr, "Error receiving: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		emu_receive(dev, packet, len, now_ns);
+		(*delivered)++;
+	}
+
+}
+
+static int compare_double(const void *a, const void *b) {
+
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run(const struct profile *prof, int format, double duration_s, unsigned int seed, struct result *res) {
+
+	struct emu_config cfg = prof->cfg;
+	struct emu_device *dev;
+	struct sender snd;
+	struct sockaddr_in addr, status_addr;
+	socklen_t addr_len = sizeof(addr);
+	unsigned char status[EMU_STATUS_LENGTH];
+	uint64_t now, next, next_send, next_sample, end, first_send, delivered = 0, cpu_start, cpu_total = 0;
+	unsigned int src = 0, num_samples = 0, max_samples;
+	double *occupancy, sum = 0;
+	int sockfd;
+
+	memset(res, 0, sizeof(*res));
+
+	cfg.seed = seed;
+
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sockfd < 0) {
+		fprintf(stderr, "Error creating socket: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			getsockname(sockfd, (struct sockaddr *) &addr, &addr_len) < 0) {
+		fprintf(stderr, "Error binding socket: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	if (sender_init(&snd, format, ntohs(addr.sin_port)) < 0) {
+		fprintf(stderr, "Error creating sender socket: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	memset(&status_addr, 0, sizeof(status_addr));
+	status_addr.sin_family = AF_INET;
+	status_addr.sin_port = htons(sender_status_port(&snd));
+	status_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	dev = malloc(sizeof(struct emu_device));
+	max_samples = (unsigned int)(duration_s * NS_PER_SEC / SAMPLE_NS) + 1;
+	occupancy = malloc(max_samples * sizeof(double));
+	if (dev == NULL || occupancy == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	emu_init(dev, &cfg, 0);
+
+	end = (uint64_t)(duration_s * NS_PER_SEC);
+
+	now = 0;
+	first_send = next_send = sender_start(&snd, now);
+	deliver(sockfd, dev, &snd, &delivered, now);
+
+	next_sample = first_send;
+
+	for (;;) {
+
+		next = next_send;
+		if (dev->next_status_ns < next)
+			next = dev->next_status_ns;
+		if (next_sample < next)
+			next = next_sample;
+		if (emu_next_event(dev) != 0 && emu_next_event(dev) < next)
+			next = emu_next_event(dev);
+
+		if (next >= end)
+			break;
+
+		now = next;
+
+		emu_advance(dev, now);
+
+		if (emu_status(dev, status, now)) {
+
+			sendto(sockfd, status, sizeof(status), 0, (struct sockaddr *) &status_addr, sizeof(status_addr));
+
+			wait_readable(snd.sockfd);
+
+			cpu_start = cpu_ns();
+			sender_poll_status(&snd);
+			cpu_total += cpu_ns() - cpu_start;
+		}
+
+		if (now >= next_sample) {
+
+			if (dev->stats.first_play_ns && now >= dev->stats.first_play_ns + STEADY_STATE_NS &&
+					num_samples < max_samples) {
+				occupancy[num_samples] = (double)(dev->sdram_fill + dev->sram_level) / (EMU_NUM_CHANNELS * SAMPLE_RATE);
+				sum += occupancy[num_samples];
+				num_samples++;
+			}
+
+			next_sample += SAMPLE_NS;
+		}
+
+		if (now >= next_send) {
+
+			cpu_start = cpu_ns();
+			if (sender_step(&snd, source + src * SENDER_PACKET_SIZE, now, &next_send))
+				src = (src + 1) % SOURCE_PACKETS;
+			cpu_total += cpu_ns() - cpu_start;
+
+			deliver(sockfd, dev, &snd, &delivered, now);
+		}
+
+	}
+
+	res->dev = dev->stats;
+	res->snd = snd.stats;
+
+	res->startup_latency_s = dev->stats.first_play_ns ? (double)(dev->stats.first_play_ns - first_send) / NS_PER_SEC : -1;
+
+	if (num_samples > 0) {
+		qsort(occupancy, num_samples, sizeof(double), compare_double);
+		res->occupancy_mean_s = sum / num_samples;
+		res->occupancy_min_s = occupancy[0];
+		res->occupancy_p5_s = occupancy[num_samples / 20];
+	}
+
+	if (snd.stats.bytes_sent)
+		res->retransmit_percent = 100.0 * snd.stats.retransmitted_bytes / snd.stats.bytes_sent;
+
+	res->wire_bytes_per_s = snd.stats.bytes_sent / duration_s;
+	res->cpu_s_per_stream_hour = (double)cpu_total / NS_PER_SEC * 3600.0 / duration_s;
+
+	free(occupancy);
+	emu_free(dev);
+	free(dev);
+	sender_free(&snd);
+	close(sockfd);
+
+}
+
+static void print_result(FILE *out, const struct profile *prof, int format, double duration_s,
+		unsigned int seed, const struct result *res) {
+
+	fprintf(out, "{\"profile\":\"%s\",\"format\":\"%s\",\"seed\":%u,\"duration_s\":%.0f,",
+		prof->name, format_names[format], seed, duration_s);
+
+	if (res->startup_latency_s >= 0)
+		fprintf(out, "\"startup_latency_s\":%.3f,", res->startup_latency_s);
+	else
+		fprintf(out, "\"startup_latency_s\":null,");
+
+	fprintf(out, "\"occupancy_mean_s\":%.3f,\"occupancy_min_s\":%.3f,\"occupancy_p5_s\":%.3f,",
+		res->occupancy_mean_s, res->occupancy_min_s, res->occupancy_p5_s);
+
+	fprintf(out, "\"sdram_underruns\":%llu,\"sram_empty\":%llu,",
+		(unsigned long long)res->dev.sdram_underrun_count,
+		(unsigned long long)res->dev.sram_empty_count);
+
+	fprintf(out, "\"datagrams_sent\":%llu,\"bytes_sent\":%llu,\"retransmitted_bytes\":%llu,\"retransmit_percent\":%.2f,",
+		(unsigned long long)res->snd.datagrams_sent,
+		(unsigned long long)res->snd.bytes_sent,
+		(unsigned long long)res->snd.retransmitted_bytes,
+		res->retransmit_percent);
+
+	fprintf(out, "\"send_errors\":%llu,\"compressed_blocks\":%llu,\"wire_bytes_per_s\":%.0f,",
+		(unsigned long long)res->snd.send_errors,
+		(unsigned long long)res->snd.compressed_blocks,
+		res->wire_bytes_per_s);
+
+	fprintf(out, "\"fragments_lost\":%llu,\"discarded_datagrams\":%llu,\"fragment_gaps\":%llu,\"enc_overflows\":%llu,",
+		(unsigned long long)res->dev.fragments_lost,
+		(unsigned long long)res->dev.discarded_datagrams,
+		(unsigned long long)res->dev.fragment_gaps,
+		(unsigned long long)res->dev.enc_overflows);
+
+	fprintf(out, "\"cpu_s_per_stream_hour\":%.3f}\n", res->cpu_s_per_stream_hour);
+
+	fflush(out);
+
+}
+
+
+/*
+ * Comparing with an earlier run.  Only reads the output format above, so
+ * this is not a general JSON parser.
+ */
+
+static int json_number(const char *line, const char *key, double *value) {
+
+	char pattern[64];
+	const char *p;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+
+	p = strstr(line, pattern);
+	if (p == NULL)
+		return 0;
+
+	p += strlen(pattern);
+
+	if (strncmp(p, "null", 4) == 0)
+		*value = -1;
+	else
+		*value = strtod(p, NULL);
+
+	return 1;
+}
+
+static int find_baseline(FILE *base, const char *profile, const char *format, char *line, int size) {
+
+	char key[96];
+
+	snprintf(key, sizeof(key), "\"profile\":\"%s\",\"format\":\"%s\",", profile, format);
+
+	rewind(base);
+
+	while (fgets(line, size, base) != NULL) {
+		if (strstr(line, key) != NULL)
+			return 1;
+	}
+
+	return 0;
+}
+
+// Returns the number of measurements that got worse
+static int compare_result(FILE *base, const struct profile *prof, int format,
+		const struct result *res, double tolerance) {
+
+	char line[2048];
+	double old;
+	int worse = 0;
+
+	if (!find_baseline(base, prof->name, format_names[format], line, sizeof(line)))
+		return 0;
+
+	// Counts that should not go up at all
+	if (json_number(line, "sdram_underruns", &old) && res->dev.sdram_underrun_count > old) {
+		fprintf(stderr, "%s/%s: SDRAM underruns %.0f -> %llu\n", prof->name, format_names[format],
+			old, (unsigned long long)res->dev.sdram_underrun_count);
+		worse++;
+	}
+
+	if (json_number(line, "sram_empty", &old) && res->dev.sram_empty_count > old) {
+		fprintf(stderr, "%s/%s: SRAM empty %.0f -> %llu\n", prof->name, format_names[format],
+			old, (unsigned long long)res->dev.sram_empty_count);
+		worse++;
+	}
+
+	if (json_number(line, "send_errors", &old) && res->snd.send_errors > old) {
+		fprintf(stderr, "%s/%s: send errors %.0f -> %llu\n", prof->name, format_names[format],
+			old, (unsigned long long)res->snd.send_errors);
+		worse++;
+	}
+
+	// Measurements that are allowed to move a little
+	if (json_number(line, "startup_latency_s", &old) && old >= 0 &&
+			(res->startup_latency_s < 0 || res->startup_latency_s > old * (1 + tolerance) + 0.05)) {
+		fprintf(stderr, "%s/%s: start-up latency %.3f -> %.3f s\n", prof->name, format_names[format],
+			old, res->startup_latency_s);
+		worse++;
+	}
+
+	if (json_number(line, "occupancy_p5_s", &old) && res->occupancy_p5_s < old * (1 - tolerance) - 0.05) {
+		fprintf(stderr, "%s/%s: 5th percentile buffer %.3f -> %.3f s\n", prof->name, format_names[format],
+			old, res->occupancy_p5_s);
+		worse++;
+	}
+
+	if (json_number(line, "retransmitted_bytes", &old) &&
+			res->snd.retransmitted_bytes > old * (1 + tolerance) + 2 * (SENDER_PACKET_SIZE + 8)) {
+		fprintf(stderr, "%s/%s: retransmitted bytes %.0f -> %llu\n", prof->name, format_names[format],
+			old, (unsigned long long)res->snd.retransmitted_bytes);
+		worse++;
+	}
+
+	return worse;
+}
+
+int main(int argc, char ** argv){
+
+	struct result res;
+	FILE *out = stdout, *base = NULL;
+	const char *only_profile = NULL;
+	double duration_s = 600, tolerance = 0.10;
+	unsigned int seed = 1;
+	int opt, i, format, only_format = -1, list = 0, runs = 0, worse = 0;
+
+	builtin_profiles();
+
+	while ((opt = getopt(argc, argv, "d:p:f:x:S:o:c:t:lh")) != -1) {
+		switch (opt) {
+		case 'd': duration_s = atof(optarg); break;
+		case 'p': only_profile = optarg; break;
+		case 'f':
+			for (only_format = 0; only_format < 3; only_format++) {
+				if (strcmp(optarg, format_names[only_format]) == 0)
+					break;
+			}
+			if (only_format == 3) {
+				fprintf(stderr, "Unknown format %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'x': custom_profile(optarg); break;
+		case 'S': seed = strtoul(optarg, NULL, 0); break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (out == NULL) {
+				fprintf(stderr, "Error opening %s: %s\n", optarg, strerror(errno));
+				exit(1);
+			}
+			break;
+		case 'c':
+			base = fopen(optarg, "r");
+			if (base == NULL) {
+				fprintf(stderr, "Error opening %s: %s\n", optarg, strerror(errno));
+				exit(1);
+			}
+			break;
+		case 't': tolerance = atof(optarg) / 100.0; break;
+		case 'l': list = 1; break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (list) {
+		for (i = 0; i < num_profiles; i++)
+			printf("%-12s %s\n", profiles[i].name, profiles[i].description);
+		return 0;
+	}
+
+	if (duration_s < 10) {
+		fprintf(stderr, "Duration must be at least 10 seconds\n");
+		exit(1);
+	}
+
+	generate_source();
+
+	for (i = 0; i < num_profiles; i++) {
+
+		if (only_profile && strcmp(only_profile, profiles[i].name) != 0)
+			continue;
+
+		for (format = 0; format < 3; format++) {
+
+			if (only_format >= 0 && format != only_format)
+				continue;
+
+			run(&profiles[i], format, duration_s, seed, &res);
+			print_result(out, &profiles[i], format, duration_s, seed, &res);
+			runs++;
+
+			if (base)
+				worse += compare_result(base, &profiles[i], format, &res, tolerance);
+		}
+	}
+
+	if (runs == 0) {
+		fprintf(stderr, "No profile called %s\n", only_profile);
+		exit(1);
+	}
+
+	if (out != stdout)
+		fclose(out);
+
+	if (base) {
+		fclose(base);
+
+		if (worse) {
+			fprintf(stderr, "%d measurement(s) worse than the baseline\n", worse);
+			return 2;
+		}
+	}
+
+	free(source);
+
+	return 0;
+}
@@ -0,0 +1,790 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emu_device.h"
+
+
+#define CMD_MUTE		0x00000001
+#define CMD_SET_SEQUENCE	0x00000002
+#define CMD_PAUSE		0x00000004
+#define CMD_PACKED		0x00000008
+#define CMD_COMPRESSED		0x00000010
+#define CMD_RESET_DAC		0x00000100
+#define CMD_USER_SIG_OFF	0x00010000
+#define CMD_USER_SIG_ON		0x00020000
+#define CMD_VOLUME		0x40000000
+#define CMD_NO_AUDIO		0x80000000
+
+#define UDP_PORT_AUDIO		9000
+
+#define IP_HEADER_LEN		20
+#define UDP_HEADER_LEN		8
+
+// Next packet pointer + receive status vector + ethernet header + FCS
+#define ENC_FRAME_OVERHEAD	(2 + 6 + 14 + 4)
+
+// Rice codes (see networking.md)
+#define RICE_ESCAPE		31
+#define RICE_MAX_PARAM		19
+
+#define NS_PER_SEC		1000000000ULL
+
+#define STATUS_FAST_NS		(NS_PER_SEC / 10)
+#define STATUS_SLOW_NS		NS_PER_SEC
+
+
+struct emu_fragment {
+
+	struct emu_fragment *next;
+
+	uint64_t arrive_ns;
+	uint64_t done_ns;
+
+	uint16_t ident;
+	uint16_t offset;	// In 8 byte units, like the IP header
+	int more_fragments;
+
+	// Size in the ENC424J600 buffer
+	unsigned int enc_size;
+
+	// IP payload (UDP header + data for the first fragment)
+	unsigned int len;
+	unsigned char data[];
+
+};
+
+
+static uint32_t emu_rand(struct emu_device *dev) {
+
+	// xorshift32, good enough for dropping packets
+	uint32_t x = dev->rand_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	dev->rand_state = x;
+
+	return x;
+}
+
+static int emu_chance(struct emu_device *dev, double percent) {
+
+	if (percent <= 0)
+		return 0;
+
+	return (emu_rand(dev) % 1000000) < (uint32_t)(percent * 10000.0);
+}
+
+// Random loss plus the two state burst loss model
+static int emu_lose(struct emu_device *dev) {
+
+	if (dev->burst_state) {
+		if (emu_chance(dev, dev->cfg.burst_exit_percent))
+			dev->burst_state = 0;
+	} else {
+		if (emu_chance(dev, dev->cfg.burst_enter_percent))
+			dev->burst_state = 1;
+	}
+
+	if (dev->burst_state && emu_chance(dev, dev->cfg.burst_loss_percent))
+		return 1;
+
+	return emu_chance(dev, dev->cfg.loss_percent);
+}
+
+static uint32_t read_be32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void write_be32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void write_be16(unsigned char *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+
+void emu_init(struct emu_device *dev, const struct emu_config *cfg, uint64_t now_ns) {
+
+	memset(dev, 0, sizeof(*dev));
+
+	dev->cfg = *cfg;
+
+	dev->rand_state = cfg->seed ? cfg->seed : 1;
+
+	dev->wire_free_ns = now_ns;
+	dev->dac_time_ns = now_ns;
+	dev->next_status_ns = now_ns;
+
+	dev->user_sig = 1;
+
+	// PAUSE | MUTE until the first command
+	dev->audio_cmd = CMD_PAUSE | CMD_MUTE;
+
+}
+
+static void free_list(struct emu_fragment *frag) {
+
+	struct emu_fragment *next;
+
+	while (frag) {
+		next = frag->next;
+		free(frag);
+		frag = next;
+	}
+
+}
+
+void emu_free(struct emu_device *dev) {
+
+	free_list(dev->wire_head);
+	free_list(dev->enc_head);
+
+	dev->wire_head = dev->wire_tail = NULL;
+	dev->enc_head = dev->enc_tail = NULL;
+
+}
+
+
+/*
+ * DAC controller
+ */
+
+static unsigned int sdram_free(struct emu_device *dev) {
+	// The ring always keeps one word unused, see sdram_size_avail
+	return EMU_SDRAM_BUFFER_SIZE - 1 - dev->sdram_fill;
+}
+
+static void dac_reset(struct emu_device *dev) {
+
+	dev->sdram_fill = 0;
+	dev->dac_playing = 0;
+	dev->dac_starved = 0;
+	dev->sram_level = 0;
+	dev->sram_since_half = 0;
+	dev->sram_pending = 0;
+
+}
+
+// Move words from SDRAM into SRAM for halves that the DAC has finished with
+static void dac_refill(struct emu_device *dev) {
+
+	unsigned int n;
+
+	if (dev->sram_pending == 0)
+		return;
+
+	if (dev->sdram_fill == 0) {
+		// Need more but SDRAM is empty, only count this once
+		if (!dev->dac_starved) {
+			dev->stats.sdram_underrun_count++;
+			dev->dac_starved = 1;
+		}
+		return;
+	}
+
+	n = dev->sram_pending;
+	if (n > dev->sdram_fill)
+		n = dev->sdram_fill;
+
+	dev->sdram_fill -= n;
+	dev->sram_level += n;
+	dev->sram_pending -= n;
+	dev->dac_starved = 0;
+
+}
+
+// Start playing once the buffer is full enough, like INIT in dac_controller
+static void dac_check_start(struct emu_device *dev, uint64_t now_ns) {
+
+	unsigned int n;
+
+	if (dev->dac_playing || sdram_free(dev) > EMU_DAC_START_AVAIL)
+		return;
+
+	// Fill the whole SRAM (less the 2 words the hardware leaves)
+	n = EMU_SRAM_SIZE - 2;
+	if (n > dev->sdram_fill)
+		n = dev->sdram_fill;
+
+	dev->sdram_fill -= n;
+	dev->sram_level = n;
+	dev->sram_since_half = 0;
+	dev->sram_pending = 0;
+	dev->dac_playing = 1;
+	dev->dac_starved = 0;
+
+	if (dev->stats.first_play_ns == 0)
+		dev->stats.first_play_ns = now_ns;
+
+}
+
+static void dac_advance(struct emu_device *dev, uint64_t now_ns) {
+
+	uint64_t words;
+	unsigned int n;
+
+	if (now_ns <= dev->dac_time_ns)
+		return;
+
+	// Exact sample clock, carrying the remainder so that there is no drift
+	dev->dac_frac += (now_ns - dev->dac_time_ns) * (uint64_t)dev->cfg.sample_rate * EMU_NUM_CHANNELS;
+	words = dev->dac_frac / NS_PER_SEC;
+	dev->dac_frac %= NS_PER_SEC;
+
+	dev->dac_time_ns = now_ns;
+
+	dac_check_start(dev, now_ns);
+
+	// Paused means the DAC stops reading, and nothing is read before it starts
+	if (!dev->dac_playing || (dev->audio_cmd & CMD_PAUSE))
+		return;
+
+	while (words > 0 && dev->dac_playing) {
+
+		// Stop at the next half boundary or when SRAM runs out
+		n = EMU_SRAM_HALF - dev->sram_since_half;
+		if (n > dev->sram_level)
+			n = dev->sram_level;
+		if (n > words)
+			n = words;
+
+		dev->sram_level -= n;
+		dev->sram_since_half += n;
+		dev->stats.samples_played += n;
+		words -= n;
+
+		if (dev->sram_since_half == EMU_SRAM_HALF) {
+			dev->sram_since_half = 0;
+			dev->sram_pending += EMU_SRAM_HALF;
+		}
+
+		dac_refill(dev);
+
+		if (dev->sram_level == 0 && words > 0) {
+			// SRAM ran dry, reload everything once the buffer is full again
+			dev->stats.sram_empty_count++;
+			dev->dac_playing = 0;
+			dac_check_start(dev, now_ns);
+		}
+
+	}
+
+}
+
+
+/*
+ * Compressed blocks
+ */
+
+struct bit_reader {
+	const unsigned char *data;
+	unsigned int len;
+	unsigned int pos;
+};
+
+static int read_bits(struct bit_reader *br, int count, uint32_t *value) {
+
+	uint32_t v = 0;
+
+	while (count-- > 0) {
+
+		if (br->pos >= br->len * 8)
+			return -1;
+
+		v = (v << 1) | ((br->data[br->pos >> 3] >> (7 - (br->pos & 7))) & 1);
+		br->pos++;
+	}
+
+	*value = v;
+
+	return 0;
+}
+
+int emu_decode_block(const unsigned char *data, unsigned int len, int32_t *samples, unsigned int max_samples) {
+
+	struct bit_reader br;
+	unsigned int order[EMU_NUM_CHANNELS], param[EMU_NUM_CHANNELS];
+	uint32_t prev1[EMU_NUM_CHANNELS], prev2[EMU_NUM_CHANNELS];
+	uint32_t frames, hdr, bit, q, u, r, pred, s;
+	unsigned int f, ch, n, warmup;
+
+	br.data = data;
+	br.len = len;
+	br.pos = 0;
+
+	if (read_bits(&br, 16, &frames) < 0)
+		return -1;
+
+	if (frames * EMU_NUM_CHANNELS > max_samples)
+		return -1;
+
+	for (ch = 0; ch < EMU_NUM_CHANNELS; ch++) {
+
+		if (read_bits(&br, 8, &hdr) < 0)
+			return -1;
+
+		order[ch] = hdr >> 5;
+		param[ch] = hdr & 0x1F;
+
+		if (order[ch] > 2 || param[ch] > RICE_MAX_PARAM)
+			return -1;
+
+		prev1[ch] = 0;
+		prev2[ch] = 0;
+	}
+
+	n = 0;
+	warmup = 0;
+
+	for (f = 0; f < frames; f++) {
+
+		for (ch = 0; ch < EMU_NUM_CHANNELS; ch++) {
+
+			// Unary part
+			q = 0;
+			for (;;) {
+				if (read_bits(&br, 1, &bit) < 0)
+					return -1;
+				if (bit || q == RICE_ESCAPE - 1)
+					break;
+				q++;
+			}
+
+			if (bit) {
+				if (read_bits(&br, param[ch], &u) < 0)
+					return -1;
+				u |= q << param[ch];
+			} else {
+				// 31 zeros, raw value follows
+				if (read_bits(&br, 20, &u) < 0)
+					return -1;
+			}
+
+			u &= 0xFFFFF;
+			r = ((u >> 1) ^ (0 - (u & 1))) & 0xFFFFF;
+
+			if (warmup == 0 || order[ch] == 0)
+				pred = 0;
+			else if (warmup == 1 || order[ch] == 1)
+				pred = prev1[ch];
+			else
+				pred = (2 * prev1[ch] - prev2[ch]) & 0xFFFFF;
+
+			s = (pred + r) & 0xFFFFF;
+
+			prev2[ch] = prev1[ch];
+			prev1[ch] = s;
+
+			// Sign extend for the caller
+			samples[n++] = (int32_t)(s << 12) >> 12;
+		}
+
+		if (warmup < 2)
+			warmup++;
+	}
+
+	return n;
+}
+
+
+/*
+ * Ethernet state machine
+ */
+
+// The last fragment of an accepted datagram has arrived
+static void finish_datagram(struct emu_device *dev) {
+
+	static int32_t decoded[EMU_MAX_DATAGRAM];
+	unsigned int len = dev->datagram_len;
+	unsigned int samples, wire_bytes;
+	int n;
+
+	dev->in_progress = 0;
+
+	if (dev->datagram_cmd & CMD_COMPRESSED) {
+
+		n = emu_decode_block(dev->datagram, len, decoded, EMU_MAX_DATAGRAM);
+		if (n < 0) {
+			dev->stats.decode_errors++;
+			return;
+		}
+
+		samples = n;
+		wire_bytes = len;
+
+	} else if (dev->datagram_cmd & CMD_PACKED) {
+
+		// 5 bytes per pair, a trailing 3 bytes is still one sample
+		samples = (len / 5) * 2 + ((len % 5) >= 3 ? 1 : 0);
+		wire_bytes = (len / 5) * 5 + ((len % 5) >= 3 ? 3 : 0);
+
+	} else {
+
+		samples = len / 3;
+		wire_bytes = samples * 3;
+
+	}
+
+	if (samples > sdram_free(dev)) {
+		// The hardware does not check this and overwrites unplayed audio
+		dev->stats.sdram_overruns++;
+		samples = sdram_free(dev);
+	}
+
+	dev->sdram_fill += samples;
+	dev->next_sequence = dev->tmp_sequence + wire_bytes;
+
+	dev->stats.datagrams_committed++;
+	dev->stats.audio_bytes_committed += wire_bytes;
+	dev->stats.samples_committed += samples;
+
+}
+
+static void append_audio(struct emu_device *dev, const unsigned char *data, unsigned int len) {
+
+	if (dev->datagram_len + len > EMU_MAX_DATAGRAM)
+		len = EMU_MAX_DATAGRAM - dev->datagram_len;
+
+	memcpy(dev->datagram + dev->datagram_len, data, len);
+	dev->datagram_len += len;
+
+}
+
+// Same decisions as the RX_* states in ethernet.vhd
+static void process_fragment(struct emu_device *dev, struct emu_fragment *frag) {
+
+	const unsigned char *p = frag->data;
+	uint32_t cmd, seq;
+	unsigned int i;
+
+	if (frag->offset == 0) {
+
+		// A new datagram always backs up to the last complete one
+		dev->in_progress = 0;
+		dev->tmp_sequence = dev->next_sequence;
+		dev->last_ident = frag->ident;
+		dev->next_frag_offset = frag->len / 8;
+
+		if (frag->len < UDP_HEADER_LEN + 8 || ((p[2] << 8) | p[3]) != UDP_PORT_AUDIO) {
+			dev->next_frag_offset = 0;
+			return;
+		}
+
+		p += UDP_HEADER_LEN;
+
+		cmd = read_be32(p);
+		seq = read_be32(p + 4);
+		p += 8;
+
+		dev->audio_cmd = cmd;
+
+		if (cmd & CMD_SET_SEQUENCE) {
+			dev->next_sequence = seq;
+			dev->tmp_sequence = seq;
+		}
+
+		if (cmd & CMD_USER_SIG_OFF)
+			dev->user_sig = 0;
+		else if (cmd & CMD_USER_SIG_ON)
+			dev->user_sig = 1;
+
+		if (cmd & CMD_VOLUME) {
+
+			for (i = 0; i < EMU_NUM_CHANNELS && p + 2 <= frag->data + frag->len; i++, p += 2)
+				dev->volume[i] = (p[0] << 8) | p[1];
+
+		} else if (!(cmd & CMD_NO_AUDIO) && ((cmd & CMD_SET_SEQUENCE) || seq == dev->next_sequence)) {
+
+			dev->in_progress = 1;
+			dev->datagram_cmd = cmd;
+			dev->datagram_len = 0;
+
+			append_audio(dev, p, frag->len - UDP_HEADER_LEN - 8);
+
+			if (!frag->more_fragments)
+				finish_datagram(dev);
+
+		} else if (cmd & CMD_RESET_DAC) {
+
+			dev->next_frag_offset = 0;
+			dac_reset(dev);
+
+		} else {
+
+			// Audio data with the wrong sequence number
+			if (!(cmd & CMD_NO_AUDIO))
+				dev->stats.discarded_datagrams++;
+
+			dev->next_frag_offset = 0;
+
+		}
+
+	} else if (frag->offset == dev->next_frag_offset && frag->ident == dev->last_ident) {
+
+		dev->next_frag_offset = frag->offset + frag->len / 8;
+
+		if (dev->in_progress) {
+
+			append_audio(dev, frag->data, frag->len);
+
+			if (!frag->more_fragments)
+				finish_datagram(dev);
+		}
+
+	} else {
+
+		// A fragment is missing or out of order
+		dev->stats.fragment_gaps++;
+
+	}
+
+}
+
+
+/*
+ * ENC424J600 receive buffer
+ */
+
+static void enc_arrive(struct emu_device *dev, struct emu_fragment *frag) {
+
+	uint64_t start;
+
+	frag->next = NULL;
+
+	if (dev->enc_used + frag->enc_size > dev->cfg.rx_buffer_size) {
+		dev->stats.enc_overflows++;
+		free(frag);
+		return;
+	}
+
+	// Processed in order, each one takes as long as reading it over SPI
+	start = frag->arrive_ns;
+	if (dev->enc_tail && dev->enc_tail->done_ns > start)
+		start = dev->enc_tail->done_ns;
+
+	frag->done_ns = start + (uint64_t)frag->enc_size * NS_PER_SEC / dev->cfg.spi_rate;
+
+	if (dev->enc_tail)
+		dev->enc_tail->next = frag;
+	else
+		dev->enc_head = frag;
+	dev->enc_tail = frag;
+
+	dev->enc_used += frag->enc_size;
+
+	if (dev->enc_used > dev->enc_high_water)
+		dev->enc_high_water = dev->enc_used;
+
+}
+
+static void enc_done(struct emu_device *dev) {
+
+	struct emu_fragment *frag = dev->enc_head;
+
+	dev->enc_head = frag->next;
+	if (dev->enc_head == NULL)
+		dev->enc_tail = NULL;
+
+	dev->enc_used -= frag->enc_size;
+
+	process_fragment(dev, frag);
+
+	free(frag);
+
+}
+
+
+// Keep the wire queue in arrival order, jitter can put a fragment ahead of others
+static void wire_insert(struct emu_device *dev, struct emu_fragment *frag) {
+
+	struct emu_fragment **pp = &dev->wire_head;
+
+	while (*pp && (*pp)->arrive_ns <= frag->arrive_ns)
+		pp = &(*pp)->next;
+
+	frag->next = *pp;
+	*pp = frag;
+
+	if (frag->next == NULL)
+		dev->wire_tail = frag;
+
+}
+
+void emu_receive(struct emu_device *dev, const unsigned char *data, unsigned int len, uint64_t now_ns) {
+
+	struct emu_fragment **frags;
+	struct emu_fragment *tmp;
+	unsigned int ip_len = len + UDP_HEADER_LEN;
+	unsigned int max_data = (dev->cfg.mtu - IP_HEADER_LEN) & ~7u;
+	unsigned int count = 0, pos = 0, n, i, src;
+	unsigned char udp_hdr[UDP_HEADER_LEN];
+	uint64_t t, delay;
+
+	if (ip_len > EMU_MAX_DATAGRAM)
+		return;
+
+	dev->stats.datagrams_received++;
+
+	write_be16(udp_hdr, 0);
+	write_be16(udp_hdr + 2, UDP_PORT_AUDIO);
+	write_be16(udp_hdr + 4, ip_len);
+	write_be16(udp_hdr + 6, 0);
+
+	// As many as the MTU needs, a small MTU can mean hundreds
+	frags = malloc(((ip_len + max_data - 1) / max_data) * sizeof(*frags));
+	if (frags == NULL)
+		return;
+
+	// Split the UDP datagram into IP fragments the way the host's stack would
+	while (pos < ip_len) {
+
+		n = ip_len - pos;
+		if (n > max_data)
+			n = max_data;
+
+		tmp = malloc(sizeof(struct emu_fragment) + n);
+		if (tmp == NULL) {
+			while (count > 0)
+				free(frags[--count]);
+			free(frags);
+			return;
+		}
+
+		tmp->ident = dev->next_ident;
+		tmp->offset = pos / 8;
+		tmp->more_fragments = (pos + n) < ip_len;
+		tmp->len = n;
+		tmp->enc_size = (ENC_FRAME_OVERHEAD + IP_HEADER_LEN + n + 1) & ~1u;
+
+		for (i = 0; i < n; i++) {
+			src = pos + i;
+			tmp->data[i] = src < UDP_HEADER_LEN ? udp_hdr[src] : data[src - UDP_HEADER_LEN];
+		}
+
+		frags[count++] = tmp;
+		pos += n;
+	}
+
+	dev->next_ident++;
+
+	for (i = 0; i + 1 < count; i++) {
+		if (emu_chance(dev, dev->cfg.reorder_percent)) {
+			tmp = frags[i];
+			frags[i] = frags[i + 1];
+			frags[i + 1] = tmp;
+			dev->stats.fragments_reordered++;
+			i++;
+		}
+	}
+
+	// Fragments go out back to back at the link rate
+	t = now_ns > dev->wire_free_ns ? now_ns : dev->wire_free_ns;
+
+	if (dev->cfg.jitter_us)
+		delay = (uint64_t)(emu_rand(dev) % (dev->cfg.jitter_us + 1)) * 1000;
+	else
+		delay = 0;
+
+	for (i = 0; i < count; i++) {
+
+		t += (uint64_t)(frags[i]->enc_size + 12 + 8) * 8 * NS_PER_SEC / dev->cfg.link_rate;
+
+		dev->stats.fragments_received++;
+
+		if (emu_lose(dev)) {
+			dev->stats.fragments_lost++;
+			free(frags[i]);
+			continue;
+		}
+
+		frags[i]->arrive_ns = t + delay;
+
+		wire_insert(dev, frags[i]);
+	}
+
+	free(frags);
+
+	dev->wire_free_ns = t;
+
+}
+
+uint64_t emu_next_event(struct emu_device *dev) {
+
+	uint64_t t = 0;
+
+	if (dev->wire_head)
+		t = dev->wire_head->arrive_ns;
+
+	if (dev->enc_head && (t == 0 || dev->enc_head->done_ns < t))
+		t = dev->enc_head->done_ns;
+
+	return t;
+}
+
+void emu_advance(struct emu_device *dev, uint64_t now_ns) {
+
+	struct emu_fragment *frag;
+	uint64_t t;
+
+	// Handle arrivals and completions in time order so that the DAC,
+	// the receive buffer and the sequence numbers all line up
+	while ((t = emu_next_event(dev)) != 0 && t <= now_ns) {
+
+		dac_advance(dev, t);
+
+		if (dev->wire_head && dev->wire_head->arrive_ns == t) {
+
+			frag = dev->wire_head;
+			dev->wire_head = frag->next;
+			if (dev->wire_head == NULL)
+				dev->wire_tail = NULL;
+
+			enc_arrive(dev, frag);
+
+		} else {
+
+			enc_done(dev);
+
+		}
+	}
+
+	dac_advance(dev, now_ns);
+
+}
+
+int emu_status(struct emu_device *dev, unsigned char *buf, uint64_t now_ns) {
+
+	unsigned int avail;
+
+	if (now_ns < dev->next_status_ns)
+		return 0;
+
+	// 10Hz while there is audio in the buffer, otherwise 1Hz
+	dev->next_status_ns = now_ns + (dev->sdram_fill > 0 ? STATUS_FAST_NS : STATUS_SLOW_NS);
+
+	avail = sdram_free(dev);
+
+	write_be32(buf, dev->next_sequence);
+	write_be32(buf + 4, avail * 4);
+	write_be32(buf + 8, 0);
+	write_be32(buf + 12, EMU_STATUS_VERSION);
+	write_be32(buf + 16, (EMU_SDRAM_BUFFER_SIZE - avail) * 4);
+	write_be16(buf + 20, dev->stats.sram_empty_count);
+	write_be16(buf + 22, dev->stats.sdram_underrun_count);
+	write_be16(buf + 24, dev->stats.discarded_datagrams);
+	write_be16(buf + 26, dev->stats.fragment_gaps);
+	write_be16(buf + 28, dev->enc_high_water);
+	write_be16(buf + 30, 0);
+
+	// Like the hardware, the high-water mark starts again from what is there now
+	dev->enc_high_water = dev->enc_used;
+
+	return 1;
+}
@@ -0,0 +1,167 @@
+#ifndef EMU_DEVICE_H
+#define EMU_DEVICE_H
+
+#include <stdint.h>
+
+/*
+ * Model of the network side of the amplifier: the ENC424J600 receive
+ * buffer, the ethernet state machine's fragment and sequence rules, the
+ * SDRAM ring and the DAC controller draining it.
+ *
+ * Nothing here touches sockets or clocks.  Times are nanoseconds on any
+ * monotonic clock chosen by the caller, so the same model can run in
+ * real time (emulator.c) or faster than real time.
+ */
+
+// From audio_player.vhd
+#define EMU_SDRAM_BUFFER_SIZE	0x100000
+// dac_controller waits until no more than this much of the ring is free
+#define EMU_DAC_START_AVAIL	0x30000
+// SRAM between SDRAM and the DAC (SRAM_ADDR_SIZE = 13), refilled by halves
+#define EMU_SRAM_SIZE		8192
+#define EMU_SRAM_HALF		4096
+#define EMU_NUM_CHANNELS	8
+
+// From ethernet.vhd
+#define EMU_RX_BUFFER_SIZE	0x5800
+#define EMU_STATUS_LENGTH	32
+#define EMU_STATUS_VERSION	1
+
+#define EMU_MAX_DATAGRAM	65536
+
+struct emu_config {
+
+	// Percent chance of dropping each IP fragment
+	double loss_percent;
+
+	// Percent chance of swapping an IP fragment with the one after it
+	double reorder_percent;
+
+	// Burst loss (Gilbert-Elliott): chance per fragment of entering and
+	// leaving the bad state, and the loss percent while in it
+	double burst_enter_percent;
+	double burst_exit_percent;
+	double burst_loss_percent;
+
+	// Each datagram is delayed by a random amount up to this, so later
+	// datagrams can overtake earlier ones
+	unsigned int jitter_us;
+
+	// Size of the ENC424J600 receive buffer in bytes
+	unsigned int rx_buffer_size;
+
+	// How fast the FPGA empties the receive buffer over SPI, bytes/sec
+	unsigned int spi_rate;
+
+	// Ethernet speed, bits/sec
+	unsigned int link_rate;
+
+	// Largest IP packet (fragments are sized from this)
+	unsigned int mtu;
+
+	// DAC sample rate, each sample uses one SDRAM word per channel
+	unsigned int sample_rate;
+
+	unsigned int seed;
+
+};
+
+struct emu_fragment;
+
+struct emu_stats {
+
+	// Same counters as the status packet, but not wrapped at 16 bits
+	uint64_t sram_empty_count;
+	uint64_t sdram_underrun_count;
+	uint64_t discarded_datagrams;
+	uint64_t fragment_gaps;
+
+	// Only known to the emulator
+	uint64_t datagrams_received;
+	uint64_t datagrams_committed;
+	uint64_t fragments_received;
+	uint64_t fragments_lost;
+	uint64_t fragments_reordered;
+	uint64_t enc_overflows;
+	uint64_t decode_errors;
+	uint64_t sdram_overruns;
+	uint64_t audio_bytes_committed;
+	uint64_t samples_committed;
+	uint64_t samples_played;
+
+	// Time the DAC first started playing, 0 if it has not
+	uint64_t first_play_ns;
+
+};
+
+struct emu_device {
+
+	struct emu_config cfg;
+
+	uint32_t rand_state;
+	int burst_state;
+
+	// Fragments still travelling on the wire, in arrival order
+	struct emu_fragment *wire_head;
+	struct emu_fragment *wire_tail;
+
+	// Fragments sitting in the ENC424J600 buffer, in processing order
+	struct emu_fragment *enc_head;
+	struct emu_fragment *enc_tail;
+	unsigned int enc_used;
+	unsigned int enc_high_water;
+	uint64_t wire_free_ns;
+
+	uint16_t next_ident;
+
+	// Ethernet state machine
+	uint32_t audio_cmd;
+	uint32_t next_sequence;
+	uint32_t tmp_sequence;
+	uint16_t next_frag_offset;
+	uint16_t last_ident;
+	int in_progress;
+	uint32_t datagram_cmd;
+	unsigned char datagram[EMU_MAX_DATAGRAM];
+	unsigned int datagram_len;
+	int user_sig;
+	uint16_t volume[EMU_NUM_CHANNELS];
+
+	// SDRAM words written but not yet read by the DAC
+	unsigned int sdram_fill;
+
+	// DAC controller
+	int dac_playing;
+	int dac_starved;
+	unsigned int sram_level;
+	unsigned int sram_since_half;
+	unsigned int sram_pending;
+	uint64_t dac_time_ns;
+	uint64_t dac_frac;
+
+	uint64_t next_status_ns;
+
+	struct emu_stats stats;
+
+};
+
+extern void emu_init(struct emu_device *dev, const struct emu_config *cfg, uint64_t now_ns);
+extern void emu_free(struct emu_device *dev);
+
+// A UDP datagram (port 9000 payload) was sent to the device at now_ns
+extern void emu_receive(struct emu_device *dev, const unsigned char *data, unsigned int len, uint64_t now_ns);
+
+// Run the model up to now_ns
+extern void emu_advance(struct emu_device *dev, uint64_t now_ns);
+
+// Time of the next fragment arrival or completion, 0 if there is none
+extern uint64_t emu_next_event(struct emu_device *dev);
+
+// Returns 1 and fills in buf (EMU_STATUS_LENGTH bytes) if a status packet is due
+extern int emu_status(struct emu_device *dev, unsigned char *buf, uint64_t now_ns);
+
+// Decodes a compressed block (command bit 4) into 20-bit samples.
+// Returns the number of samples, or -1 if the block is invalid.
+extern int emu_decode_block(const unsigned char *data, unsigned int len, int32_t *samples, unsigned int max_samples);
+
+#endif
@@ -0,0 +1,227 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "emu_device.h"
+
+
+/*
+ * Pretends to be the amplifier on the local machine.  Audio is received
+ * on UDP port 9000 and status packets are sent to port 9001, so a sender
+ * can be pointed at it instead of the real hardware.
+ */
+
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static unsigned char packet[EMU_MAX_DATAGRAM];
+
+
+static void on_signal(int sig) {
+	stop_requested = 1;
+}
+
+static uint64_t now_ns(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(const char *name) {
+
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "  -l percent   Drop this percent of IP fragments (default 0)\n");
+	fprintf(stderr, "  -r percent   Swap this percent of IP fragments with the next one (default 0)\n");
+	fprintf(stderr, "  -g e,x,l     Burst loss: percent chance to enter and exit a burst, loss percent in it\n");
+	fprintf(stderr, "  -j ms        Delay each datagram by up to this many milliseconds (default 0)\n");
+	fprintf(stderr, "  -b bytes     ENC424J600 receive buffer size (default %d)\n", EMU_RX_BUFFER_SIZE);
+	fprintf(stderr, "  -s rate      SPI read rate in bytes/sec (default 1500000)\n");
+	fprintf(stderr, "  -m mtu       IP MTU used to fragment datagrams (default 1500)\n");
+	fprintf(stderr, "  -f rate      DAC sample rate (default 44100)\n");
+	fprintf(stderr, "  -a address   Where to send status packets (default 127.0.0.1)\n");
+	fprintf(stderr, "  -p port      Port to receive audio on (default 9000)\n");
+	fprintf(stderr, "  -P port      Port to send status to (default 9001)\n");
+	fprintf(stderr, "  -S seed      Random seed for loss and reordering\n");
+	fprintf(stderr, "  -v           Print the device state with every status packet\n");
+
+}
+
+static void print_summary(struct emu_device *dev, uint64_t start_ns, uint64_t end_ns) {
+
+	struct emu_stats *st = &dev->stats;
+
+	printf("Run time:              %.1f s\n", (end_ns - start_ns) / 1e9);
+	if (st->first_play_ns)
+		printf("Start-up latency:      %.3f s\n", (st->first_play_ns - start_ns) / 1e9);
+	printf("Datagrams received:    %llu\n", (unsigned long long)st->datagrams_received);
+	printf("Datagrams committed:   %llu\n", (unsigned long long)st->datagrams_committed);
+	printf("Datagrams discarded:   %llu\n", (unsigned long long)st->discarded_datagrams);
+	printf("Fragments received:    %llu\n", (unsigned long long)st->fragments_received);
+	printf("Fragments lost:        %llu\n", (unsigned long long)st->fragments_lost);
+	printf("Fragments reordered:   %llu\n", (unsigned long long)st->fragments_reordered);
+	printf("Fragment gaps:         %llu\n", (unsigned long long)st->fragment_gaps);
+	printf("ENC overflows:         %llu\n", (unsigned long long)st->enc_overflows);
+	printf("Decode errors:         %llu\n", (unsigned long long)st->decode_errors);
+	printf("SDRAM overruns:        %llu\n", (unsigned long long)st->sdram_overruns);
+	printf("SDRAM underruns:       %llu\n", (unsigned long long)st->sdram_underrun_count);
+	printf("SRAM empty:            %llu\n", (unsigned long long)st->sram_empty_count);
+	printf("Samples played:        %llu\n", (unsigned long long)st->samples_played);
+
+}
+
+int main(int argc, char ** argv){
+
+	struct emu_config cfg;
+	struct emu_device *dev;
+	struct sockaddr_in addr, status_addr, from;
+	socklen_t from_len;
+	struct pollfd pfd;
+	unsigned char status[EMU_STATUS_LENGTH];
+	uint64_t start, now, next;
+	int sockfd, opt, len, timeout_ms, verbose = 0;
+	int audio_port = 9000, status_port = 9001;
+	const char *status_host = "127.0.0.1";
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.rx_buffer_size = EMU_RX_BUFFER_SIZE;
+	cfg.spi_rate = 1500000;
+	cfg.link_rate = 100000000;
+	cfg.mtu = 1500;
+	cfg.sample_rate = 44100;
+	cfg.seed = time(NULL);
+
+	while ((opt = getopt(argc, argv, "l:r:g:j:b:s:m:f:a:p:P:S:vh")) != -1) {
+		switch (opt) {
+		case 'l': cfg.loss_percent = atof(optarg); break;
+		case 'r': cfg.reorder_percent = atof(optarg); break;
+		case 'g':
+			if (sscanf(optarg, "%lf,%lf,%lf", &cfg.burst_enter_percent,
+					&cfg.burst_exit_percent, &cfg.burst_loss_percent) != 3) {
+				fprintf(stderr, "Burst loss must be given as enter,exit,loss\n");
+				exit(1);
+			}
+			break;
+		case 'j': cfg.jitter_us = (unsigned int)(atof(optarg) * 1000.0); break;
+		case 'b': cfg.rx_buffer_size = strtoul(optarg, NULL, 0); break;
+		case 's': cfg.spi_rate = strtoul(optarg, NULL, 0); break;
+		case 'm': cfg.mtu = strtoul(optarg, NULL, 0); break;
+		case 'f': cfg.sample_rate = strtoul(optarg, NULL, 0); break;
+		case 'a': status_host = optarg; break;
+		case 'p': audio_port = atoi(optarg); break;
+		case 'P': status_port = atoi(optarg); break;
+		case 'S': cfg.seed = strtoul(optarg, NULL, 0); break;
+		case 'v': verbose = 1; break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (cfg.mtu < 68 || cfg.spi_rate == 0 || cfg.sample_rate == 0) {
+		fprintf(stderr, "Invalid MTU, SPI rate or sample rate\n");
+		exit(1);
+	}
+
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sockfd < 0) {
+		fprintf(stderr, "Error creating socket: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	opt = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &opt, sizeof(opt));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(audio_port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Error binding to port %d: %s\n", audio_port, strerror(errno));
+		exit(1);
+	}
+
+	memset(&status_addr, 0, sizeof(status_addr));
+	status_addr.sin_family = AF_INET;
+	status_addr.sin_port = htons(status_port);
+	if (inet_aton(status_host, &status_addr.sin_addr) == 0) {
+		fprintf(stderr, "Invalid status address %s\n", status_host);
+		exit(1);
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	dev = malloc(sizeof(struct emu_device));
+	if (dev == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	start = now_ns();
+	emu_init(dev, &cfg, start);
+
+	fprintf(stderr, "Listening on port %d, sending status to %s:%d\n", audio_port, status_host, status_port);
+
+	pfd.fd = sockfd;
+	pfd.events = POLLIN;
+
+	while (!stop_requested) {
+
+		now = now_ns();
+
+		emu_advance(dev, now);
+
+		if (emu_status(dev, status, now)) {
+
+			sendto(sockfd, status, sizeof(status), 0, (struct sockaddr *) &status_addr, sizeof(status_addr));
+
+			if (verbose) {
+				fprintf(stderr, "seq %u fill %u sram %u%s underruns %llu empty %llu gaps %llu overflows %llu\n",
+					dev->next_sequence, dev->sdram_fill, dev->sram_level,
+					dev->dac_playing ? " playing" : "",
+					(unsigned long long)dev->stats.sdram_underrun_count,
+					(unsigned long long)dev->stats.sram_empty_count,
+					(unsigned long long)dev->stats.fragment_gaps,
+					(unsigned long long)dev->stats.enc_overflows);
+			}
+		}
+
+		// Sleep until the next fragment is due or the next status packet
+		next = dev->next_status_ns;
+		if (emu_next_event(dev) != 0 && emu_next_event(dev) < next)
+			next = emu_next_event(dev);
+
+		now = now_ns();
+		timeout_ms = next > now ? (int)((next - now + 999999) / 1000000) : 0;
+
+		if (poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN)) {
+
+			from_len = sizeof(from);
+			len = recvfrom(sockfd, packet, sizeof(packet), 0, (struct sockaddr *) &from, &from_len);
+
+			if (len > 0)
+				emu_receive(dev, packet, len, now_ns());
+		}
+
+	}
+
+	print_summary(dev, start, now_ns());
+
+	emu_free(dev);
+	free(dev);
+	close(sockfd);
+
+	return 0;
+}
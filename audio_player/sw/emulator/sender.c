@@ -0,0 +1,527 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "sender.h"
+
+
+#define NS_PER_MS		1000000ULL
+
+// Same limits as sendAudioData
+#define START_RETRIES		7
+#define RETRY_QUEUE_LENGTH	20
+
+#define RICE_MAX_PARAM		19
+#define RICE_ESCAPE		31
+
+#define MAX_FRAMES		(SENDER_PACKET_SIZE / 24)
+
+
+static void write_be32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t read_be32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+int sender_init(struct sender *s, int format, int device_port) {
+
+	struct sockaddr_in addr;
+
+	memset(s, 0, sizeof(*s));
+
+	s->format = format;
+	s->retries = -1;
+
+	s->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s->sockfd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(s->sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		return -1;
+
+	memset(&s->dest, 0, sizeof(s->dest));
+	s->dest.sin_family = AF_INET;
+	s->dest.sin_port = htons(device_port);
+	s->dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	return 0;
+}
+
+static void queue_clear(struct sender *s) {
+
+	while (s->queue_count > 0) {
+		free(s->queue[s->queue_head].data);
+		s->queue_head = (s->queue_head + 1) % SENDER_QUEUE_SIZE;
+		s->queue_count--;
+	}
+
+	s->resending = 0;
+}
+
+void sender_free(struct sender *s) {
+
+	queue_clear(s);
+
+	if (s->sockfd >= 0)
+		close(s->sockfd);
+	s->sockfd = -1;
+
+}
+
+int sender_status_port(struct sender *s) {
+
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	if (getsockname(s->sockfd, (struct sockaddr *) &addr, &len) < 0)
+		return -1;
+
+	return ntohs(addr.sin_port);
+}
+
+static int send_datagram(struct sender *s, const unsigned char *data, unsigned int len) {
+
+	int ret;
+
+	ret = sendto(s->sockfd, data, len, 0, (struct sockaddr *) &s->dest, sizeof(s->dest));
+
+	if (ret < 0) {
+		fprintf(stderr, "Error sending to device: %s\n", strerror(errno));
+		return ret;
+	}
+
+	s->stats.datagrams_sent++;
+	s->stats.bytes_sent += ret;
+
+	return ret;
+}
+
+static void send_command(struct sender *s, uint32_t command, uint32_t sequence) {
+
+	unsigned char pkt[8];
+
+	write_be32(pkt, SENDER_CMD_NO_AUDIO | command);
+	write_be32(pkt + 4, sequence);
+
+	send_datagram(s, pkt, sizeof(pkt));
+
+}
+
+uint64_t sender_start(struct sender *s, uint64_t now_ns) {
+
+	s->send_sequence = 0;
+
+	// Reset sequence to 0 and stop anything that is playing
+	send_command(s, SENDER_CMD_RESET_I2S | SENDER_CMD_SET_SEQUENCE | SENDER_CMD_MUTE, s->send_sequence);
+
+	queue_clear(s);
+
+	// Let any status messages be processed first
+	return now_ns + 1000 * NS_PER_MS;
+}
+
+int sender_sleep_ms(struct sender *s, int packet_size) {
+
+	// 8 channels of 24 bits at 44.1kHz
+	double pkts_per_sec = 1058400.0 / (double)packet_size;
+
+	int ms_per_sleep = (int)(1000.0 / pkts_per_sec);
+
+	int rx_congested = s->status_version >= 1 && s->rx_high_water > (SENDER_RX_BUFFER_SIZE * 3) / 4;
+
+	if (s->recv_window > (uint32_t)packet_size * 10 && !rx_congested)
+		ms_per_sleep = ms_per_sleep / 3;
+	else if (s->recv_window < (uint32_t)packet_size * 4)
+		ms_per_sleep = ms_per_sleep * 2;
+
+	if (ms_per_sleep < 15)
+		ms_per_sleep = 15;
+
+	return ms_per_sleep;
+}
+
+void sender_poll_status(struct sender *s) {
+
+	unsigned char buf[64];
+	struct sender_packet *pkt;
+	uint64_t recv_seq;
+	int len;
+
+	while ((len = recv(s->sockfd, buf, sizeof(buf), MSG_DONTWAIT)) >= 12) {
+
+		s->stats.status_received++;
+
+		s->recv_sequence = read_be32(buf);
+		s->recv_window = read_be32(buf + 4);
+
+		if (len >= SENDER_STATUS_V1_LENGTH) {
+			s->status_version = read_be32(buf + 12);
+			s->sdram_fill = read_be32(buf + 16);
+			s->rx_high_water = (buf[28] << 8) | buf[29];
+		} else {
+			s->status_version = 0;
+		}
+
+		// Same rule as onStatusReceived, keep packets until well past them
+		while (s->queue_count > 0) {
+
+			pkt = &s->queue[s->queue_head];
+			recv_seq = s->recv_sequence;
+
+			if (pkt->seq > 0xFFF00000 && recv_seq < 0x00080000)
+				recv_seq += 0x100000000ULL;
+
+			if (pkt->seq < recv_seq && (recv_seq - pkt->seq) >= 3 * (uint64_t)(pkt->len - 8)) {
+				free(pkt->data);
+				s->queue_head = (s->queue_head + 1) % SENDER_QUEUE_SIZE;
+				s->queue_count--;
+				if (s->resend_index > 0)
+					s->resend_index--;
+			} else {
+				break;
+			}
+		}
+	}
+
+}
+
+// Finds the first packet that resendMissingPackets would send, returns
+// queue_count if there is nothing to resend
+static unsigned int first_missing(struct sender *s) {
+
+	struct sender_packet *pkt;
+	unsigned int i;
+
+	for (i = 0; i < s->queue_count; i++) {
+
+		pkt = &s->queue[(s->queue_head + i) % SENDER_QUEUE_SIZE];
+
+		if (!(pkt->seq < s->recv_sequence && (s->recv_sequence - pkt->seq) >= pkt->len - 8))
+			break;
+	}
+
+	return i;
+}
+
+static void resend_next(struct sender *s, uint64_t now_ns, uint64_t *next_ns) {
+
+	struct sender_packet *pkt = &s->queue[(s->queue_head + s->resend_index) % SENDER_QUEUE_SIZE];
+
+	s->send_sequence = pkt->seq;
+
+	if (send_datagram(s, pkt->data, pkt->len) > 0) {
+		s->stats.retransmitted_datagrams++;
+		s->stats.retransmitted_bytes += pkt->len;
+	}
+
+	s->send_sequence = pkt->seq + (pkt->len - 8);
+
+	// Wait for amplifier to process the data
+	*next_ns = now_ns + sender_sleep_ms(s, pkt->len - 8) * NS_PER_MS;
+
+	s->resend_index++;
+
+	if (s->resend_index >= s->queue_count) {
+		s->resending = 0;
+		s->retries--;
+	}
+
+}
+
+int sender_step(struct sender *s, const unsigned char *data, uint64_t now_ns, uint64_t *next_ns) {
+
+	struct sender_packet *pkt;
+	unsigned int wire_len, missing;
+	int len;
+
+	if (s->resending && s->resend_index < s->queue_count) {
+		resend_next(s, now_ns, next_ns);
+		return 0;
+	}
+
+	if (s->resending) {
+		// Everything left was acknowledged part way through the pass
+		s->resending = 0;
+		s->retries--;
+	}
+
+	// Start of a new sendAudioData call, unless it is still retrying
+	if (s->retries < 0)
+		s->retries = START_RETRIES;
+
+	while (s->retries > 0 && s->queue_count > RETRY_QUEUE_LENGTH) {
+
+		missing = first_missing(s);
+
+		if (missing < s->queue_count) {
+			s->stats.retry_rounds++;
+			s->resending = 1;
+			s->resend_index = missing;
+			resend_next(s, now_ns, next_ns);
+			return 0;
+		}
+
+		s->retries--;
+	}
+
+	if (s->retries == 0) {
+		// sendAudioData throws here, the caller tries again with the next packet
+		s->stats.send_errors++;
+		s->retries = -1;
+		*next_ns = now_ns + sender_sleep_ms(s, SENDER_PACKET_SIZE) * NS_PER_MS;
+		return 0;
+	}
+
+	s->retries = -1;
+
+	if (s->queue_count == SENDER_QUEUE_SIZE) {
+		free(s->queue[s->queue_head].data);
+		s->queue_head = (s->queue_head + 1) % SENDER_QUEUE_SIZE;
+		s->queue_count--;
+	}
+
+	pkt = &s->queue[(s->queue_head + s->queue_count) % SENDER_QUEUE_SIZE];
+
+	wire_len = s->format == SENDER_FORMAT_PACKED ? (SENDER_PACKET_SIZE / 6) * 5 : SENDER_PACKET_SIZE;
+
+	pkt->data = malloc(wire_len + 8);
+	if (pkt->data == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	write_be32(pkt->data, 0);
+
+	if (s->format == SENDER_FORMAT_COMPRESSED) {
+
+		// Only use a compressed block if it actually saves something
+		len = sender_compress_samples(data, SENDER_PACKET_SIZE, pkt->data + 8, wire_len - 1);
+
+		if (len > 0) {
+			wire_len = len;
+			pkt->data[3] |= SENDER_CMD_COMPRESSED;
+			s->stats.compressed_blocks++;
+		} else {
+			memcpy(pkt->data + 8, data, SENDER_PACKET_SIZE);
+		}
+
+	} else if (s->format == SENDER_FORMAT_PACKED) {
+
+		pkt->data[3] |= SENDER_CMD_PACKED;
+		sender_pack_samples(data, SENDER_PACKET_SIZE, pkt->data + 8);
+
+	} else {
+
+		memcpy(pkt->data + 8, data, SENDER_PACKET_SIZE);
+
+	}
+
+	write_be32(pkt->data + 4, s->send_sequence);
+
+	pkt->seq = s->send_sequence;
+	pkt->len = wire_len + 8;
+
+	s->queue_count++;
+
+	// Sequence counts bytes on the wire, not bytes of 24-bit samples
+	if (send_datagram(s, pkt->data, pkt->len) == (int)pkt->len)
+		s->send_sequence += wire_len;
+
+	s->stats.audio_bytes_sent += SENDER_PACKET_SIZE;
+
+	*next_ns = now_ns + sender_sleep_ms(s, SENDER_PACKET_SIZE) * NS_PER_MS;
+
+	return 1;
+}
+
+
+/*
+ * Sample formats, the same as packSamples and compressSamples
+ */
+
+void sender_pack_samples(const unsigned char *src, int data_len, unsigned char *dst) {
+
+	uint64_t a, b, pair;
+	int i;
+
+	for (i = 0; i < data_len; i += 6) {
+
+		a = ((uint64_t)src[i] << 12) | ((uint64_t)src[i + 1] << 4) | (src[i + 2] >> 4);
+		b = ((uint64_t)src[i + 3] << 12) | ((uint64_t)src[i + 4] << 4) | (src[i + 5] >> 4);
+		pair = (a << 20) | b;
+
+		dst[0] = pair >> 32;
+		dst[1] = pair >> 24;
+		dst[2] = pair >> 16;
+		dst[3] = pair >> 8;
+		dst[4] = pair;
+
+		dst += 5;
+	}
+
+}
+
+struct rice_writer {
+	unsigned char *buf;
+	int offset;
+	int end;
+	uint64_t bits;
+	int bit_count;
+};
+
+static void rice_write(struct rice_writer *w, uint32_t value, int count) {
+
+	w->bits = (w->bits << count) | (value & ((1ULL << count) - 1));
+	w->bit_count += count;
+
+	while (w->bit_count >= 8) {
+
+		w->bit_count -= 8;
+
+		if (w->offset < w->end)
+			w->buf[w->offset] = w->bits >> w->bit_count;
+
+		w->offset++;
+	}
+
+}
+
+static int64_t choose_rice_param(const int32_t *residual, int count, int *best_param) {
+
+	int64_t sum = 0, bits, best_bits = INT64_MAX;
+	int estimate = 0, i, k, q;
+
+	for (i = 0; i < count; i++)
+		sum += residual[i];
+
+	while (estimate < RICE_MAX_PARAM && ((int64_t)count << (estimate + 1)) < sum)
+		estimate++;
+
+	*best_param = 0;
+
+	for (k = estimate > 0 ? estimate - 1 : 0; k <= estimate + 1 && k <= RICE_MAX_PARAM; k++) {
+
+		bits = 0;
+
+		for (i = 0; i < count; i++) {
+			q = residual[i] >> k;
+			bits += q < RICE_ESCAPE ? q + 1 + k : RICE_ESCAPE + 20;
+		}
+
+		if (bits < best_bits) {
+			best_bits = bits;
+			*best_param = k;
+		}
+	}
+
+	return best_bits;
+}
+
+int sender_compress_samples(const unsigned char *src, int data_len, unsigned char *dst, int max_len) {
+
+	static int32_t residuals[8][MAX_FRAMES];
+	int32_t samples[MAX_FRAMES], residual[MAX_FRAMES];
+	int param[8];
+	struct rice_writer w;
+	int frames = data_len / 24;
+	int ch, f, i, n, order, best_order, k, q;
+	int32_t pred, r;
+	uint32_t u;
+	int64_t bits, best_bits;
+
+	if (max_len < SENDER_COMPRESSED_HEADER || frames > MAX_FRAMES)
+		return -1;
+
+	dst[0] = frames >> 8;
+	dst[1] = frames;
+
+	for (ch = 0; ch < 8; ch++) {
+
+		for (f = 0; f < frames; f++) {
+			i = f * 24 + ch * 3;
+			samples[f] = (src[i] << 12) | (src[i + 1] << 4) | (src[i + 2] >> 4);
+		}
+
+		best_bits = INT64_MAX;
+		best_order = 0;
+
+		for (order = 0; order <= 2; order++) {
+
+			for (f = 0; f < frames; f++) {
+
+				n = order < f ? order : f;
+				pred = 0;
+
+				if (n == 1)
+					pred = samples[f - 1];
+				else if (n == 2)
+					pred = 2 * samples[f - 1] - samples[f - 2];
+
+				r = (int32_t)((uint32_t)(samples[f] - pred) << 12) >> 12;
+				residual[f] = (((uint32_t)r << 1) ^ (r >> 19)) & 0xFFFFF;
+			}
+
+			bits = choose_rice_param(residual, frames, &k);
+
+			if (bits < best_bits) {
+				best_bits = bits;
+				best_order = order;
+				param[ch] = k;
+				memcpy(residuals[ch], residual, frames * sizeof(int32_t));
+			}
+		}
+
+		dst[2 + ch] = (best_order << 5) | param[ch];
+	}
+
+	w.buf = dst;
+	w.offset = SENDER_COMPRESSED_HEADER;
+	w.end = max_len;
+	w.bits = 0;
+	w.bit_count = 0;
+
+	for (f = 0; f < frames; f++) {
+
+		for (ch = 0; ch < 8; ch++) {
+
+			u = residuals[ch][f];
+			k = param[ch];
+			q = u >> k;
+
+			if (q < RICE_ESCAPE) {
+				// q zeros and a one, then the low k bits
+				rice_write(&w, 1, q + 1);
+				rice_write(&w, u, k);
+			} else {
+				rice_write(&w, 0, RICE_ESCAPE);
+				rice_write(&w, u, 20);
+			}
+		}
+
+		if (w.offset > w.end)
+			return -1;
+	}
+
+	if (w.bit_count > 0)
+		rice_write(&w, 0, 8 - w.bit_count);
+
+	if (w.offset > w.end)
+		return -1;
+
+	return w.offset;
+}
@@ -0,0 +1,112 @@
+#ifndef SENDER_H
+#define SENDER_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+/*
+ * C version of the sending side of EthernetAudio.cs: the same packet
+ * layout, pacing (getEstimatedSleepLength), acknowledgement queue and
+ * retransmission rules.  It is driven by the caller's clock instead of
+ * Thread.Sleep so that it can run faster than real time against the
+ * device model.
+ */
+
+#define SENDER_FORMAT_RAW		0
+#define SENDER_FORMAT_PACKED		1
+#define SENDER_FORMAT_COMPRESSED	2
+
+// Command bits, see networking.md
+#define SENDER_CMD_MUTE			0x00000001
+#define SENDER_CMD_SET_SEQUENCE		0x00000002
+#define SENDER_CMD_PACKED		0x00000008
+#define SENDER_CMD_COMPRESSED		0x00000010
+#define SENDER_CMD_RESET_I2S		0x00000100
+#define SENDER_CMD_NO_AUDIO		0x80000000
+
+#define SENDER_STATUS_V1_LENGTH		32
+#define SENDER_RX_BUFFER_SIZE		0x5800
+#define SENDER_COMPRESSED_HEADER	10
+
+// Same size as the buffers in Form1.cs
+#define SENDER_PACKET_SIZE		20088
+
+// Largest number of packets waiting for an acknowledgement
+#define SENDER_QUEUE_SIZE		1024
+
+struct sender_packet {
+	uint32_t seq;
+	unsigned int len;
+	unsigned char *data;
+};
+
+struct sender_stats {
+	uint64_t datagrams_sent;
+	uint64_t bytes_sent;
+	uint64_t audio_bytes_sent;
+	uint64_t retransmitted_datagrams;
+	uint64_t retransmitted_bytes;
+	uint64_t compressed_blocks;
+	uint64_t retry_rounds;
+	// sendAudioData gave up after too many retries
+	uint64_t send_errors;
+	uint64_t status_received;
+};
+
+struct sender {
+
+	int sockfd;
+	struct sockaddr_in dest;
+
+	int format;
+
+	uint32_t send_sequence;
+
+	// From the last status packet
+	uint32_t recv_sequence;
+	uint32_t recv_window;
+	uint32_t status_version;
+	uint32_t sdram_fill;
+	uint16_t rx_high_water;
+
+	// Packets not acknowledged yet, oldest first
+	struct sender_packet queue[SENDER_QUEUE_SIZE];
+	unsigned int queue_head;
+	unsigned int queue_count;
+
+	// A resendMissingPackets pass in progress
+	int resending;
+	unsigned int resend_index;
+	// Retries left in the current sendAudioData call, -1 between calls
+	int retries;
+
+	struct sender_stats stats;
+
+};
+
+// Opens a socket on the loopback interface for the given device port
+extern int sender_init(struct sender *s, int format, int device_port);
+extern void sender_free(struct sender *s);
+
+// Port that status packets should be sent to
+extern int sender_status_port(struct sender *s);
+
+// Same as the start of sendAudioData with newAudioStream set.  Returns the
+// time to send the first packet.
+extern uint64_t sender_start(struct sender *s, uint64_t now_ns);
+
+// Sends the next packet (new audio or a retransmission) taken from data,
+// which must hold SENDER_PACKET_SIZE bytes of 24-bit samples.  Returns
+// non-zero if the packet used new audio, and sets *next_ns to when the
+// next call is due.
+extern int sender_step(struct sender *s, const unsigned char *data, uint64_t now_ns, uint64_t *next_ns);
+
+// Reads any status packets waiting on the socket
+extern void sender_poll_status(struct sender *s);
+
+extern int sender_sleep_ms(struct sender *s, int packet_size);
+
+extern void sender_pack_samples(const unsigned char *src, int data_len, unsigned char *dst);
+extern int sender_compress_samples(const unsigned char *src, int data_len, unsigned char *dst, int max_len);
+
+#endif
@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#include "spitrace.h"
 
 
 #define BCM2708_PERI_BASE        0x20000000
@@ -35,6 +36,9 @@ void *gpio_map;
 // I/O access
 volatile unsigned *gpio;
 
+// Last level of each GPIO, for tracing
+static unsigned int lastLevels;
+
 //
 // Set up a memory regions to access GPIO
 //
@@ -73,7 +77,16 @@ void setup_gpio()
 
 
 int get_gpio(int port) {
-	return GET_GPIO(port);
+	int value = GET_GPIO(port);
+	int level = value ? 1 : 0;
+
+	// Only the edges go in the trace, not every poll
+	if (spi_trace_enabled && level != ((lastLevels >> port) & 1)) {
+		spi_trace_counter("gpio", port, level);
+		lastLevels ^= 1 << port;
+	}
+
+	return value;
 }
 
 
@@ -0,0 +1,149 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "wishbone_wrapper.h"
+
+
+// sys_clk, which the arbiter counters run on
+#define SYS_CLK_HZ 85000000.0
+
+// The cycle counter is 32 bits and wraps after about 50 seconds
+#define MAX_INTERVAL 50
+
+#define REG_STATS_CTL 27
+#define REG_STATS_CYCLES 28
+// dac, eth and rpi each have 7 registers starting here
+#define REG_STATS_MASTER 30
+
+
+static const char *masterNames[] = { "dac", "eth", "rpi" };
+
+static unsigned char buffer[16];
+
+static volatile int stop = 0;
+
+
+extern int spi_init();
+extern void spi_close();
+
+
+static void handleSignal(int sig) {
+	stop = 1;
+}
+
+static unsigned int readReg(unsigned int reg) {
+
+	wishbone_read((unsigned char *)buffer, 2, reg);
+
+	return (buffer[1] << 8) | buffer[0];
+
+}
+
+static unsigned int readReg32(unsigned int reg) {
+
+	return (readReg(reg) << 16) | readReg(reg + 1);
+
+}
+
+// Copy the counters to the stats registers and start them again from 0
+static void snapshotAndClear() {
+
+	buffer[1] = 0;
+	buffer[0] = 3;
+	wishbone_write((unsigned char *)buffer, 2, REG_STATS_CTL);
+
+	buffer[1] = 0;
+	buffer[0] = 0;
+	wishbone_write((unsigned char *)buffer, 2, REG_STATS_CTL);
+
+}
+
+static void printStats() {
+
+	unsigned int cycles = readReg32(REG_STATS_CYCLES);
+	unsigned int totalWords = 0;
+	int i;
+
+	if (cycles == 0) {
+		fprintf(stderr, "Cycle counter is 0\n");
+		return;
+	}
+
+	printf("Interval: %.3f s (%u cycles)\n", cycles / SYS_CLK_HZ, cycles);
+	printf("       grants      words   words/s   busy%%  stall%%  max wait\n");
+
+	for (i = 0; i < 3; i++) {
+		unsigned int reg = REG_STATS_MASTER + i * 7;
+		unsigned int grants = readReg32(reg);
+		unsigned int stallCycles = readReg32(reg + 2);
+		unsigned int words = readReg32(reg + 4);
+		unsigned int maxWait = readReg(reg + 6);
+
+		totalWords += words;
+
+		printf("  %s %10u %10u %9.0f %6.2f%% %6.2f%% %6u cycles (%.2f us)%s\n",
+			masterNames[i], grants, words,
+			words * SYS_CLK_HZ / cycles,
+			100.0 * words / cycles,
+			100.0 * stallCycles / cycles,
+			maxWait, maxWait * 1000000.0 / SYS_CLK_HZ,
+			maxWait == 0xFFFF ? "+" : "");
+	}
+
+	printf("  all %21u %9.0f %6.2f%%\n\n",
+		totalWords, totalWords * SYS_CLK_HZ / cycles,
+		100.0 * totalWords / cycles);
+
+	fflush(stdout);
+
+}
+
+int main(int argc, char ** argv){
+
+	int interval = 1;
+	int count = 0;
+	int n;
+
+	if (argc > 1)
+		interval = atoi(argv[1]);
+	if (argc > 2)
+		count = atoi(argv[2]);
+
+	if (interval < 1 || interval > MAX_INTERVAL || count < 0) {
+		fprintf(stderr, "Usage: %s [interval secs, 1-%d] [count, 0 = forever]\n", argv[0], MAX_INTERVAL);
+		return 1;
+	}
+
+	spi_init();
+
+	wishbone_read((unsigned char *)buffer, 2, 0x0000);
+
+	if (buffer[1] != 0xde || buffer[0] != 0xad) {
+		fprintf(stderr, "Invalid ID: 0x%02x%02x.  Did you load the FPGA?\n", buffer[1], buffer[0]);
+		spi_close();
+		exit(1);
+	}
+
+	signal(SIGINT, handleSignal);
+	signal(SIGTERM, handleSignal);
+
+	// Start the first interval from 0
+	snapshotAndClear();
+
+	for (n = 0; !stop && (count == 0 || n < count); n++) {
+
+		sleep(interval);
+		if (stop)
+			break;
+
+		snapshotAndClear();
+		printStats();
+
+	}
+
+	spi_close();
+	return 0;
+
+}
@@ -0,0 +1,133 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+#include "spitrace.h"
+#include "wblog.h"
+#include "wbcache.h"
+#include "spispeed.h"
+
+
+// spidev access, used by wishbone_wrapper.c.  wishbone_sim.c provides the
+// same functions against a simulated FPGA.
+
+int spi_fd ;
+unsigned int fifo_size ;
+static const char * device = "/dev/spidev0.0";
+static unsigned int mode = 0 ;
+static unsigned int bits = 8 ;
+
+// wbcalibrate finds what this board can do
+#define SPI_DEFAULT_SPEED 32000000UL
+
+unsigned long spi_speed = SPI_DEFAULT_SPEED ;
+// Used when there is no calibration, or it stops working
+const unsigned long spi_default_speed = SPI_DEFAULT_SPEED ;
+
+// Name of this SPI implementation, for reports
+const char * spi_backend = "spidev";
+// Key for the calibrated clock, see spispeed.c
+const char * spi_speed_bus = "wishbone";
+static unsigned int delay = 0;
+
+
+int spi_init(void){
+	int ret ;
+
+	spi_trace_init();
+
+	spi_speed = spi_speed_load(spi_speed_bus, spi_default_speed);
+
+	if (wb_log_init(spi_speed) < 0)
+		return -1 ;
+
+	wb_cache_init();
+
+	// Everything comes from the log, the board isn't needed
+	if (wb_log_replaying){
+		spi_fd = -1 ;
+		return 1 ;
+	}
+
+	spi_fd = open(device, O_RDWR);
+	if (spi_fd < 0){
+		printf("can't open device\n");
+		return -1 ;
+	}
+
+	ret = ioctl(spi_fd, SPI_IOC_WR_MODE, &mode);
+	if (ret == -1){
+		printf("can't set spi mode \n");
+		return -1 ;
+	}
+
+	ret = ioctl(spi_fd, SPI_IOC_RD_MODE, &mode);
+	if (ret == -1){
+		printf("can't get spi mode \n ");
+		return -1 ;
+	}
+
+	/*
+	 * bits per word
+	 */
+	ret = ioctl(spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
+	if (ret == -1){
+		printf("can't set bits per word \n");
+		return -1 ;
+	}
+
+	ret = ioctl(spi_fd, SPI_IOC_RD_BITS_PER_WORD, &bits);
+	if (ret == -1){
+		printf("can't get bits per word \n");
+		return -1 ;
+	}
+
+	/*
+	 * max speed hz
+	 */
+	ret = ioctl(spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &spi_speed);
+	if (ret == -1){
+		printf("can't set max speed hz \n");
+		return -1 ;
+	}
+
+	ret = ioctl(spi_fd, SPI_IOC_RD_MAX_SPEED_HZ, &spi_speed);
+	if (ret == -1){
+		printf("can't get max speed hz \n");
+		return -1 ;
+	}
+
+	return 1;
+}
+
+
+int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size)
+{
+	int ret ;
+	SPI_TRACE_BEGIN(traceStart);
+	struct spi_ioc_transfer tr = {
+		.tx_buf = (unsigned long)send_buffer,
+		.rx_buf = (unsigned long)receive_buffer,
+		.len = size,
+		.delay_usecs = delay,
+		.speed_hz = spi_speed,
+		.bits_per_word = bits,
+	};
+
+	ret = ioctl(spi_fd, SPI_IOC_MESSAGE(1), &tr);
+	SPI_TRACE_END(traceStart, "spi_transfer", SPI_TRACE_NONE, SPI_TRACE_NONE, size);
+	if (ret < 1){
+		printf("can't send spi message  \n");
+		return -1 ;	
+	}
+	return 0;
+}
+
+
+void spi_close(void){
+	wb_cache_close();
+	if (spi_fd >= 0)
+		close(spi_fd);
+}
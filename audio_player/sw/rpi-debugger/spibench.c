@@ -0,0 +1,226 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include "wishbone_wrapper.h"
+
+/*
+ * Benchmark of the host side of the Wishbone transport: single register
+ * reads and writes, bulk transfers of several sizes, and a sequence of
+ * register accesses done one message per register or batched into one
+ * auto-increment transfer.  Each test runs for a fixed time and reports
+ * operations per second and latency percentiles.
+ *
+ * spibench uses spidev and a loaded FPGA, spibench_sim the simulated
+ * wrapper in wishbone_sim.c.  Results are printed as one JSON object per
+ * test, so that runs can be kept and compared over time.
+ *
+ * Only the unused registers 5-12 are written, so it is safe to run while
+ * the audio player is playing.
+ */
+
+// Register that nothing uses, for writes
+#define REG_SCRATCH 5
+
+// Registers in the batched/unbatched sequence, starting at REG_SCRATCH
+#define SEQUENCE_REGS 8
+
+// Latency samples kept per test, anything after is only counted
+#define MAX_SAMPLES 200000
+
+static const unsigned int bulkSizes[] = { 64, 512, 4096, 32764 };
+
+extern int spi_init();
+extern void spi_close();
+extern int logipi_write(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc);
+extern int logipi_read(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc);
+extern unsigned long spi_speed;
+extern const char * spi_backend;
+
+enum test_op {
+	READ_REG,
+	WRITE_REG,
+	BULK_READ,
+	BULK_WRITE,
+	SEQUENCE_READ,
+	SEQUENCE_WRITE,
+	BATCHED_READ,
+	BATCHED_WRITE
+};
+
+static unsigned char buffer[32768];
+static double samples[MAX_SAMPLES];
+
+
+static uint64_t now_ns() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(unsigned int count, double p) {
+
+	unsigned int i = (unsigned int)(p * (count - 1) + 0.5);
+
+	return samples[i];
+}
+
+// One operation of the test, returns non-zero on error
+static int run_op(enum test_op op, unsigned int size) {
+
+	unsigned int i;
+
+	switch (op) {
+
+	case READ_REG:
+		return wishbone_read(buffer, 2, 0) != 2;
+
+	case WRITE_REG:
+		return wishbone_write(buffer, 2, REG_SCRATCH) != 2;
+
+	// No auto-increment, so every word goes to the same register
+	case BULK_READ:
+		return logipi_read(0, buffer, size, 0) < 0;
+
+	case BULK_WRITE:
+		return logipi_write(REG_SCRATCH, buffer, size, 0) < 0;
+
+	case SEQUENCE_READ:
+		for (i = 0; i < SEQUENCE_REGS; i++)
+			if (wishbone_read(buffer + i * 2, 2, REG_SCRATCH + i) != 2)
+				return 1;
+		return 0;
+
+	case SEQUENCE_WRITE:
+		for (i = 0; i < SEQUENCE_REGS; i++)
+			if (wishbone_write(buffer + i * 2, 2, REG_SCRATCH + i) != 2)
+				return 1;
+		return 0;
+
+	case BATCHED_READ:
+		return logipi_read(REG_SCRATCH, buffer, SEQUENCE_REGS * 2, 1) < 0;
+
+	case BATCHED_WRITE:
+		return logipi_write(REG_SCRATCH, buffer, SEQUENCE_REGS * 2, 1) < 0;
+
+	}
+
+	return 1;
+}
+
+static void run_test(FILE *out, const char *name, enum test_op op, unsigned int size, double seconds) {
+
+	uint64_t start, end, opStart, opEnd;
+	unsigned long ops = 0;
+	unsigned int count = 0;
+
+	memset(buffer, 0, size);
+
+	start = now_ns();
+	end = start + (uint64_t)(seconds * 1e9);
+
+	do {
+		opStart = now_ns();
+		if (run_op(op, size)) {
+			// spidev's bufsiz parameter limits the message size
+			fprintf(stderr, "%s of %u bytes failed, skipped\n", name, size);
+			return;
+		}
+		opEnd = now_ns();
+
+		if (count < MAX_SAMPLES)
+			samples[count++] = (opEnd - opStart) / 1000.0;
+		ops++;
+	} while (opEnd < end);
+
+	qsort(samples, count, sizeof(double), compare_double);
+
+	seconds = (opEnd - start) / 1e9;
+
+	fprintf(out, "{\"backend\":\"%s\",\"spi_speed\":%lu,\"test\":\"%s\",\"size\":%u,"
+		"\"ops\":%lu,\"ops_per_s\":%.0f,\"bytes_per_s\":%.0f,"
+		"\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+		spi_backend, spi_speed, name, size,
+		ops, ops / seconds, ops * size / seconds,
+		percentile(count, 0.5), percentile(count, 0.9), percentile(count, 0.99),
+		samples[count - 1]);
+	fflush(out);
+
+	if (out != stdout)
+		fprintf(stderr, "%-16s %6u bytes %9.0f ops/s  p50 %7.1f us  p99 %7.1f us\n",
+			name, size, ops / seconds, percentile(count, 0.5), percentile(count, 0.99));
+
+}
+
+int main(int argc, char ** argv){
+
+	FILE *out = stdout;
+	double seconds = 1.0;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:t:")) != -1) {
+		switch (opt) {
+		case 'o':
+			out = fopen(optarg, "w");
+			if (!out) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-o results.json] [-t seconds per test]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (seconds <= 0) {
+		fprintf(stderr, "Time per test must be more than 0\n");
+		return 1;
+	}
+
+	spi_init();
+
+	wishbone_read((unsigned char *)buffer, 2, 0x0000);
+
+	if (buffer[1] != 0xde || buffer[0] != 0xad) {
+		fprintf(stderr, "Invalid ID: 0x%02x%02x.  Did you load the FPGA?\n", buffer[1], buffer[0]);
+		spi_close();
+		exit(1);
+	}
+
+	run_test(out, "read_reg", READ_REG, 2, seconds);
+	run_test(out, "write_reg", WRITE_REG, 2, seconds);
+
+	for (i = 0; i < sizeof(bulkSizes) / sizeof(bulkSizes[0]); i++) {
+		run_test(out, "bulk_read", BULK_READ, bulkSizes[i], seconds);
+		run_test(out, "bulk_write", BULK_WRITE, bulkSizes[i], seconds);
+	}
+
+	run_test(out, "sequence_read", SEQUENCE_READ, SEQUENCE_REGS * 2, seconds);
+	run_test(out, "batched_read", BATCHED_READ, SEQUENCE_REGS * 2, seconds);
+	run_test(out, "sequence_write", SEQUENCE_WRITE, SEQUENCE_REGS * 2, seconds);
+	run_test(out, "batched_write", BATCHED_WRITE, SEQUENCE_REGS * 2, seconds);
+
+	if (out != stdout)
+		fclose(out);
+
+	spi_close();
+	return 0;
+
+}
@@ -0,0 +1,145 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spispeed.h"
+
+/*
+ * The fastest SPI clock that works depends on the board and how the Pi is
+ * wired to it, so calibration (flash_loader -c, wbcalibrate) tries each of
+ * spi_speed_steps and saves the one to use here.  spi_init() then starts
+ * at that clock.  The file has a line for each board and bus:
+ *
+ *   <Pi serial number> <bus> <clock in Hz>
+ *
+ * The Pi's serial number stands in for the board, since each LogiPi stays
+ * on its Pi.
+ */
+
+#define LINE_SIZE 128
+
+const unsigned long spi_speed_steps[] = {
+	1000000, 2000000, 4000000, 8000000, 12000000, 16000000,
+	20000000, 25000000, 32000000, 40000000, 50000000, 64000000
+};
+const unsigned int spi_speed_num_steps = sizeof(spi_speed_steps) / sizeof(spi_speed_steps[0]);
+
+static char boardId[64];
+static char fileName[512];
+
+
+const char * spi_board_id(void) {
+
+	FILE *f;
+	char line[LINE_SIZE];
+	char *p;
+
+	if (boardId[0])
+		return boardId;
+
+	strcpy(boardId, "unknown");
+
+	f = fopen("/proc/cpuinfo", "r");
+	if (!f)
+		return boardId;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "Serial", 6) != 0 || (p = strchr(line, ':')) == NULL)
+			continue;
+		if (sscanf(p + 1, "%63s", boardId) != 1)
+			strcpy(boardId, "unknown");
+		break;
+	}
+
+	fclose(f);
+
+	return boardId;
+}
+
+static const char * speed_file(void) {
+
+	const char *home;
+
+	if (getenv("SPI_SPEED_FILE"))
+		return getenv("SPI_SPEED_FILE");
+
+	home = getenv("HOME");
+	snprintf(fileName, sizeof(fileName), "%s/.logipi_spi_speed", home ? home : ".");
+
+	return fileName;
+}
+
+// Returns the saved clock for bus on this board, or defaultSpeed
+unsigned long spi_speed_load(const char * bus, unsigned long defaultSpeed) {
+
+	FILE *f;
+	char line[LINE_SIZE], board[64], lineBus[16];
+	unsigned long speed, found = 0;
+
+	if (getenv("SPI_SPEED") && strtoul(getenv("SPI_SPEED"), NULL, 0) > 0)
+		return strtoul(getenv("SPI_SPEED"), NULL, 0);
+
+	f = fopen(speed_file(), "r");
+	if (!f)
+		return defaultSpeed;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63s %15s %lu", board, lineBus, &speed) == 3 &&
+				strcmp(board, spi_board_id()) == 0 && strcmp(lineBus, bus) == 0)
+			found = speed;
+	}
+
+	fclose(f);
+
+	return found ? found : defaultSpeed;
+}
+
+// Replaces the line for bus on this board, returns non-zero on error
+int spi_speed_save(const char * bus, unsigned long speed) {
+
+	FILE *f, *old;
+	char *line = NULL, tempName[600];
+	char board[64], lineBus[16];
+	size_t lineSize = 0;
+	int failed = 0;
+
+	// Written to the side and renamed, so a reader never sees half a file
+	snprintf(tempName, sizeof(tempName), "%s.tmp", speed_file());
+
+	f = fopen(tempName, "w");
+	if (!f) {
+		perror(tempName);
+		return 1;
+	}
+
+	// Every other board's and bus's line is copied over, however many there are
+	old = fopen(speed_file(), "r");
+	if (old) {
+		while (getline(&line, &lineSize, old) != -1) {
+			if (sscanf(line, "%63s %15s", board, lineBus) == 2 &&
+					strcmp(board, spi_board_id()) == 0 && strcmp(lineBus, bus) == 0)
+				continue;
+			fputs(line, f);
+		}
+		failed = ferror(old);
+		fclose(old);
+		free(line);
+	}
+
+	if (failed) {
+		fprintf(stderr, "Error reading %s, not saving the SPI clock\n", speed_file());
+		fclose(f);
+		unlink(tempName);
+		return 1;
+	}
+
+	fprintf(f, "%s %s %lu\n", spi_board_id(), bus, speed);
+
+	if (fclose(f) || rename(tempName, speed_file())) {
+		perror(speed_file());
+		unlink(tempName);
+		return 1;
+	}
+
+	return 0;
+}
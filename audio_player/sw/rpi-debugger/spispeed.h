@@ -0,0 +1,24 @@
+#ifndef SPISPEED_H
+#define SPISPEED_H
+
+/*
+ * SPI clocks found by calibration, saved per board (see spispeed.c).
+ *
+ *   SPI_SPEED         use this clock in Hz, whatever was saved
+ *   SPI_SPEED_FILE    where calibrations are kept (default
+ *                     $HOME/.logipi_spi_speed)
+ *
+ * bus is "flash" for flash_loader and "wishbone" for the rpi-debugger
+ * tools, which share the file.  The simulated backends use "flash-sim"
+ * and "wishbone-sim", so they never change what the hardware uses.
+ */
+
+// Clocks tried by calibration, in Hz, lowest first
+extern const unsigned long spi_speed_steps[];
+extern const unsigned int spi_speed_num_steps;
+
+const char * spi_board_id(void);
+unsigned long spi_speed_load(const char * bus, unsigned long defaultSpeed);
+int spi_speed_save(const char * bus, unsigned long speed);
+
+#endif
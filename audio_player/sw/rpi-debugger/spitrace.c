@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include "spitrace.h"
+
+
+#define DEFAULT_EVENTS 65536
+
+struct trace_event {
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	unsigned int address;
+	unsigned int op;
+	unsigned int size;
+	// Counter value, or -1 for a transfer.  address is the counter series
+	int value;
+};
+
+/*
+ * One ring per thread.  Only the owning thread writes events and head, so
+ * recording needs no lock.  Rings are pushed onto a list with a
+ * compare-and-swap the first time a thread records something, and are
+ * never freed so that the dump at exit can still read them.
+ */
+struct trace_ring {
+	struct trace_ring *next;
+	long tid;
+	unsigned int mask;
+	unsigned long head;
+	struct trace_event *events;
+};
+
+int spi_trace_enabled = 0;
+
+static const char *traceFile;
+static unsigned int ringSize = DEFAULT_EVENTS;
+static struct trace_ring *rings;
+static __thread struct trace_ring *threadRing;
+
+
+uint64_t spi_trace_now(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+}
+
+static struct trace_ring *get_ring(void) {
+
+	struct trace_ring *ring;
+
+	if (threadRing)
+		return threadRing;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring)
+		ring->events = calloc(ringSize, sizeof(struct trace_event));
+	if (!ring || !ring->events) {
+		fprintf(stderr, "spi trace: out of memory, tracing stopped\n");
+		spi_trace_enabled = 0;
+		free(ring);
+		return NULL;
+	}
+
+	ring->tid = syscall(SYS_gettid);
+	ring->mask = ringSize - 1;
+
+	ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	threadRing = ring;
+	return ring;
+
+}
+
+static struct trace_event *next_event(struct trace_ring *ring) {
+
+	return &ring->events[ring->head & ring->mask];
+
+}
+
+static void commit_event(struct trace_ring *ring) {
+
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+}
+
+void spi_trace_record(const char *name, uint64_t start, unsigned int address, unsigned int op, unsigned int size) {
+
+	uint64_t end = spi_trace_now();
+	struct trace_ring *ring = get_ring();
+	struct trace_event *ev;
+
+	if (!ring)
+		return;
+
+	ev = next_event(ring);
+	ev->name = name;
+	ev->start = start;
+	ev->end = end;
+	ev->address = address;
+	ev->op = op;
+	ev->size = size;
+	ev->value = -1;
+
+	commit_event(ring);
+
+}
+
+void spi_trace_counter(const char *name, unsigned int series, int value) {
+
+	struct trace_ring *ring;
+	struct trace_event *ev;
+
+	if (!spi_trace_enabled)
+		return;
+
+	ring = get_ring();
+	if (!ring)
+		return;
+
+	ev = next_event(ring);
+	ev->name = name;
+	ev->start = ev->end = spi_trace_now();
+	ev->address = series;
+	ev->op = SPI_TRACE_NONE;
+	ev->size = 0;
+	ev->value = value;
+
+	commit_event(ring);
+
+}
+
+static void write_event(FILE *f, long pid, long tid, const struct trace_event *ev, int *first) {
+
+	fprintf(f, "%s\n", *first ? "" : ",");
+	*first = 0;
+
+	if (ev->value >= 0) {
+		fprintf(f, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld,"
+			"\"args\":{\"%u\":%d}}",
+			ev->name, ev->start / 1000.0, pid, tid, ev->address, ev->value);
+		return;
+	}
+
+	fprintf(f, "{\"name\":\"%s\",\"cat\":\"spi\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+		"\"pid\":%ld,\"tid\":%ld,\"args\":{\"size\":%u",
+		ev->name, ev->start / 1000.0, (ev->end - ev->start) / 1000.0, pid, tid, ev->size);
+	if (ev->address != SPI_TRACE_NONE)
+		fprintf(f, ",\"address\":\"0x%06x\"", ev->address);
+	if (ev->op != SPI_TRACE_NONE)
+		fprintf(f, ",\"op\":\"0x%02x\"", ev->op);
+	fprintf(f, "}}");
+
+}
+
+void spi_trace_dump(void) {
+
+	FILE *f;
+	struct trace_ring *ring;
+	long pid = getpid();
+	int first = 1;
+	unsigned long total = 0, dropped = 0;
+
+	if (!traceFile)
+		return;
+
+	f = fopen(traceFile, "w");
+	if (!f) {
+		fprintf(stderr, "spi trace: can't write %s: %s\n", traceFile, strerror(errno));
+		return;
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	fprintf(f, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"args\":{\"name\":\"%s\"}}",
+		pid, program_invocation_short_name);
+	first = 0;
+
+	for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+		unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long i = head > ring->mask + 1 ? head - ring->mask - 1 : 0;
+
+		total += head - i;
+		dropped += i;
+
+		for (; i < head; i++)
+			write_event(f, pid, ring->tid, &ring->events[i & ring->mask], &first);
+	}
+
+	fprintf(f, "\n]}\n");
+	fclose(f);
+
+	fprintf(stderr, "spi trace: %lu events written to %s", total, traceFile);
+	if (dropped)
+		fprintf(stderr, ", %lu older events overwritten", dropped);
+	fprintf(stderr, "\n");
+
+	// Only dump once, even if called again at exit
+	traceFile = NULL;
+
+}
+
+// ^C would otherwise skip atexit and lose the trace.  The dump uses stdio,
+// which isn't async-signal-safe, but a trace that is usually written is
+// better than none.  Events being recorded when the signal came are left
+// out, they are only visible once committed.
+void spi_trace_stop(int sig) {
+
+	spi_trace_dump();
+
+	_exit(128 + sig);
+
+}
+
+// Only if the program doesn't handle the signal itself
+static void catch_signal(int sig) {
+
+	struct sigaction old;
+
+	if (sigaction(sig, NULL, &old) == 0 && old.sa_handler == SIG_DFL)
+		signal(sig, spi_trace_stop);
+
+}
+
+void spi_trace_init(void) {
+
+	const char *size;
+
+	if (traceFile || !getenv("SPI_TRACE"))
+		return;
+
+	traceFile = getenv("SPI_TRACE");
+
+	size = getenv("SPI_TRACE_EVENTS");
+	if (size && atoi(size) > 0) {
+		// Round up to a power of 2 so the ring index is a mask
+		ringSize = 1;
+		while (ringSize < (unsigned int)atoi(size) && ringSize < 0x40000000)
+			ringSize <<= 1;
+	}
+
+	atexit(spi_trace_dump);
+	catch_signal(SIGINT);
+	catch_signal(SIGTERM);
+	spi_trace_enabled = 1;
+
+}
@@ -0,0 +1,42 @@
+#ifndef SPITRACE_H
+#define SPITRACE_H
+
+#include <stdint.h>
+
+/*
+ * Opt-in tracing of SPI transfers.  Set SPI_TRACE to a file name and every
+ * traced call is recorded with CLOCK_MONOTONIC start time and duration,
+ * then written as Chrome trace JSON (chrome://tracing or ui.perfetto.dev)
+ * when the program exits, or is stopped with SIGINT or SIGTERM.
+ * SPI_TRACE_EVENTS sets how many events each thread keeps (default 65536);
+ * older events are overwritten.
+ *
+ * When SPI_TRACE is not set each traced call costs one test of
+ * spi_trace_enabled.
+ */
+
+// No address or opcode for this event
+#define SPI_TRACE_NONE 0xFFFFFFFFu
+
+extern int spi_trace_enabled;
+
+void spi_trace_init(void);
+uint64_t spi_trace_now(void);
+void spi_trace_record(const char *name, uint64_t start, unsigned int address, unsigned int op, unsigned int size);
+// Counter track, for example a GPIO level.  value must not be negative
+void spi_trace_counter(const char *name, unsigned int series, int value);
+void spi_trace_dump(void);
+// The SIGINT/SIGTERM handler, other handlers may replace it if they dump too
+void spi_trace_stop(int sig);
+
+// name must be a string constant, it is only saved as a pointer
+#define SPI_TRACE_BEGIN(start) \
+	uint64_t start = spi_trace_enabled ? spi_trace_now() : 0
+
+#define SPI_TRACE_END(start, name, address, op, size) \
+	do { \
+		if (spi_trace_enabled) \
+			spi_trace_record(name, start, address, op, size); \
+	} while (0)
+
+#endif
@@ -0,0 +1,271 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wbcache.h"
+
+/*
+ * Register cache for the control sequences the debug tools use.  audio-write
+ * writes the SDRAM address, data and control registers once per word and
+ * pulses the control register between a command and 0; with the cache the
+ * address and data writes are held back and go out in the same transfer as
+ * the command, and writes that don't change a register are dropped.
+ *
+ * The shadow only knows about our own writes, so it must only be enabled
+ * when one tool at a time drives the registers.
+ *
+ * WISHBONE_CACHE=1 turns it on with the policies below, a tool can change
+ * them with wb_cache_policy().  A summary is printed at spi_close().
+ */
+
+static struct {
+	unsigned char policy;
+	unsigned char valid;
+	// As on the wire, low byte first
+	unsigned char value[2];
+} regs[WB_CACHE_REGS] = {
+	[0] = { WB_REG_CACHED },		// ID
+	[1] = { WB_REG_COALESCE },		// SDRAM data, reads give the data read
+	[2] = { WB_REG_CACHED },		// SDRAM address high
+	[3] = { WB_REG_CACHED },		// SDRAM address low
+	[4] = { WB_REG_WRITE_THROUGH },		// SDRAM control
+	[27] = { WB_REG_WRITE_THROUGH },	// Stats control
+};
+
+int wb_cache_enabled = 0;
+
+static int initialised = 0;
+
+// Writes not sent yet, their values are in the shadow
+static unsigned int heldFirst, heldCount = 0;
+
+static unsigned char transfer[WB_CACHE_REGS * 2];
+
+static struct {
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long transfers;
+	unsigned long dropped;
+	unsigned long hits;
+} stats;
+
+extern int logipi_write(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc);
+extern int logipi_read(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc);
+
+
+static void forget(unsigned int address, unsigned int count) {
+
+	unsigned int i;
+
+	for (i = address; i < address + count && i < WB_CACHE_REGS; i++)
+		regs[i].valid = 0;
+
+}
+
+// Sends registers first to first + count - 1 from the shadow in one transfer
+static int send(unsigned int first, unsigned int count) {
+
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		memcpy(&transfer[i * 2], regs[first + i].value, 2);
+
+	stats.transfers++;
+
+	if (logipi_write(first, transfer, count * 2, 1) < 0) {
+		forget(first, count);
+		return -1;
+	}
+
+	return 0;
+}
+
+int wb_cache_flush(void) {
+
+	unsigned int count = heldCount;
+
+	if (count == 0)
+		return 0;
+
+	heldCount = 0;
+
+	return send(heldFirst, count);
+}
+
+static int unchanged(unsigned int reg, unsigned char * value) {
+
+	return regs[reg].valid && memcmp(regs[reg].value, value, 2) == 0;
+}
+
+int wb_cache_write(unsigned char * buffer, unsigned int length, unsigned int address) {
+
+	unsigned int first = address, count = length / 2, end, i;
+	int immediate = 0;
+
+	stats.writes++;
+
+	if (length == 0 || (length % 2) != 0 || address + count > WB_CACHE_REGS) {
+		if (wb_cache_flush() < 0)
+			return 0;
+		forget(address, (length + 1) / 2);
+		stats.transfers++;
+		return -1;
+	}
+
+	for (i = address; i < address + count; i++) {
+		if (regs[i].policy == WB_REG_VOLATILE) {
+			if (wb_cache_flush() < 0)
+				return 0;
+			forget(address, count);
+			stats.transfers++;
+			return -1;
+		}
+	}
+
+	// Drop registers at either end that already hold the value
+	while (count > 0 && unchanged(first, &buffer[(first - address) * 2])) {
+		first++;
+		count--;
+	}
+	while (count > 0 && unchanged(first + count - 1, &buffer[(first + count - 1 - address) * 2]))
+		count--;
+
+	if (count == 0) {
+		stats.dropped++;
+		return length;
+	}
+
+	end = first + count;
+
+	for (i = first; i < end; i++)
+		if (regs[i].policy == WB_REG_WRITE_THROUGH)
+			immediate = 1;
+
+	// Held back writes go first in the transfer, so they have to end where
+	// this one starts; otherwise they are sent on their own.  Writes that
+	// are held back merge with any that touch them.
+	if (heldCount > 0) {
+		if (immediate ? heldFirst + heldCount != first :
+				(first > heldFirst + heldCount || end < heldFirst)) {
+			if (wb_cache_flush() < 0)
+				return 0;
+		}
+	}
+
+	for (i = first; i < end; i++) {
+		memcpy(regs[i].value, &buffer[(i - address) * 2], 2);
+		regs[i].valid = 1;
+	}
+
+	if (heldCount > 0) {
+		if (heldFirst + heldCount > end)
+			end = heldFirst + heldCount;
+		if (heldFirst < first)
+			first = heldFirst;
+	}
+
+	if (immediate) {
+		heldCount = 0;
+		return send(first, end - first) < 0 ? 0 : length;
+	}
+
+	heldFirst = first;
+	heldCount = end - first;
+
+	return length;
+}
+
+int wb_cache_read(unsigned char * buffer, unsigned int length, unsigned int address) {
+
+	unsigned int count = length / 2, i;
+	int hit = 1;
+
+	stats.reads++;
+
+	if (length == 0 || (length % 2) != 0 || address + count > WB_CACHE_REGS) {
+		if (wb_cache_flush() < 0)
+			return 0;
+		stats.transfers++;
+		return -1;
+	}
+
+	for (i = address; i < address + count; i++)
+		if (regs[i].policy != WB_REG_CACHED || !regs[i].valid)
+			hit = 0;
+
+	if (hit) {
+		for (i = 0; i < count; i++)
+			memcpy(&buffer[i * 2], regs[address + i].value, 2);
+		stats.hits++;
+		return length;
+	}
+
+	if (wb_cache_flush() < 0)
+		return 0;
+
+	stats.transfers++;
+
+	if (logipi_read(address, buffer, length, 1) < 0)
+		return 0;
+
+	for (i = address; i < address + count; i++) {
+		if (regs[i].policy == WB_REG_CACHED) {
+			memcpy(regs[i].value, &buffer[(i - address) * 2], 2);
+			regs[i].valid = 1;
+		}
+	}
+
+	return length;
+}
+
+void wb_cache_policy(unsigned int address, unsigned int count, int policy) {
+
+	unsigned int i;
+
+	wb_cache_flush();
+
+	for (i = address; i < address + count && i < WB_CACHE_REGS; i++) {
+		regs[i].policy = policy;
+		regs[i].valid = 0;
+	}
+
+}
+
+// For tools that exit without spi_close()
+static void exit_flush(void) {
+
+	if (wb_cache_enabled)
+		wb_cache_flush();
+
+}
+
+void wb_cache_init(void) {
+
+	const char * env = getenv("WISHBONE_CACHE");
+
+	if (initialised)
+		return;
+	initialised = 1;
+
+	if (env == NULL || strcmp(env, "0") == 0)
+		return;
+
+	memset(&stats, 0, sizeof(stats));
+	wb_cache_enabled = 1;
+	atexit(exit_flush);
+
+}
+
+void wb_cache_close(void) {
+
+	if (!wb_cache_enabled)
+		return;
+
+	wb_cache_flush();
+	wb_cache_enabled = 0;
+
+	fprintf(stderr, "wishbone cache: %lu writes and %lu reads in %lu transfers, "
+		"%lu writes dropped, %lu reads from the cache\n",
+		stats.writes, stats.reads, stats.transfers, stats.dropped, stats.hits);
+
+}
@@ -0,0 +1,42 @@
+#ifndef WBCACHE_H
+#define WBCACHE_H
+
+/*
+ * Shadow of the Wishbone registers in front of wishbone_read and
+ * wishbone_write (see wbcache.c).  Off unless WISHBONE_CACHE is set.
+ *
+ * Policies, for 16-bit registers below WB_CACHE_REGS:
+ *   WB_REG_VOLATILE       every read and write goes to the FPGA
+ *   WB_REG_CACHED         only changed by our writes: reads come from the
+ *                         shadow once known, writes are held back
+ *   WB_REG_COALESCE       reads go to the FPGA, writes are held back
+ *   WB_REG_WRITE_THROUGH  reads go to the FPGA, writes are sent at once,
+ *                         in one transfer with held back writes to the
+ *                         registers just below
+ *
+ * Writes of the value last written are dropped for all but volatile
+ * registers.  Held back writes are merged into one auto-increment transfer
+ * and sent before the next access that goes to the FPGA, at
+ * wb_cache_flush() or at spi_close().
+ */
+
+#define WB_REG_VOLATILE		0
+#define WB_REG_CACHED		1
+#define WB_REG_COALESCE		2
+#define WB_REG_WRITE_THROUGH	3
+
+// Registers the cache covers, anything above is always volatile
+#define WB_CACHE_REGS	64
+
+extern int wb_cache_enabled;
+
+void wb_cache_init(void);
+void wb_cache_close(void);
+void wb_cache_policy(unsigned int address, unsigned int count, int policy);
+int wb_cache_flush(void);
+
+// Return -1 when the access isn't cached and has to be done directly
+int wb_cache_write(unsigned char * buffer, unsigned int length, unsigned int address);
+int wb_cache_read(unsigned char * buffer, unsigned int length, unsigned int address);
+
+#endif
@@ -0,0 +1,219 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spispeed.h"
+
+/*
+ * Finds the fastest SPI clock the Wishbone wrapper works at on this board
+ * and saves it (see spispeed.c), so that spi_init() uses it from then on.
+ *
+ * At each clock in spi_speed_steps it does a number of rounds of: an ID
+ * read, a pattern written to the SDRAM address registers and read back, and
+ * a pattern written to SDRAM through registers 1-4 and read back.  The
+ * clock one step below the fastest without errors is saved.
+ *
+ * The SDRAM test uses words above the 4 MB audio ring, so it is safe while
+ * audio is playing.  -r leaves SDRAM out altogether.
+ */
+
+#define REG_ID 0
+#define REG_SDRAM_DATA 1
+#define REG_SDRAM_ADDR_H 2
+#define REG_SDRAM_CTL 4
+
+// In 16-bit words, the audio ring ends at 0x200000
+#define SDRAM_TEST_ADDR 0x300000
+#define SDRAM_TEST_WORDS 16
+
+#define DEFAULT_ROUNDS 20
+
+extern int spi_init();
+extern void spi_close();
+extern int logipi_write(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc);
+extern int logipi_read(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc);
+extern unsigned long spi_speed;
+extern int wishbone_speed_fallback;
+extern const char * spi_speed_bus;
+
+static unsigned int pattern = 0x2545F491;
+
+
+// Pseudo-random 16-bit words, so that every bit changes often
+static unsigned int nextWord() {
+
+	pattern ^= pattern << 13;
+	pattern ^= pattern >> 17;
+	pattern ^= pattern << 5;
+
+	return pattern >> 16;
+}
+
+// Bytes that differ
+static unsigned int compare(unsigned char *a, unsigned char *b, unsigned int size) {
+
+	unsigned int i, errors = 0;
+
+	for (i = 0; i < size; i++) {
+		if (a[i] != b[i])
+			errors++;
+	}
+
+	return errors;
+}
+
+static void putWord(unsigned char *buffer, unsigned int value) {
+
+	buffer[0] = value & 0xFF;
+	buffer[1] = (value >> 8) & 0xFF;
+
+}
+
+// Writes a word to SDRAM and reads it back, returns the bytes that differ
+// or -1 if a transfer failed
+static int sdramWord(unsigned int address, unsigned int value) {
+
+	unsigned char buffer[8], zero[2] = { 0, 0 };
+
+	// Data, address and the write command in one auto-increment transfer
+	putWord(buffer, value);
+	putWord(buffer + 2, address >> 16);
+	putWord(buffer + 4, address & 0xFFFF);
+	putWord(buffer + 6, 3);
+
+	if (logipi_write(REG_SDRAM_DATA, buffer, 8, 1) < 0 || logipi_write(REG_SDRAM_CTL, zero, 2, 1) < 0)
+		return -1;
+
+	// Then address and the read command
+	putWord(buffer, address >> 16);
+	putWord(buffer + 2, address & 0xFFFF);
+	putWord(buffer + 4, 1);
+
+	if (logipi_write(REG_SDRAM_ADDR_H, buffer, 6, 1) < 0)
+		return -1;
+	usleep(10);
+	if (logipi_write(REG_SDRAM_CTL, zero, 2, 1) < 0 || logipi_read(REG_SDRAM_DATA, buffer + 2, 2, 1) < 0)
+		return -1;
+
+	putWord(buffer, value);
+
+	return compare(buffer, buffer + 2, 2);
+}
+
+// Bytes wrong at the current clock, or -1 if a transfer failed
+static int testClock(unsigned int rounds, int useSdram) {
+
+	unsigned char id[2] = { 0xad, 0xde }, sent[4], received[4];
+	unsigned int round, i;
+	int errors = 0, wrong;
+
+	for (round = 0; round < rounds; round++) {
+
+		if (logipi_read(REG_ID, received, 2, 1) < 0)
+			return -1;
+		errors += compare(id, received, 2);
+
+		// The address registers read back what was written
+		putWord(sent, nextWord());
+		putWord(sent + 2, nextWord());
+		if (logipi_write(REG_SDRAM_ADDR_H, sent, 4, 1) < 0 || logipi_read(REG_SDRAM_ADDR_H, received, 4, 1) < 0)
+			return -1;
+		errors += compare(sent, received, 4);
+
+		if (!useSdram)
+			continue;
+
+		for (i = 0; i < SDRAM_TEST_WORDS; i++) {
+			if ((wrong = sdramWord(SDRAM_TEST_ADDR + i, nextWord())) < 0)
+				return -1;
+			errors += wrong;
+		}
+	}
+
+	return errors;
+}
+
+int main(int argc, char ** argv){
+
+	unsigned char buffer[2];
+	unsigned int rounds = DEFAULT_ROUNDS, i;
+	int errors, useSdram = 1, best = -1, use, opt;
+
+	while ((opt = getopt(argc, argv, "n:r")) != -1) {
+		switch (opt) {
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 'r':
+			useSdram = 0;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n rounds per clock] [-r]\n", argv[0]);
+			fprintf(stderr, "  -r  only test registers, leave SDRAM alone\n");
+			return 1;
+		}
+	}
+
+	if (rounds < 1) {
+		fprintf(stderr, "Need at least 1 round per clock\n");
+		return 1;
+	}
+
+	spi_init();
+
+	wishbone_speed_fallback = 0;
+
+	spi_speed = spi_speed_steps[0];
+
+	if (logipi_read(REG_ID, buffer, 2, 1) < 0) {
+		fprintf(stderr, "SPI transfer failed\n");
+		spi_close();
+		return 1;
+	}
+
+	if (buffer[1] != 0xde || buffer[0] != 0xad) {
+		fprintf(stderr, "Invalid ID: 0x%02x%02x.  Did you load the FPGA?\n", buffer[1], buffer[0]);
+		spi_close();
+		exit(1);
+	}
+
+	for (i = 0; i < spi_speed_num_steps; i++) {
+
+		spi_speed = spi_speed_steps[i];
+
+		errors = testClock(rounds, useSdram);
+
+		// Not something a slower clock would fix, so nothing is saved
+		if (errors < 0) {
+			fprintf(stderr, "SPI transfer failed at %.1f MHz\n", spi_speed / 1e6);
+			spi_close();
+			return 1;
+		}
+
+		if (errors) {
+			printf("%5.1f MHz: %d bytes wrong\n", spi_speed / 1e6, errors);
+			break;
+		}
+
+		printf("%5.1f MHz: ok\n", spi_speed / 1e6);
+		best = i;
+	}
+
+	if (best < 0) {
+		fprintf(stderr, "The wrapper does not work reliably even at %.1f MHz\n", spi_speed_steps[0] / 1e6);
+		spi_close();
+		return 1;
+	}
+
+	// One step down, for margin
+	use = best > 0 ? best - 1 : 0;
+	spi_speed = spi_speed_steps[use];
+
+	printf("Fastest clock without errors is %.1f MHz, using %.1f MHz for board %s\n",
+		spi_speed_steps[best] / 1e6, spi_speed / 1e6, spi_board_id());
+
+	spi_close();
+
+	return spi_speed_save(spi_speed_bus, spi_speed);
+
+}
@@ -0,0 +1,109 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wblog.h"
+
+/*
+ * Prints a Wishbone log written with WISHBONE_RECORD, one transaction per
+ * line, then a profile of where the time went: transactions, bytes and
+ * time spent in transfers for each register address.
+ */
+
+// Addresses above this are counted together
+#define MAX_ADDRESS 256
+
+// Data bytes shown per transaction
+#define SHOW_BYTES 8
+
+static struct {
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long bytes;
+	unsigned long long us;
+} profile[MAX_ADDRESS + 1];
+
+static struct wb_log_record rec;
+
+
+int main(int argc, char ** argv){
+
+	FILE *f;
+	unsigned long speed, count = 0;
+	unsigned long long busy = 0, end = 0;
+	int summaryOnly = 0;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s")) != -1) {
+		switch (opt) {
+		case 's':
+			summaryOnly = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s] log\n  -s  only print the profile\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-s] log\n  -s  only print the profile\n", argv[0]);
+		return 1;
+	}
+
+	f = wb_log_open(argv[optind], &speed);
+	if (f == NULL)
+		return 1;
+
+	if (!summaryOnly)
+		printf("SPI clock %lu Hz\n\n        time      dur  op     address  size  data\n", speed);
+
+	memset(&rec, 0, sizeof(rec));
+
+	while (wb_log_next(f, &rec) == 0) {
+		unsigned int a = rec.address < MAX_ADDRESS ? rec.address : MAX_ADDRESS;
+
+		if (rec.flags & WBLOG_READ)
+			profile[a].reads++;
+		else
+			profile[a].writes++;
+		profile[a].bytes += rec.size;
+		profile[a].us += rec.duration_us;
+
+		busy += rec.duration_us;
+		end = rec.start_us + rec.duration_us;
+		count++;
+
+		if (summaryOnly)
+			continue;
+
+		printf("%10.6f %6llu us  %-5s%s 0x%04x %5u ",
+			rec.start_us / 1e6, rec.duration_us,
+			(rec.flags & WBLOG_READ) ? "read" : "write",
+			(rec.flags & WBLOG_INC) ? "+" : " ",
+			rec.address, rec.size);
+		for (i = 0; i < rec.size && i < SHOW_BYTES; i++)
+			printf(" %02x", rec.data[i]);
+		printf("%s\n", rec.size > SHOW_BYTES ? " ..." : "");
+	}
+
+	fclose(f);
+
+	printf("%s%lu transactions over %.3f s, %.3f s (%.1f%%) in transfers\n\n",
+		summaryOnly ? "" : "\n", count, end / 1e6, busy / 1e6, end ? 100.0 * busy / end : 0.0);
+
+	printf("address    reads   writes      bytes    time (ms)\n");
+	for (i = 0; i <= MAX_ADDRESS; i++) {
+		if (profile[i].reads == 0 && profile[i].writes == 0)
+			continue;
+		if (i == MAX_ADDRESS)
+			printf("higher ");
+		else
+			printf(" 0x%04x", i);
+		printf(" %8lu %8lu %10lu %12.3f\n",
+			profile[i].reads, profile[i].writes, profile[i].bytes, profile[i].us / 1e3);
+	}
+
+	return 0;
+
+}
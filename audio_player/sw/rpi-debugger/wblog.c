@@ -0,0 +1,379 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "wblog.h"
+#include "spitrace.h"
+
+/*
+ * Log of Wishbone transactions, written by logipi_read/logipi_write when
+ * WISHBONE_RECORD is set and played back in their place when
+ * WISHBONE_REPLAY is set.  Replaying a session checks that a tool still
+ * makes the same register accesses, without the board.
+ *
+ * The file starts with "WBLG", a version byte and the SPI clock.  Each
+ * transaction is then a flags byte (WBLOG_READ, WBLOG_INC) followed by
+ * variable length numbers (7 bits per byte, low bits first): time since
+ * the previous transaction started, duration, address and size, all times
+ * in us.  The data read or written follows.  A 2 byte register access
+ * takes about 8 bytes.
+ *
+ * A recording is buffered here and written with write(), so that a signal
+ * handler can flush it safely when the tool is stopped.
+ */
+
+#define WBLOG_VERSION 1
+
+// Room for the largest transaction: flags, 4 numbers and the data
+#define RECORD_MAX (1 + 4 * 10 + WBLOG_MAX_DATA)
+#define RECORD_BUFFER_SIZE (4 * RECORD_MAX)
+
+int wb_log_recording = 0;
+int wb_log_replaying = 0;
+
+static FILE * logFile;
+static const char * logName;
+static int initialised = 0;
+static int realTime = 0;
+
+static int recordFd = -1;
+static unsigned char recordBuffer[RECORD_BUFFER_SIZE];
+static unsigned int recordUsed = 0;
+static int writeFailed = 0;
+
+// Set while the buffer is being changed, a signal then only sets
+// stopPending and the tool stops once the change is complete
+static volatile sig_atomic_t inRecord = 0;
+static volatile sig_atomic_t stopPending = 0;
+
+static unsigned long count = 0;
+static unsigned long long firstStart, lastStart;
+static unsigned long long replayStart;
+
+static struct wb_log_record next;
+static int haveNext = 0;
+
+
+unsigned long long wb_log_now(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void record_number(unsigned long long value) {
+
+	while (value >= 0x80) {
+		recordBuffer[recordUsed++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	recordBuffer[recordUsed++] = value;
+
+}
+
+// Writes out the buffer.  Only uses write(), so it is safe in a signal
+// handler as long as the buffer is not being changed.
+static void record_flush(void) {
+
+	unsigned int done = 0;
+	ssize_t n;
+
+	while (done < recordUsed && !writeFailed) {
+		n = write(recordFd, recordBuffer + done, recordUsed - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			writeFailed = 1;
+		else
+			done += n;
+	}
+
+	recordUsed = 0;
+
+}
+
+static int get_number(FILE * f, unsigned long long * value) {
+
+	int c, shift = 0;
+
+	*value = 0;
+
+	do {
+		c = fgetc(f);
+		if (c == EOF || shift > 63)
+			return -1;
+		*value |= (unsigned long long)(c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+FILE * wb_log_open(const char * name, unsigned long * speed) {
+
+	FILE * f;
+	char magic[5];
+	unsigned long long value;
+
+	f = fopen(name, "rb");
+	if (f == NULL) {
+		perror(name);
+		return NULL;
+	}
+
+	if (fread(magic, 1, 5, f) != 5 || memcmp(magic, "WBLG", 4) != 0 ||
+			magic[4] != WBLOG_VERSION || get_number(f, &value)) {
+		fprintf(stderr, "%s is not a Wishbone log\n", name);
+		fclose(f);
+		return NULL;
+	}
+
+	if (speed)
+		*speed = value;
+
+	return f;
+}
+
+// Returns 0 with the next transaction in rec, or -1 at the end of the log.
+// rec must start zeroed, since start_us is added to for each transaction.
+int wb_log_next(FILE * f, struct wb_log_record * rec) {
+
+	unsigned long long delta, duration, address, size;
+	int c;
+
+	c = fgetc(f);
+	if (c == EOF)
+		return -1;
+
+	if (get_number(f, &delta) || get_number(f, &duration) ||
+			get_number(f, &address) || get_number(f, &size) ||
+			size > WBLOG_MAX_DATA || fread(rec->data, 1, size, f) != size) {
+		fprintf(stderr, "Wishbone log is cut short\n");
+		return -1;
+	}
+
+	rec->flags = c;
+	rec->start_us += delta;
+	rec->duration_us = duration;
+	rec->address = address;
+	rec->size = size;
+
+	return 0;
+}
+
+void wb_log_record(unsigned int flags, unsigned int address, unsigned char * data, unsigned int size,
+		unsigned long long start_us, unsigned long long end_us) {
+
+	inRecord = 1;
+
+	if (count == 0)
+		firstStart = lastStart = start_us;
+
+	if (recordUsed + RECORD_MAX > RECORD_BUFFER_SIZE)
+		record_flush();
+
+	recordBuffer[recordUsed++] = flags;
+	record_number(start_us - lastStart);
+	record_number(end_us - start_us);
+	record_number(address);
+	record_number(size);
+	memcpy(recordBuffer + recordUsed, data, size);
+	recordUsed += size;
+
+	lastStart = start_us;
+	count++;
+
+	inRecord = 0;
+
+	// Stopped while the transaction was being added
+	if (stopPending)
+		exit(128 + stopPending);
+
+}
+
+static void wait_until(unsigned long long us) {
+
+	unsigned long long now = wb_log_now();
+
+	if (now < us)
+		usleep(us - now);
+
+}
+
+static const char * describe(unsigned int flags) {
+
+	return (flags & WBLOG_READ) ? "read" : "write";
+}
+
+// Fails with a description of both transactions and exit status 2, so that
+// a replay can be used as a regression test
+static void mismatch(const char * what, unsigned int flags, unsigned int address, unsigned int size) {
+
+	fprintf(stderr, "wishbone replay: transaction %lu %s: log has %s of %u bytes at 0x%04x, "
+		"program did %s of %u bytes at 0x%04x\n",
+		count + 1, what,
+		describe(next.flags), next.size, next.address,
+		describe(flags), size, address);
+
+	exit(2);
+
+}
+
+int wb_log_replay(unsigned int flags, unsigned int address, unsigned char * data, unsigned int size) {
+
+	unsigned int i;
+
+	if (!haveNext) {
+		fprintf(stderr, "wishbone replay: program did %s of %u bytes at 0x%04x after the end of the log\n",
+			describe(flags), size, address);
+		exit(2);
+	}
+
+	if (next.flags != flags || next.address != address || next.size != size)
+		mismatch("differs", flags, address, size);
+
+	if (realTime) {
+		if (count == 0)
+			replayStart = wb_log_now() - next.start_us;
+		wait_until(replayStart + next.start_us);
+	}
+
+	if (flags & WBLOG_READ) {
+		memcpy(data, next.data, size);
+	} else {
+		for (i = 0; i < size; i++) {
+			if (data[i] != next.data[i]) {
+				fprintf(stderr, "wishbone replay: byte %u written is 0x%02x, log has 0x%02x\n",
+					i, data[i], next.data[i]);
+				mismatch("data differs", flags, address, size);
+			}
+		}
+	}
+
+	if (realTime)
+		wait_until(replayStart + next.start_us + next.duration_us);
+
+	count++;
+	haveNext = (wb_log_next(logFile, &next) == 0);
+
+	return 0;
+}
+
+static void close_log(void) {
+
+	unsigned long left = 0;
+
+	if (wb_log_recording) {
+		inRecord = 1;
+		record_flush();
+		if (close(recordFd))
+			writeFailed = 1;
+		if (writeFailed)
+			fprintf(stderr, "wishbone log: error writing %s, the log is incomplete\n", logName);
+		else
+			fprintf(stderr, "wishbone log: %lu transactions over %.3f s written to %s\n",
+				count, count ? (lastStart - firstStart) / 1e6 : 0.0, logName);
+	}
+
+	if (wb_log_replaying) {
+		while (haveNext) {
+			left++;
+			haveNext = (wb_log_next(logFile, &next) == 0);
+		}
+		fclose(logFile);
+		fprintf(stderr, "wishbone replay: %lu transactions matched %s", count, logName);
+		if (left)
+			fprintf(stderr, ", %lu more in the log were not used", left);
+		fprintf(stderr, "\n");
+	}
+
+	wb_log_recording = wb_log_replaying = 0;
+
+}
+
+// Writes the end of the log, and the SPI trace if there is one, when the
+// tool is stopped with ^C, unless the tool handles the signal itself.  In
+// the middle of a transaction that is left to wb_log_record, which exits
+// once it is done.
+static void stop_signal(int sig) {
+
+	if (inRecord) {
+		stopPending = sig;
+		return;
+	}
+
+	record_flush();
+	close(recordFd);
+
+	spi_trace_dump();
+
+	_exit(128 + sig);
+
+}
+
+static void catch_signal(int sig) {
+
+	struct sigaction old;
+
+	// spitrace's handler is replaced, stop_signal dumps the trace as well
+	if (sigaction(sig, NULL, &old) == 0 &&
+			(old.sa_handler == SIG_DFL || old.sa_handler == spi_trace_stop))
+		signal(sig, stop_signal);
+
+}
+
+// speed is the SPI clock, saved in the log.  Returns -1 if the log can't
+// be used.
+int wb_log_init(unsigned long speed) {
+
+	const char * record = getenv("WISHBONE_RECORD");
+	const char * replay = getenv("WISHBONE_REPLAY");
+	const char * replaySpeed = getenv("WISHBONE_REPLAY_SPEED");
+
+	if (initialised)
+		return 0;
+	initialised = 1;
+
+	if (record && replay) {
+		fprintf(stderr, "Only one of WISHBONE_RECORD and WISHBONE_REPLAY can be set\n");
+		return -1;
+	}
+
+	if (record) {
+		recordFd = open(record, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (recordFd < 0) {
+			perror(record);
+			return -1;
+		}
+		memcpy(recordBuffer, "WBLG", 4);
+		recordBuffer[4] = WBLOG_VERSION;
+		recordUsed = 5;
+		record_number(speed);
+
+		logName = record;
+		wb_log_recording = 1;
+		catch_signal(SIGINT);
+		catch_signal(SIGTERM);
+		atexit(close_log);
+	}
+
+	if (replay) {
+		logFile = wb_log_open(replay, NULL);
+		if (logFile == NULL)
+			return -1;
+
+		logName = replay;
+		realTime = (replaySpeed != NULL && strcmp(replaySpeed, "recorded") == 0);
+		haveNext = (wb_log_next(logFile, &next) == 0);
+		wb_log_replaying = 1;
+		atexit(close_log);
+	}
+
+	return 0;
+}
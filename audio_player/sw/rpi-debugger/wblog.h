@@ -0,0 +1,45 @@
+#ifndef WBLOG_H
+#define WBLOG_H
+
+#include <stdio.h>
+
+/*
+ * Recording and replay of Wishbone transactions (see wblog.c).
+ *
+ *   WISHBONE_RECORD=file    write every logipi_read/logipi_write to a
+ *                           new log in file
+ *   WISHBONE_REPLAY=file    don't open SPI at all: reads are served from
+ *                           the log and writes must match it
+ *   WISHBONE_REPLAY_SPEED   "recorded" to keep the recorded timing,
+ *                           otherwise replay runs as fast as it can
+ */
+
+#define WBLOG_READ	0x01
+#define WBLOG_INC	0x02
+
+// Largest transfer logipi_read/logipi_write can do
+#define WBLOG_MAX_DATA	32768
+
+struct wb_log_record {
+	unsigned int flags;
+	// Since the first transaction
+	unsigned long long start_us;
+	unsigned long long duration_us;
+	unsigned int address;
+	unsigned int size;
+	unsigned char data[WBLOG_MAX_DATA];
+};
+
+extern int wb_log_recording;
+extern int wb_log_replaying;
+
+int wb_log_init(unsigned long speed);
+unsigned long long wb_log_now(void);
+void wb_log_record(unsigned int flags, unsigned int address, unsigned char * data, unsigned int size,
+	unsigned long long start_us, unsigned long long end_us);
+int wb_log_replay(unsigned int flags, unsigned int address, unsigned char * data, unsigned int size);
+
+FILE * wb_log_open(const char * name, unsigned long * speed);
+int wb_log_next(FILE * f, struct wb_log_record * rec);
+
+#endif
@@ -0,0 +1,190 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include "spitrace.h"
+#include "wblog.h"
+#include "wbcache.h"
+#include "spispeed.h"
+
+/*
+ * Simulated spi_wishbone_wrapper and debug registers, for running the
+ * tools without a board.  It provides the same functions as spi.c, so
+ * linking with wishbone_sim.o instead gives a program that talks to this
+ * model (see the _sim targets in the Makefile).
+ *
+ * Messages are decoded like the wrapper does: a 3 byte header with the
+ * address, read/write and auto-increment bits, then 16-bit words low byte
+ * first.  Register 0 reads 0xDEAD and the rest read back what was last
+ * written.  Each message takes as long as it would on the wire plus the
+ * time for the kernel to start it.
+ *
+ * Environment:
+ *   WISHBONE_SIM_MESSAGE_US  time to start each message (default 20)
+ *   WISHBONE_SIM_SCALE       divide all times by this (default 1)
+ *   WISHBONE_SIM_MAX_SPEED   above this SPI clock in Hz, about one byte in
+ *                            WISHBONE_SIM_ERROR_RATE (default 2048) read
+ *                            or written has a bit flipped, like a marginal board
+ */
+
+#define SIM_REGS 256
+
+// Time for the kernel to start each SPI message
+#define SIM_MESSAGE_US 20
+
+int spi_fd ;
+unsigned long spi_speed = 32000000UL ;
+const unsigned long spi_default_speed = 32000000UL ;
+const char * spi_backend = "sim";
+// Kept apart from the real wrapper, so a simulated calibration never
+// changes the clock the hardware uses
+const char * spi_speed_bus = "wishbone-sim";
+
+static unsigned short regs[SIM_REGS];
+static unsigned int messageUs = SIM_MESSAGE_US;
+static unsigned int timeScale = 1;
+static unsigned long maxSpeed = 0;
+static unsigned int errorRate = 2048;
+
+static struct {
+	unsigned int messages;
+	unsigned int reads;
+	unsigned int writes;
+	unsigned long bytes;
+	unsigned int bitErrors;
+} stats;
+
+
+static uint64_t now_ns() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Flips a bit now and then when the clock is too fast
+static unsigned char sim_noise(unsigned char value) {
+
+	if (maxSpeed == 0 || spi_speed <= maxSpeed || rand() % errorRate != 0)
+		return value;
+
+	stats.bitErrors++;
+
+	return value ^ (1 << (rand() % 8));
+}
+
+// Spins rather than sleeping, since usleep() overshoots short waits by
+// more than the wait itself
+static void sim_wait(unsigned int bytes) {
+
+	uint64_t ns = (uint64_t)messageUs * 1000 + (uint64_t)bytes * 8 * 1000000000ULL / spi_speed;
+	uint64_t until = now_ns() + ns / timeScale;
+
+	while (now_ns() < until)
+		;
+
+}
+
+int spi_init(void) {
+
+	spi_trace_init();
+
+	spi_speed = spi_speed_load(spi_speed_bus, spi_default_speed);
+
+	if (wb_log_init(spi_speed) < 0)
+		return -1;
+
+	wb_cache_init();
+
+	if (getenv("WISHBONE_SIM_MESSAGE_US"))
+		messageUs = atoi(getenv("WISHBONE_SIM_MESSAGE_US"));
+
+	if (getenv("WISHBONE_SIM_SCALE") && atoi(getenv("WISHBONE_SIM_SCALE")) > 0)
+		timeScale = atoi(getenv("WISHBONE_SIM_SCALE"));
+
+	if (getenv("WISHBONE_SIM_MAX_SPEED"))
+		maxSpeed = strtoul(getenv("WISHBONE_SIM_MAX_SPEED"), NULL, 0);
+
+	if (getenv("WISHBONE_SIM_ERROR_RATE") && atoi(getenv("WISHBONE_SIM_ERROR_RATE")) > 0)
+		errorRate = atoi(getenv("WISHBONE_SIM_ERROR_RATE"));
+
+	memset(regs, 0, sizeof(regs));
+	regs[0] = 0xDEAD;
+
+	memset(&stats, 0, sizeof(stats));
+
+	// Anything but 0, which the wrapper takes to mean not open yet
+	spi_fd = 1;
+
+	return 1;
+}
+
+int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size) {
+
+	unsigned int address, inc, read, i;
+	unsigned char header[3];
+	SPI_TRACE_BEGIN(traceStart);
+
+	sim_wait(size);
+
+	stats.messages++;
+	stats.bytes += size;
+
+	if (size < 3) {
+		if (receive_buffer)
+			memset(receive_buffer, 0, size);
+		return 0;
+	}
+
+	memcpy(header, send_buffer, 3);
+
+	address = (header[0] << 14) | (header[1] << 6) | (header[2] >> 2);
+	inc = (header[2] >> 1) & 1;
+	read = header[2] & 1;
+
+	if (receive_buffer)
+		memset(receive_buffer, 0, 3);
+
+	for (i = 3; i + 1 < size; i += 2) {
+		unsigned int reg = address % SIM_REGS;
+
+		if (read) {
+			stats.reads++;
+			if (receive_buffer) {
+				receive_buffer[i] = sim_noise(regs[reg] & 0xFF);
+				receive_buffer[i + 1] = sim_noise(regs[reg] >> 8);
+			}
+		} else {
+			stats.writes++;
+			if (reg != 0)
+				regs[reg] = sim_noise(send_buffer[i]) | (sim_noise(send_buffer[i + 1]) << 8);
+			if (receive_buffer && receive_buffer != send_buffer)
+				memset(receive_buffer + i, 0, 2);
+		}
+
+		if (inc)
+			address++;
+	}
+
+	SPI_TRACE_END(traceStart, "spi_transfer", SPI_TRACE_NONE, SPI_TRACE_NONE, size);
+
+	return 0;
+}
+
+void spi_close(void) {
+
+	wb_cache_close();
+
+	fprintf(stderr, "wishbone sim: %u messages, %lu bytes, %u register reads, %u register writes\n",
+		stats.messages, stats.bytes, stats.reads, stats.writes);
+
+	if (stats.bitErrors)
+		fprintf(stderr, "wishbone sim: %u bit errors from running SPI at %lu Hz\n", stats.bitErrors, spi_speed);
+
+	spi_fd = 0;
+
+}
@@ -10,6 +10,10 @@
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
+#include "spitrace.h"
+#include "wblog.h"
+#include "wbcache.h"
+#include "spispeed.h"
 
 
 #define WR0(a, i)	((a >> 14) & 0x0FF)
@@ -22,128 +26,108 @@
 
 
 
-int spi_fd ;
-unsigned int fifo_size ;
-static const char * device = "/dev/spidev0.0";
-static unsigned int mode = 0 ;
-static unsigned int bits = 8 ;
-unsigned long spi_speed = 32000000UL ;
-static unsigned int delay = 0;
+extern int spi_fd ;
+extern unsigned long spi_speed ;
+extern const unsigned long spi_default_speed ;
+extern const char * spi_speed_bus ;
+
+// wbcalibrate turns this off to see the errors at each clock
+int wishbone_speed_fallback = 1 ;
+
+// The ID is checked on the first access and then every this many, in
+// case a calibrated clock stops working while a tool runs
+#define SPEED_CHECK_INTERVAL 4096
+static unsigned int accessesToCheck = 0 ;
 
 #define COM_BUFFER_SIZE 32768
 static unsigned char com_buffer [COM_BUFFER_SIZE] ;
 
 
-void spi_close(void) ;
-int spi_init(void) ;
-int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size);
+extern void spi_close(void) ;
+extern int spi_init(void) ;
+extern int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size);
 int logipi_write(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc);
 int logipi_read(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc);
 
-int spi_init(void){
-	int ret ;
-	spi_fd = open(device, O_RDWR);
-	if (spi_fd < 0){
-		printf("can't open device\n");
-		return -1 ;
-	}
-
-	ret = ioctl(spi_fd, SPI_IOC_WR_MODE, &mode);
-	if (ret == -1){
-		printf("can't set spi mode \n");
-		return -1 ;
-	}
-
-	ret = ioctl(spi_fd, SPI_IOC_RD_MODE, &mode);
-	if (ret == -1){
-		printf("can't get spi mode \n ");
-		return -1 ;
-	}
-
-	/*
-	 * bits per word
-	 */
-	ret = ioctl(spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
-	if (ret == -1){
-		printf("can't set bits per word \n");
-		return -1 ;
-	}
-
-	ret = ioctl(spi_fd, SPI_IOC_RD_BITS_PER_WORD, &bits);
-	if (ret == -1){
-		printf("can't get bits per word \n");
-		return -1 ;
-	}
-
-	/*
-	 * max speed hz
-	 */
-	ret = ioctl(spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &spi_speed);
-	if (ret == -1){
-		printf("can't set max speed hz \n");
-		return -1 ;
-	}
-
-	ret = ioctl(spi_fd, SPI_IOC_RD_MAX_SPEED_HZ, &spi_speed);
-	if (ret == -1){
-		printf("can't get max speed hz \n");
-		return -1 ;
-	}
-
-	return 1;
-}
-
-
-int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size)
-{
-	int ret ;
-	struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long)send_buffer,
-		.rx_buf = (unsigned long)receive_buffer,
-		.len = size,
-		.delay_usecs = delay,
-		.speed_hz = spi_speed,
-		.bits_per_word = bits,
-	};
-
-	ret = ioctl(spi_fd, SPI_IOC_MESSAGE(1), &tr);
-	if (ret < 1){
-		printf("can't send spi message  \n");
-		return -1 ;	
-	}
-	return 0;
-}
-
 int logipi_write(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc){
+	int ret ;
+	unsigned long long logStart = 0 ;
+	SPI_TRACE_BEGIN(traceStart);
+	if (wb_log_replaying)
+		return wb_log_replay(inc ? WBLOG_INC : 0, add, data, size);
+	if (wb_log_recording)
+		logStart = wb_log_now();
 	com_buffer[0] = WR0(add, inc) ;
 	com_buffer[1] = WR1(add, inc) ;
 	com_buffer[2] = WR2(add, inc) ;
 	memcpy(&com_buffer[3], data, size);
-	return spi_transfer(com_buffer, com_buffer , (size + 3));
+	ret = spi_transfer(com_buffer, com_buffer , (size + 3));
+	SPI_TRACE_END(traceStart, "logipi_write", add, SPI_TRACE_NONE, size);
+	if (wb_log_recording && ret == 0)
+		wb_log_record(inc ? WBLOG_INC : 0, add, data, size, logStart, wb_log_now());
+	return ret ;
 }
 
 
 int logipi_read(unsigned int add, unsigned char * data, unsigned int size, unsigned char inc){
 	int ret ;	
+	unsigned long long logStart = 0 ;
+	SPI_TRACE_BEGIN(traceStart);
+	if (wb_log_replaying)
+		return wb_log_replay(WBLOG_READ | (inc ? WBLOG_INC : 0), add, data, size);
+	if (wb_log_recording)
+		logStart = wb_log_now();
 	com_buffer[0] = RD0(add, inc) ;
 	com_buffer[1] = RD1(add, inc) ;
 	com_buffer[2] = RD2(add, inc) ;
 	ret = spi_transfer(com_buffer, com_buffer , (size + 3));
 	memcpy(data, &com_buffer[3], size);
+	SPI_TRACE_END(traceStart, "logipi_read", add, SPI_TRACE_NONE, size);
+	if (wb_log_recording && ret == 0)
+		wb_log_record(WBLOG_READ | (inc ? WBLOG_INC : 0), add, data, size, logStart, wb_log_now());
 	return ret ;
 }
 
 
-void spi_close(void){
-	close(spi_fd);
+// True if the ID register reads right, without logging or caching
+static int id_ok(void){
+	unsigned char buffer[5] = { RD0(0, 1), RD1(0, 1), RD2(0, 1), 0, 0 } ;
+	return spi_transfer(buffer, buffer, 5) == 0 && buffer[3] == 0xad && buffer[4] == 0xde ;
 }
 
+// If the ID is only right at the default clock, the calibration no longer
+// suits this board and the default is saved in its place
+static void check_speed(void){
+	unsigned long calibrated = spi_speed ;
+	if (accessesToCheck > 0){
+		accessesToCheck-- ;
+		return ;
+	}
+	accessesToCheck = SPEED_CHECK_INTERVAL ;
+	if (!wishbone_speed_fallback || wb_log_replaying || spi_speed <= spi_default_speed || id_ok())
+		return ;
+	spi_speed = spi_default_speed ;
+	if (id_ok()){
+		fprintf(stderr, "Wishbone ID is wrong at %.1f MHz, using %.1f MHz from now on\n",
+			calibrated / 1e6, spi_speed / 1e6);
+		spi_speed_save(spi_speed_bus, spi_speed);
+	} else {
+		// Not loaded, which is for the tool to report
+		spi_speed = calibrated ;
+	}
+}
 
 unsigned int wishbone_write(unsigned char * buffer, unsigned int length, unsigned int address){
 	unsigned int tr_size = 0, count = 0 ;
+	int ret ;
 	if(spi_fd == 0){
 		spi_init();
 	}
+	check_speed();
+	if(wb_cache_enabled){
+		ret = wb_cache_write(buffer, length, address);
+		if(ret >= 0) return ret ;
+	}
 	while(count < length){
                 tr_size = (length-count) < (COM_BUFFER_SIZE-3) ? (length-count) : (COM_BUFFER_SIZE-3) ;
 		if(logipi_write((address+count), &buffer[count], tr_size, 1) < 0) return 0;
@@ -154,9 +138,15 @@ unsigned int wishbone_write(unsigned char * buffer, unsigned int length, unsigne
 }
 unsigned int wishbone_read(unsigned char * buffer, unsigned int length, unsigned int address){
 	unsigned int tr_size = 0, count = 0 ;
+	int ret ;
 	if(spi_fd == 0){
 		spi_init();
 	}
+	check_speed();
+	if(wb_cache_enabled){
+		ret = wb_cache_read(buffer, length, address);
+		if(ret >= 0) return ret ;
+	}
 	while(count < length){
 		tr_size = (length-count) < (COM_BUFFER_SIZE-3) ? (length-count) : (COM_BUFFER_SIZE-3) ;
 		if(logipi_read((address+count), &buffer[count], tr_size, 1) < 0) return 0 ;
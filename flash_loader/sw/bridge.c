@@ -0,0 +1,275 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <fcntl.h>
+#include "spispeed.h"
+
+/*
+ * Loads spibridge.bit into the FPGA over slave serial, the same way
+ * logi_loader does, but without starting another process: the Pi's SPI
+ * clock and MOSI drive CCLK and DIN, and PROG_B, INIT_B, DONE and M1 are
+ * on the I2C expander.  Whatever design is running is never sent flash
+ * commands: the bridge is loaded first, unless the caller says the running
+ * design already connects the flash.
+ */
+
+// Expander pins, as used by logipi_loader on the R1.5 board
+#define PIN_MODE1 0x01
+#define PIN_INIT 0x02
+#define PIN_PROG 0x04
+#define PIN_DONE 0x08
+#define PIN_SPI_OE 0x10
+
+// How long to wait for INIT_B after PROG_B and for DONE at the end
+#define INIT_TIMEOUT_US 100000
+#define DONE_TIMEOUT_US 100000
+#define POLL_US 1000
+
+extern int spi_init();
+extern void spi_close();
+extern int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size);
+extern unsigned int spi_buffer_size(void);
+extern unsigned long spi_speed;
+extern const unsigned long spi_default_speed;
+extern const char * spi_speed_bus;
+
+extern int i2c_read_pins(unsigned char *value);
+extern int i2c_update_pins(unsigned char clear, unsigned char set);
+extern int i2c_disconnect_spi();
+
+
+// Polls the expander until pin reads as high, returns non-zero on timeout
+static int wait_pin(unsigned char pin, unsigned int timeout) {
+
+	unsigned char value;
+	unsigned int waited;
+
+	for (waited = 0; waited <= timeout; waited += POLL_US) {
+
+		if (i2c_read_pins(&value))
+			return 1;
+
+		if (value & pin)
+			return 0;
+
+		usleep(POLL_US);
+	}
+
+	return 1;
+}
+
+// Sends the bitstream in data to the FPGA, SPI must be open
+static int fpga_configure(unsigned char *data, unsigned int len) {
+
+	unsigned char dummy[16];
+	unsigned int chunk, maxChunk;
+
+	// Slave serial mode, SPI connected to CCLK and DIN, then pulse PROG_B
+	if (i2c_update_pins(PIN_SPI_OE | PIN_PROG, PIN_MODE1))
+		return 1;
+
+	usleep(1000);
+
+	if (i2c_update_pins(0, PIN_PROG))
+		return 1;
+
+	if (wait_pin(PIN_INIT, INIT_TIMEOUT_US)) {
+		fprintf(stderr, "FPGA did not come out of reset\n");
+		return 1;
+	}
+
+	memset(dummy, 0xFF, sizeof(dummy));
+
+	if (spi_transfer(dummy, dummy, sizeof(dummy))) {
+		fprintf(stderr, "Error sending bitstream\n");
+		return 1;
+	}
+
+	// As much as spidev will take in one message
+	maxChunk = spi_buffer_size();
+
+	while (len > 0) {
+
+		chunk = len < maxChunk ? len : maxChunk;
+
+		// Nothing useful comes back, so there is no receive buffer
+		if (spi_transfer(data, NULL, chunk)) {
+			fprintf(stderr, "Error sending bitstream\n");
+			return 1;
+		}
+
+		data += chunk;
+		len -= chunk;
+	}
+
+	// Extra clocks for the startup sequence
+	memset(dummy, 0xFF, sizeof(dummy));
+
+	if (spi_transfer(dummy, dummy, sizeof(dummy))) {
+		fprintf(stderr, "Error sending bitstream\n");
+		return 1;
+	}
+
+	if (wait_pin(PIN_DONE, DONE_TIMEOUT_US)) {
+		fprintf(stderr, "FPGA did not raise DONE, the bitstream was not accepted\n");
+		return 1;
+	}
+
+	// Back to master SPI so that the next reconfiguration comes from flash
+	return i2c_update_pins(PIN_MODE1, 0);
+}
+
+// Loads a .bit file into the FPGA, SPI must be open
+static int fpga_load(const char *filename) {
+
+	int inputFile, ret;
+	struct stat bitStat;
+	unsigned char *bitFileData;
+	unsigned int i, bitFileLen;
+
+	inputFile = open(filename, O_RDONLY);
+
+	if (inputFile < 0) {
+		fprintf(stderr, "Error opening file: %s\n", filename);
+		return 1;
+	}
+
+	if (fstat(inputFile, &bitStat) || bitStat.st_size < 4) {
+		fprintf(stderr, "Error getting file size: %s\n", filename);
+		close(inputFile);
+		return 1;
+	}
+
+	bitFileLen = bitStat.st_size;
+
+	bitFileData = mmap(NULL, bitFileLen, PROT_READ, MAP_PRIVATE, inputFile, 0);
+
+	close(inputFile);
+
+	if (bitFileData == MAP_FAILED) {
+		fprintf(stderr, "Error reading file: %s\n", filename);
+		return 1;
+	}
+
+	// Skip the .bit header, the FPGA only needs what follows the sync word
+	for (i = 0; i < bitFileLen - 4; i++) {
+
+		if (bitFileData[i] == 0xAA && bitFileData[i+1] == 0x99 && bitFileData[i+2] == 0x55 && bitFileData[i+3] == 0x66)
+			break;
+
+	}
+
+	if (i == bitFileLen - 4) {
+		fprintf(stderr, "Couldn't find sync word in bit file\n");
+		munmap(bitFileData, bitFileLen);
+		return 1;
+	}
+
+	ret = fpga_configure(bitFileData + i, bitFileLen - i);
+
+	munmap(bitFileData, bitFileLen);
+
+	return ret;
+}
+
+// True if the S25FL032P answers RDID
+static int flash_present(unsigned char *id) {
+
+	unsigned char spiBuffer[4];
+
+	memset(spiBuffer, 0, sizeof(spiBuffer));
+	memset(id, 0, 3);
+	spiBuffer[0] = 0x9F; // RDID
+
+	if (spi_transfer(spiBuffer, spiBuffer, 4)) {
+		fprintf(stderr, "Error communicating with flash\n");
+		return 0;
+	}
+
+	memcpy(id, spiBuffer + 1, 3);
+
+	return spiBuffer[1] == 0x01 && spiBuffer[2] == 0x02 && spiBuffer[3] == 0x15;
+}
+
+// As flash_present, but if the flash only answers at the default clock the
+// calibrated one is given up and the default saved in its place
+static int flash_present_fallback(unsigned char *id) {
+
+	unsigned long calibrated = spi_speed;
+
+	if (flash_present(id))
+		return 1;
+
+	if (spi_speed <= spi_default_speed)
+		return 0;
+
+	spi_speed = spi_default_speed;
+
+	if (!flash_present(id)) {
+		// Probably no bridge, so leave the clock alone
+		spi_speed = calibrated;
+		return 0;
+	}
+
+	fprintf(stderr, "Flash does not answer at %.1f MHz, using %.1f MHz from now on\n",
+		calibrated / 1e6, spi_speed / 1e6);
+	spi_speed_save(spi_speed_bus, spi_speed);
+
+	return 1;
+}
+
+/*
+ * Opens SPI with the flash reachable through the FPGA.  The bridge in
+ * bitFile is loaded first, or nothing if bitFile is NULL (the running
+ * design must provide the bridge, and DONE must be high).  Returns
+ * non-zero with SPI closed on error.
+ *
+ * spibridge is only wires, with nothing the Pi can read to tell it apart
+ * from another design, so whether it is still loaded is up to the caller.
+ */
+int bridge_open(const char *bitFile) {
+
+	unsigned char id[3];
+
+	unsigned char pins;
+
+	if (i2c_disconnect_spi())
+		return 1;
+
+	if (!bitFile) {
+
+		if (i2c_read_pins(&pins))
+			return 1;
+
+		if (!(pins & PIN_DONE)) {
+			fprintf(stderr, "The FPGA is not configured, leave out -k to load the bridge\n");
+			return 1;
+		}
+
+	}
+
+	if (spi_init())
+		return 1;
+
+	if (bitFile) {
+
+		printf("Load %s...\n", bitFile);
+
+		if (fpga_load(bitFile) || i2c_disconnect_spi()) {
+			spi_close();
+			return 1;
+		}
+
+	}
+
+	if (flash_present_fallback(id))
+		return 0;
+
+	fprintf(stderr, "Flash chip is not responding %02X %02X %02X\n", id[0], id[1], id[2]);
+	spi_close();
+
+	return 1;
+}
@@ -0,0 +1,154 @@
+#include <stdint.h>
+#include <string.h>
+#ifdef __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+#endif
+
+/*
+ * SHA-256 (FIPS 180-4) for identifying images on the flash, and CRC-32
+ * (the zlib/Ethernet polynomial) for the image records and for checking
+ * each page read back after programming.
+ *
+ * CRC-32 uses the ARMv8 CRC instructions when the compiler is allowed to,
+ * which the Makefile only does for aarch64 (64-bit Pi OS).  32-bit Pi OS
+ * also runs on ARMv7 Pis, which don't have them, so 32-bit builds and
+ * other machines use the table.
+ */
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t *state, const unsigned char *block) {
+
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = ((uint32_t)block[i*4] << 24) | ((uint32_t)block[i*4+1] << 16) |
+			((uint32_t)block[i*4+2] << 8) | block[i*4+3];
+
+	for (i = 16; i < 64; i++)
+		w[i] = w[i-16] + (ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3)) +
+			w[i-7] + (ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10));
+
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+
+}
+
+void sha256(const unsigned char *data, unsigned int len, unsigned char *hash) {
+
+	uint32_t state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	unsigned char block[64];
+	uint64_t bits = (uint64_t)len * 8;
+	unsigned int i, rest;
+
+	for (i = 0; i + 64 <= len; i += 64)
+		sha256_block(state, data + i);
+
+	// Padding: a one bit, zeros, then the length in bits
+	rest = len - i;
+	memset(block, 0, sizeof(block));
+	memcpy(block, data + i, rest);
+	block[rest] = 0x80;
+
+	if (rest >= 56) {
+		sha256_block(state, block);
+		memset(block, 0, sizeof(block));
+	}
+
+	for (i = 0; i < 8; i++)
+		block[56 + i] = bits >> (56 - i * 8);
+
+	sha256_block(state, block);
+
+	for (i = 0; i < 8; i++) {
+		hash[i*4] = state[i] >> 24;
+		hash[i*4+1] = state[i] >> 16;
+		hash[i*4+2] = state[i] >> 8;
+		hash[i*4+3] = state[i];
+	}
+
+}
+
+#ifdef __ARM_FEATURE_CRC32
+
+// ARMv8 has the same polynomial as an instruction, aarch64 builds only
+uint32_t crc32(const unsigned char *data, unsigned int len) {
+
+	uint32_t crc = 0xFFFFFFFF;
+	uint64_t word;
+
+	for (; len > 0 && ((uintptr_t)data & 7); len--)
+		crc = __crc32b(crc, *data++);
+
+	for (; len >= 8; len -= 8, data += 8) {
+		memcpy(&word, data, 8);
+		crc = __crc32d(crc, word);
+	}
+
+	for (; len > 0; len--)
+		crc = __crc32b(crc, *data++);
+
+	return ~crc;
+}
+
+#else
+
+static uint32_t crcTable[256];
+static int crcTableReady = 0;
+
+static void init_crc_table() {
+
+	uint32_t crc;
+	int i, bit;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		crcTable[i] = crc;
+	}
+
+	crcTableReady = 1;
+
+}
+
+uint32_t crc32(const unsigned char *data, unsigned int len) {
+
+	uint32_t crc = 0xFFFFFFFF;
+	unsigned int i;
+
+	if (!crcTableReady)
+		init_crc_table();
+
+	for (i = 0; i < len; i++)
+		crc = (crc >> 8) ^ crcTable[(crc ^ data[i]) & 0xFF];
+
+	return ~crc;
+}
+
+#endif
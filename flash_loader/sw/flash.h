@@ -0,0 +1,19 @@
+#ifndef FLASH_H
+#define FLASH_H
+
+/*
+ * The S25FL032P on the LogiPi (RDID 01 02 15), 32 Mbit.  Commands take
+ * 3 address bytes, so anything up to 16 MB could be addressed, but only
+ * the 4 MB that are there mean anything.
+ */
+
+#define FLASH_CHIP_SIZE (4*1024*1024)
+
+#define FLASH_SECTOR_SIZE (1<<16)
+#define FLASH_SUBSECTOR_SIZE (1<<12)
+#define FLASH_PAGE_SIZE (1<<8)
+
+// FAST_READ: command, 3 address bytes and a dummy byte
+#define FAST_READ_HEADER 5
+
+#endif
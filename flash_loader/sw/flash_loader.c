@@ -3,307 +3,1552 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <strings.h>
 #include <fcntl.h>
 #include <time.h>
+#include <stdint.h>
+#include "spispeed.h"
+#include "mcs_parser.h"
+#include "flash.h"
 
+// Largest image
 #define FLASH_SIZE (1024*1024)
 
-#define FLASH_SECTOR_SIZE (1<<16)
-#define FLASH_PAGE_SIZE (1<<8)
+#define SUBSECTORS_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_SUBSECTOR_SIZE)
+#define PAGES_PER_SUBSECTOR (FLASH_SUBSECTOR_SIZE / FLASH_PAGE_SIZE)
+
+// The S25FL032P only takes 4 KB erases in its 128 KB of parameter
+// sectors.  RDID does not say whether they are at the top or bottom, so
+// this assumes the bottom and each 4 KB erase is checked afterwards.
+#define FLASH_PARAM_END 0x20000
+
+#define ERASE_NONE 0
+#define ERASE_SUBSECTORS 1
+#define ERASE_SECTOR 2
+
+// Times to rewrite pages that fail verification, halving the SPI clock
+// (down to MIN_SPI_SPEED) each time after the first
+#define VERIFY_ROUNDS 4
+#define MIN_SPI_SPEED 1000000UL
+
+/*
+ * Images can go at address 0 on their own, or in MultiBoot slots.  With
+ * slots a header at address 0 tells the FPGA to load the update image and
+ * to fall back to the golden image if that fails.  The golden image starts
+ * right after the header's sector, so while the header is blank the FPGA
+ * reads on past it and loads the golden image.  The header is cleared
+ * before the update slot is touched and written again last.
+ */
+#define HEADER_ADDR 0
+#define GOLDEN_ADDR FLASH_SECTOR_SIZE
+#define UPDATE_ADDR (GOLDEN_ADDR + FLASH_SIZE)
+
+#define SLOT_SINGLE 0
+#define SLOT_GOLDEN 1
+#define SLOT_UPDATE 2
+#define NUM_SLOTS 3
+
+/*
+ * A one page record describing the image in a slot, kept in the last
+ * sectors of the chip, one sector per slot.  It is erased before anything
+ * else is changed and written once the image is complete, so a record on
+ * the flash always matches the image that is there.
+ *
+ *   0  "LPIM"
+ *   4  record version (1)
+ *   8  image length in bytes
+ *  12  image address
+ *  16  SHA-256 of the image
+ *  48  design name from the .bit header
+ * 112  part name
+ * 144  date
+ * 160  time
+ * 252  CRC-32 of bytes 0 to 251
+ *
+ * Numbers are big endian and strings are padded with zeros.
+ */
+#define META_ADDR (FLASH_CHIP_SIZE - FLASH_SECTOR_SIZE)
+#define META_SLOT_ADDR(slot) (META_ADDR - (slot) * FLASH_SECTOR_SIZE)
+#define META_VERSION 1
+#define META_CRC_OFFSET 252
+
+/*
+ * flash_loader -c keeps a test pattern in the sector below the image
+ * records.  At each clock in spi_speed_steps it reads RDID and the pattern
+ * CALIB_ROUNDS times, and the clock one step below the fastest without
+ * errors is saved for the board.
+ */
+#define CALIB_ADDR META_SLOT_ADDR(NUM_SLOTS)
+#define CALIB_LEN (16 * FLASH_PAGE_SIZE)
+#define CALIB_ROUNDS 20
+
+// Separate runs of data an .mcs file can have
+#define MCS_MAX_RANGES 256
 
-extern int spi_init();
 extern void spi_close();
 extern int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size);
+extern int spi_transfer_pair(unsigned char * first, unsigned int first_len, unsigned char * second, unsigned int second_len);
+extern int spi_transfer_read(unsigned char * cmd, unsigned int cmd_len, unsigned char * receive_buffer, unsigned int size);
+extern unsigned int spi_buffer_size(void);
+extern unsigned long spi_speed;
+extern const char * spi_speed_bus;
+
+extern void sha256(const unsigned char *data, unsigned int len, unsigned char *hash);
+extern uint32_t crc32(const unsigned char *data, unsigned int len);
+
+extern int bridge_open(const char *bitFile);
+
+
+static unsigned char spiBuffer[4096];
+static unsigned char subsectorBuffer[FLASH_SUBSECTOR_SIZE];
+
+static const char *slotNames[NUM_SLOTS] = { "single", "golden", "update" };
+static const unsigned int slotAddr[NUM_SLOTS] = { 0, GOLDEN_ADDR, UPDATE_ADDR };
+
+// What an .mcs file covers, relative to the image address
+static struct mcs_range mcsRanges[MCS_MAX_RANGES];
+static unsigned int mcsNumRanges = 0;
+
+
+struct image_info {
+	unsigned int length;
+	unsigned int address;
+	unsigned char hash[32];
+	char design[64];
+	char part[32];
+	char date[16];
+	char time[16];
+};
+
+
+/*
+ * How long the chip takes to finish a program or erase.  Typical and
+ * maximum times are from the S25FL032P datasheet (RDID 01 02 15).  The estimate starts at
+ * the typical time and follows what this chip actually does.
+ */
+struct flash_timing {
+	const char *operation;
+	unsigned int typical_us;
+	unsigned int timeout_us;
+	unsigned int estimate_us;
+};
+
+static struct flash_timing pageProgramTiming = { "write", 1500, 50000, 1500 };
+static struct flash_timing subsectorEraseTiming = { "erase", 200000, 2000000, 200000 };
+static struct flash_timing sectorEraseTiming = { "erase", 500000, 5000000, 500000 };
+static struct flash_timing bulkEraseTiming = { "erase", 32000000, 130000000, 32000000 };
+
+static uint64_t now_us() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Waits for WIP to clear after an operation that started at startTime
+static int flash_wait_ready(struct flash_timing *timing, uint64_t startTime) {
+
+	uint64_t elapsed;
+	unsigned int step, maxStep;
+
+	// Nothing to poll for until it is nearly done
+	elapsed = now_us() - startTime;
+	if (elapsed < timing->estimate_us * 3 / 4)
+		usleep(timing->estimate_us * 3 / 4 - elapsed);
+
+	// Then poll more and more slowly in case it is running long
+	step = timing->estimate_us / 32;
+	if (step < 20)
+		step = 20;
+	maxStep = timing->estimate_us / 4;
+	if (maxStep < step)
+		maxStep = step;
+
+	for (;;) {
+
+		spiBuffer[0] = 0x05; // RDSR (read status)
+
+		if (spi_transfer(spiBuffer, spiBuffer, 2)) {
+			fprintf(stderr, "Error communicating with flash\n");
+			return 1;
+		}
+
+		elapsed = now_us() - startTime;
+
+		if (!(spiBuffer[1] & 0x01)) // WIP (write in progres)
+			break;
+
+		if (elapsed > timing->timeout_us) {
+			fprintf(stderr, "Flash %s took too long\n", timing->operation);
+			return 1;
+		}
+
+		usleep(step);
+
+		step *= 2;
+		if (step > maxStep)
+			step = maxStep;
+	}
+
+	timing->estimate_us = (timing->estimate_us * 7 + elapsed) / 8;
+
+	return 0;
+}
+
+static int flash_erase(unsigned char command, unsigned int addr, struct flash_timing *timing) {
+
+	unsigned char wren = 0x06; // WREN (write enable)
+
+	spiBuffer[0] = command;
+
+	spiBuffer[1] = (addr >> 16) & 0xFF; // Address
+	spiBuffer[2] = (addr >> 8) & 0xFF;
+	spiBuffer[3] = addr & 0xFF;
+
+	// WE latch is disabled after every erase, so enable it in the same message
+	if (spi_transfer_pair(&wren, 1, spiBuffer, command == 0xC7 ? 1 : 4)) {
+		fprintf(stderr, "Error communicating with flash\n");
+		return 1;
+	}
+
+	return flash_wait_ready(timing, now_us());
+}
+
+static int flash_erase_subsector(unsigned int addr) {
+	return flash_erase(0x20, addr, &subsectorEraseTiming); // P4E (4 KB erase)
+}
+
+static int flash_erase_sector(unsigned int addr) {
+	return flash_erase(0xD8, addr, &sectorEraseTiming); // SE (sector erase)
+}
+
+static int flash_erase_bulk() {
+	return flash_erase(0xC7, 0, &bulkEraseTiming); // BE (bulk erase)
+}
+
+// Fills in a PP (page program) command for the page at addr
+static void flash_prepare_page(unsigned char *command, unsigned int addr, unsigned char *data) {
+
+	command[0] = 0x02; // PP (page program)
+
+	command[1] = (addr >> 16) & 0xFF; // Address
+	command[2] = (addr >> 8) & 0xFF;
+	command[3] = 0x00;
+
+	memcpy(command+4, data, FLASH_PAGE_SIZE);
+
+}
+
+// Sends WREN and PP together, the program cycle then runs on its own
+static int flash_start_program(unsigned char *command) {
+
+	unsigned char wren = 0x06; // WREN (write enable)
+
+	if (spi_transfer_pair(&wren, 1, command, 4 + FLASH_PAGE_SIZE)) {
+		fprintf(stderr, "Error communicating with flash\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+// Writes one page and waits for it
+static int flash_program_page(unsigned int addr, unsigned char *data) {
+
+	unsigned char command[4 + FLASH_PAGE_SIZE];
+
+	flash_prepare_page(command, addr, data);
+
+	if (flash_start_program(command))
+		return 1;
+
+	return flash_wait_ready(&pageProgramTiming, now_us());
+}
+
+static int flash_read(unsigned int addr, unsigned char *data, unsigned int len) {
+
+	unsigned char command[FAST_READ_HEADER];
+	unsigned int chunk, maxChunk;
+
+	// As much as spidev will take in one message
+	maxChunk = spi_buffer_size() - FAST_READ_HEADER;
+
+	while (len > 0) {
+
+		chunk = len < maxChunk ? len : maxChunk;
+
+		command[0] = 0x0B; // FAST_READ
+
+		command[1] = (addr >> 16) & 0xFF; // Address
+		command[2] = (addr >> 8) & 0xFF;
+		command[3] = addr & 0xFF;
+		command[4] = 0x00; // Dummy
+
+		if (spi_transfer_read(command, FAST_READ_HEADER, data, chunk)) {
+			fprintf(stderr, "Error communicating with flash\n");
+			return 1;
+		}
+
+		addr += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+static int is_blank(unsigned char *data, unsigned int len) {
+
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		if (data[i] != 0xFF)
+			return 0;
+	}
+
+	return 1;
+}
+
+// True if some bit has to go from 0 to 1, which only an erase can do
+static int needs_erase(unsigned char *current, unsigned char *wanted, unsigned int len) {
+
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		if ((current[i] & wanted[i]) != wanted[i])
+			return 1;
+	}
+
+	return 0;
+}
+
+static unsigned int bit_count(unsigned int mask) {
+
+	unsigned int count = 0;
+
+	for (; mask; mask >>= 1)
+		count += mask & 1;
+
+	return count;
+}
+
+/*
+ * Erase planning.  Only the first dataLen bytes matter, anything after
+ * the image is left as it is.  current is NULL when the flash was not
+ * read back, in which case everything in the image is erased.
+ */
+
+// Bit per 4 KB subsector of the sector that has to be erased
+static unsigned int subsectors_to_erase(unsigned int sector, unsigned char *current,
+		unsigned char *wanted, unsigned int dataLen) {
+
+	unsigned int j, addr, len, mask = 0;
+
+	for (j = 0; j < SUBSECTORS_PER_SECTOR; j++) {
+
+		addr = sector + j * FLASH_SUBSECTOR_SIZE;
+		if (addr >= dataLen)
+			break;
+
+		len = dataLen - addr;
+		if (len > FLASH_SUBSECTOR_SIZE)
+			len = FLASH_SUBSECTOR_SIZE;
+
+		if (!current || needs_erase(current + addr, wanted + addr, len))
+			mask |= 1 << j;
+	}
+
+	return mask;
+}
+
+// Pages in the sector to program once the subsectors in eraseMask are
+// erased, added to pages if it is not NULL
+static unsigned int pages_to_program(unsigned int sector, unsigned int eraseMask, unsigned char *current,
+		unsigned char *wanted, unsigned int dataLen, unsigned int *pages) {
+
+	unsigned int i, len, count = 0;
+
+	for (i = sector; i < sector + FLASH_SECTOR_SIZE && i < dataLen; i += FLASH_PAGE_SIZE) {
+
+		len = dataLen - i;
+		if (len > FLASH_PAGE_SIZE)
+			len = FLASH_PAGE_SIZE;
+
+		if (eraseMask & (1 << ((i - sector) / FLASH_SUBSECTOR_SIZE))) {
+			// Already reads back as 0xFF
+			if (is_blank(wanted + i, len))
+				continue;
+		}
+		else {
+			if (!current || memcmp(current + i, wanted + i, len) == 0)
+				continue;
+		}
+
+		if (pages)
+			pages[count] = i;
+		count++;
+
+	}
+
+	return count;
+}
+
+/*
+ * Reads the image back a sector at a time and compares the CRC-32 of each
+ * page with pageCrc.  Offsets of the pages that differ go in bad.  Returns
+ * the number of bad pages, or -1 if the flash could not be read.
+ */
+static int verify_pages(unsigned int imageAddr, unsigned int dataLen, uint32_t *pageCrc,
+		unsigned char *readBack, unsigned int *bad) {
+
+	unsigned int i, j, len, chunk, numBad = 0;
+
+	for (i = 0; i < dataLen; i += FLASH_SECTOR_SIZE) {
+
+		chunk = dataLen - i;
+		if (chunk > FLASH_SECTOR_SIZE)
+			chunk = FLASH_SECTOR_SIZE;
+
+		if (flash_read(imageAddr + i, readBack + i, chunk))
+			return -1;
+
+		for (j = i; j < i + chunk; j += FLASH_PAGE_SIZE) {
+
+			len = i + chunk - j;
+			if (len > FLASH_PAGE_SIZE)
+				len = FLASH_PAGE_SIZE;
+
+			if (crc32(readBack + j, len) != pageCrc[j / FLASH_PAGE_SIZE])
+				bad[numBad++] = j;
+		}
+	}
+
+	return numBad;
+}
+
+/*
+ * Writes bad pages again.  Each one is read a second time first, in case
+ * only the read went wrong.  A page with a bit that has to go back to 1
+ * needs its whole sector erased and written again.
+ */
+static int rewrite_pages(unsigned int imageAddr, unsigned char *wanted, unsigned char *readBack,
+		unsigned int dataLen, unsigned int *bad, unsigned int numBad) {
+
+	unsigned int i, j, len, sector, erasedSector = 0xFFFFFFFF;
+
+	for (i = 0; i < numBad; i++) {
+
+		sector = bad[i] & ~(FLASH_SECTOR_SIZE - 1);
+		if (sector == erasedSector)
+			continue;
+
+		len = dataLen - bad[i];
+		if (len > FLASH_PAGE_SIZE)
+			len = FLASH_PAGE_SIZE;
+
+		if (flash_read(imageAddr + bad[i], readBack + bad[i], len))
+			return 1;
+
+		if (memcmp(readBack + bad[i], wanted + bad[i], len) == 0)
+			continue;
+
+		if (!needs_erase(readBack + bad[i], wanted + bad[i], len)) {
+
+			if (flash_program_page(imageAddr + bad[i], wanted + bad[i]))
+				return 1;
+
+			continue;
+		}
+
+		if (flash_erase_sector(imageAddr + sector))
+			return 1;
+
+		erasedSector = sector;
+
+		for (j = sector; j < sector + FLASH_SECTOR_SIZE && j < dataLen; j += FLASH_PAGE_SIZE) {
+
+			len = dataLen - j;
+			if (len > FLASH_PAGE_SIZE)
+				len = FLASH_PAGE_SIZE;
+
+			if (!is_blank(wanted + j, len) && flash_program_page(imageAddr + j, wanted + j))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t get_be32(unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Pulls the design name, part, date and time out of the .bit header: a
+ * 2 byte length and that many bytes of magic, 2 more bytes, then fields
+ * of a one letter key, 2 byte length and a string.  Field 'e' is the
+ * bitstream itself.
+ */
+static void parse_bit_header(unsigned char *data, unsigned int len, struct image_info *info) {
+
+	unsigned int pos, fieldLen, size;
+	char *dest;
+
+	if (len < 2)
+		return;
+
+	pos = 2 + ((data[0] << 8) | data[1]) + 2;
+
+	while (pos + 3 <= len && data[pos] != 'e') {
+
+		fieldLen = (data[pos+1] << 8) | data[pos+2];
+
+		switch (data[pos]) {
+		case 'a': dest = info->design; size = sizeof(info->design); break;
+		case 'b': dest = info->part; size = sizeof(info->part); break;
+		case 'c': dest = info->date; size = sizeof(info->date); break;
+		case 'd': dest = info->time; size = sizeof(info->time); break;
+		default: dest = NULL; size = 0; break;
+		}
+
+		pos += 3;
+		if (pos + fieldLen > len)
+			break;
+
+		if (dest) {
+			if (fieldLen < size)
+				size = fieldLen + 1;
+			memcpy(dest, data + pos, size - 1);
+			dest[size - 1] = 0;
+		}
+
+		pos += fieldLen;
+	}
+
+}
+
+static void meta_encode(struct image_info *info, unsigned char *page) {
+
+	memset(page, 0, FLASH_PAGE_SIZE);
+
+	memcpy(page, "LPIM", 4);
+	put_be32(page + 4, META_VERSION);
+	put_be32(page + 8, info->length);
+	put_be32(page + 12, info->address);
+	memcpy(page + 16, info->hash, 32);
+	strncpy((char *)page + 48, info->design, 63);
+	strncpy((char *)page + 112, info->part, 31);
+	strncpy((char *)page + 144, info->date, 15);
+	strncpy((char *)page + 160, info->time, 15);
+	put_be32(page + META_CRC_OFFSET, crc32(page, META_CRC_OFFSET));
+
+}
+
+// Returns 0 if the page holds a valid record
+static int meta_decode(unsigned char *page, struct image_info *info) {
+
+	if (memcmp(page, "LPIM", 4) != 0 || get_be32(page + 4) != META_VERSION)
+		return 1;
+
+	if (get_be32(page + META_CRC_OFFSET) != crc32(page, META_CRC_OFFSET))
+		return 1;
+
+	memset(info, 0, sizeof(*info));
+
+	info->length = get_be32(page + 8);
+	info->address = get_be32(page + 12);
+	memcpy(info->hash, page + 16, 32);
+	memcpy(info->design, page + 48, sizeof(info->design) - 1);
+	memcpy(info->part, page + 112, sizeof(info->part) - 1);
+	memcpy(info->date, page + 144, sizeof(info->date) - 1);
+	memcpy(info->time, page + 160, sizeof(info->time) - 1);
+
+	return 0;
+}
+
+// Erases a slot's record unless its page is already blank
+static int meta_invalidate(int slot) {
+
+	if (flash_read(META_SLOT_ADDR(slot), subsectorBuffer, FLASH_PAGE_SIZE))
+		return 1;
+
+	if (is_blank(subsectorBuffer, FLASH_PAGE_SIZE))
+		return 0;
+
+	return flash_erase_sector(META_SLOT_ADDR(slot));
+}
+
+// Reads an image back and checks it against the SHA-256 in its record,
+// returns 0 if it matches
+static int image_check(struct image_info *info) {
+
+	unsigned char *data, hash[32];
+	int ret;
+
+	if (info->length > FLASH_SIZE)
+		return 1;
+
+	data = malloc(info->length);
+	if (!data) {
+		fprintf(stderr, "malloc error\n");
+		return 1;
+	}
+
+	ret = flash_read(info->address, data, info->length);
+	if (!ret) {
+		sha256(data, info->length, hash);
+		ret = memcmp(hash, info->hash, 32) != 0;
+	}
+
+	free(data);
+
+	return ret;
+}
+
+/*
+ * Spartan-6 MultiBoot header from UG380: after the sync word it sets the
+ * watchdog, the next image address in GENERAL1/2 and the fallback image
+ * in GENERAL3/4 (both read with FAST_READ), then issues IPROG.
+ */
+static void multiboot_header(unsigned char *page, unsigned int next, unsigned int fallback) {
+
+	unsigned short words[] = {
+		0xFFFF, 0xFFFF, // Dummy
+		0xAA99, 0x5566, // Sync
+		0x31E1, 0xFFFF, // CWDT (watchdog)
+		0x3261, next & 0xFFFF, // GENERAL1
+		0x3281, 0x0B00 | ((next >> 16) & 0xFF), // GENERAL2
+		0x32A1, fallback & 0xFFFF, // GENERAL3
+		0x32C1, 0x0B00 | ((fallback >> 16) & 0xFF), // GENERAL4
+		0x32E1, 0x0000, // GENERAL5
+		0x3301, 0x2100, // MODE_REG (new mode, x1 SPI)
+		0x3201, 0x001F, // HC_OPT_REG
+		0x30A1, 0x000E, // CMD IPROG
+		0x2000, 0x2000, 0x2000, 0x2000 // NOOP
+	};
+	unsigned int i;
+
+	memset(page, 0xFF, FLASH_PAGE_SIZE);
+
+	for (i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		page[i*2] = words[i] >> 8;
+		page[i*2+1] = words[i] & 0xFF;
+	}
+
+}
+
+// Clears the header's sector, after which the FPGA loads the golden image
+static int multiboot_erase_header() {
+
+	unsigned int i;
+
+	for (i = 0; i < FLASH_SECTOR_SIZE; i += FLASH_SUBSECTOR_SIZE) {
+
+		if (flash_read(HEADER_ADDR + i, subsectorBuffer, FLASH_SUBSECTOR_SIZE))
+			return 1;
+
+		// Anything left over from a single image could hold a sync word
+		if (!is_blank(subsectorBuffer, FLASH_SUBSECTOR_SIZE))
+			return flash_erase_sector(HEADER_ADDR);
+
+	}
+
+	return 0;
+}
+
+// Points the header at the update image.  The sync word is written last,
+// until then the FPGA skips the header and loads the golden image.
+static int multiboot_write_header(unsigned int next) {
+
+	unsigned char page[FLASH_PAGE_SIZE];
+
+	multiboot_header(page, next, GOLDEN_ADDR);
+
+	if (flash_read(HEADER_ADDR, subsectorBuffer, FLASH_PAGE_SIZE))
+		return 1;
+
+	if (memcmp(subsectorBuffer, page, FLASH_PAGE_SIZE) == 0)
+		return 0;
+
+	if (multiboot_erase_header())
+		return 1;
+
+	memset(page + 4, 0xFF, 4);
+
+	if (flash_program_page(HEADER_ADDR, page))
+		return 1;
+
+	multiboot_header(page, next, GOLDEN_ADDR);
+
+	return flash_program_page(HEADER_ADDR, page);
+}
+
+static void print_info(const char *title, struct image_info *info) {
+
+	unsigned int i;
+
+	printf("%s: %s, %s, %s %s, %u bytes, SHA-256 ", title, info->design[0] ? info->design : "(no name)",
+		info->part, info->date, info->time, info->length);
+
+	for (i = 0; i < 8; i++)
+		printf("%02x", info->hash[i]);
+
+	printf("...\n");
+
+}
+
+// Reads a .bit file and returns the data to put on the flash, padded to
+// whole sectors with 0xFF
+static unsigned char *load_bit_file(const char *filename, unsigned int *dataLen, struct image_info *info) {
+
+	int inputFile;
+	struct stat bitStat;
+	unsigned char *bitFileData, *startCfgPtr, *flashMemory;
+	unsigned int i, bitFileLen, flashDataLen, imageLen;
+
+	inputFile = open(filename, O_RDONLY);
+
+	if (inputFile < 0) {
+		fprintf(stderr, "Error opening file: %s\n", filename);
+		return NULL;
+	}
+
+	if (fstat(inputFile, &bitStat)) {
+		fprintf(stderr, "Error getting file size: %s\n", filename);
+		close(inputFile);
+		return NULL;
+	}
+
+	bitFileLen = bitStat.st_size;
+
+	if (bitFileLen > FLASH_SIZE) {
+		fprintf(stderr, "Bit file too large\n");
+		close(inputFile);
+		return NULL;
+	}
+
+	bitFileData = malloc(bitFileLen);
+	if (!bitFileData) {
+		fprintf(stderr, "malloc error\n");
+		close(inputFile);
+		return NULL;
+	}
+
+	if (read(inputFile, bitFileData, bitFileLen) != bitFileLen) {
+		fprintf(stderr, "Error while reading file: %s\n", filename);
+		close(inputFile);
+		return NULL;
+	}
+
+	close(inputFile);
+
+	printf("Bit file size: %i bytes\n", bitFileLen);
+
+
+	startCfgPtr = (unsigned char *)0xFFFFFFFF;
+
+	// Search for sych word
+	for (i = 0; i < bitFileLen-4; i++) {
+
+		if (bitFileData[i] == 0xAA && bitFileData[i+1] == 0x99 && bitFileData[i+2] == 0x55 && bitFileData[i+3] == 0x66) {
+			startCfgPtr = bitFileData + i;
+			break;
+		}
+
+	}
+
+	if (startCfgPtr == (unsigned char *)0xFFFFFFFF) {
+		fprintf(stderr, "Couldn't find sync word in bit file\n");
+		return NULL;
+	}
+
+	printf("Sync word found at 0x%x\n", (startCfgPtr-bitFileData));
+
+	// Start with 16 bytes of 0xFF then the rest of the bit file
+
+	flashDataLen = (bitFileLen - (startCfgPtr-bitFileData)) + 16;
+
+	// Whole sectors, the end reads back as 0xFF after an erase
+	imageLen = (flashDataLen + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+
+	flashMemory = malloc(imageLen);
+	if (!flashMemory) {
+		fprintf(stderr, "malloc error\n");
+		return NULL;
+	}
+
+	memset(flashMemory, 0xFF, imageLen);
+	memcpy(flashMemory+16, startCfgPtr, flashDataLen - 16);
+
+	memset(info, 0, sizeof(*info));
+	parse_bit_header(bitFileData, startCfgPtr - bitFileData, info);
+
+	info->length = flashDataLen;
+	info->address = 0;
+	sha256(flashMemory, flashDataLen, info->hash);
+
+	free(bitFileData);
+
+	*dataLen = flashDataLen;
+
+	return flashMemory;
+
+}
+
+/*
+ * Reads an .mcs file for the slot at imageAddr.  The file has flash
+ * addresses, so all of its data has to be inside the slot.  The image runs
+ * from imageAddr to the end of the last data; what the file leaves out is
+ * filled in from the flash by mcs_fill_gaps() once the bridge is open.
+ */
+static unsigned char *load_mcs_file(const char *filename, unsigned int imageAddr, unsigned int *dataLen, struct image_info *info) {
+
+	FILE *inputFile;
+	unsigned char *fileData, *flashMemory;
+	unsigned int i, endAddr, flashDataLen, imageLen;
+	const char *name;
+
+	inputFile = fopen(filename, "r");
+
+	if (!inputFile) {
+		fprintf(stderr, "Error opening file: %s\n", filename);
+		return NULL;
+	}
+
+	fileData = malloc(FLASH_CHIP_SIZE);
+	if (!fileData) {
+		fprintf(stderr, "malloc error\n");
+		fclose(inputFile);
+		return NULL;
+	}
+
+	memset(fileData, 0xFF, FLASH_CHIP_SIZE);
+
+	if (parseMCS(inputFile, fileData, FLASH_CHIP_SIZE, mcsRanges, MCS_MAX_RANGES, &mcsNumRanges, &endAddr)) {
+		fprintf(stderr, "Error reading MCS file: %s\n", filename);
+		fclose(inputFile);
+		free(fileData);
+		return NULL;
+	}
+
+	fclose(inputFile);
+
+	if (mcsNumRanges == 0) {
+		fprintf(stderr, "No data in MCS file: %s\n", filename);
+		free(fileData);
+		return NULL;
+	}
+
+	for (i = 0; i < mcsNumRanges; i++) {
+
+		if (mcsRanges[i].start < imageAddr || mcsRanges[i].start + mcsRanges[i].length > imageAddr + FLASH_SIZE) {
+			fprintf(stderr, "MCS file has data at 0x%06X-0x%06X, outside the slot at 0x%06X-0x%06X\n",
+				mcsRanges[i].start, mcsRanges[i].start + mcsRanges[i].length - 1, imageAddr, imageAddr + FLASH_SIZE - 1);
+			free(fileData);
+			return NULL;
+		}
+
+		mcsRanges[i].start -= imageAddr;
+
+	}
+
+	flashDataLen = endAddr - imageAddr;
+
+	printf("MCS file: %u bytes in %u ranges\n", flashDataLen, mcsNumRanges);
+
+	imageLen = (flashDataLen + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+
+	flashMemory = malloc(imageLen);
+	if (!flashMemory) {
+		fprintf(stderr, "malloc error\n");
+		free(fileData);
+		return NULL;
+	}
+
+	memset(flashMemory, 0xFF, imageLen);
+	memcpy(flashMemory, fileData + imageAddr, flashDataLen);
+
+	free(fileData);
+
+	// There is no .bit header, so the record gets the file name
+	name = strrchr(filename, '/');
+	memset(info, 0, sizeof(*info));
+	snprintf(info->design, sizeof(info->design), "%s", name ? name + 1 : filename);
+
+	info->length = flashDataLen;
+	info->address = imageAddr;
+
+	*dataLen = flashDataLen;
+
+	return flashMemory;
+
+}
+
+// Puts the flash contents in the gaps of an .mcs image, so that writing it
+// leaves them as they are, and works out the image hash
+static int mcs_fill_gaps(unsigned int imageAddr, unsigned char *flashMemory, unsigned int dataLen, struct image_info *info) {
+
+	unsigned char *current;
+	unsigned int i;
+
+	current = malloc(dataLen);
+	if (!current) {
+		fprintf(stderr, "malloc error\n");
+		return 1;
+	}
 
-extern int i2c_disconnect_spi();
+	if (flash_read(imageAddr, current, dataLen)) {
+		free(current);
+		return 1;
+	}
 
-int main(int argc, char **argv) {
+	for (i = 0; i < mcsNumRanges; i++)
+		memcpy(current + mcsRanges[i].start, flashMemory + mcsRanges[i].start, mcsRanges[i].length);
 
-	int inputFile;
-	struct stat bitStat;
-	unsigned char spiBuffer[1024];
-	unsigned char *bitFileData, *startCfgPtr, *flashMemory;
-	unsigned int i, bitFileLen, flashDataLen;
-	int ret;
-	time_t startTime, currentTime;
+	memcpy(flashMemory, current, dataLen);
+	free(current);
 
+	sha256(flashMemory, dataLen, info->hash);
 
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s filename.bit\n", argv[0]);
-		return 1;
-	}
+	return 0;
+}
 
-	inputFile = open(argv[1], O_RDONLY);
+// Pseudo-random, so that every bit changes often and no two pages match
+static void calib_pattern(unsigned char *data) {
 
-	if (inputFile < 0) {
-		fprintf(stderr, "Error opening file: %s\n", argv[1]);
-		return 1;
+	uint32_t x = 0x2545F491;
+	unsigned int i;
+
+	for (i = 0; i < CALIB_LEN; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		data[i] = x >> 24;
 	}
 
-	if (fstat(inputFile, &bitStat)) {
-		fprintf(stderr, "Error getting file size: %s\n", argv[1]);
-		close(inputFile);
-		return 1;
+}
+
+// Bytes wrong in CALIB_ROUNDS of RDID and reading the pattern back, or -1
+// if a transfer failed
+static int calib_errors(unsigned char *pattern, unsigned char *readBack) {
+
+	unsigned int round, i;
+	int errors = 0;
+
+	for (round = 0; round < CALIB_ROUNDS; round++) {
+
+		memset(spiBuffer, 0, 4);
+		spiBuffer[0] = 0x9F; // RDID
+
+		if (spi_transfer(spiBuffer, spiBuffer, 4))
+			return -1;
+
+		errors += (spiBuffer[1] != 0x01) + (spiBuffer[2] != 0x02) + (spiBuffer[3] != 0x15);
+
+		if (flash_read(CALIB_ADDR, readBack, CALIB_LEN))
+			return -1;
+
+		for (i = 0; i < CALIB_LEN; i++) {
+			if (readBack[i] != pattern[i])
+				errors++;
+		}
 	}
 
-	bitFileLen = bitStat.st_size;
+	return errors;
+}
 
-	if (bitFileLen > FLASH_SIZE) {
-		fprintf(stderr, "Bit file too large\n");
-		close(inputFile);
+// Finds the fastest SPI clock that reads the flash reliably and saves it
+static int calibrate_clock(void) {
+
+	unsigned char pattern[CALIB_LEN], readBack[CALIB_LEN];
+	unsigned int i;
+	int errors, best = -1, use;
+
+	calib_pattern(pattern);
+
+	// The pattern is checked and written at the slowest clock
+	spi_speed = spi_speed_steps[0];
+
+	if (flash_read(CALIB_ADDR, readBack, CALIB_LEN))
 		return 1;
+
+	if (memcmp(readBack, pattern, CALIB_LEN) != 0) {
+
+		printf("Write test pattern at 0x%06X...\n", CALIB_ADDR);
+
+		if (flash_erase_sector(CALIB_ADDR))
+			return 1;
+
+		for (i = 0; i < CALIB_LEN; i += FLASH_PAGE_SIZE) {
+			if (flash_program_page(CALIB_ADDR + i, pattern + i))
+				return 1;
+		}
+
 	}
 
-	bitFileData = malloc(bitFileLen);
-	if (!bitFileData) {
-		fprintf(stderr, "malloc error\n");
-		close(inputFile);
-		return 1;
+	for (i = 0; i < spi_speed_num_steps; i++) {
+
+		spi_speed = spi_speed_steps[i];
+
+		errors = calib_errors(pattern, readBack);
+
+		// Not something a slower clock would fix, so nothing is saved
+		if (errors < 0) {
+			fprintf(stderr, "SPI transfer failed at %.1f MHz\n", spi_speed / 1e6);
+			return 1;
+		}
+
+		if (errors) {
+			printf("%5.1f MHz: %d bytes wrong\n", spi_speed / 1e6, errors);
+			break;
+		}
+
+		printf("%5.1f MHz: ok\n", spi_speed / 1e6);
+		best = i;
 	}
 
-	if (read(inputFile, bitFileData, bitFileLen) != bitFileLen) {
-		fprintf(stderr, "Error while reading file: %s\n", argv[1]);
-		close(inputFile);
+	if (best < 0) {
+		fprintf(stderr, "The flash does not read back reliably even at %.1f MHz\n", spi_speed_steps[0] / 1e6);
 		return 1;
 	}
 
-	close(inputFile);
+	// One step down, for margin
+	use = best > 0 ? best - 1 : 0;
+	spi_speed = spi_speed_steps[use];
 
-	printf("Bit file size: %i bytes\n", bitFileLen);
+	printf("Fastest clock without errors is %.1f MHz, using %.1f MHz for board %s\n",
+		spi_speed_steps[best] / 1e6, spi_speed / 1e6, spi_board_id());
 
+	return spi_speed_save(spi_speed_bus, spi_speed);
+}
 
-	startCfgPtr = (unsigned char *)0xFFFFFFFF;
+static void usage(const char *name) {
+
+	fprintf(stderr, "Usage: %s [-d] [-b] [-f] [-k] [-s slot] filename.bit|filename.mcs\n", name);
+	fprintf(stderr, "       %s -v [-s slot] [filename.bit|filename.mcs]\n", name);
+	fprintf(stderr, "       %s -c [-k]\n", name);
+	fprintf(stderr, "  -d   Only erase and write the parts of the flash that are different\n");
+	fprintf(stderr, "  -b   Allow erasing the whole chip if that is quicker (loses anything after the image)\n");
+	fprintf(stderr, "  -f   Write the image even if the flash says it already has it\n");
+	fprintf(stderr, "  -v   Check the flash against its image record, and against the file if given\n");
+	fprintf(stderr, "  -k   Keep the running design, it already connects the flash to the Pi's SPI.\n");
+	fprintf(stderr, "       For several runs of flash_loader or flash_read in a row, leave -k off the\n");
+	fprintf(stderr, "       first to load spibridge.bit and add it to the rest.\n");
+	fprintf(stderr, "  -c   Find the fastest SPI clock that works on this board and use it from now on\n");
+	fprintf(stderr, "  -s   single (default): one image at address 0\n");
+	fprintf(stderr, "       golden: MultiBoot fallback image, write this once\n");
+	fprintf(stderr, "       update: MultiBoot image, the golden image loads if writing it is interrupted\n");
+	fprintf(stderr, "An .mcs file has flash addresses, its data must be inside the slot.  Parts of\n");
+	fprintf(stderr, "the slot it has no data for keep what the flash has.\n");
 
-	// Search for sych word
-	for (i = 0; i < bitFileLen-4; i++) {
+}
 
-		if (bitFileData[i] == 0xAA && bitFileData[i+1] == 0x99 && bitFileData[i+2] == 0x55 && bitFileData[i+3] == 0x66) {
-			startCfgPtr = bitFileData + i;
+int main(int argc, char **argv) {
+
+	unsigned char *flashMemory = NULL, *flashCurrent = NULL;
+	unsigned char metaPage[FLASH_PAGE_SIZE];
+	char title[32];
+	struct image_info newInfo, slotInfo[NUM_SLOTS];
+	int haveRecord[NUM_SLOTS];
+	unsigned int i, j, sector, imageAddr, flashDataLen = 0, imageLen = 0, numSectors;
+	unsigned int bytesProgrammed = 0, sectorsSkipped = 0;
+	unsigned int subsectorsErased = 0, sectorsErased = 0, bulkErased = 0;
+	unsigned int *pages, numPages = 0;
+	unsigned int *badPages;
+	unsigned char *readBack;
+	uint32_t *pageCrc;
+	int numBad, round;
+	unsigned char pageBuffer[2][4 + FLASH_PAGE_SIZE];
+	unsigned char *eraseType;
+	unsigned short *eraseMask;
+	uint64_t startTime, programStart, subsectorCost, sectorCost, planCost, bulkCost;
+	double elapsed;
+	size_t len;
+	int ret, opt, isMcs = 0, diffMode = 0, allowBulk = 0, force = 0, verify = 0, keepDesign = 0, calibrate = 0, slot = SLOT_SINGLE;
+
+
+	while ((opt = getopt(argc, argv, "dbfvkcs:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			diffMode = 1;
+			break;
+		case 'b':
+			allowBulk = 1;
+			break;
+		case 'f':
+			force = 1;
+			break;
+		case 'v':
+			verify = 1;
+			break;
+		case 'k':
+			keepDesign = 1;
+			break;
+		case 'c':
+			calibrate = 1;
+			break;
+		case 's':
+			for (slot = 0; slot < NUM_SLOTS; slot++) {
+				if (strcmp(optarg, slotNames[slot]) == 0)
+					break;
+			}
+			if (slot == NUM_SLOTS) {
+				fprintf(stderr, "Unknown slot: %s\n", optarg);
+				return 1;
+			}
 			break;
+		default:
+			usage(argv[0]);
+			return 1;
 		}
-
 	}
 
-	if (startCfgPtr == (unsigned char *)0xFFFFFFFF) {
-		fprintf(stderr, "Couldn't find sync word in bit file\n");
+	if (optind >= argc && !verify && !calibrate) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	printf("Sync word found at 0x%x\n", (startCfgPtr-bitFileData));
+	imageAddr = slotAddr[slot];
 
-	// Start with 16 bytes of 0xFF then the rest of the bit file
+	if (optind < argc) {
 
-	flashDataLen = (bitFileLen - (startCfgPtr-bitFileData)) + 16;
+		len = strlen(argv[optind]);
+		isMcs = len > 4 && strcasecmp(argv[optind] + len - 4, ".mcs") == 0;
+
+		if (isMcs)
+			flashMemory = load_mcs_file(argv[optind], imageAddr, &flashDataLen, &newInfo);
+		else
+			flashMemory = load_bit_file(argv[optind], &flashDataLen, &newInfo);
+
+		if (!flashMemory)
+			return 1;
+
+		imageLen = (flashDataLen + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
 
-	flashMemory = malloc(flashDataLen);
-	if (!flashMemory) {
-		fprintf(stderr, "malloc error\n");
-		return 1;
 	}
 
-	memset(flashMemory, 0xFF, 16);
-	memcpy(flashMemory+16, startCfgPtr, flashDataLen - 16);
+	newInfo.address = imageAddr;
 
-	free(bitFileData);
+	// Erasing the whole chip would take the golden image with it
+	if (slot != SLOT_SINGLE)
+		allowBulk = 0;
 
 
-	ret = system("/usr/bin/logi_loader spibridge.bit");
-	if (ret != 1<<8) {
-		fprintf(stderr, "Error loading spibridge.bit, return code: %d\n", ret);
+	// With -k the running design already connects the flash to the Pi,
+	// so it carries on while the image is written
+	if (bridge_open(keepDesign ? NULL : "spibridge.bit"))
 		return 1;
+
+	if (calibrate) {
+		ret = calibrate_clock();
+		spi_close();
+		return ret;
 	}
 
-	if (i2c_disconnect_spi())
-		return 1;
+	for (i = 0; i < NUM_SLOTS; i++) {
 
-	if (spi_init())
-		return 1;
+		if (flash_read(META_SLOT_ADDR(i), metaPage, FLASH_PAGE_SIZE)) {
+			spi_close();
+			return 1;
+		}
 
-	memset(spiBuffer, 0, sizeof(spiBuffer));
-	spiBuffer[0] = 0x9F; // RDID
+		haveRecord[i] = meta_decode(metaPage, &slotInfo[i]) == 0 && slotInfo[i].address == slotAddr[i];
+
+		if (haveRecord[i]) {
+			snprintf(title, sizeof(title), "On flash (%s)", slotNames[i]);
+			print_info(title, &slotInfo[i]);
+		}
 
-	if (spi_transfer(spiBuffer, spiBuffer, 4)) {
-		fprintf(stderr, "Error communicating with flash\n");
-		spi_close();
-		return 1;
 	}
 
-	if (spiBuffer[1] != 0x01 || spiBuffer[2] != 0x02 || spiBuffer[3] != 0x15) {
-		fprintf(stderr, "Flash chip is not responding %02X %02X %02X\n", spiBuffer[1], spiBuffer[2], spiBuffer[3]);
+	if (isMcs && mcs_fill_gaps(imageAddr, flashMemory, flashDataLen, &newInfo)) {
 		spi_close();
 		return 1;
 	}
 
-/*
-	spiBuffer[0] = 0x06; // WREN (write enable)
+	if (verify) {
 
-	if (spi_transfer(spiBuffer, spiBuffer, 1)) {
-		fprintf(stderr, "Error communicating with flash\n");
+		if (!haveRecord[slot]) {
+			fprintf(stderr, "No image record for the %s slot\n", slotNames[slot]);
+			spi_close();
+			return 1;
+		}
+
+		startTime = now_us();
+
+		ret = image_check(&slotInfo[slot]);
+
+		spi_close();
+
+		if (ret) {
+			fprintf(stderr, "Flash contents do not match the record\n");
+			return 1;
+		}
+
+		printf("Flash contents match the record (%.2f s)\n", (now_us() - startTime) / 1e6);
+
+		if (flashMemory && (slotInfo[slot].length != newInfo.length || memcmp(slotInfo[slot].hash, newInfo.hash, 32) != 0)) {
+			fprintf(stderr, "Flash has a different image to %s\n", argv[optind]);
+			return 1;
+		}
+
+		return 0;
+
+	}
+
+	if (slot == SLOT_UPDATE && !haveRecord[SLOT_GOLDEN]) {
+		fprintf(stderr, "No golden image to fall back to, write one first with -s golden\n");
 		spi_close();
 		return 1;
 	}
-*/
 
-	printf("Erase old data...\n");
+	print_info("New image", &newInfo);
 
-	// Erase all sectors that we are about to use
+	if (haveRecord[slot] && !force && slotInfo[slot].length == newInfo.length &&
+			memcmp(slotInfo[slot].hash, newInfo.hash, 32) == 0) {
 
-	// We add 64K to data len so that we make sure to erase
-	// the last sector too.
-	for (i = 0; i < (flashDataLen+FLASH_SECTOR_SIZE); i += FLASH_SECTOR_SIZE) {
+		// A previous run may have stopped before the header was written
+		if (slot != SLOT_SINGLE && (haveRecord[SLOT_UPDATE] ?
+				multiboot_write_header(UPDATE_ADDR) : multiboot_erase_header())) {
+			spi_close();
+			return 1;
+		}
 
-		// WE latch is disabled after every sector erase
+		printf("Flash already has this image, nothing to do (use -f to write it anyway)\n");
+		spi_close();
+		return 0;
+	}
 
-		spiBuffer[0] = 0x06; // WREN (write enable)
+	// From here on the flash does not match any record.  A single image
+	// overwrites the header and the start of the golden slot, and
+	// MultiBoot needs the single image gone from address 0.
+	if (slot == SLOT_SINGLE) {
 
-		if (spi_transfer(spiBuffer, spiBuffer, 1)) {
-			fprintf(stderr, "Error communicating with flash\n");
+		if (meta_invalidate(SLOT_SINGLE) || meta_invalidate(SLOT_GOLDEN)) {
 			spi_close();
 			return 1;
 		}
 
-		spiBuffer[0] = 0xD8; // SE (sector erase)
+	}
+	else {
+
+		if (multiboot_erase_header() || meta_invalidate(SLOT_SINGLE) || meta_invalidate(slot)) {
+			spi_close();
+			return 1;
+		}
 
-		spiBuffer[1] = (i >> 16) & 0xFF; // Address
-//		spiBuffer[2] = (i >> 8) & 0xFF;
-//		spiBuffer[3] = i & 0xFF;
-		spiBuffer[2] = 0x00;
-		spiBuffer[3] = 0x00;
+		haveRecord[slot] = 0;
 
-		if (spi_transfer(spiBuffer, spiBuffer, 4)) {
-			fprintf(stderr, "Error communicating with flash\n");
+	}
+
+	if (diffMode) {
+
+		printf("Read current data...\n");
+
+		flashCurrent = malloc(imageLen);
+		if (!flashCurrent) {
+			fprintf(stderr, "malloc error\n");
+			spi_close();
+			return 1;
+		}
+
+		if (flash_read(imageAddr, flashCurrent, flashDataLen)) {
 			spi_close();
 			return 1;
 		}
 
-		time(&startTime);
+	}
+
+
+	// Pick the cheapest way to erase each sector, counting the pages that
+	// would have to be programmed again afterwards
+
+	numSectors = imageLen / FLASH_SECTOR_SIZE;
+
+	eraseType = malloc(numSectors);
+	eraseMask = malloc(numSectors * sizeof(unsigned short));
+	pages = malloc((imageLen / FLASH_PAGE_SIZE) * sizeof(unsigned int));
+	if (!eraseType || !eraseMask || !pages) {
+		fprintf(stderr, "malloc error\n");
+		spi_close();
+		return 1;
+	}
+
+	planCost = 0;
+	bulkCost = bulkEraseTiming.typical_us;
+
+	for (j = 0; j < numSectors; j++) {
+
+		sector = j * FLASH_SECTOR_SIZE;
+
+		eraseMask[j] = subsectors_to_erase(sector, flashCurrent, flashMemory, flashDataLen);
+
+		sectorCost = sectorEraseTiming.typical_us +
+			pages_to_program(sector, 0xFFFF, flashCurrent, flashMemory, flashDataLen, NULL) * pageProgramTiming.typical_us;
+
+		bulkCost += pages_to_program(sector, 0xFFFF, flashCurrent, flashMemory, flashDataLen, NULL) * pageProgramTiming.typical_us;
+
+		if (eraseMask[j] == 0) {
+			eraseType[j] = ERASE_NONE;
+			planCost += pages_to_program(sector, 0, flashCurrent, flashMemory, flashDataLen, NULL) * pageProgramTiming.typical_us;
+			continue;
+		}
+
+		subsectorCost = bit_count(eraseMask[j]) * subsectorEraseTiming.typical_us +
+			pages_to_program(sector, eraseMask[j], flashCurrent, flashMemory, flashDataLen, NULL) * pageProgramTiming.typical_us;
+
+		if (imageAddr + sector < FLASH_PARAM_END && subsectorCost < sectorCost) {
+			eraseType[j] = ERASE_SUBSECTORS;
+			planCost += subsectorCost;
+		}
+		else {
+			eraseType[j] = ERASE_SECTOR;
+			planCost += sectorCost;
+		}
+
+	}
+
+	if (allowBulk && bulkCost < planCost) {
+		bulkErased = 1;
+		for (j = 0; j < numSectors; j++)
+			eraseType[j] = ERASE_SECTOR;
+	}
+
+	planCost = bulkErased ? bulkEraseTiming.typical_us : 0;
+	for (j = 0; j < numSectors && !bulkErased; j++) {
+		if (eraseType[j] == ERASE_SUBSECTORS)
+			planCost += bit_count(eraseMask[j]) * subsectorEraseTiming.typical_us;
+		else if (eraseType[j] == ERASE_SECTOR)
+			planCost += sectorEraseTiming.typical_us;
+	}
+
+	printf("Erase old data, estimated %.1f s...\n", planCost / 1e6);
+
+	startTime = now_us();
+
+	if (bulkErased && flash_erase_bulk()) {
+		spi_close();
+		return 1;
+	}
+
+	for (j = 0; j < numSectors && !bulkErased; j++) {
 
-		do {
+		sector = imageAddr + j * FLASH_SECTOR_SIZE;
 
-			spiBuffer[0] = 0x05; // RDSR (read status)
+		if (eraseType[j] == ERASE_SECTOR) {
 
-			if (spi_transfer(spiBuffer, spiBuffer, 2)) {
-				fprintf(stderr, "Error communicating with flash\n");
+			if (flash_erase_sector(sector)) {
 				spi_close();
 				return 1;
 			}
 
-			time(&currentTime);
-			if (currentTime - startTime > 5) {
-				fprintf(stderr, "Flash erase took too long\n");
-				spi_close();
-				return 1;
+			sectorsErased++;
+
+		}
+		else if (eraseType[j] == ERASE_SUBSECTORS) {
+
+			for (i = 0; i < SUBSECTORS_PER_SECTOR; i++) {
+
+				if (!(eraseMask[j] & (1 << i)))
+					continue;
+
+				if (flash_erase_subsector(sector + i * FLASH_SUBSECTOR_SIZE) ||
+						flash_read(sector + i * FLASH_SUBSECTOR_SIZE, subsectorBuffer, FLASH_SUBSECTOR_SIZE)) {
+					spi_close();
+					return 1;
+				}
+
+				// Outside the parameter sectors the command does nothing
+				if (!is_blank(subsectorBuffer, FLASH_SUBSECTOR_SIZE)) {
+
+					printf("4 KB erase not supported at 0x%06X, using sector erase\n", sector);
+
+					if (flash_erase_sector(sector)) {
+						spi_close();
+						return 1;
+					}
+
+					eraseType[j] = ERASE_SECTOR;
+					sectorsErased++;
+					break;
+
+				}
+
+				subsectorsErased++;
+
 			}
 
-		} while (spiBuffer[1] & 0x01); // WIP (write in progres)
+		}
+
+	}
+
+	printf("Erase took %.1f s: ", (now_us() - startTime) / 1e6);
+	if (bulkErased)
+		printf("whole chip\n");
+	else
+		printf("%u x 4 KB, %u x 64 KB\n", subsectorsErased, sectorsErased);
+
+
+	// Work out which pages need writing
+
+	for (j = 0; j < numSectors; j++) {
+
+		sector = j * FLASH_SECTOR_SIZE;
+
+		if (eraseType[j] == ERASE_NONE && diffMode &&
+				pages_to_program(sector, 0, flashCurrent, flashMemory, flashDataLen, NULL) == 0) {
+			sectorsSkipped++;
+			continue;
+		}
+
+		numPages += pages_to_program(sector, eraseType[j] == ERASE_SECTOR ? 0xFFFF :
+			eraseType[j] == ERASE_SUBSECTORS ? eraseMask[j] : 0,
+			flashCurrent, flashMemory, flashDataLen, pages + numPages);
 
-	} // sector erase
+	}
 
 
 	printf("Write new data...\n");
 
-	// Write data one page at a time
+	startTime = now_us();
 
-	for (i = 0; i < flashDataLen; i += FLASH_PAGE_SIZE) {
+	// Write data one page at a time.  The next page is copied into the
+	// other buffer while the chip is busy with the current one.
 
-		// WE latch is disabled after every page program
+	if (numPages > 0)
+		flash_prepare_page(pageBuffer[0], imageAddr + pages[0], flashMemory + pages[0]);
 
-		spiBuffer[0] = 0x06; // WREN (write enable)
+	for (i = 0; i < numPages; i++) {
 
-		if (spi_transfer(spiBuffer, spiBuffer, 1)) {
-			fprintf(stderr, "Error communicating with flash\n");
+		if (flash_start_program(pageBuffer[i % 2])) {
 			spi_close();
 			return 1;
 		}
 
-		spiBuffer[0] = 0x02; // PP (page program)
-
-		spiBuffer[1] = (i >> 16) & 0xFF; // Address
-		spiBuffer[2] = (i >> 8) & 0xFF;
-		spiBuffer[3] = 0x00;
+		programStart = now_us();
 
-		memcpy(spiBuffer+4, flashMemory+i, FLASH_PAGE_SIZE);
+		if (i + 1 < numPages)
+			flash_prepare_page(pageBuffer[(i + 1) % 2], imageAddr + pages[i + 1], flashMemory + pages[i + 1]);
 
-		if (spi_transfer(spiBuffer, spiBuffer, 4 + FLASH_PAGE_SIZE)) {
-			fprintf(stderr, "Error communicating with flash\n");
+		if (flash_wait_ready(&pageProgramTiming, programStart)) {
 			spi_close();
 			return 1;
 		}
 
-		time(&startTime);
+	}
 
-		do {
+	bytesProgrammed = numPages * FLASH_PAGE_SIZE;
 
-			spiBuffer[0] = 0x05; // RDSR (read status)
+	elapsed = (now_us() - startTime) / 1e6;
 
-			if (spi_transfer(spiBuffer, spiBuffer, 2)) {
-				fprintf(stderr, "Error communicating with flash\n");
-				spi_close();
-				return 1;
-			}
+	if (numPages > 0)
+		printf("Wrote %u pages in %.2f s (%.0f KB/s, %u us per page)\n", numPages, elapsed,
+			bytesProgrammed / elapsed / 1024, (unsigned int)(elapsed * 1e6 / numPages));
 
-			time(&currentTime);
-			if (currentTime - startTime > 5) {
-				fprintf(stderr, "Flash write took too long\n");
-				spi_close();
-				return 1;
-			}
+	printf("Programmed %u bytes", bytesProgrammed);
+	if (diffMode)
+		printf(", %u sectors already up to date", sectorsSkipped);
+	printf("\n");
 
-		} while (spiBuffer[1] & 0x01); // WIP (write in progres)
+	// Read everything back, writing wrong pages again and slowing the
+	// clock down if that does not fix them
+
+	printf("Verify...\n");
+
+	startTime = now_us();
+
+	readBack = malloc(imageLen);
+	pageCrc = malloc((imageLen / FLASH_PAGE_SIZE) * sizeof(uint32_t));
+	badPages = malloc((imageLen / FLASH_PAGE_SIZE) * sizeof(unsigned int));
+	if (!readBack || !pageCrc || !badPages) {
+		fprintf(stderr, "malloc error\n");
+		spi_close();
+		return 1;
 	}
 
-	// Last page
+	for (i = 0; i < flashDataLen; i += FLASH_PAGE_SIZE)
+		pageCrc[i / FLASH_PAGE_SIZE] = crc32(flashMemory + i, flashDataLen - i < FLASH_PAGE_SIZE ? flashDataLen - i : FLASH_PAGE_SIZE);
+
+	for (round = 0; ; round++) {
+
+		numBad = verify_pages(imageAddr, flashDataLen, pageCrc, readBack, badPages);
+		if (numBad < 0) {
+			spi_close();
+			return 1;
+		}
 
-	if (flashDataLen - i > 0) {
+		if (numBad == 0)
+			break;
 
-		unsigned int remain = flashDataLen - i + FLASH_PAGE_SIZE;
+		if (round == VERIFY_ROUNDS) {
+			fprintf(stderr, "%d pages are still wrong after writing them %d times\n", numBad, VERIFY_ROUNDS);
+			spi_close();
+			return 1;
+		}
 
-		// WE latch is disabled after every page program
+		if (round > 0 && spi_speed / 2 >= MIN_SPI_SPEED) {
+			spi_speed /= 2;
+			printf("Errors persist, slowing SPI clock to %.1f MHz\n", spi_speed / 1e6);
+			// Start there next time too, until the board is calibrated again
+			spi_speed_save(spi_speed_bus, spi_speed);
+		}
 
-		spiBuffer[0] = 0x06; // WREN (write enable)
+		printf("%d pages did not verify, writing them again...\n", numBad);
 
-		if (spi_transfer(spiBuffer, spiBuffer, 1)) {
-			fprintf(stderr, "Error communicating with flash\n");
+		if (rewrite_pages(imageAddr, flashMemory, readBack, flashDataLen, badPages, numBad)) {
 			spi_close();
 			return 1;
 		}
 
-		spiBuffer[0] = 0x02; // PP (page program)
+	}
+
+	printf("Verified %u bytes in %.2f s, CRC-32 %08x\n", flashDataLen, (now_us() - startTime) / 1e6,
+		crc32(flashMemory, flashDataLen));
 
-		spiBuffer[1] = (i >> 16) & 0xFF; // Address
-		spiBuffer[2] = (i >> 8) & 0xFF;
-		spiBuffer[3] = 0x00;
+	// Never switch over to an image that did not write properly
+	if (slot != SLOT_SINGLE) {
 
-		memcpy(spiBuffer+4, flashMemory + i, remain);
+		printf("Check %s image...\n", slotNames[slot]);
 
-		if (spi_transfer(spiBuffer, spiBuffer, 4 + remain)) {
-			fprintf(stderr, "Error communicating with flash\n");
+		if (image_check(&newInfo)) {
+			fprintf(stderr, "The %s image does not read back correctly\n", slotNames[slot]);
 			spi_close();
 			return 1;
 		}
 
-		time(&startTime);
+	}
 
-		do {
+	// The image is complete, so record what it is
+	meta_encode(&newInfo, metaPage);
 
-			spiBuffer[0] = 0x05; // RDSR (read status)
+	if (flash_program_page(META_SLOT_ADDR(slot), metaPage)) {
+		spi_close();
+		return 1;
+	}
 
-			if (spi_transfer(spiBuffer, spiBuffer, 2)) {
-				fprintf(stderr, "Error communicating with flash\n");
-				spi_close();
-				return 1;
-			}
+	haveRecord[slot] = 1;
 
-			time(&currentTime);
-			if (currentTime - startTime > 5) {
-				fprintf(stderr, "Flash write took too long\n");
-				spi_close();
-				return 1;
-			}
+	if (slot != SLOT_SINGLE && haveRecord[SLOT_UPDATE]) {
+
+		printf("Switch to the update image...\n");
+
+		if (multiboot_write_header(UPDATE_ADDR)) {
+			spi_close();
+			return 1;
+		}
 
-		} while (spiBuffer[1] & 0x01); // WIP (write in progres)
+		printf("The update image loads at the next reconfiguration, the golden image if it fails\n");
 
-	} // Last page
+	}
 
 /*
 	spiBuffer[0] = 0x04; // WRDI (write disable)
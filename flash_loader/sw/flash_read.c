@@ -6,109 +6,335 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include "flash.h"
 
-#define FLASH_SIZE (1024*1024*32)
+// Data goes to the file in blocks this size, one being written while the
+// other is read from the flash
+#define WRITE_BLOCK_SIZE (256*1024)
 
-extern int spi_init();
 extern void spi_close();
 extern int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size);
+extern int spi_transfer_read(unsigned char * cmd, unsigned int cmd_len, unsigned char * receive_buffer, unsigned int size);
+extern unsigned int spi_buffer_size(void);
+
+extern int bridge_open(const char *bitFile);
+
+/*
+ * The output file is written by writerThread while the flash is read into
+ * the other block.  full[n] is set when block n is ready to write and
+ * cleared once it has been written.
+ */
+struct writer {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	unsigned char *block[2];
+	unsigned int len[2];
+	int full[2];
+	int finished;
+	int error;
+	int fd;
+};
+
+// Writes all of data, returns non-zero on error
+static int write_all(int fd, unsigned char *data, unsigned int len) {
+
+	ssize_t written;
+
+	while (len > 0) {
+
+		written = write(fd, data, len);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+
+		data += written;
+		len -= written;
+	}
+
+	return 0;
+}
+
+static void *writer_thread(void *arg) {
+
+	struct writer *w = arg;
+	unsigned int n = 0;
+	int error;
+
+	for (;;) {
+
+		pthread_mutex_lock(&w->lock);
+		while (!w->full[n] && !w->finished)
+			pthread_cond_wait(&w->changed, &w->lock);
+		if (!w->full[n]) {
+			pthread_mutex_unlock(&w->lock);
+			break;
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		error = write_all(w->fd, w->block[n], w->len[n]) ? errno : 0;
+
+		pthread_mutex_lock(&w->lock);
+		if (error && !w->error)
+			w->error = error;
+		w->full[n] = 0;
+		pthread_cond_signal(&w->changed);
+		pthread_mutex_unlock(&w->lock);
+
+		n ^= 1;
+	}
+
+	return NULL;
+}
+
+// Waits for block n to be free, returns the write error if there was one
+static int writer_wait(struct writer *w, unsigned int n) {
+
+	int error;
 
-extern int i2c_disconnect_spi();
+	pthread_mutex_lock(&w->lock);
+	while (w->full[n] && !w->error)
+		pthread_cond_wait(&w->changed, &w->lock);
+	error = w->error;
+	pthread_mutex_unlock(&w->lock);
+
+	return error;
+}
+
+static void writer_queue(struct writer *w, unsigned int n, unsigned int len) {
+
+	pthread_mutex_lock(&w->lock);
+	w->len[n] = len;
+	w->full[n] = 1;
+	pthread_cond_signal(&w->changed);
+	pthread_mutex_unlock(&w->lock);
+
+}
+
+// Lets the thread write what is queued and stop, returns the write error
+static int writer_finish(struct writer *w, pthread_t thread) {
+
+	pthread_mutex_lock(&w->lock);
+	w->finished = 1;
+	pthread_cond_signal(&w->changed);
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_join(thread, NULL);
+
+	return w->error;
+}
+
+// Reads a whole number (0x for hex), returns non-zero if text isn't one
+static int parse_number(const char *text, unsigned int *value) {
+
+	unsigned long n;
+	char *end;
+
+	errno = 0;
+	n = strtoul(text, &end, 0);
+
+	if (errno || end == text || *end != '\0' || text[0] == '-' || n > UINT_MAX)
+		return 1;
+
+	*value = n;
+
+	return 0;
+}
+
+// Drops a partly written output file
+static void discard_output(int fd, const char *name) {
+
+	close(fd);
+	unlink(name);
+
+}
+
+static void usage(const char *name) {
+
+	fprintf(stderr, "Usage: %s [-k] [-o offset] [-l length] filename.bin [size_to_read]\n", name);
+	fprintf(stderr, "  -o offset   Flash address to start reading at (default 0)\n");
+	fprintf(stderr, "  -l length   Number of bytes to read (default to the end of the flash)\n");
+	fprintf(stderr, "  -k          Keep the running design, it already connects the flash to the Pi's SPI\n");
+	fprintf(stderr, "For several reads or writes in a row, run the first without -k to load\n");
+	fprintf(stderr, "spibridge.bit and add -k to the rest.\n");
+
+}
 
 int main(int argc, char **argv) {
 
 	int outputFile;
 	unsigned char spiBuffer[1024];
-	unsigned int i, flashDataLen;
-	int ret;
+	struct writer w;
+	pthread_t thread;
+	unsigned int i, chunk, maxChunk, blockUsed, n, flashOffset = 0, flashDataLen = 0;
+	struct timespec startTime, endTime;
+	double seconds;
+	int opt, error, keepDesign = 0;
+
+	while ((opt = getopt(argc, argv, "o:l:kh")) != -1) {
+		switch (opt) {
+		case 'o':
+			if (parse_number(optarg, &flashOffset)) {
+				fprintf(stderr, "Bad offset: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'l':
+			if (parse_number(optarg, &flashDataLen) || flashDataLen < 1) {
+				fprintf(stderr, "Bad number of bytes: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'k':
+			keepDesign = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s filename.bin [size_to_read]\n", argv[0]);
+	if (optind >= argc) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	flashDataLen = FLASH_SIZE;
+	if (flashOffset >= FLASH_CHIP_SIZE) {
+		fprintf(stderr, "Offset is past the end of the flash\n");
+		return 1;
+	}
 
-	if (argc == 3) {
-		flashDataLen = atoi(argv[2]);
-		if (flashDataLen < 1 || flashDataLen > FLASH_SIZE) {
-			fprintf(stderr, "Bad number of bytes: %s\n", argv[2]);
+	if (optind + 1 < argc) {
+		if (parse_number(argv[optind + 1], &flashDataLen) || flashDataLen < 1 || flashDataLen > FLASH_CHIP_SIZE) {
+			fprintf(stderr, "Bad number of bytes: %s\n", argv[optind + 1]);
 			return 1;
 		}
 	}
 
-	outputFile = open(argv[1], O_WRONLY|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if (flashDataLen == 0)
+		flashDataLen = FLASH_CHIP_SIZE - flashOffset;
 
-	if (outputFile < 0) {
-		perror("Error creating output file");
+	if (flashDataLen > FLASH_CHIP_SIZE - flashOffset) {
+		fprintf(stderr, "Range goes past the end of the flash\n");
 		return 1;
 	}
 
-	ret = system("/usr/bin/logi_loader spibridge.bit");
-	if (ret != 1<<8) {
-		fprintf(stderr, "Error loading spibridge.bit, return code: %d\n", ret);
-		close(outputFile);
+	outputFile = open(argv[optind], O_WRONLY|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+
+	if (outputFile < 0) {
+		perror("Error creating output file");
 		return 1;
 	}
 
-	if (i2c_disconnect_spi())
+	if (bridge_open(keepDesign ? NULL : "spibridge.bit")) {
+		discard_output(outputFile, argv[optind]);
 		return 1;
+	}
 
-	// logi_loader leaves fpga/flash SPI pins connected to Pi
-	// so we need to disconnect them now
 
-	if (spi_init()) {
-		close(outputFile);
-		return 1;
-	}
+	// As much as spidev will take in one message
+	maxChunk = spi_buffer_size() - FAST_READ_HEADER;
 
-	memset(spiBuffer, 0, sizeof(spiBuffer));
-	spiBuffer[0] = 0x9F; // RDID
+	memset(&w, 0, sizeof(w));
+	w.fd = outputFile;
+	w.block[0] = malloc(WRITE_BLOCK_SIZE);
+	w.block[1] = malloc(WRITE_BLOCK_SIZE);
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_cond_init(&w.changed, NULL);
 
-	if (spi_transfer(spiBuffer, spiBuffer, 4)) {
-		fprintf(stderr, "Error communicating with flash\n");
+	if (!w.block[0] || !w.block[1] || pthread_create(&thread, NULL, writer_thread, &w)) {
+		fprintf(stderr, "Error starting the output file writer\n");
 		spi_close();
-		close(outputFile);
+		free(w.block[0]);
+		free(w.block[1]);
+		discard_output(outputFile, argv[optind]);
 		return 1;
 	}
 
-	if (spiBuffer[1] != 0x01 || spiBuffer[2] != 0x02 || spiBuffer[3] != 0x15) {
-		fprintf(stderr, "Flash chip is not responding %02X %02X %02X\n", spiBuffer[1], spiBuffer[2], spiBuffer[3]);
-		spi_close();
-		close(outputFile);
-		return 1;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
 
+	n = 0;
+	blockUsed = 0;
+	error = 0;
 
-	// Read data one page at a time
+	for (i = 0; i < flashDataLen; i += chunk) {
 
-	for (i = 0; i < flashDataLen; i += (1<<8)) {
+		// Start on a block once the writer is done with it
+		if (blockUsed == 0 && (error = writer_wait(&w, n)) != 0)
+			break;
 
+		chunk = flashDataLen - i;
+		if (chunk > maxChunk)
+			chunk = maxChunk;
+		if (chunk > WRITE_BLOCK_SIZE - blockUsed)
+			chunk = WRITE_BLOCK_SIZE - blockUsed;
 
-		spiBuffer[0] = 0x03; // READ
+		spiBuffer[0] = 0x0B; // FAST_READ
 
-		spiBuffer[1] = (i >> 16) & 0xFF; // Address
-		spiBuffer[2] = (i >> 8) & 0xFF;
-		spiBuffer[3] = 0x00;
+		spiBuffer[1] = ((flashOffset + i) >> 16) & 0xFF; // Address
+		spiBuffer[2] = ((flashOffset + i) >> 8) & 0xFF;
+		spiBuffer[3] = (flashOffset + i) & 0xFF;
+		spiBuffer[4] = 0x00; // Dummy
 
-		if (spi_transfer(spiBuffer, spiBuffer, 4 + (1<<8))) {
+		if (spi_transfer_read(spiBuffer, FAST_READ_HEADER, w.block[n] + blockUsed, chunk)) {
 			fprintf(stderr, "Error communicating with flash\n");
+			writer_finish(&w, thread);
 			spi_close();
-			close(outputFile);
+			free(w.block[0]);
+			free(w.block[1]);
+			discard_output(outputFile, argv[optind]);
 			return 1;
 		}
 
-		write(outputFile, spiBuffer+4, 1<<8);
+		blockUsed += chunk;
+
+		// Full, or the last one: hand it over and read into the other
+		if (blockUsed == WRITE_BLOCK_SIZE || i + chunk == flashDataLen) {
+			writer_queue(&w, n, blockUsed);
+			n ^= 1;
+			blockUsed = 0;
+		}
 
 	}
 
+	// Also the error that stopped the loop, if one did
+	error = writer_finish(&w, thread);
+
+	clock_gettime(CLOCK_MONOTONIC, &endTime);
+
 	spi_close();
+	free(w.block[0]);
+	free(w.block[1]);
+
+	if (error) {
+		errno = error;
+		perror("Error writing output file");
+		discard_output(outputFile, argv[optind]);
+		return 1;
+	}
+
+	// A full disk or I/O error may only show up when the data reaches it
+	if (fsync(outputFile)) {
+		perror("Error writing output file");
+		discard_output(outputFile, argv[optind]);
+		return 1;
+	}
+
+	if (close(outputFile)) {
+		perror("Error writing output file");
+		unlink(argv[optind]);
+		return 1;
+	}
 
-	// We may have written more than we intended to due to page alignment,
-	// so truncate the file to right length
-	ftruncate(outputFile, flashDataLen);
+	seconds = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec) / 1e9;
 
-	close(outputFile);
+	printf("Read %u bytes from 0x%06X in %.2f s (%.0f KB/s)\n", flashDataLen, flashOffset,
+		seconds, seconds > 0 ? flashDataLen / seconds / 1024 : 0);
 
 	printf("Done!\n");
 
@@ -0,0 +1,552 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include "spitrace.h"
+#include "spispeed.h"
+
+/*
+ * Simulated S25FL032P for trying out flash_loader and flash_read without a
+ * board.  It provides the same functions as spi.c and i2c.c, so linking
+ * with flash_sim.o instead of those (make sim) gives flash_loader_sim and
+ * flash_read_sim.
+ *
+ * Commands are decoded a byte at a time between chip select edges, the
+ * same as the real chip.  Programs and erases keep WIP set for the
+ * datasheet's typical time and anything other than RDSR is ignored while
+ * they run.  Programs can only clear bits, wrap within the 256 byte page
+ * and need WREN first.  4 KB erases only work in the parameter sectors.
+ * Each message also takes as long as it would on the wire.  Mistakes a
+ * real chip would ignore are counted and reported when SPI is closed.
+ *
+ * The expander's output pins are kept as bridge.c sets them.  While the SPI
+ * OE or PROG_B is low the Pi's SPI goes to the FPGA's configuration pins,
+ * not the flash, so the chip sees nothing and reads return 0xFF.
+ *
+ * Environment:
+ *   FLASH_SIM         file holding the flash contents, created if missing
+ *                     (default flash_sim.bin)
+ *   FLASH_SIM_SCALE   divide all times by this to run faster (default 1),
+ *                     flash_loader still waits for its own estimates so
+ *                     only use this for checking results, not timing
+ *   FLASH_SIM_TOPBOOT put the parameter sectors at the top of the chip
+ *   FLASH_SIM_MAX_SPEED
+ *                     above this SPI clock in Hz, about one byte in
+ *                     FLASH_SIM_ERROR_RATE (default 2048) read or programmed
+ *                     has a bit flipped, like a marginal board
+ */
+
+#define SIM_CHIP_SIZE (4*1024*1024)
+#define SIM_PAGE_SIZE 256
+#define SIM_SUBSECTOR_SIZE (4*1024)
+#define SIM_SECTOR_SIZE (64*1024)
+#define SIM_PARAM_SIZE (128*1024)
+
+// Typical times from the datasheet, in us
+#define SIM_PP_US 1500
+#define SIM_P4E_US 200000
+#define SIM_SE_US 500000
+#define SIM_BE_US 32000000
+
+// Time for the kernel to start each SPI message
+#define SIM_MESSAGE_US 20
+
+#define SIM_BUFSIZ 4096
+
+#define STATUS_WIP 0x01
+#define STATUS_WEL 0x02
+
+unsigned long spi_speed = 16000000UL;
+const unsigned long spi_default_speed = 16000000UL;
+const char * spi_backend = "sim";
+// Kept apart from the real flash, so a simulated calibration never
+// changes the clock the hardware uses
+const char * spi_speed_bus = "flash-sim";
+
+static unsigned char flash[SIM_CHIP_SIZE];
+static const char *imageFile;
+static unsigned int timeScale = 1;
+static unsigned int paramStart = 0;
+static unsigned long maxSpeed = 0;
+static unsigned int errorRate = 2048;
+
+static unsigned char status;
+static uint64_t busyUntil;
+
+// Expander output register, all high after power up like the real one
+#define PIN_PROG 0x04
+#define PIN_SPI_OE 0x10
+static unsigned char expanderPins = 0xFF;
+
+// Command in progress while chip select is low
+static unsigned char command;
+static unsigned int commandBytes;
+static unsigned int address;
+static unsigned char pageData[SIM_PAGE_SIZE];
+static unsigned char pageUsed[SIM_PAGE_SIZE];
+static unsigned int pageBytes;
+static int ignoring;
+
+static struct {
+	unsigned int messages;
+	unsigned int readBytes;
+	unsigned int pagePrograms;
+	unsigned int subsectorErases;
+	unsigned int sectorErases;
+	unsigned int bulkErases;
+	unsigned int ignoredCommands;
+	unsigned int programOverData;
+	unsigned int bitErrors;
+	unsigned int configBytes;
+	uint64_t busyUs;
+} stats;
+
+
+static uint64_t now_us() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void start_busy(unsigned int us) {
+
+	us /= timeScale;
+
+	status |= STATUS_WIP;
+	busyUntil = now_us() + us;
+	stats.busyUs += us;
+
+}
+
+static void update_status() {
+
+	if ((status & STATUS_WIP) && now_us() >= busyUntil)
+		status &= ~(STATUS_WIP | STATUS_WEL);
+
+}
+
+static void warn(const char *message) {
+
+	fprintf(stderr, "flash sim: %s (command %02X, address 0x%06X)\n", message, command, address);
+
+}
+
+// Flips a bit now and then when the clock is too fast
+static unsigned char sim_noise(unsigned char value) {
+
+	if (maxSpeed == 0 || spi_speed <= maxSpeed || rand() % errorRate != 0)
+		return value;
+
+	stats.bitErrors++;
+
+	return value ^ (1 << (rand() % 8));
+}
+
+static void sim_select() {
+
+	update_status();
+
+	command = 0;
+	commandBytes = 0;
+	address = 0;
+	pageBytes = 0;
+	memset(pageUsed, 0, sizeof(pageUsed));
+	ignoring = 0;
+
+}
+
+static unsigned char sim_byte(unsigned char in) {
+
+	unsigned char out = 0xFF;
+	unsigned int n = commandBytes++;
+
+	if (n == 0) {
+
+		command = in;
+
+		update_status();
+
+		// Only RDSR gets through while a program or erase is running
+		if ((status & STATUS_WIP) && command != 0x05) {
+			warn("command while busy");
+			stats.ignoredCommands++;
+			ignoring = 1;
+		}
+
+		return out;
+	}
+
+	if (ignoring)
+		return out;
+
+	if (n <= 3 && command != 0x05 && command != 0x9F) {
+		address = (address << 8) | in;
+		return out;
+	}
+
+	switch (command) {
+
+	case 0x9F: // RDID
+		if (n <= 3)
+			out = sim_noise(n == 1 ? 0x01 : n == 2 ? 0x02 : 0x15);
+		break;
+
+	case 0x05: // RDSR
+		update_status();
+		out = status;
+		break;
+
+	case 0x03: // READ
+	case 0x0B: // FAST_READ
+		if (command == 0x0B && n == 4)
+			break; // Dummy byte
+		out = sim_noise(flash[address % SIM_CHIP_SIZE]);
+		address++;
+		stats.readBytes++;
+		break;
+
+	case 0x02: // PP
+		// Past the end of the page the address wraps around, so with
+		// more than a page sent only the last 256 bytes are kept
+		pageData[(address + pageBytes) % SIM_PAGE_SIZE] = sim_noise(in);
+		pageUsed[(address + pageBytes) % SIM_PAGE_SIZE] = 1;
+		pageBytes++;
+		break;
+
+	}
+
+	return out;
+
+}
+
+static void sim_deselect() {
+
+	unsigned int i, start;
+	unsigned char *cell;
+
+	if (ignoring || commandBytes == 0)
+		return;
+
+	switch (command) {
+
+	case 0x06: // WREN
+		status |= STATUS_WEL;
+		return;
+
+	case 0x04: // WRDI
+		status &= ~STATUS_WEL;
+		return;
+
+	case 0x02: // PP
+	case 0x20: // P4E
+	case 0xD8: // SE
+	case 0xC7: // BE
+	case 0x60: // BE
+		break;
+
+	default:
+		return;
+
+	}
+
+	if (!(status & STATUS_WEL)) {
+		warn("program or erase without WREN");
+		stats.ignoredCommands++;
+		return;
+	}
+
+	if (command == 0x02) {
+
+		if (commandBytes < 4 || pageBytes == 0) {
+			warn("incomplete page program");
+			status &= ~STATUS_WEL;
+			return;
+		}
+
+		start = (address % SIM_CHIP_SIZE) & ~(SIM_PAGE_SIZE - 1);
+
+		for (i = 0; i < SIM_PAGE_SIZE; i++) {
+
+			if (!pageUsed[i])
+				continue;
+
+			cell = &flash[start + i];
+
+			// Programming can only clear bits
+			if ((*cell & pageData[i]) != pageData[i])
+				stats.programOverData++;
+
+			*cell &= pageData[i];
+		}
+
+		stats.pagePrograms++;
+		start_busy(SIM_PP_US);
+		return;
+	}
+
+	if (command != 0xC7 && command != 0x60 && commandBytes != 4) {
+		warn("erase without a 3 byte address");
+		status &= ~STATUS_WEL;
+		return;
+	}
+
+	address %= SIM_CHIP_SIZE;
+
+	if (command == 0x20) {
+
+		if (address < paramStart || address >= paramStart + SIM_PARAM_SIZE) {
+			// The chip ignores it, which flash_loader checks for
+			status &= ~STATUS_WEL;
+			return;
+		}
+
+		memset(flash + (address & ~(SIM_SUBSECTOR_SIZE - 1)), 0xFF, SIM_SUBSECTOR_SIZE);
+		stats.subsectorErases++;
+		start_busy(SIM_P4E_US);
+
+	}
+	else if (command == 0xD8) {
+
+		memset(flash + (address & ~(SIM_SECTOR_SIZE - 1)), 0xFF, SIM_SECTOR_SIZE);
+		stats.sectorErases++;
+		start_busy(SIM_SE_US);
+
+	}
+	else {
+
+		memset(flash, 0xFF, SIM_CHIP_SIZE);
+		stats.bulkErases++;
+		start_busy(SIM_BE_US);
+
+	}
+
+}
+
+// Time the message would take on the wire
+static void sim_wait(unsigned int bytes) {
+
+	uint64_t us = SIM_MESSAGE_US + (uint64_t)bytes * 8 * 1000000 / spi_speed;
+	uint64_t until;
+
+	stats.messages++;
+
+	us /= timeScale;
+
+	// usleep() overshoots short waits by more than the wait itself, which
+	// would swamp the message times that flashbench measures
+	if (us >= 1000) {
+		usleep(us);
+		return;
+	}
+
+	until = now_us() + us;
+	while (now_us() < until)
+		;
+
+}
+
+static void sim_send(unsigned char *send_buffer, unsigned char *receive_buffer, unsigned int size) {
+
+	unsigned int i;
+	unsigned char in;
+
+	for (i = 0; i < size; i++) {
+		in = send_buffer ? send_buffer[i] : 0;
+		in = sim_byte(in);
+		if (receive_buffer)
+			receive_buffer[i] = in;
+	}
+
+}
+
+int spi_init(void) {
+
+	FILE *f;
+	const char *scale;
+
+	spi_trace_init();
+
+	spi_speed = spi_speed_load(spi_speed_bus, spi_default_speed);
+
+	imageFile = getenv("FLASH_SIM");
+	if (!imageFile)
+		imageFile = "flash_sim.bin";
+
+	scale = getenv("FLASH_SIM_SCALE");
+	if (scale && atoi(scale) > 0)
+		timeScale = atoi(scale);
+
+	if (getenv("FLASH_SIM_TOPBOOT"))
+		paramStart = SIM_CHIP_SIZE - SIM_PARAM_SIZE;
+
+	if (getenv("FLASH_SIM_MAX_SPEED"))
+		maxSpeed = strtoul(getenv("FLASH_SIM_MAX_SPEED"), NULL, 0);
+
+	if (getenv("FLASH_SIM_ERROR_RATE") && atoi(getenv("FLASH_SIM_ERROR_RATE")) > 0)
+		errorRate = atoi(getenv("FLASH_SIM_ERROR_RATE"));
+
+	memset(flash, 0xFF, sizeof(flash));
+
+	f = fopen(imageFile, "rb");
+	if (f) {
+		if (fread(flash, 1, sizeof(flash), f) != sizeof(flash))
+			fprintf(stderr, "flash sim: %s is short, the rest is blank\n", imageFile);
+		fclose(f);
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	status = 0;
+
+	return 0;
+}
+
+// False while bridge.c is sending a bitstream
+static int flash_connected(void) {
+
+	return (expanderPins & (PIN_SPI_OE | PIN_PROG)) == (PIN_SPI_OE | PIN_PROG);
+}
+
+int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size) {
+
+	SPI_TRACE_BEGIN(traceStart);
+
+	if (flash_connected()) {
+		sim_select();
+		sim_send(send_buffer, receive_buffer, size);
+		sim_deselect();
+	}
+	else {
+		stats.configBytes += size;
+		if (receive_buffer)
+			memset(receive_buffer, 0xFF, size);
+	}
+
+	sim_wait(size);
+
+	SPI_TRACE_END(traceStart, "spi_transfer", SPI_TRACE_NONE,
+		send_buffer ? send_buffer[0] : SPI_TRACE_NONE, size);
+
+	return 0;
+}
+
+int spi_transfer_pair(unsigned char * first, unsigned int first_len, unsigned char * second, unsigned int second_len) {
+
+	SPI_TRACE_BEGIN(traceStart);
+
+	if (flash_connected()) {
+		sim_select();
+		sim_send(first, NULL, first_len);
+		sim_deselect();
+
+		sim_select();
+		sim_send(second, NULL, second_len);
+		sim_deselect();
+	}
+	else {
+		stats.configBytes += first_len + second_len;
+	}
+
+	sim_wait(first_len + second_len);
+
+	SPI_TRACE_END(traceStart, "spi_transfer_pair",
+		second_len >= 4 ? (second[1] << 16) | (second[2] << 8) | second[3] : SPI_TRACE_NONE,
+		second[0], first_len + second_len);
+
+	return 0;
+}
+
+int spi_transfer_read(unsigned char * cmd, unsigned int cmd_len, unsigned char * receive_buffer, unsigned int size) {
+
+	SPI_TRACE_BEGIN(traceStart);
+
+	if (flash_connected()) {
+		sim_select();
+		sim_send(cmd, NULL, cmd_len);
+		sim_send(NULL, receive_buffer, size);
+		sim_deselect();
+	}
+	else {
+		stats.configBytes += cmd_len + size;
+		memset(receive_buffer, 0xFF, size);
+	}
+
+	sim_wait(cmd_len + size);
+
+	SPI_TRACE_END(traceStart, "spi_transfer_read",
+		cmd_len >= 4 ? (cmd[1] << 16) | (cmd[2] << 8) | cmd[3] : SPI_TRACE_NONE,
+		cmd[0], cmd_len + size);
+
+	return 0;
+}
+
+unsigned int spi_buffer_size(void) {
+	return SIM_BUFSIZ;
+}
+
+void spi_close(void) {
+
+	FILE *f;
+
+	// Let anything still running finish
+	update_status();
+	if (status & STATUS_WIP)
+		usleep(busyUntil - now_us());
+
+	f = fopen(imageFile, "wb");
+	if (!f || fwrite(flash, 1, sizeof(flash), f) != sizeof(flash))
+		perror("flash sim: error saving flash contents");
+	if (f)
+		fclose(f);
+
+	fprintf(stderr, "flash sim: %u messages, %u bytes read, %u pages programmed, "
+		"%u x 4 KB + %u x 64 KB + %u bulk erases, busy %.2f s\n",
+		stats.messages, stats.readBytes, stats.pagePrograms,
+		stats.subsectorErases, stats.sectorErases, stats.bulkErases, stats.busyUs / 1e6);
+
+	if (stats.ignoredCommands || stats.programOverData)
+		fprintf(stderr, "flash sim: %u commands ignored, %u bytes programmed without an erase\n",
+			stats.ignoredCommands, stats.programOverData);
+
+	if (stats.bitErrors)
+		fprintf(stderr, "flash sim: %u bit errors from running SPI at %lu Hz\n", stats.bitErrors, spi_speed);
+
+	if (stats.configBytes)
+		fprintf(stderr, "flash sim: %u bytes sent to the FPGA while the flash was disconnected\n", stats.configBytes);
+
+}
+
+// The expander inputs read as a configured FPGA and the bridge is always
+// there, the outputs only decide whether the flash is on the bus.
+// Each transfer takes as long as it would at 100 kHz, 9 clocks per byte.
+
+static void sim_i2c_wait(unsigned int bytes) {
+
+	uint64_t until = now_us() + bytes * 90 / timeScale;
+
+	while (now_us() < until)
+		;
+
+}
+
+int i2c_read_pins(unsigned char *value) {
+	// Address + register, then address + data
+	sim_i2c_wait(4);
+	*value = 0x0A; // INIT_B and DONE
+	return 0;
+}
+
+int i2c_update_pins(unsigned char clear, unsigned char set) {
+	// Read as above, then address + register + data
+	sim_i2c_wait(7);
+	expanderPins = (expanderPins & ~clear) | set;
+	return 0;
+}
+
+int i2c_disconnect_spi() {
+	return i2c_update_pins(0, PIN_SPI_OE);
+}
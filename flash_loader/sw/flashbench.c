@@ -0,0 +1,212 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include "flash.h"
+
+/*
+ * Benchmark of the flash SPI and I2C paths: status register reads, FAST_READ
+ * at several sizes, WREN/WRDI sent as two messages or as one message with
+ * spi_transfer_pair(), and reads of the I2C expander pins.  Each test runs
+ * for a fixed time and reports operations per second and latency
+ * percentiles, as one JSON object per test.
+ *
+ * flashbench uses the board (loading spibridge.bit first, unless -k says
+ * the running design already connects the flash), flashbench_sim
+ * the simulated chip in flash_sim.c.  Nothing on the flash is changed.
+ */
+
+// Latency samples kept per test, anything after is only counted
+#define MAX_SAMPLES 200000
+
+static const unsigned int readSizes[] = { 16, 256, 1024, 0 };
+
+extern void spi_close();
+extern int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size);
+extern int spi_transfer_pair(unsigned char * first, unsigned int first_len, unsigned char * second, unsigned int second_len);
+extern int spi_transfer_read(unsigned char * cmd, unsigned int cmd_len, unsigned char * receive_buffer, unsigned int size);
+extern unsigned int spi_buffer_size(void);
+extern unsigned long spi_speed;
+extern const char * spi_backend;
+
+extern int i2c_read_pins(unsigned char *value);
+
+extern int bridge_open(const char *bitFile);
+
+enum test_op {
+	RDSR,
+	FAST_READ,
+	WREN_WRDI,
+	WREN_WRDI_PAIR,
+	I2C_READ
+};
+
+static unsigned char *buffer;
+static double samples[MAX_SAMPLES];
+
+
+static uint64_t now_ns() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(unsigned int count, double p) {
+
+	unsigned int i = (unsigned int)(p * (count - 1) + 0.5);
+
+	return samples[i];
+}
+
+// One operation of the test, returns non-zero on error
+static int run_op(enum test_op op, unsigned int size) {
+
+	unsigned char command[FAST_READ_HEADER];
+	unsigned char wren = 0x06, wrdi = 0x04;
+
+	switch (op) {
+
+	case RDSR:
+		command[0] = 0x05;
+		return spi_transfer(command, command, 2);
+
+	case FAST_READ:
+		command[0] = 0x0B;
+		command[1] = command[2] = command[3] = command[4] = 0;
+		return spi_transfer_read(command, FAST_READ_HEADER, buffer, size);
+
+	case WREN_WRDI:
+		return spi_transfer(&wren, NULL, 1) || spi_transfer(&wrdi, NULL, 1);
+
+	case WREN_WRDI_PAIR:
+		return spi_transfer_pair(&wren, 1, &wrdi, 1);
+
+	case I2C_READ:
+		return i2c_read_pins(command);
+
+	}
+
+	return 1;
+}
+
+static void run_test(FILE *out, const char *name, enum test_op op, unsigned int size, double seconds) {
+
+	uint64_t start, end, opStart, opEnd;
+	unsigned long ops = 0;
+	unsigned int count = 0;
+
+	start = now_ns();
+	end = start + (uint64_t)(seconds * 1e9);
+
+	do {
+		opStart = now_ns();
+		if (run_op(op, size)) {
+			fprintf(stderr, "%s of %u bytes failed, skipped\n", name, size);
+			return;
+		}
+		opEnd = now_ns();
+
+		if (count < MAX_SAMPLES)
+			samples[count++] = (opEnd - opStart) / 1000.0;
+		ops++;
+	} while (opEnd < end);
+
+	qsort(samples, count, sizeof(double), compare_double);
+
+	seconds = (opEnd - start) / 1e9;
+
+	fprintf(out, "{\"backend\":\"%s\",\"spi_speed\":%lu,\"test\":\"%s\",\"size\":%u,"
+		"\"ops\":%lu,\"ops_per_s\":%.0f,\"bytes_per_s\":%.0f,"
+		"\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+		spi_backend, spi_speed, name, size,
+		ops, ops / seconds, ops * size / seconds,
+		percentile(count, 0.5), percentile(count, 0.9), percentile(count, 0.99),
+		samples[count - 1]);
+	fflush(out);
+
+	if (out != stdout)
+		fprintf(stderr, "%-16s %6u bytes %9.0f ops/s  p50 %7.1f us  p99 %7.1f us\n",
+			name, size, ops / seconds, percentile(count, 0.5), percentile(count, 0.99));
+
+}
+
+int main(int argc, char **argv) {
+
+	FILE *out = stdout;
+	double seconds = 1.0;
+	unsigned int i, size, maxRead;
+	int opt, keepDesign = 0;
+
+	while ((opt = getopt(argc, argv, "o:t:k")) != -1) {
+		switch (opt) {
+		case 'o':
+			out = fopen(optarg, "w");
+			if (!out) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 'k':
+			keepDesign = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-k] [-o results.json] [-t seconds per test]\n", argv[0]);
+			fprintf(stderr, "  -k  Keep the running design, it already connects the flash (e.g. after flash_read)\n");
+			return 1;
+		}
+	}
+
+	if (seconds <= 0) {
+		fprintf(stderr, "Time per test must be more than 0\n");
+		return 1;
+	}
+
+	if (bridge_open(keepDesign ? NULL : "spibridge.bit"))
+		return 1;
+
+	maxRead = spi_buffer_size() - FAST_READ_HEADER;
+
+	buffer = malloc(maxRead);
+	if (!buffer) {
+		fprintf(stderr, "Out of memory\n");
+		spi_close();
+		return 1;
+	}
+
+	run_test(out, "rdsr", RDSR, 2, seconds);
+
+	// 0 is the largest read spidev takes in one message
+	for (i = 0; i < sizeof(readSizes) / sizeof(readSizes[0]); i++) {
+		size = readSizes[i] ? readSizes[i] : maxRead;
+		if (size <= maxRead)
+			run_test(out, "fast_read", FAST_READ, size, seconds);
+	}
+
+	run_test(out, "wren_wrdi", WREN_WRDI, 2, seconds);
+	run_test(out, "wren_wrdi_pair", WREN_WRDI_PAIR, 2, seconds);
+
+	run_test(out, "i2c_read_pins", I2C_READ, 1, seconds);
+
+	if (out != stdout)
+		fclose(out);
+
+	free(buffer);
+	spi_close();
+
+	return 0;
+}
@@ -7,27 +7,77 @@
 
 // I2C routines borrowed from logipi_loader
 
-int i2c_disconnect_spi() {
+// Expander registers, as logipi_loader uses them
+#define EXP_INPUT_REG 0x00
+#define EXP_OUTPUT_REG 0x01
+#define EXP_CONFIG_REG 0x03
 
-	int i2c_fd;
-	unsigned char buffer[4];
+// Pins the Pi drives: MODE1, PROG_B and the SPI OE, the rest are inputs
+// (a 1 in the configuration register)
+#define EXP_OUTPUTS (0x01 | 0x04 | 0x10)
 
-	// logi_loader leaves fpga/flash SPI pins connected to Pi
-	// so we need to disconnect them now
+static int directionSet = 0;
+
+static int i2c_open_expander() {
+
+	int i2c_fd;
 
 	i2c_fd = open("/dev/i2c-1", O_RDWR);
 	if (i2c_fd < 0) {
 		perror("Could not open I2C device");
-		close(i2c_fd);
-		return 1;
+		return -1;
 	}
 	if (ioctl(i2c_fd, I2C_SLAVE, 0x20) < 0) {
 		perror("I2C ioctl failed");
 		close(i2c_fd);
+		return -1;
+	}
+
+	return i2c_fd;
+
+}
+
+// Reads the levels on the expander's pins
+int i2c_read_pins(unsigned char *value) {
+
+	int i2c_fd;
+	unsigned char buffer[1];
+
+	i2c_fd = i2c_open_expander();
+	if (i2c_fd < 0)
+		return 1;
+
+	buffer[0] = EXP_INPUT_REG;
+
+	if (write(i2c_fd, buffer, 1) != 1) {
+		perror("I2C write failed");
+		close(i2c_fd);
 		return 1;
 	}
+	if (read(i2c_fd, value, 1) != 1) {
+		perror("I2C read failed");
+		close(i2c_fd);
+		return 1;
+	}
+
+	close(i2c_fd);
+
+	return 0;
+
+}
 
-	buffer[0] = 0x00; // Address of data register
+// Clears then sets bits in the expander's output register, and makes the
+// pins the Pi drives outputs the first time
+int i2c_update_pins(unsigned char clear, unsigned char set) {
+
+	int i2c_fd;
+	unsigned char buffer[2];
+
+	i2c_fd = i2c_open_expander();
+	if (i2c_fd < 0)
+		return 1;
+
+	buffer[0] = EXP_OUTPUT_REG;
 
 	if (write(i2c_fd, buffer, 1) != 1) {
 		perror("I2C write failed");
@@ -40,7 +90,7 @@ int i2c_disconnect_spi() {
 		return 1;
 	}
 
-	buffer[1] |= 0x10; // OE bit that controls SPI
+	buffer[1] = (buffer[1] & ~clear) | set;
 
 	if (write(i2c_fd, buffer, 2) != 2) {
 		perror("I2C write failed");
@@ -48,8 +98,32 @@ int i2c_disconnect_spi() {
 		return 1;
 	}
 
+	// After the output register, so the pins start at the right level
+	if (!directionSet) {
+
+		buffer[0] = EXP_CONFIG_REG;
+		buffer[1] = 0xFF & ~EXP_OUTPUTS;
+
+		if (write(i2c_fd, buffer, 2) != 2) {
+			perror("I2C write failed");
+			close(i2c_fd);
+			return 1;
+		}
+
+		directionSet = 1;
+	}
+
 	close(i2c_fd);
 
 	return 0;
 
 }
+
+int i2c_disconnect_spi() {
+
+	// logi_loader leaves fpga/flash SPI pins connected to Pi
+	// so we need to disconnect them now
+
+	return i2c_update_pins(0, 0x10); // OE bit that controls SPI
+
+}
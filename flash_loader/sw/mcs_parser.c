@@ -1,103 +1,267 @@
 #include <stdio.h>
 #include <string.h>
+#include "mcs_parser.h"
 
 /*
- * Unused routine to parse MCS files.  This has been tested on a basic MCS file generated
- * by iMPACT.  This may be useful if we want to use mutliboot images generated by iMPACT
- * at a later date.
+ * Parses MCS (Intel HEX) files, as generated by iMPACT, for flash_loader:
+ * the data goes into flashMemory at its flash address and the parts of the
+ * flash that the file covers are returned as a list of ranges, so the gaps
+ * between images can be left alone.
+ *
+ * The file is read in large blocks and decoded one character at a time, so
+ * a 32 MB image takes a fraction of a second.
  */
 
+// A record is at most 255 data bytes plus count, address, type and checksum
+#define MCS_MAX_RECORD (255 + 5)
 
-int parseMVS(FILE *inputFile, unsigned char *flashMemory, unsigned int flashMemoryMax, unsigned int *flashDataLen) {
+#define MCS_READ_SIZE (64*1024)
 
-	char line[1024];
-	unsigned int byteCount, recAddr, recType, highAddr;
-	unsigned int i, dataByte;
+// Value of each hex digit, 0xFF for anything else
+static unsigned char hexValue[256];
+static int hexTableReady = 0;
 
-	*flashDataLen = 0;
+static void init_hex_table() {
 
-	while (!feof(inputFile)) {
+	int i;
 
-		memset(line, 0, sizeof(line));
+	memset(hexValue, 0xFF, sizeof(hexValue));
 
-		if (!fgets(line, sizeof(line), inputFile)) {
+	for (i = 0; i < 10; i++)
+		hexValue['0' + i] = i;
+
+	for (i = 0; i < 6; i++) {
+		hexValue['A' + i] = 10 + i;
+		hexValue['a' + i] = 10 + i;
+	}
+
+	hexTableReady = 1;
+
+}
+
+struct mcs_state {
+	unsigned char *flashMemory;
+	unsigned int flashMemoryMax;
+	struct mcs_range *ranges;
+	unsigned int maxRanges;
+	unsigned int numRanges;
+	unsigned int flashDataLen;
+	unsigned int baseAddr;
+	int done;
+};
+
+// Handles one complete record, returns non-zero on error
+static int mcs_record(struct mcs_state *state, unsigned char *rec, unsigned int recLen, unsigned int lineNum) {
+
+	unsigned int i, byteCount, recAddr, recType, addr;
+	unsigned char sum = 0;
+	struct mcs_range *range;
+
+	if (recLen < 5) {
+		fprintf(stderr, "Record too short on line %u\n", lineNum);
+		return 1;
+	}
+
+	byteCount = rec[0];
+	recAddr = (rec[1] << 8) | rec[2];
+	recType = rec[3];
+
+	if (recLen != byteCount + 5) {
+		fprintf(stderr, "Invalid line length on line %u\n", lineNum);
+		return 1;
+	}
+
+	for (i = 0; i < recLen; i++)
+		sum += rec[i];
+
+	if (sum != 0) {
+		fprintf(stderr, "Bad checksum on line %u\n", lineNum);
+		return 1;
+	}
+
+	switch (recType) {
+
+	case 0: // Data
+
+		if (byteCount == 0)
 			break;
-		}
 
-		if (line[strlen(line) - 1] == '\n') {
-			line[strlen(line) - 1] = 0;
+		addr = state->baseAddr + recAddr;
+
+		if (addr >= state->flashMemoryMax || byteCount > state->flashMemoryMax - addr) {
+			fprintf(stderr, "Address out of range on line %u\n", lineNum);
+			return 1;
 		}
-		if (line[strlen(line) - 1] == '\r') {
-			line[strlen(line) - 1] = 0;
+
+		memcpy(state->flashMemory + addr, rec + 4, byteCount);
+
+		// Carry on the last range if this follows it
+		range = state->numRanges > 0 ? &state->ranges[state->numRanges - 1] : NULL;
+
+		if (range && range->start + range->length == addr) {
+			range->length += byteCount;
 		}
+		else {
+
+			if (state->numRanges == state->maxRanges) {
+				fprintf(stderr, "Too many separate address ranges on line %u\n", lineNum);
+				return 1;
+			}
+
+			range = &state->ranges[state->numRanges++];
+			range->start = addr;
+			range->length = byteCount;
 
-		if (!line[0] == ':') {
-			fprintf(stderr, "Invalid line in file: %s\n", line);
-			return 1;
 		}
 
-		if (sscanf(line+1, "%2X%4X%2X", &byteCount, &recAddr, &recType) != 3) {
-			fprintf(stderr, "Invalid line in file: %s\n", line);
+		if (addr + byteCount > state->flashDataLen)
+			state->flashDataLen = addr + byteCount;
+
+		break;
+
+	case 1: // End of file
+		state->done = 1;
+		break;
+
+	case 2: // Extended segment address
+	case 4: // Extended linear address
+
+		if (byteCount != 2) {
+			fprintf(stderr, "Invalid byte count for address record on line %u\n", lineNum);
 			return 1;
 		}
 
-		if (recType == 0) {
+		state->baseAddr = (rec[4] << 8) | rec[5];
+		state->baseAddr <<= recType == 2 ? 4 : 16;
 
-			if (strlen(line) != 1+8+2+(byteCount*2)) {
-				fprintf(stderr, "Invalid line length: %i %s\n", (1+8+2+byteCount), line);
-				return 1;
-			}
+		break;
 
-			for (i = 0; i < byteCount; i++) {
+	case 3: // Start segment address
+	case 5: // Start linear address
+		// Only means something to a CPU
+		break;
 
-				if (sscanf(line+1+8+(i*2), "%2X", &dataByte) != 1) {
-					fprintf(stderr, "Error while reading byte in line: %s\n", line);
-					return 1;
+	default:
+		fprintf(stderr, "Invalid record type on line %u\n", lineNum);
+		return 1;
+
+	}
+
+	return 0;
+
+}
+
+/*
+ * Reads the whole file into flashMemory.  On success ranges holds
+ * numRanges runs of data in file order, and flashDataLen is the end of the
+ * highest one.  Returns non-zero on error.
+ */
+int parseMCS(FILE *inputFile, unsigned char *flashMemory, unsigned int flashMemoryMax,
+		struct mcs_range *ranges, unsigned int maxRanges, unsigned int *numRanges, unsigned int *flashDataLen) {
+
+	unsigned char buffer[MCS_READ_SIZE];
+	unsigned char rec[MCS_MAX_RECORD];
+	unsigned int recLen = 0, lineNum = 1;
+	unsigned char c, value, highNibble = 0;
+	int inRecord = 0, haveNibble = 0;
+	size_t len, i;
+	struct mcs_state state;
+
+	if (!hexTableReady)
+		init_hex_table();
+
+	memset(&state, 0, sizeof(state));
+	state.flashMemory = flashMemory;
+	state.flashMemoryMax = flashMemoryMax;
+	state.ranges = ranges;
+	state.maxRanges = maxRanges;
+
+	while (!state.done && (len = fread(buffer, 1, sizeof(buffer), inputFile)) > 0) {
+
+		for (i = 0; i < len && !state.done; i++) {
+
+			c = buffer[i];
+			value = hexValue[c];
+
+			if (inRecord && value != 0xFF) {
+
+				if (!haveNibble) {
+					highNibble = value;
+					haveNibble = 1;
+					continue;
 				}
 
-				if (highAddr + recAddr + i >= flashMemoryMax) {
-					fprintf(stderr, "Address out of range in line: %s\n", line);
+				if (recLen == MCS_MAX_RECORD) {
+					fprintf(stderr, "Line %u is too long\n", lineNum);
 					return 1;
 				}
 
-				flashMemory[highAddr + recAddr + i] = dataByte & 0xFF;
+				rec[recLen++] = (highNibble << 4) | value;
+				haveNibble = 0;
 
 			}
+			else if (c == ':' && !inRecord) {
 
-			if (highAddr + recAddr + byteCount > *flashDataLen)
-				*flashDataLen = highAddr + recAddr + byteCount;
-
-		}
-		else if (recType == 1) {
-			break;
-		}
-		else if (recType == 4) {
+				inRecord = 1;
+				recLen = 0;
+				haveNibble = 0;
 
-			if (strlen(line) != 1+8+2+(byteCount*2)) {
-				fprintf(stderr, "Invalid line length: %i %s\n", (1+8+2+byteCount), line);
-				return 1;
 			}
+			else if (c == '\n' || c == '\r') {
 
-			if (byteCount != 2) {
-				fprintf(stderr, "Invalid byte count for linear address record in line: %s\n", line);
-				return 1;
-			}
+				if (inRecord) {
 
-			if (sscanf(line+1+8, "%4X", &recAddr) != 1) {
-				fprintf(stderr, "Invalid line in file: %s\n", line);
+					if (haveNibble) {
+						fprintf(stderr, "Odd number of digits on line %u\n", lineNum);
+						return 1;
+					}
+
+					if (mcs_record(&state, rec, recLen, lineNum))
+						return 1;
+
+					inRecord = 0;
+
+				}
+
+				if (c == '\n')
+					lineNum++;
+
+			}
+			else if (c != ' ' && c != '\t') {
+				fprintf(stderr, "Invalid character in line %u\n", lineNum);
 				return 1;
 			}
 
-			highAddr = recAddr << 16;
-
 		}
-		else {
-			fprintf(stderr, "Invalid record type in line: %s\n", line);
+
+	}
+
+	if (ferror(inputFile)) {
+		perror("Error reading MCS file");
+		return 1;
+	}
+
+	// The last line may not have a line ending
+	if (!state.done && inRecord) {
+
+		if (haveNibble) {
+			fprintf(stderr, "Odd number of digits on line %u\n", lineNum);
 			return 1;
 		}
 
+		if (mcs_record(&state, rec, recLen, lineNum))
+			return 1;
+
 	}
 
+	if (!state.done) {
+		fprintf(stderr, "No end of file record, the file may be truncated\n");
+		return 1;
+	}
+
+	*numRanges = state.numRanges;
+	*flashDataLen = state.flashDataLen;
+
 	return 0;
 
 }
@@ -0,0 +1,20 @@
+#ifndef MCS_PARSER_H
+#define MCS_PARSER_H
+
+#include <stdio.h>
+
+/*
+ * MCS (Intel HEX) files as generated by iMPACT (see mcs_parser.c).
+ * Addresses in the file are flash addresses.
+ */
+
+// A run of bytes the file has data for
+struct mcs_range {
+	unsigned int start;
+	unsigned int length;
+};
+
+int parseMCS(FILE *inputFile, unsigned char *flashMemory, unsigned int flashMemoryMax,
+		struct mcs_range *ranges, unsigned int maxRanges, unsigned int *numRanges, unsigned int *flashDataLen);
+
+#endif
@@ -1,26 +1,67 @@
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>
+#include "spitrace.h"
+#include "spispeed.h"
 
 int spi_fd ;
 unsigned int fifo_size ;
 static const char * device = "/dev/spidev0.0";
 static unsigned int mode = 0 ;
 static unsigned int bits = 8 ;
-unsigned long spi_speed = 16000000UL ;
-static unsigned int delay = 0;
 
 // Flash chip should go up to 50MHz, but it only
-// seems stable up to 16MHz or so.
+// seems stable up to 16MHz or so.  flash_loader -c
+// finds what this board can do.
+#define SPI_DEFAULT_SPEED 16000000UL
+
+unsigned long spi_speed = SPI_DEFAULT_SPEED ;
+// Used when there is no calibration, or it stops working
+const unsigned long spi_default_speed = SPI_DEFAULT_SPEED ;
+// Name of this SPI implementation, for reports
+const char * spi_backend = "spidev";
+// Key for the calibrated clock, see spispeed.c
+const char * spi_speed_bus = "flash";
+static unsigned int delay = 0;
 
+// spidev refuses messages larger than this in total
+static const char * bufsiz_param = "/sys/module/spidev/parameters/bufsiz";
+#define SPI_DEFAULT_BUFSIZ 4096
+static unsigned int bufferSize = SPI_DEFAULT_BUFSIZ;
 
 // SPI routines borrowed from logipi_loader and logipi_wishbone projects
 
+// Reads spidev's limit, which can only change when the module is reloaded
+static unsigned int read_buffer_size(void){
+
+	FILE *f;
+	unsigned int size;
+
+	f = fopen(bufsiz_param, "r");
+	if (f == NULL)
+		return SPI_DEFAULT_BUFSIZ;
+
+	if (fscanf(f, "%u", &size) != 1 || size == 0)
+		size = SPI_DEFAULT_BUFSIZ;
+
+	fclose(f);
+
+	return size;
+}
+
 int spi_init(void){
 	int ret ;
+
+	spi_trace_init();
+
+	bufferSize = read_buffer_size();
+
+	spi_speed = spi_speed_load(spi_speed_bus, spi_default_speed);
+
 	spi_fd = open(device, O_RDWR);
 	if (spi_fd < 0){
 		perror("Error while opening SPI device");
@@ -76,6 +117,7 @@ int spi_init(void){
 int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size)
 {
 	int ret ;
+	SPI_TRACE_BEGIN(traceStart);
 	struct spi_ioc_transfer tr = {
 		.tx_buf = (unsigned long)send_buffer,
 		.rx_buf = (unsigned long)receive_buffer,
@@ -86,6 +128,43 @@ int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, un
 	};
 
 	ret = ioctl(spi_fd, SPI_IOC_MESSAGE(1), &tr);
+	SPI_TRACE_END(traceStart, "spi_transfer", SPI_TRACE_NONE,
+		send_buffer ? send_buffer[0] : SPI_TRACE_NONE, size);
+	if (ret < 1){
+		perror("Can't send spi message");
+		return -1 ;
+	}
+	return 0;
+}
+
+/*
+ * Sends two commands in one message, releasing chip select between them.
+ * Used for WREN followed by a program or erase, which saves an ioctl.
+ */
+int spi_transfer_pair(unsigned char * first, unsigned int first_len, unsigned char * second, unsigned int second_len)
+{
+	int ret ;
+	struct spi_ioc_transfer tr[2];
+	SPI_TRACE_BEGIN(traceStart);
+
+	memset(tr, 0, sizeof(tr));
+
+	tr[0].tx_buf = (unsigned long)first;
+	tr[0].len = first_len;
+	tr[0].speed_hz = spi_speed;
+	tr[0].bits_per_word = bits;
+	tr[0].cs_change = 1;
+
+	tr[1].tx_buf = (unsigned long)second;
+	tr[1].len = second_len;
+	tr[1].delay_usecs = delay;
+	tr[1].speed_hz = spi_speed;
+	tr[1].bits_per_word = bits;
+
+	ret = ioctl(spi_fd, SPI_IOC_MESSAGE(2), tr);
+	SPI_TRACE_END(traceStart, "spi_transfer_pair",
+		second_len >= 4 ? (second[1] << 16) | (second[2] << 8) | second[3] : SPI_TRACE_NONE,
+		second[0], first_len + second_len);
 	if (ret < 1){
 		perror("Can't send spi message");
 		return -1 ;
@@ -93,6 +172,47 @@ int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, un
 	return 0;
 }
 
+/*
+ * Sends cmd then reads size bytes straight into receive_buffer, with chip
+ * select held for both.  cmd_len + size must not be more than
+ * spi_buffer_size().
+ */
+int spi_transfer_read(unsigned char * cmd, unsigned int cmd_len, unsigned char * receive_buffer, unsigned int size)
+{
+	int ret ;
+	struct spi_ioc_transfer tr[2];
+	SPI_TRACE_BEGIN(traceStart);
+
+	memset(tr, 0, sizeof(tr));
+
+	tr[0].tx_buf = (unsigned long)cmd;
+	tr[0].len = cmd_len;
+	tr[0].speed_hz = spi_speed;
+	tr[0].bits_per_word = bits;
+
+	tr[1].rx_buf = (unsigned long)receive_buffer;
+	tr[1].len = size;
+	tr[1].delay_usecs = delay;
+	tr[1].speed_hz = spi_speed;
+	tr[1].bits_per_word = bits;
+
+	ret = ioctl(spi_fd, SPI_IOC_MESSAGE(2), tr);
+	SPI_TRACE_END(traceStart, "spi_transfer_read",
+		cmd_len >= 4 ? (cmd[1] << 16) | (cmd[2] << 8) | cmd[3] : SPI_TRACE_NONE,
+		cmd[0], cmd_len + size);
+	if (ret < 1){
+		perror("Can't send spi message");
+		return -1 ;
+	}
+	return 0;
+}
+
+// Largest message spidev will accept, as read by spi_init
+unsigned int spi_buffer_size(void){
+
+	return bufferSize;
+}
+
 void spi_close(void){
 	close(spi_fd);
 }
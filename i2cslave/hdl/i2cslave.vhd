@@ -7,6 +7,8 @@
 --   DATA_WIDTH  -- Wishbone data width in bits (8, 16, 24, 32...64)
 --   I2C_ADDRESS -- I2C device address, defaults to 0x60 which does not
 --                  conflict with logipi board
+--   AUTO_INC_ADDRESS -- Increment the WB address after each word of a
+--                       transaction
 --
 -- Signals: Clock, Reset, standard wishbone, SDA, SCL
 --
@@ -16,11 +18,15 @@
 --         WB address results in the address register being undefined.
 --         After sending the WB address, optionally send (DATA_WIDTH/8) bytes
 --         of WB data.  Sending partial WB data results in the write being
---         cancelled.
+--         cancelled.  Keep sending data to write the following words (if
+--         AUTO_INC_ADDRESS is set, otherwise they all go to the same address).
 --
 -- Reads: First perform a write of (ADDR_WIDTH/8) bytes to set the WB address.
 --        Next perform a read of (DATA_WIDTH/8) bytes to read the WB data.
 --        Performing a partial read will read the first N bits of the WB data.
+--        ACK the last byte of a word to read the following word (if
+--        AUTO_INC_ADDRESS is set, otherwise the same word again).  The write
+--        and the read can be one transaction with a repeated start.
 --
 -- WB addresses and data are in big endian order, MSB first.
 --
@@ -58,7 +64,8 @@ entity i2cslave is
 	 Generic (
 				  ADDR_WIDTH : Positive range 8 to 64 := 8;
 				  DATA_WIDTH : Positive range 8 to 64 := 8;
-				  I2C_ADDRESS : Positive range 1 to 16#7F# := 16#60#
+				  I2C_ADDRESS : Positive range 1 to 16#7F# := 16#60#;
+				  AUTO_INC_ADDRESS : STD_LOGIC := '1'
 	           );
     Port ( sys_clk : in  STD_LOGIC;
            i2c_sda : inout  STD_LOGIC;
@@ -484,9 +491,18 @@ begin
 						state <= DONE_SCL_LOW;
 					else
 						
-						-- TODO: Count the data bits and if needed, increment address?
-						
-						state <= READ_BEGIN_BYTE;
+						if data_bit_count = DATA_WIDTH then
+							
+							-- Whole word sent, fetch the next one
+							if AUTO_INC_ADDRESS = '1' then
+								addr_reg <= addr_reg + 1;
+							end if;
+							
+							state <= READ_WB_CYCLE_START;
+							
+						else
+							state <= READ_BEGIN_BYTE;
+						end if;
 						
 					end if;
 				
@@ -550,6 +566,12 @@ begin
 							data_reg(DATA_WIDTH-1 downto 0) <= data_reg(DATA_WIDTH-2 downto 0) & tmp_bit;
 							
 							if data_bit_count = DATA_WIDTH then
+								
+								-- First bit of the next word
+								if AUTO_INC_ADDRESS = '1' then
+									addr_reg <= addr_reg + 1;
+								end if;
+								
 								data_bit_count <= 1;
 							else
 								data_bit_count <= data_bit_count + 1;
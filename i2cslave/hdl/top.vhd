@@ -76,7 +76,8 @@ begin
 	generic map(
 		DATA_WIDTH => 16,
 		ADDR_WIDTH => 16,
-		I2C_ADDRESS => 16#60#
+		I2C_ADDRESS => 16#60#,
+		AUTO_INC_ADDRESS => '1'
 	)
 	port map(
 		sys_clk => OSC_FPGA,
@@ -26,22 +26,91 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdint.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
+#include <time.h>
 
 #define I2C_DEVICE_ADDR 0x60
 
+// Words per transaction, the slave moves to the next address after each one
+#define BLOCK_WORDS 64
+
 // I2C routines borrowed from logipi_loader
 
+static double elapsed(struct timespec *start) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Writes count 16-bit words starting at addr in one transaction
+static int i2c_write_block(int i2c_fd, unsigned int addr, unsigned char *data, unsigned int count) {
+
+	unsigned char i2c_out[2 + BLOCK_WORDS * 2];
+	struct i2c_msg msgs[1];
+	struct i2c_rdwr_ioctl_data rdwr;
+
+	// Addr
+	i2c_out[0] = (unsigned char) ((addr >> 8) & 0xFF);
+	i2c_out[1] = (unsigned char) (addr & 0xFF);
+	// Data
+	memcpy(i2c_out + 2, data, count * 2);
+
+	msgs[0].addr = I2C_DEVICE_ADDR;
+	msgs[0].flags = 0;
+	msgs[0].len = 2 + count * 2;
+	msgs[0].buf = i2c_out;
+
+	rdwr.msgs = msgs;
+	rdwr.nmsgs = 1;
+
+	return ioctl(i2c_fd, I2C_RDWR, &rdwr) < 0;
+}
+
+// Reads count 16-bit words starting at addr: the address is written and
+// the data read back after a repeated start, so nothing can get in between
+static int i2c_read_block(int i2c_fd, unsigned int addr, unsigned char *data, unsigned int count) {
+
+	unsigned char i2c_out[2];
+	struct i2c_msg msgs[2];
+	struct i2c_rdwr_ioctl_data rdwr;
+
+	// Addr
+	i2c_out[0] = (unsigned char) ((addr >> 8) & 0xFF);
+	i2c_out[1] = (unsigned char) (addr & 0xFF);
+
+	msgs[0].addr = I2C_DEVICE_ADDR;
+	msgs[0].flags = 0;
+	msgs[0].len = 2;
+	msgs[0].buf = i2c_out;
+
+	msgs[1].addr = I2C_DEVICE_ADDR;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = count * 2;
+	msgs[1].buf = data;
+
+	rdwr.msgs = msgs;
+	rdwr.nmsgs = 2;
+
+	return ioctl(i2c_fd, I2C_RDWR, &rdwr) < 0;
+}
+
 int main() {
 
-	int i2c_fd, i, r;
-	unsigned char i2c_out[128], i2c_in[128];
+	int i2c_fd, i, j, r;
+	unsigned char i2c_out[BLOCK_WORDS * 2], i2c_in[BLOCK_WORDS * 2];
+	struct timespec start;
+	double seconds;
 
 
 	i2c_fd = open("/dev/i2c-1", O_RDWR);
@@ -50,53 +119,64 @@ int main() {
 		close(i2c_fd);
 		return -1 ;
 	}
-	if (ioctl(i2c_fd, I2C_SLAVE, I2C_DEVICE_ADDR) < 0){
-		printf("I2C communication error ! \n");
-		close(i2c_fd);
-		return -1 ;
-	}
 
-	srand(time());
+	srand(time(NULL));
 	r = rand();
 
 	printf("Writing data...\n");
 
-	for (i = 0; i < (1<<15); i++) {
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-		// Addr
-		i2c_out[0] = (unsigned char) ((i >> 8) & 0xFF);
-		i2c_out[1] = (unsigned char) (i & 0xFF);
-		// Data
-		i2c_out[2] = (unsigned char)(((i >> 8) ^ (r >> 8)) & 0xFF);
-		i2c_out[3] = (unsigned char)((i ^ r) & 0xFF);
+	for (i = 0; i < (1<<15); i += BLOCK_WORDS) {
 
-		write(i2c_fd, i2c_out, 4);
+		for (j = 0; j < BLOCK_WORDS; j++) {
+			i2c_out[j*2] = (unsigned char)((((i + j) >> 8) ^ (r >> 8)) & 0xFF);
+			i2c_out[j*2+1] = (unsigned char)(((i + j) ^ r) & 0xFF);
+		}
+
+		if (i2c_write_block(i2c_fd, i, i2c_out, BLOCK_WORDS)) {
+			perror("I2C write failed");
+			close(i2c_fd);
+			return -1;
+		}
 
 	}
 
+	seconds = elapsed(&start);
+	printf("Wrote %d words in %.3f s (%.0f words/s)\n", 1<<15, seconds, (1<<15) / seconds);
+
 	printf("Reading back data...\n");
 
-	for (i = 0; i < (1<<15); i++) {
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-		// Addr
-		i2c_out[0] = (unsigned char) ((i >> 8) & 0xFF);
-		i2c_out[1] = (unsigned char) (i & 0xFF);
+	for (i = 0; i < (1<<15); i += BLOCK_WORDS) {
 
-		write(i2c_fd, i2c_out, 2);
+		memset(i2c_in, 0, sizeof(i2c_in));
 
-		i2c_in[0] = 0;
-		i2c_in[1] = 0;
+		if (i2c_read_block(i2c_fd, i, i2c_in, BLOCK_WORDS)) {
+			perror("I2C read failed");
+			close(i2c_fd);
+			return -1;
+		}
 
-		read(i2c_fd, i2c_in, 2);
+		for (j = 0; j < BLOCK_WORDS; j++) {
+
+			if ((unsigned char)((((i + j) >> 8) ^ (r >> 8)) & 0xFF) != i2c_in[j*2] ||
+			    (unsigned char)(((i + j) ^ r) & 0xFF) != i2c_in[j*2+1]) {
+				printf("Mismatch at 0x%04x: 0x%04x vs 0x%02x%02x\n", i + j, (i + j) ^ (r & 0xFFFF), i2c_in[j*2], i2c_in[j*2+1]);
+				break;
+			}
 
-		if ((unsigned char)(((i >> 8) ^ (r >> 8)) & 0xFF) != i2c_in[0] ||
-		    (unsigned char)((i ^ r) & 0xFF) != i2c_in[1]) {
-			printf("Mismatch at 0x%04x: 0x%04x vs 0x%02x%02x\n", i, i ^ 0xDEAD, i2c_in[0], i2c_in[1]);
-			break;
 		}
 
+		if (j < BLOCK_WORDS)
+			break;
+
 	}
 
+	seconds = elapsed(&start);
+	printf("Read %d words in %.3f s (%.0f words/s)\n", i, seconds, i / seconds);
+
 	printf("Done\n");
 
 	close(i2c_fd);
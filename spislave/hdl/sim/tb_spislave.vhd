@@ -0,0 +1,203 @@
+----------------------------------------------------------------------------------
+--
+-- Testbench for spislave as top.vhd uses it (16-bit address and data,
+-- auto increment, no dummy bytes), with a plain memory as the WB slave.
+--
+-- Writes a burst, reads it back, then reads bursts that run past the top
+-- of the address space.  Reads must wrap to address 0 and never start a
+-- WB write.  Stops with a failure on the first mismatch.
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+entity tb_spislave is
+end tb_spislave;
+
+architecture sim of tb_spislave is
+
+	constant ADDR_WIDTH : integer := 16;
+	constant DATA_WIDTH : integer := 16;
+	constant WORDS : integer := 2**(ADDR_WIDTH-1);
+
+	-- 100 MHz sys_clk, 10 MHz SPI
+	constant SYS_PERIOD : time := 10 ns;
+	constant SPI_HALF : time := 50 ns;
+
+	type mem_type is array(0 to WORDS-1) of std_logic_vector(DATA_WIDTH-1 downto 0);
+
+	-- Each word holds something that depends on its address
+	function init_mem return mem_type is
+		variable m : mem_type;
+	begin
+		for i in 0 to WORDS-1 loop
+			m(i) := std_logic_vector(to_unsigned((i * 40503 + 12345) mod 65536, DATA_WIDTH));
+		end loop;
+		return m;
+	end function;
+
+	signal mem : mem_type := init_mem;
+
+	signal sys_clk : std_logic := '0';
+	signal done : boolean := false;
+
+	signal spi_clk : std_logic := '0';
+	signal spi_ce : std_logic := '1';
+	signal spi_mosi : std_logic := '0';
+	signal spi_miso : std_logic;
+
+	signal wb_cycle, wb_strobe, wb_write, wb_ack : std_logic := '0';
+	signal wb_address : std_logic_vector(ADDR_WIDTH-1 downto 0);
+	signal wb_data_i, wb_data_o : std_logic_vector(DATA_WIDTH-1 downto 0);
+
+	-- WB writes started, counted on the rising edge of wb_strobe
+	signal write_count : natural := 0;
+	signal last_strobe : std_logic := '0';
+
+begin
+
+	sys_clk <= not sys_clk after SYS_PERIOD / 2 when not done;
+
+	dut : entity work.spislave
+	generic map (
+		ADDR_WIDTH => ADDR_WIDTH,
+		DATA_WIDTH => DATA_WIDTH,
+		AUTO_INC_ADDRESS => '1',
+		READ_DUMMY_BYTES => 0
+	)
+	port map (
+		sys_clk => sys_clk,
+		spi_clk => spi_clk,
+		spi_ce => spi_ce,
+		spi_mosi => spi_mosi,
+		spi_miso => spi_miso,
+		wb_cycle => wb_cycle,
+		wb_strobe => wb_strobe,
+		wb_write => wb_write,
+		wb_address => wb_address,
+		wb_data_i => wb_data_i,
+		wb_data_o => wb_data_o,
+		wb_ack => wb_ack
+	);
+
+	-- Memory with reads straight from the address.  ack follows strobe, so
+	-- it is still there at the next SPI clock, which is when spislave looks.
+	wb_data_i <= mem(to_integer(unsigned(wb_address)));
+
+	process(sys_clk)
+	begin
+
+		if rising_edge(sys_clk) then
+
+			wb_ack <= wb_strobe;
+			last_strobe <= wb_strobe;
+
+			if wb_strobe = '1' and last_strobe = '0' and wb_write = '1' then
+				mem(to_integer(unsigned(wb_address))) <= wb_data_o;
+				write_count <= write_count + 1;
+			end if;
+
+		end if;
+
+	end process;
+
+
+	process
+
+		variable rx : std_logic_vector(7 downto 0);
+		variable word : std_logic_vector(DATA_WIDTH-1 downto 0);
+		variable writes : natural;
+
+		-- Mode 0: MOSI changes while the clock is low, MISO is sampled as it rises
+		procedure spi_byte(tx : in std_logic_vector(7 downto 0); rx : out std_logic_vector(7 downto 0)) is
+		begin
+			for i in 7 downto 0 loop
+				spi_mosi <= tx(i);
+				wait for SPI_HALF;
+				spi_clk <= '1';
+				rx(i) := spi_miso;
+				wait for SPI_HALF;
+				spi_clk <= '0';
+			end loop;
+		end procedure;
+
+		procedure spi_start(address : in natural; write_flag : in std_logic) is
+			variable a : std_logic_vector(ADDR_WIDTH-1 downto 0);
+			variable dummy : std_logic_vector(7 downto 0);
+		begin
+			a := write_flag & std_logic_vector(to_unsigned(address, ADDR_WIDTH-1));
+			spi_ce <= '0';
+			wait for SPI_HALF;
+			spi_byte(a(15 downto 8), dummy);
+			spi_byte(a(7 downto 0), dummy);
+		end procedure;
+
+		procedure spi_end is
+		begin
+			wait for SPI_HALF;
+			spi_ce <= '1';
+			wait for 4 * SPI_HALF;
+		end procedure;
+
+		procedure write_burst(address : in natural; count : in natural; seed : in natural) is
+			variable dummy : std_logic_vector(7 downto 0);
+		begin
+			spi_start(address, '1');
+			for i in 0 to count-1 loop
+				word := std_logic_vector(to_unsigned((seed + i * 7919) mod 65536, DATA_WIDTH));
+				spi_byte(word(15 downto 8), dummy);
+				spi_byte(word(7 downto 0), dummy);
+			end loop;
+			spi_end;
+		end procedure;
+
+		-- Reads count words from address on and checks them against mem
+		procedure read_burst(address : in natural; count : in natural) is
+		begin
+			writes := write_count;
+			spi_start(address, '0');
+			for i in 0 to count-1 loop
+				spi_byte(x"00", rx);
+				word(15 downto 8) := rx;
+				spi_byte(x"00", rx);
+				word(7 downto 0) := rx;
+				assert word = mem((address + i) mod WORDS)
+					report "Read of " & integer'image((address + i) mod WORDS) & " in a burst from " &
+						integer'image(address) & " returned the wrong word"
+					severity failure;
+			end loop;
+			spi_end;
+			assert write_count = writes
+				report "Burst read from " & integer'image(address) & " started a WB write"
+				severity failure;
+		end procedure;
+
+	begin
+
+		wait for 10 * SYS_PERIOD;
+
+		-- Writes, wrapping at the top, then read back
+		write_burst(16#7FFD#, 5, 1);
+		assert write_count = 5 report "Burst write did not write 5 words" severity failure;
+		assert mem(16#7FFD#) = std_logic_vector(to_unsigned(1, DATA_WIDTH)) and
+			mem(1) = std_logic_vector(to_unsigned(1 + 4 * 7919, DATA_WIDTH))
+			report "Burst write went to the wrong addresses" severity failure;
+		read_burst(16#7FFD#, 5);
+
+		-- Single words and bursts in the middle
+		read_burst(16#1234#, 1);
+		read_burst(16#0100#, 64);
+
+		-- Bursts whose read ahead carries out of the address bits
+		read_burst(16#7FFE#, 4);
+		read_burst(16#7FFF#, 4);
+		read_burst(16#7FFF#, 1);
+
+		report "spislave: all tests passed";
+		done <= true;
+		wait;
+
+	end process;
+
+end sim;
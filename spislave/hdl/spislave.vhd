@@ -5,6 +5,8 @@
 -- Parameters:
 --   ADDR_WIDTH  -- Wishbone address width in bits (8, 16, 24, 32...64)
 --   DATA_WIDTH  -- Wishbone data width in bits (8, 16, 24, 32...64)
+--   AUTO_INC_ADDRESS -- Increment the WB address after each word of a burst
+--   READ_DUMMY_BYTES -- Bytes between the address and the first word of a read
 --
 -- Signals: Clock, Reset, standard wishbone, SPI: CLK, CE, MOSI, MISO
 --
@@ -20,16 +22,21 @@
 --
 -- Reads: First perform a write of (ADDR_WIDTH/8) bytes to set the WB address.
 --        The top bit of the addressw must be set to '0' to indicate a read
---        cycle.  Send (DATA_WIDTH/8) more bytes of any value while reading
---        from the MISO pin.  Performing a partial read will read the first N
---        bits of the WB data.
+--        cycle.  Send READ_DUMMY_BYTES of any value, then (DATA_WIDTH/8) more
+--        bytes of any value while reading from the MISO pin.  Performing a
+--        partial read will read the first N bits of the WB data.  Keep CE low
+--        and send more bytes to read the following words (if AUTO_INC_ADDRESS
+--        is set), with no dummy bytes between them.  Each word is read from WB
+--        while the one before it is shifted out, so the word after the last
+--        one is also read.  Bursts wrap from the top WB address to 0.
 --
 -- WB addresses and data are in big endian order, MSB first.
 --
 -- Because the SPI protocol has no way to tell the master device to wait for
--- data to become available, WB reads must be complete within one SPI clock
--- cycle.  With a Raspberry PI running SPI at 32MHz and sys_clk at 100MHz, that
--- is less than 3 sys_clk cycles.
+-- data to become available, the first WB read must be complete within one SPI
+-- clock cycle plus 8 for each dummy byte.  With a Raspberry PI running SPI at
+-- 32MHz and sys_clk at 100MHz, one SPI clock is less than 3 sys_clk cycles.
+-- Later words in a burst have (DATA_WIDTH-2) SPI clock cycles.
 --
 ----------------------------------------------------------------------------------
 --
@@ -65,7 +72,8 @@ entity spislave is
 	 Generic (
 				  ADDR_WIDTH : Positive range 8 to 64 := 8;
 				  DATA_WIDTH : Positive range 8 to 64 := 8;
-				  AUTO_INC_ADDRESS : STD_LOGIC := '1'
+				  AUTO_INC_ADDRESS : STD_LOGIC := '1';
+				  READ_DUMMY_BYTES : Natural := 0
 				  );
     Port ( sys_clk : in  STD_LOGIC;
 			  
@@ -86,6 +94,8 @@ end spislave;
 
 architecture Behavioral of spislave is
 
+	constant DUMMY_BITS : integer := READ_DUMMY_BYTES * 8;
+
 	signal spi_addr_shift_reg : std_logic_vector(ADDR_WIDTH-1 downto 0);
 	signal spi_shift_in_reg : std_logic_vector(DATA_WIDTH-1 downto 0);
 	signal spi_shift_out_reg : std_logic_vector(DATA_WIDTH-1 downto 0);
@@ -100,6 +110,13 @@ architecture Behavioral of spislave is
 	signal wb_data_o_reg : std_logic_vector(DATA_WIDTH-1 downto 0);
 	
 	signal spi_clk_delayed : std_logic;
+	
+	-- Burst reads: bits since the address (dummy bits, then each word in
+	-- turn) and the next word, read from WB ahead of time
+	signal read_active : std_logic := '0';
+	signal read_bit_count : integer range 0 to (DUMMY_BITS + DATA_WIDTH - 1);
+	signal read_buf : std_logic_vector(DATA_WIDTH-1 downto 0);
+	signal read_buf_valid : std_logic := '0';
 
 begin
 	
@@ -131,6 +148,8 @@ begin
 			spi_shift_count <= 0;
 			wb_cycle_reg <= '0';
 			wb_strobe_reg <= '0';
+			read_active <= '0';
+			read_buf_valid <= '0';
 			
 		elsif rising_edge(spi_clk_delayed ) then
 			
@@ -160,14 +179,40 @@ begin
 				wb_write_reg <= '0';
 				wb_data_o_reg <= (others => '0');
 				
+				read_active <= '1';
+				read_bit_count <= 0;
+				read_buf_valid <= '0';
+				
 			-- Write cycle is done after data has arrived
-			elsif spi_shift_count = (ADDR_WIDTH+DATA_WIDTH-1) and spi_addr_shift_reg(ADDR_WIDTH-1) = '1' then
+			elsif spi_shift_count = (ADDR_WIDTH+DATA_WIDTH-1) and spi_addr_shift_reg(ADDR_WIDTH-1) = '1' and read_active = '0' then
 				
 				wb_cycle_reg <= '1';
 				wb_strobe_reg <= '1';
 				wb_write_reg <= '1';
 				wb_data_o_reg <= spi_shift_in_reg(DATA_WIDTH-2 downto 0) & spi_mosi;
 				
+			-- Read the next word of a burst once the last one has been used
+			elsif read_active = '1' and wb_strobe_reg = '0' and read_buf_valid = '0' then
+				
+				wb_cycle_reg <= '1';
+				wb_strobe_reg <= '1';
+				
+			end if;
+			
+			-- Counting through dummy bits, then through each word
+			if read_active = '1' then
+				
+				if read_bit_count = DUMMY_BITS + DATA_WIDTH - 1 then
+					read_bit_count <= DUMMY_BITS;
+				else
+					read_bit_count <= read_bit_count + 1;
+				end if;
+				
+				-- Word has gone to the output shift register
+				if read_bit_count = DUMMY_BITS then
+					read_buf_valid <= '0';
+				end if;
+				
 			end if;
 
 			-- End of read or write cycle
@@ -177,23 +222,41 @@ begin
 				wb_strobe_reg <= '0';
 				
 				-- If we allow multiple writes without de-asserting CE, then
-				-- increment address and go back to data phase
+				-- increment address and go back to data phase.  Only the
+				-- address bits count, the top bit is the read/write flag.
 				if AUTO_INC_ADDRESS = '1' and wb_write_reg = '1' then
 					
-					spi_addr_shift_reg <= spi_addr_shift_reg + 1;
+					spi_addr_shift_reg(ADDR_WIDTH-2 downto 0) <= spi_addr_shift_reg(ADDR_WIDTH-2 downto 0) + 1;
 					
 					spi_shift_count <= ADDR_WIDTH+1;
 					
 				end if;
 				
+				if wb_write_reg = '0' then
+					
+					if AUTO_INC_ADDRESS = '1' then
+						spi_addr_shift_reg(ADDR_WIDTH-2 downto 0) <= spi_addr_shift_reg(ADDR_WIDTH-2 downto 0) + 1;
+					end if;
+					
+					-- Keep the word for later unless it is going out right now
+					if read_bit_count /= DUMMY_BITS then
+						read_buf <= wb_data_i;
+						read_buf_valid <= '1';
+					end if;
+					
+				end if;
+				
 			end if;
 			
 		end if;
 		
 	end process;
 	
-	-- Make first bit available from wb_data immediately, and otherwise use shift register
-	spi_miso <= wb_data_i(DATA_WIDTH-1) when spi_shift_count = ADDR_WIDTH else spi_shift_out_reg(DATA_WIDTH-1);
+	-- Make first bit of each word available immediately, from the word read ahead
+	-- of time or straight from wb_data, and otherwise use shift register
+	spi_miso <= read_buf(DATA_WIDTH-1) when read_active = '1' and read_bit_count = DUMMY_BITS and read_buf_valid = '1' else
+	            wb_data_i(DATA_WIDTH-1) when read_active = '1' and read_bit_count = DUMMY_BITS else
+	            spi_shift_out_reg(DATA_WIDTH-1);
 	
 	
 	-- Clocking out data
@@ -204,15 +267,19 @@ begin
 		-- higher speeds we give extra time by transitioning on the delayed rising edge
 		if rising_edge(spi_clk_delayed) then
 			
-			-- Shifting data output
-			if spi_shift_count > ADDR_WIDTH then
+			-- Capture the next word and start output
+			if read_active = '1' and read_bit_count = DUMMY_BITS then
 				
-				spi_shift_out_reg <= spi_shift_out_reg(DATA_WIDTH-2 downto 0) & '0';
+				if read_buf_valid = '1' then
+					spi_shift_out_reg <= read_buf(DATA_WIDTH-2 downto 0) & '0';
+				else
+					spi_shift_out_reg <= wb_data_i(DATA_WIDTH-2 downto 0) & '0';
+				end if;
 				
-			-- Capture data from wishbone device and start output
-			elsif spi_shift_count = ADDR_WIDTH and wb_ack = '1' then
+			-- Shifting data output
+			else
 				
-				spi_shift_out_reg <= wb_data_i(DATA_WIDTH-2 downto 0) & '0';
+				spi_shift_out_reg <= spi_shift_out_reg(DATA_WIDTH-2 downto 0) & '0';
 				
 			end if;
 			
@@ -76,7 +76,8 @@ begin
 	generic map(
 		DATA_WIDTH => 16,
 		ADDR_WIDTH => 16,
-		AUTO_INC_ADDRESS => '1'
+		AUTO_INC_ADDRESS => '1',
+		READ_DUMMY_BYTES => 0
 	)
 	port map(
 		sys_clk => sys_clk,
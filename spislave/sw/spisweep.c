@@ -0,0 +1,571 @@
+/*
+
+SPI characterization program
+
+This program sweeps the SPI clock and transfer size against spislave.vhd,
+assuming it is connected to a 32K SRAM buffer (the same setup as spitest).
+For every clock and block size it writes a pseudo-random pattern to the
+whole SRAM, reads it back and records bit errors, throughput and the time
+taken by each ioctl.  Clocks are recorded as the Pi actually runs them,
+its SPI block divides the core clock by an even number, and steps that
+end up at the same clock as the one before are skipped.  The results go to a CSV file, and the recommended
+clock and block size go to a file named after the board's serial number.
+
+Build with: gcc -O2 -Wall -o spisweep spisweep.c
+
+
+Copyright (C) 2017  Nathan Friess
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include <time.h>
+
+// SPI routines borrowed from logipi_loader
+
+static int spi_fd ;
+static unsigned int mode = 0 ;
+static unsigned int bits = 8 ;
+static unsigned long spi_speed ;
+static unsigned int delay = 0;
+
+// Must match READ_DUMMY_BYTES in top.vhd
+#define READ_DUMMY_BYTES 0
+
+// SRAM size in 16-bit words
+#define SRAM_WORDS (1<<15)
+
+static const char * bufsiz_param = "/sys/module/spidev/parameters/bufsiz";
+#define SPI_DEFAULT_BUFSIZ 4096
+
+// The SPI block's input clock, only readable with debugfs mounted (as root)
+static const char * core_clock_param = "/sys/kernel/debug/clk/vpu/clk_rate";
+#define DEFAULT_CORE_CLOCK 250000000UL
+
+static unsigned long coreClock;
+
+// Clocks to try, the Pi runs each one at coreClock over an even divider
+static const unsigned long sweepSpeeds[] = {
+	1000000, 2000000, 3300000, 4000000, 8000000, 10000000, 16000000,
+	20000000, 25000000, 32000000, 40000000, 50000000
+};
+#define NUM_SPEEDS (sizeof(sweepSpeeds) / sizeof(sweepSpeeds[0]))
+
+// Data bytes per transfer, not counting the address
+static const unsigned int sweepSizes[] = { 2, 16, 64, 256, 1024, 4096 };
+#define NUM_SIZES (sizeof(sweepSizes) / sizeof(sweepSizes[0]))
+
+struct sweep_result {
+	// What the Pi ran at, and what was asked for
+	unsigned long speed;
+	unsigned long requested;
+	unsigned int size;
+	unsigned long words;
+	unsigned long wordErrors;
+	unsigned long bitErrors;
+	unsigned long ioctlErrors;
+	double writeMBs;
+	double readMBs;
+	// ioctl latency in microseconds
+	double p50, p90, p99, max;
+};
+
+static unsigned char spi_out[SPI_DEFAULT_BUFSIZ * 16], spi_in[SPI_DEFAULT_BUFSIZ * 16];
+
+// One sample per ioctl of a whole write and read pass at the smallest size
+static double latency[2 * SRAM_WORDS];
+
+
+static double elapsed(struct timespec *start) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// xorshift32, cheap and the same sequence for the write and the read back
+static uint32_t prng_next(uint32_t *state) {
+
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	*state = x;
+
+	return x;
+}
+
+int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size)
+{
+	int ret ;
+	struct spi_ioc_transfer tr;
+
+	memset(&tr, 0, sizeof(struct spi_ioc_transfer));
+
+	tr.tx_buf = (unsigned long)send_buffer;
+	tr.rx_buf = (unsigned long)receive_buffer;
+	tr.len = size;
+	tr.delay_usecs = delay;
+	tr.speed_hz = spi_speed;
+	tr.bits_per_word = bits;
+
+	ret = ioctl(spi_fd, SPI_IOC_MESSAGE(1), &tr);
+	if (ret < 1)
+		return -1 ;
+
+	return 0;
+}
+
+// Largest message spidev will accept
+static unsigned int spi_buffer_size(void) {
+
+	FILE *f;
+	unsigned int size;
+
+	f = fopen(bufsiz_param, "r");
+	if (f == NULL)
+		return SPI_DEFAULT_BUFSIZ;
+
+	if (fscanf(f, "%u", &size) != 1 || size == 0)
+		size = SPI_DEFAULT_BUFSIZ;
+
+	fclose(f);
+
+	if (size > sizeof(spi_out))
+		size = sizeof(spi_out);
+
+	return size;
+}
+
+// Same rounding as the spi-bcm2835 driver: the divider is rounded up to
+// an even number, 2 at the least
+static unsigned long effective_speed(unsigned long speed) {
+
+	unsigned long cdiv;
+
+	if (speed >= coreClock / 2)
+		return coreClock / 2;
+
+	cdiv = (coreClock + speed - 1) / speed;
+	cdiv += cdiv % 2;
+
+	if (cdiv >= 65536)
+		cdiv = 65536;
+
+	return coreClock / cdiv;
+}
+
+static unsigned long read_core_clock(void) {
+
+	FILE *f;
+	unsigned long rate;
+
+	f = fopen(core_clock_param, "r");
+	if (f == NULL)
+		return DEFAULT_CORE_CLOCK;
+
+	if (fscanf(f, "%lu", &rate) != 1 || rate == 0)
+		rate = DEFAULT_CORE_CLOCK;
+
+	fclose(f);
+
+	return rate;
+}
+
+static int compare_double(const void *a, const void *b) {
+
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(double *samples, unsigned int count, unsigned int pct) {
+
+	unsigned int i;
+
+	if (count == 0)
+		return 0;
+
+	i = (unsigned int)((unsigned long)(count - 1) * pct / 100);
+
+	return samples[i];
+}
+
+static int count_bits(unsigned char x) {
+
+	int n = 0;
+
+	for (; x; x &= x - 1)
+		n++;
+
+	return n;
+}
+
+/*
+ * Writes and reads back the whole SRAM with size data bytes per transfer
+ * and adds the outcome to result.  Returns the number of latency samples.
+ */
+static unsigned int sweep_pass(struct sweep_result *result, unsigned int size, uint32_t seed,
+		double *samples, double *writeSeconds, double *readSeconds) {
+
+	struct timespec start, opStart;
+	unsigned int i, j, k, words, numSamples = 0;
+	uint32_t state;
+	unsigned char expect[2];
+
+	words = size / 2;
+
+	// Write
+	state = seed;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < SRAM_WORDS; i += k) {
+
+		k = words;
+		if (k > SRAM_WORDS - i)
+			k = SRAM_WORDS - i;
+
+		// Addr, top bit = 1 for write
+		spi_out[0] = (unsigned char) (((i >> 8) & 0xFF) | 0x80);
+		spi_out[1] = (unsigned char) (i & 0xFF);
+
+		for (j = 0; j < k; j++) {
+			uint32_t x = prng_next(&state);
+			spi_out[2 + j*2] = (unsigned char) (x >> 8);
+			spi_out[2 + j*2 + 1] = (unsigned char) x;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &opStart);
+
+		if (spi_transfer(spi_out, spi_in, 2 + k * 2))
+			result->ioctlErrors++;
+
+		samples[numSamples++] = elapsed(&opStart) * 1e6;
+
+	}
+
+	*writeSeconds += elapsed(&start);
+
+	// Read back
+	state = seed;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < SRAM_WORDS; i += k) {
+
+		k = words;
+		if (k > SRAM_WORDS - i)
+			k = SRAM_WORDS - i;
+
+		// Addr, top bit = 0 for read, then dummy bytes and the data
+		memset(spi_out, 0, 2 + READ_DUMMY_BYTES + k * 2);
+		spi_out[0] = (unsigned char) ((i >> 8) & 0x7F);
+		spi_out[1] = (unsigned char) (i & 0xFF);
+
+		clock_gettime(CLOCK_MONOTONIC, &opStart);
+
+		if (spi_transfer(spi_out, spi_in, 2 + READ_DUMMY_BYTES + k * 2))
+			result->ioctlErrors++;
+
+		samples[numSamples++] = elapsed(&opStart) * 1e6;
+
+		for (j = 0; j < k; j++) {
+
+			uint32_t x = prng_next(&state);
+
+			expect[0] = (unsigned char) (x >> 8);
+			expect[1] = (unsigned char) x;
+
+			if (expect[0] != spi_in[2 + READ_DUMMY_BYTES + j*2] ||
+			    expect[1] != spi_in[2 + READ_DUMMY_BYTES + j*2 + 1]) {
+				result->wordErrors++;
+				result->bitErrors += count_bits(expect[0] ^ spi_in[2 + READ_DUMMY_BYTES + j*2]) +
+					count_bits(expect[1] ^ spi_in[2 + READ_DUMMY_BYTES + j*2 + 1]);
+			}
+
+		}
+
+		result->words += k;
+
+	}
+
+	*readSeconds += elapsed(&start);
+
+	return numSamples;
+}
+
+// Reads a line from a /proc or /sys file, without the newline
+static void read_board_info(const char *filename, const char *key, char *value, unsigned int len) {
+
+	FILE *f;
+	char line[256], *p;
+
+	snprintf(value, len, "unknown");
+
+	f = fopen(filename, "r");
+	if (f == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+
+		if (key != NULL) {
+			if (strncmp(line, key, strlen(key)) != 0 || (p = strchr(line, ':')) == NULL)
+				continue;
+			p++;
+			while (*p == ' ' || *p == '\t')
+				p++;
+		}
+		else
+			p = line;
+
+		p[strcspn(p, "\r\n")] = '\0';
+
+		if (*p != '\0')
+			snprintf(value, len, "%s", p);
+
+		break;
+	}
+
+	fclose(f);
+}
+
+static void usage(const char *name) {
+
+	fprintf(stderr, "Usage: %s [-d spi_device] [-p passes] [-m max_speed] [-c core_clock] [-o results.csv]\n", name);
+	fprintf(stderr, "  -d  SPI device, default /dev/spidev0.0\n");
+	fprintf(stderr, "  -p  Passes over the SRAM for each clock and size, default 3\n");
+	fprintf(stderr, "  -m  Highest clock to try in Hz, default 50000000\n");
+	fprintf(stderr, "  -c  Core clock the SPI clock is divided from in Hz, default from\n");
+	fprintf(stderr, "      %s, or 250000000 if that can't be read\n", core_clock_param);
+	fprintf(stderr, "  -o  CSV file for all of the results, default spisweep.csv\n");
+
+}
+
+int main(int argc, char **argv) {
+
+	const char *device = "/dev/spidev0.0", *csvName = "spisweep.csv";
+	unsigned long maxSpeed = 50000000UL;
+	unsigned int passes = 3, pass, s, n, z, numSamples, maxSize;
+	struct sweep_result results[NUM_SPEEDS][NUM_SIZES], *res;
+	unsigned long speed;
+	int cleanUpTo = -1, recSpeed, recSize, opt;
+	double writeSeconds, readSeconds;
+	char model[256], serial[256], recName[300];
+	FILE *csv, *rec;
+
+	coreClock = read_core_clock();
+
+	while ((opt = getopt(argc, argv, "d:p:m:c:o:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		case 'm':
+			maxSpeed = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			coreClock = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			csvName = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (passes == 0 || coreClock < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	spi_fd = open(device, O_RDWR);
+	if (spi_fd < 0) {
+		printf("could not open SPI device\n");
+		return -1;
+	}
+	if (ioctl(spi_fd, SPI_IOC_WR_MODE, &mode) < 0) {
+		printf("Can't set SPI WR mode\n");
+		close(spi_fd);
+		return -1;
+	}
+	if (ioctl(spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0) {
+		printf("Can't set SPI WR bit size\n");
+		close(spi_fd);
+		return -1;
+	}
+
+	csv = fopen(csvName, "w");
+	if (csv == NULL) {
+		perror("Can't create results file");
+		close(spi_fd);
+		return -1;
+	}
+
+	fprintf(csv, "speed_hz,requested_hz,block_bytes,words,word_errors,bit_errors,ioctl_errors,"
+		"write_mb_s,read_mb_s,lat_p50_us,lat_p90_us,lat_p99_us,lat_max_us\n");
+
+	maxSize = spi_buffer_size() - 2 - READ_DUMMY_BYTES;
+
+	printf("Core clock %lu Hz\n", coreClock);
+
+	printf("%10s %6s %9s %9s %8s %8s %8s %8s %8s\n", "Clock", "Block", "Errors", "Bit err",
+		"Wr MB/s", "Rd MB/s", "p50 us", "p99 us", "max us");
+
+	memset(results, 0, sizeof(results));
+
+	// n counts the clocks actually tested, results[n] is the n'th of them
+	for (s = 0, n = 0; s < NUM_SPEEDS && sweepSpeeds[s] <= maxSpeed; s++) {
+
+		speed = effective_speed(sweepSpeeds[s]);
+
+		if (n > 0 && speed == results[n - 1][0].speed) {
+			printf("%10lu runs at %lu Hz like %lu Hz, skipped\n", sweepSpeeds[s], speed,
+				results[n - 1][0].requested);
+			continue;
+		}
+
+		spi_speed = sweepSpeeds[s];
+
+		if (ioctl(spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &spi_speed) < 0) {
+			printf("Can't set SPI WR speed %lu\n", spi_speed);
+			break;
+		}
+
+		for (z = 0; z < NUM_SIZES; z++) {
+
+			res = &results[n][z];
+			res->speed = speed;
+			res->requested = spi_speed;
+			res->size = sweepSizes[z] < maxSize ? sweepSizes[z] : (maxSize & ~1);
+
+			writeSeconds = readSeconds = 0;
+			numSamples = 0;
+
+			for (pass = 0; pass < passes; pass++) {
+
+				// Different pattern for every run, but never a zero seed
+				numSamples = sweep_pass(res, res->size, 0x9E3779B9 ^ (n << 16) ^ (z << 8) ^ pass,
+						latency, &writeSeconds, &readSeconds);
+
+			}
+
+			// Latency of the last pass, earlier ones are the same shape
+			qsort(latency, numSamples, sizeof(double), compare_double);
+
+			res->p50 = percentile(latency, numSamples, 50);
+			res->p90 = percentile(latency, numSamples, 90);
+			res->p99 = percentile(latency, numSamples, 99);
+			res->max = percentile(latency, numSamples, 100);
+
+			res->writeMBs = (double)res->words * 2 / writeSeconds / 1e6;
+			res->readMBs = (double)res->words * 2 / readSeconds / 1e6;
+
+			printf("%10lu %6u %9lu %9lu %8.3f %8.3f %8.1f %8.1f %8.1f\n", res->speed, res->size,
+				res->wordErrors, res->bitErrors, res->writeMBs, res->readMBs, res->p50, res->p99, res->max);
+
+			fprintf(csv, "%lu,%lu,%u,%lu,%lu,%lu,%lu,%.4f,%.4f,%.1f,%.1f,%.1f,%.1f\n",
+				res->speed, res->requested, res->size,
+				res->words, res->wordErrors, res->bitErrors, res->ioctlErrors,
+				res->writeMBs, res->readMBs, res->p50, res->p90, res->p99, res->max);
+
+		}
+
+		// Every clock up to this one has been error free
+		for (z = 0; z < NUM_SIZES; z++) {
+			if (results[n][z].wordErrors != 0 || results[n][z].ioctlErrors != 0)
+				break;
+		}
+
+		if (z < NUM_SIZES) {
+			// No point going faster
+			n++;
+			break;
+		}
+
+		cleanUpTo = n++;
+
+	}
+
+	fclose(csv);
+	close(spi_fd);
+
+	if (cleanUpTo < 0) {
+		printf("No clock rate was error free, check the wiring and the FPGA design\n");
+		return 1;
+	}
+
+	// One step below the fastest clean clock for margin, unless only the
+	// slowest worked or the sweep stopped at the maximum without errors
+	recSpeed = cleanUpTo;
+	if (recSpeed > 0 && (unsigned int)cleanUpTo + 1 < n)
+		recSpeed--;
+
+	// Fastest block size at that clock
+	recSize = 0;
+	for (z = 1; z < NUM_SIZES; z++) {
+		if (results[recSpeed][z].writeMBs + results[recSpeed][z].readMBs >
+				results[recSpeed][recSize].writeMBs + results[recSpeed][recSize].readMBs)
+			recSize = z;
+	}
+
+	read_board_info("/proc/device-tree/model", NULL, model, sizeof(model));
+	read_board_info("/proc/cpuinfo", "Serial", serial, sizeof(serial));
+
+	snprintf(recName, sizeof(recName), "spisweep-%s.txt", serial);
+
+	rec = fopen(recName, "w");
+	if (rec == NULL) {
+		perror("Can't create recommendation file");
+		return 1;
+	}
+
+	res = &results[recSpeed][recSize];
+
+	fprintf(rec, "model=%s\n", model);
+	fprintf(rec, "serial=%s\n", serial);
+	fprintf(rec, "error_free_hz=%lu\n", results[cleanUpTo][0].speed);
+	fprintf(rec, "speed_hz=%lu\n", res->speed);
+	fprintf(rec, "requested_hz=%lu\n", res->requested);
+	fprintf(rec, "core_clock_hz=%lu\n", coreClock);
+	fprintf(rec, "block_bytes=%u\n", res->size);
+	fprintf(rec, "write_mb_s=%.3f\n", res->writeMBs);
+	fprintf(rec, "read_mb_s=%.3f\n", res->readMBs);
+
+	fclose(rec);
+
+	printf("Error free up to %lu Hz\n", results[cleanUpTo][0].speed);
+	// Asking for the effective clock itself can round down to the next divider
+	printf("Recommended: %lu Hz (set %lu Hz in spidev) with %u byte blocks (%.3f MB/s write, %.3f MB/s read), saved to %s\n",
+		res->speed, res->requested, res->size, res->writeMBs, res->readMBs, recName);
+
+	return 0;
+
+}
@@ -44,6 +44,18 @@ static unsigned int bits = 8 ;
 unsigned long spi_speed = 3300000UL ;
 static unsigned int delay = 0;
 
+// Must match READ_DUMMY_BYTES in top.vhd
+#define READ_DUMMY_BYTES 0
+
+static double elapsed(struct timespec *start) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
 
 int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, unsigned int size)
 {
@@ -69,8 +81,10 @@ int spi_transfer(unsigned char * send_buffer, unsigned char * receive_buffer, un
 
 int main() {
 
-	int i, j, r;
+	int i, j, k, r, errors = 0;
 	unsigned char spi_out[1024], spi_in[1024];
+	struct timespec start;
+	double seconds;
 
 	spi_fd = open("/dev/spidev0.0", O_RDWR);
 	if (spi_fd < 0) {
@@ -99,6 +113,8 @@ int main() {
 
 	printf("Writing data...\n");
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 // Writing one word at a time...
 /*	for (i = 0; i < (1<<15); i++) {
 
@@ -130,9 +146,15 @@ int main() {
 
 	}
 
+	seconds = elapsed(&start);
+	printf("Wrote %d KB in %.3f s (%.0f KB/s)\n", (1<<16) / 1024, seconds, (1<<16) / 1024 / seconds);
+
 	printf("Reading back data...\n");
 
-	for (i = 0; i < (1<<15); i++) {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+// Reading one word at a time...
+/*	for (i = 0; i < (1<<15); i++) {
 
 		// Addr, top bit = 0 for read
 		spi_out[0] = (unsigned char) ((i >> 8) & 0x7F);
@@ -146,6 +168,37 @@ int main() {
 		}
 
 	}
+*/
+
+	// Reading 1K blocks at a time
+	for (i = 0; i < (1<<15); ) {
+
+		// Addr, top bit = 0 for read, then dummy bytes and the data
+		memset(spi_out, 0, sizeof(spi_out));
+		spi_out[0] = (unsigned char) ((i >> 8) & 0x7F);
+		spi_out[1] = (unsigned char) (i & 0xFF);
+
+		// As many words as fit, the address goes up by one for each
+		k = (1024 - 2 - READ_DUMMY_BYTES) / 2;
+		if (k > (1<<15) - i)
+			k = (1<<15) - i;
+
+		spi_transfer(spi_out, spi_in, 2 + READ_DUMMY_BYTES + k * 2);
+
+		for (j = 2 + READ_DUMMY_BYTES; k > 0; j+=2, i++, k--) {
+
+			if ((unsigned char)(((i >> 8) ^ (r >> 8)) & 0xFF) != spi_in[j] ||
+			    (unsigned char)((i ^ r) & 0xFF) != spi_in[j+1]) {
+				printf("Mismatch at 0x%04x: 0x%04x vs 0x%02x%02x\n", i, (i ^ r) & 0xFFFF, spi_in[j], spi_in[j+1]);
+				errors++;
+			}
+
+		}
+
+	}
+
+	seconds = elapsed(&start);
+	printf("Read %d KB in %.3f s (%.0f KB/s), %d mismatches\n", (1<<16) / 1024, seconds, (1<<16) / 1024 / seconds, errors);
 
 	printf("Done\n");
 